@@ -30,6 +30,31 @@ MPU9250::MPU9250( I2C &i2c, InterruptIn* intr)
 {
     _i2c =  &i2c;
     _intr = intr;
+    _magfs = MFS_14BITS;
+    _accelfs = AFS_2G;
+    _gyrofs = GFS_250DPS;
+    _configValid = false;
+    _accelCalValid = false;
+    _smplrtDiv = 0;
+    _masterEnabled = false;
+    _mstClock = MPU_I2C_MST_400K;
+    _mstDelay = 0;
+    _magSlaved = false;
+    _magMode = MFS_CONT2;
+    _magTrigger = false;
+    _subCount = 0;
+    _seq = 0;
+    _latency = NULL;
+    _pool = NULL;
+    _intCfg = 0;
+    _auxCount = 0;
+    _auxFifo = 0;
+    _auxFifoLen = 0;
+    _extLen = 0;
+    _retries = 0;
+    _checkInterval = 0;
+    _checkCount = 0;
+    memset(&_health, 0, sizeof(_health));
 
     MPU9250::init();
 
@@ -67,7 +92,7 @@ uint8_t MPU9250::init(void)
             debug ("MPU9250 accel biases: %6i, %6i, %6i\n", _accelBias[0], _accelBias[1], _accelBias[2]);
 #endif
             // disable FIFO, enable bypass
-            reg_val[0] = (MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR | MPU_BYPASS_EN);
+            reg_val[0] = (_intCfg | MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR | MPU_BYPASS_EN);
             reg_val[1] = 0x00;
             result |= MPU9250::writeRegister(INT_PIN_CFG, &reg_val[0], 2);
             // check status of magnetometer
@@ -109,6 +134,8 @@ uint8_t MPU9250::setParameters(MEMS_MODE opmode, ASCALE accelfs, MSCALE magfs, G
     uint8_t result = 255;
     
     _opmode = opmode;
+    _accelfs = accelfs;
+    _gyrofs = gyrofs;
     switch (opmode)
     {
         case VLP_ACC:
@@ -133,8 +160,10 @@ uint8_t MPU9250::setParameters(MEMS_MODE opmode, ASCALE accelfs, MSCALE magfs, G
             debug("MPU9250 cmd %d : %02x %02x %02x %02x %02x %02x\n", SMPLRT_DIV, reg_val[0], reg_val[1], reg_val[2], reg_val[3], reg_val[4], reg_val[5]);
 #endif
             result |= MPU9250::writeRegister(SMPLRT_DIV, &reg_val[0], 6);
+            _smplrtDiv = reg_val[0];
+            memcpy(_config, reg_val, MPU_CONFIG_LEN);
             // enable interrupt, disable FIFO
-            reg_val[0] = (MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR);
+            reg_val[0] = (_intCfg | MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR);
             reg_val[1] = MPU_DRDY_INT_EN;
 #if MPU9250_DEBUG
             debug("MPU9250 cmd %d : %02x %02x\n", INT_PIN_CFG, reg_val[0], reg_val[1]);
@@ -165,8 +194,10 @@ uint8_t MPU9250::setParameters(MEMS_MODE opmode, ASCALE accelfs, MSCALE magfs, G
             debug("MPU9250 cmd %d : %02x %02x %02x %02x %02x %02x\n", SMPLRT_DIV, reg_val[0], reg_val[1], reg_val[2], reg_val[3], reg_val[4], reg_val[5]);
 #endif
             result |= MPU9250::writeRegister(SMPLRT_DIV, &reg_val[0], 6);
+            _smplrtDiv = reg_val[0];
+            memcpy(_config, reg_val, MPU_CONFIG_LEN);
             // enable interrupt, disable FIFO
-            reg_val[0] = (MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR | MPU_BYPASS_EN);
+            reg_val[0] = (_intCfg | MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR | (_masterEnabled ? 0 : MPU_BYPASS_EN));
             reg_val[1] = MPU_DRDY_INT_EN;
 #if MPU9250_DEBUG
             debug("MPU9250 cmd %d : %02x %02x\n", INT_PIN_CFG, reg_val[0], reg_val[1]);
@@ -204,8 +235,10 @@ uint8_t MPU9250::setParameters(MEMS_MODE opmode, ASCALE accelfs, MSCALE magfs, G
             debug("MPU9250 cmd %d : %02x %02x %02x %02x %02x %02x\n", SMPLRT_DIV, reg_val[0], reg_val[1], reg_val[2], reg_val[3], reg_val[4], reg_val[5]);
 #endif
             result |= MPU9250::writeRegister(SMPLRT_DIV, &reg_val[0], 6);
+            _smplrtDiv = reg_val[0];
+            memcpy(_config, reg_val, MPU_CONFIG_LEN);
             // enable interrupt, disable FIFO
-            reg_val[0] = (MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR | MPU_BYPASS_EN);
+            reg_val[0] = (_intCfg | MPU_LATCH_INT_EN | MPU_ANYRD_2CLEAR | (_masterEnabled ? 0 : MPU_BYPASS_EN));
             reg_val[1] = MPU_DRDY_INT_EN;
 #if MPU9250_DEBUG
             debug("MPU9250 cmd %d : %02x %02x\n", INT_PIN_CFG, reg_val[0], reg_val[1]);
@@ -223,6 +256,7 @@ uint8_t MPU9250::setParameters(MEMS_MODE opmode, ASCALE accelfs, MSCALE magfs, G
         case HPP_ALL:
             break;
     }
+    _configValid = (result == 0);
     return result;
 }
 
@@ -231,9 +265,17 @@ void MPU9250::readAccelData(int16_t * destination)
     uint8_t rawData[6];
     
     MPU9250::readRegister(ACCEL_XOUT_H, &rawData[0], 6);
-    destination[0] = (int16_t)(((uint16_t)rawData[0] << 8) | (uint16_t)rawData[1]);
-    destination[1] = (int16_t)(((uint16_t)rawData[2] << 8) | (uint16_t)rawData[3]);  
-    destination[2] = (int16_t)(((uint16_t)rawData[4] << 8) | (uint16_t)rawData[5]); 
+    destination[0] = MPU9250Counts(&rawData[0]);
+    destination[1] = MPU9250Counts(&rawData[2]);
+    destination[2] = MPU9250Counts(&rawData[4]);
+    if (_accelCalValid && (_accelCal.ascale == _accelfs)) {
+        MPU9250ApplyCalibration(&_accelCal, destination, destination);
+    }
+}
+
+uint8_t MPU9250::readBurst(uint8_t * destination)
+{
+    return MPU9250::readRegister(ACCEL_XOUT_H, destination, 14);
 }
 
 uint8_t MPU9250::readGyroData(int16_t * destination)
@@ -243,27 +285,34 @@ uint8_t MPU9250::readGyroData(int16_t * destination)
     
     if (_opmode == HP_ALL) {
         result = MPU9250::readRegister(GYRO_XOUT_H, &rawData[0], 6);
-        destination[0] = (int16_t)(((uint16_t)rawData[0] << 8) | (uint16_t)rawData[1]) ;  // Turn the MSB and LSB into a signed 16-bit value
-        destination[1] = (int16_t)(((uint16_t)rawData[2] << 8) | (uint16_t)rawData[3]) ;  
-        destination[2] = (int16_t)(((uint16_t)rawData[4] << 8) | (uint16_t)rawData[5]) ; 
+        destination[0] = MPU9250Counts(&rawData[0]);
+        destination[1] = MPU9250Counts(&rawData[2]);
+        destination[2] = MPU9250Counts(&rawData[4]);
     }
     return result;
 }
 
 uint8_t MPU9250::readMagData(int16_t * destination)
 {
-    uint8_t rawData[7];  // x/y/z gyro register data, ST2 register stored here, must read ST2 at end of data acquisition
+    uint8_t rawData[8];  // ST1, x/y/z mag register data, ST2 register stored here, must read ST2 at end of data acquisition
     uint8_t result = 0;
   
     if (_opmode != VLP_ACC) {
         rawData[0] = 0x00;
-        MPU9250::readMagRegister(AK8963_ST1, &rawData[0], 1);
+        if (_magSlaved) {
+            // ST1, data and ST2 are polled into EXT_SENS_DATA by the internal master
+            MPU9250::readRegister(EXT_SENS_DATA_00 + _auxOffset[_magSlot], &rawData[0], 8);
+        } else {
+            MPU9250::readMagRegister(AK8963_ST1, &rawData[0], 1);
+        }
         if (rawData[0] & 0x01) {            // if magnetometer data ready bit set, then read out data
-            MPU9250::readMagRegister(AK8963_XOUT_L, &rawData[0], 7);
-            if (!(rawData[0] & 0x08)) {     // good measurement so read data
-                destination[0] = (int16_t)(((uint16_t)rawData[1] << 8) | (uint16_t)rawData[0]);     // Turn the MSB and LSB into a signed 16-bit value
-                destination[1] = (int16_t)(((uint16_t)rawData[3] << 8) | (uint16_t)rawData[2]) ;    // Data stored as little Endian
-                destination[2] = (int16_t)(((uint16_t)rawData[5] << 8) | (uint16_t)rawData[4]) ; 
+            if (!_magSlaved) {
+                MPU9250::readMagRegister(AK8963_XOUT_L, &rawData[1], 7);
+            }
+            if (!(rawData[7] & 0x08)) {     // good measurement so read data
+                destination[0] = (int16_t)(((uint16_t)rawData[2] << 8) | (uint16_t)rawData[1]);     // Turn the MSB and LSB into a signed 16-bit value
+                destination[1] = (int16_t)(((uint16_t)rawData[4] << 8) | (uint16_t)rawData[3]) ;    // Data stored as little Endian
+                destination[2] = (int16_t)(((uint16_t)rawData[6] << 8) | (uint16_t)rawData[5]) ; 
                 if (_magfs == MFS_16BITS) { // scale to 0.1uT per bit
                     destination[0] = destination[0] + (destination[0] >> 1);
                     destination[1] = destination[1] + (destination[1] >> 1);
@@ -271,12 +320,20 @@ uint8_t MPU9250::readMagData(int16_t * destination)
                 }
             } else {
                 result = 3;
+                _health.magOverflows++;
+            }
+            if (!_magSlaved) {
+                // Initiate next single shot measurement
+                rawData[0] = (MFS_SINGLE | _magfs);
+                _magTrigger = (MPU9250::writeMagRegister(AK8963_CNTL, &rawData[0], 1) != 0);
             }
-            // Initiate next single shot measurement
-            rawData[0] = (MFS_SINGLE | _magfs);
-            MPU9250::writeMagRegister(AK8963_CNTL, &rawData[0], 1);
         } else {
             result = 2;
+            if (_magTrigger) {
+                // the last restart was lost on the bus, without it no data ever comes
+                rawData[0] = (MFS_SINGLE | _magfs);
+                _magTrigger = (MPU9250::writeMagRegister(AK8963_CNTL, &rawData[0], 1) != 0);
+            }
         }
     } else {
         result = 1;
@@ -284,17 +341,845 @@ uint8_t MPU9250::readMagData(int16_t * destination)
     return result;
 }
 
+uint8_t MPU9250::addAuxSensor(uint8_t addr, uint8_t reg, uint8_t len, uint8_t rateDiv, bool fifo, uint8_t * slot)
+{
+    uint8_t reg_val[3];
+    uint8_t result = 0;
+    uint8_t n = _auxCount;
+
+    if ((n >= MPU_AUX_SLOTS) || (len == 0) || (len > 15) || ((_extLen + len) > MPU_EXT_SENS_LEN)) {
+        return 1;
+    }
+    if (!_masterEnabled) {
+        result = MPU9250::enableMaster();
+    }
+    // slaves are serviced in order, so EXT_SENS_DATA is packed by slot
+    _auxLen[n] = len;
+    _auxOffset[n] = _extLen;
+    reg_val[0] = MPU_SLV_READ | (addr >> 1);
+    reg_val[1] = reg;
+    reg_val[2] = MPU_SLV_EN | len;
+    result |= MPU9250::writeRegister(I2C_SLV0_ADDR + (3 * n), &reg_val[0], 3);
+    if ((rateDiv > 1) && (result == 0)) {
+        // the delay is shared by all reduced rate slaves, keep the slowest requested
+        if ((rateDiv - 1) > _mstDelay) {
+            _mstDelay = (rateDiv > 32) ? 31 : (rateDiv - 1);
+            reg_val[0] = _mstDelay;
+            result |= MPU9250::writeRegister(I2C_SLV4_CTRL, &reg_val[0]);
+        }
+        result |= MPU9250::readRegister(I2C_MST_DELAY_CTRL, &reg_val[0]);
+        reg_val[0] |= (1 << n);
+        result |= MPU9250::writeRegister(I2C_MST_DELAY_CTRL, &reg_val[0]);
+    }
+    if (fifo && (result == 0)) {
+        if (n == 3) {
+            result |= MPU9250::readRegister(I2C_MST_CTRL, &reg_val[0]);
+            reg_val[0] |= MPU_SLV3_FIFO_EN;
+            result |= MPU9250::writeRegister(I2C_MST_CTRL, &reg_val[0]);
+        } else {
+            result |= MPU9250::readRegister(FIFO_EN, &reg_val[0]);
+            reg_val[0] |= (MPU_SLV0_FIFO_EN << n);
+            result |= MPU9250::writeRegister(FIFO_EN, &reg_val[0]);
+        }
+    }
+    if (result == 0) {
+        _auxAddr[n] = addr;
+        _auxReg[n] = reg;
+        _auxDiv[n] = rateDiv;
+        _auxFifo |= fifo ? (1 << n) : 0;
+        // the FIFO packs only its own slots, also in slot order
+        _auxFifoOffset[n] = _auxFifoLen;
+        _auxFifoLen += fifo ? len : 0;
+        _extLen += len;
+        _auxCount++;
+        *slot = n;
+    }
+#if MPU9250_DEBUG
+    debug("MPU9250 aux sensor %02x reg %02x len %d slot %d : %x\n", addr, reg, len, n, result);
+#endif
+    return result;
+}
+
+uint8_t MPU9250::readSensorHub(int16_t * accel, int16_t * gyro, int16_t * temp)
+{
+    uint8_t rawData[14 + MPU_EXT_SENS_LEN];
+    uint8_t result;
+
+    // ACCEL_XOUT_H..GYRO_ZOUT_L and EXT_SENS_DATA are contiguous, so one transaction covers all
+    result = MPU9250::readRegister(ACCEL_XOUT_H, &rawData[0], 14 + _extLen);
+    if (result == 0) {
+        accel[0] = (int16_t)(((uint16_t)rawData[0] << 8) | (uint16_t)rawData[1]);
+        accel[1] = (int16_t)(((uint16_t)rawData[2] << 8) | (uint16_t)rawData[3]);
+        accel[2] = (int16_t)(((uint16_t)rawData[4] << 8) | (uint16_t)rawData[5]);
+        if (_accelCalValid && (_accelCal.ascale == _accelfs)) {
+            MPU9250ApplyCalibration(&_accelCal, accel, accel);
+        }
+        if (temp != NULL) {
+            *temp = (int16_t)(((uint16_t)rawData[6] << 8) | (uint16_t)rawData[7]);
+        }
+        gyro[0] = (int16_t)(((uint16_t)rawData[8] << 8) | (uint16_t)rawData[9]);
+        gyro[1] = (int16_t)(((uint16_t)rawData[10] << 8) | (uint16_t)rawData[11]);
+        gyro[2] = (int16_t)(((uint16_t)rawData[12] << 8) | (uint16_t)rawData[13]);
+        memcpy(_extData, &rawData[14], _extLen);
+    }
+    return result;
+}
+
+uint8_t MPU9250::readAuxData(uint8_t slot, uint8_t * destination, const uint8_t * ext, bool fifo)
+{
+    if ((slot >= _auxCount) || (fifo && ((ext == NULL) || ((_auxFifo & (1 << slot)) == 0)))) {
+        return 1;
+    }
+    if (ext == NULL) {
+        ext = _extData;
+    }
+    memcpy(destination, ext + (fifo ? _auxFifoOffset[slot] : _auxOffset[slot]), _auxLen[slot]);
+    return 0;
+}
+
+uint8_t MPU9250::slaveMagnetometer(MMODE mode, uint8_t clk)
+{
+    uint8_t reg_val[1];
+    uint8_t result = 0;
+    uint16_t odr;
+    uint16_t div;
+
+    if (_magSlaved) {
+        return 0;
+    }
+    if (mode == MFS_CONT1) {
+        odr = 8;
+    } else if (mode == MFS_CONT2) {
+        odr = 100;
+    } else {
+        return 1;
+    }
+    // poll ~12% faster than the ODR so the asynchronous AK8963 clock never outruns the master
+    div = ((uint32_t)MPU9250::getSampleRate() * 8) / (odr * 9);
+    if (div < 1) {
+        div = 1;
+    } else if (div > 32) {
+        div = 32;
+    }
+
+    _mstClock = clk & MPU_I2C_MST_CLK;
+    if (!_masterEnabled) {
+        result = MPU9250::enableMaster();
+    } else {
+        result = MPU9250::readRegister(I2C_MST_CTRL, &reg_val[0]);
+        reg_val[0] = (reg_val[0] & ~MPU_I2C_MST_CLK) | _mstClock;
+        result |= MPU9250::writeRegister(I2C_MST_CTRL, &reg_val[0]);
+    }
+    // continuous measurement, written through SLV4 now bypass is off
+    reg_val[0] = (mode | _magfs);
+    result |= MPU9250::writeMagRegister(AK8963_CNTL, &reg_val[0], 1);
+    if (result == 0) {
+        result = MPU9250::addAuxSensor(AK8963_ADDRESS, AK8963_ST1, 8, div, false, &_magSlot);
+    }
+    if (result == 0) {
+        // only shadow EXT_SENS_DATA once all slaves have been read
+        result = MPU9250::readRegister(I2C_MST_DELAY_CTRL, &reg_val[0]);
+        reg_val[0] |= MPU_DELAY_ES_SHADOW;
+        result |= MPU9250::writeRegister(I2C_MST_DELAY_CTRL, &reg_val[0]);
+        _magSlaved = (result == 0);
+        _magMode = mode;
+    }
+#if MPU9250_DEBUG
+    debug("MPU9250 slave magnetometer, %d Hz sample rate / %d : %x\n", MPU9250::getSampleRate(), div, result);
+#endif
+    return result;
+}
+
+uint16_t MPU9250::getSampleRate(void)
+{
+    return 1000 / (1 + (uint16_t)_smplrtDiv);
+}
+
+uint8_t MPU9250::subscribe(MPU9250Subscriber * sub)
+{
+    if (_subCount >= MPU_MAX_SUBSCRIBERS) {
+        return 1;
+    }
+    sub->_count = 0;
+    _subs[_subCount++] = sub;
+    return MPU9250::updateSubscriberRates();
+}
+
+uint8_t MPU9250::unsubscribe(MPU9250Subscriber * sub)
+{
+    uint8_t i;
+
+    for (i = 0; i < _subCount; i++) {
+        if (_subs[i] == sub) {
+            break;
+        }
+    }
+    if (i == _subCount) {
+        return 1;
+    }
+    _subCount--;
+    for (; i < _subCount; i++) {
+        _subs[i] = _subs[i + 1];
+    }
+    return MPU9250::updateSubscriberRates();
+}
+
+uint8_t MPU9250::publish(void)
+{
+    return MPU9250::publishSample(NULL, false);
+}
+
+uint8_t MPU9250::publishIfReady(uint8_t * status, bool burst)
+{
+    return MPU9250::publishSample(status, burst);
+}
+
+uint8_t MPU9250::publishSample(uint8_t * status, bool burst)
+{
+    MPU9250Sample sample;
+    uint8_t rawData[15];        // INT_STATUS, then accel, temperature and gyro
+    uint8_t *data = &rawData[1];
+    uint8_t len = 0;
+    uint8_t due = 0;
+    uint8_t result = 0;
+    uint8_t i;
+
+    for (i = 0; i < _subCount; i++) {
+        if ((_subs[i]->_count + 1) >= _subs[i]->_div) {
+            due |= _subs[i]->_channels;
+        }
+    }
+    if (due & (MPU_CH_GYRO | MPU_CH_TEMP)) {
+        // accel, temperature and gyro are contiguous, one burst for all
+        len = 14;
+    } else if (due & MPU_CH_ACCEL) {
+        len = 6;
+    }
+    if (status != NULL) {
+        // INT_STATUS sits just ahead of ACCEL_XOUT_H, so it can come in the sample's burst;
+        // any read clears it, which releases a latched INT, so it is read before anything else
+        result = MPU9250::readRegister(INT_STATUS, &rawData[0], burst ? (1 + len) : 1);
+        *status = (result == 0) ? rawData[0] : 0;
+        if (!(*status & MPU_RAW_DATA_RDY_INT)) {
+            if ((result != 0) && (_checkInterval != 0)) {
+                _checkCount = _checkInterval;
+            }
+            return result;
+        }
+        if (burst) {
+            len = 0;
+        }
+    }
+
+    if ((_checkInterval != 0) && (++_checkCount >= _checkInterval)) {
+        _checkCount = 0;
+        MPU9250::checkHealth();
+    }
+    for (i = 0; i < _subCount; i++) {
+        ++_subs[i]->_count;
+    }
+    sample.seq = _seq++;
+    if (_latency != NULL) {
+        _latency->begin(sample.seq);
+    }
+    if (due == 0) {
+        return 0;
+    }
+
+    // all transfers first, then decode, so the latency stages are separate
+    sample.channels = 0;
+    if (len > 0) {
+        result = MPU9250::readRegister(ACCEL_XOUT_H, data, len);
+    }
+    if ((result == 0) && (due & (MPU_CH_GYRO | MPU_CH_TEMP))) {
+        sample.channels = (MPU_CH_ACCEL | MPU_CH_TEMP) | ((_opmode == HP_ALL) ? MPU_CH_GYRO : 0);
+    } else if ((result == 0) && (due & MPU_CH_ACCEL)) {
+        sample.channels = MPU_CH_ACCEL;
+    }
+    if ((due & MPU_CH_MAG) && (MPU9250::readMagData(&sample.mag[0]) == 0)) {
+        sample.channels |= MPU_CH_MAG;
+    }
+    if (_latency != NULL) {
+        _latency->stamp(sample.seq, MPU_LAT_TRANSFER);
+    }
+
+    if (sample.channels & MPU_CH_TEMP) {
+        sample.temp = MPU9250Counts(&data[6]);
+    }
+    if (sample.channels & MPU_CH_GYRO) {
+        sample.gyro[0] = MPU9250Counts(&data[8]);
+        sample.gyro[1] = MPU9250Counts(&data[10]);
+        sample.gyro[2] = MPU9250Counts(&data[12]);
+    }
+    if (sample.channels & MPU_CH_ACCEL) {
+        sample.accel[0] = MPU9250Counts(&data[0]);
+        sample.accel[1] = MPU9250Counts(&data[2]);
+        sample.accel[2] = MPU9250Counts(&data[4]);
+    }
+    if (_latency != NULL) {
+        _latency->stamp(sample.seq, MPU_LAT_DECODE);
+    }
+    if ((sample.channels & MPU_CH_ACCEL) && _accelCalValid && (_accelCal.ascale == _accelfs)) {
+        MPU9250ApplyCalibration(&_accelCal, sample.accel, sample.accel);
+    }
+    if (_latency != NULL) {
+        _latency->stamp(sample.seq, MPU_LAT_CALIBRATE);
+    }
+
+    for (i = 0; i < _subCount; i++) {
+        if (_subs[i]->_count >= _subs[i]->_div) {
+            _subs[i]->_count = 0;
+            _subs[i]->push(sample);
+        }
+    }
+    if ((result != 0) && (_checkInterval != 0)) {
+        // a reset device may be why the bus failed, check on the next publish
+        _checkCount = _checkInterval;
+    }
+    return result;
+}
+
+uint8_t MPU9250::updateSubscriberRates(void)
+{
+    uint8_t reg_val[1];
+    uint8_t result = 0;
+    uint16_t rate = 0;
+    uint16_t fs;
+    uint8_t i;
+
+    for (i = 0; i < _subCount; i++) {
+        if (_subs[i]->_rate > rate) {
+            rate = _subs[i]->_rate;
+        }
+    }
+    if ((rate > 0) && (rate != MPU9250::getSampleRate())) {
+        // 1 kHz internal rate with the DLPF enabled
+        reg_val[0] = (rate >= 1000) ? 0 : ((1000 / rate) > 256 ? 255 : (1000 / rate) - 1);
+        result = MPU9250::writeRegister(SMPLRT_DIV, &reg_val[0]);
+        if (result == 0) {
+            _smplrtDiv = reg_val[0];
+            _config[0] = reg_val[0];
+        }
+    }
+    fs = MPU9250::getSampleRate();
+    for (i = 0; i < _subCount; i++) {
+        _subs[i]->_div = (_subs[i]->_rate >= fs) ? 1 : (fs + (_subs[i]->_rate / 2)) / _subs[i]->_rate;
+    }
+#if MPU9250_DEBUG
+    debug("MPU9250 %d subscribers, sample rate %d Hz : %x\n", _subCount, fs, result);
+#endif
+    return result;
+}
+
+void MPU9250::setBufferPool(MPU9250BufferPool * pool)
+{
+    _pool = pool;
+    return;
+}
+
+uint8_t MPU9250::setInterruptPin(uint8_t cfg)
+{
+    uint8_t reg_val[1];
+    uint8_t result;
+
+    _intCfg = cfg & (MPU_INT_ACTL | MPU_INT_OD);
+    result = MPU9250::readRegister(INT_PIN_CFG, &reg_val[0]);
+    reg_val[0] = (reg_val[0] & ~(MPU_INT_ACTL | MPU_INT_OD)) | _intCfg;
+    result |= MPU9250::writeRegister(INT_PIN_CFG, &reg_val[0]);
+#if MPU9250_DEBUG
+    debug("MPU9250 INT pin %02x : %x\n", _intCfg, result);
+#endif
+    return result;
+}
+
+void MPU9250::setLatency(MPU9250Latency * latency)
+{
+    _latency = latency;
+    return;
+}
+
+void MPU9250::setRecovery(uint8_t retries, uint16_t checkInterval)
+{
+    _retries = retries;
+    _checkInterval = checkInterval;
+    _checkCount = 0;
+    return;
+}
+
+uint8_t MPU9250::checkHealth(void)
+{
+    uint8_t reg_val[MPU_CONFIG_LEN];
+    uint8_t result;
+
+    if (!_configValid) {
+        return 0;
+    }
+    _health.checks++;
+    result = MPU9250::readRegister(SMPLRT_DIV, &reg_val[0], MPU_CONFIG_LEN);
+    if ((result == 0) && (memcmp(reg_val, _config, MPU_CONFIG_LEN) != 0)) {
+        // back at reset values, so the device lost its supply or was reset
+        _health.resets++;
+        result = MPU9250::recover();
+    }
+    return result;
+}
+
+uint8_t MPU9250::recover(void)
+{
+    uint8_t auxCount = _auxCount;
+    uint8_t auxFifo = _auxFifo;
+    uint8_t magSlot = _magSlaved ? _magSlot : MPU_AUX_SLOTS;
+    uint8_t slot;
+    uint8_t result;
+
+    // back to the state after construction, then replay the configuration
+    _masterEnabled = false;
+    _magSlaved = false;
+    _magTrigger = false;
+    _mstDelay = 0;
+    _auxCount = 0;
+    _auxFifo = 0;
+    _auxFifoLen = 0;
+    _extLen = 0;
+    result = MPU9250::init();
+    if ((result == 0) && _configValid) {
+        result = MPU9250::setParameters(_opmode, _accelfs, _magfs, _gyrofs);
+        if ((result == 0) && (_subCount > 0)) {
+            result = MPU9250::updateSubscriberRates();
+        }
+        // slots are replayed in order so EXT_SENS_DATA keeps its layout
+        for (uint8_t k = 0; (k < auxCount) && (result == 0); k++) {
+            if (k == magSlot) {
+                result = MPU9250::slaveMagnetometer(_magMode, _mstClock);
+            } else {
+                result = MPU9250::addAuxSensor(_auxAddr[k], _auxReg[k], _auxLen[k], _auxDiv[k],
+                                               (auxFifo & (1 << k)) != 0, &slot);
+            }
+        }
+    }
+    if (result == 0) {
+        _health.recoveries++;
+    }
+#if MPU9250_DEBUG
+    debug("MPU9250 recover : %x\n", result);
+#endif
+    return result;
+}
+
+uint8_t MPU9250::setInclinometerMode(ASCALE accelfs)
+{
+    uint8_t reg_val[6];
+    uint8_t result;
+
+    _opmode = VLP_ACC;
+    _accelfs = accelfs;
+    // clocks, power mode, sleep until a measurement is asked for
+    reg_val[0] = (CLK_INTERNAL | MPU_TEMP_DIS | MPU_SLEEP);
+    reg_val[1] = MPU_GYRO_DIS;
+    result = MPU9250::writeRegister(PWR_MGMT_1, &reg_val[0], 2);
+    // sample rate, gyro config, accel config, narrowest filter
+    reg_val[0] = 0x09;              // 100 Hz
+    reg_val[1] = DLPF_5;
+    reg_val[2] = GFS_250DPS;
+    reg_val[3] = accelfs;
+    reg_val[4] = ACCEL_BW_5;
+    reg_val[5] = ACCEL_DR_00024;
+    result |= MPU9250::writeRegister(SMPLRT_DIV, &reg_val[0], 6);
+    _smplrtDiv = reg_val[0];
+    // recover restores setParameters modes only
+    _configValid = false;
+    // accel only into the FIFO
+    reg_val[0] = MPU_FIFO_ACCEL_EN;
+    result |= MPU9250::writeRegister(FIFO_EN, &reg_val[0]);
+    result |= MPU9250::readRegister(USER_CTRL, &reg_val[0]);
+    reg_val[0] |= (MPU_FIFO_MODE_EN | MPU_FIFO_RST);
+    result |= MPU9250::writeRegister(USER_CTRL, &reg_val[0]);
+#if MPU9250_DEBUG
+    debug("MPU9250 set inclinometer mode : %x\n", result);
+#endif
+    return result;
+}
+
+uint8_t MPU9250::readTilt(uint16_t samples, float * pitch, float * roll, float * uncertainty)
+{
+    uint8_t reg_val[1];
+    uint8_t result;
+    int64_t sum[3] = {0, 0, 0};
+    int64_t sumSq[3] = {0, 0, 0};
+    uint32_t n = 0;
+    float mean[3];
+    float var = 0.0f;
+    float g2;
+
+    // wake, let the filter settle then start from an empty FIFO
+    result = MPU9250::readRegister(PWR_MGMT_1, &reg_val[0]);
+    reg_val[0] &= ~MPU_SLEEP;
+    result |= MPU9250::writeRegister(PWR_MGMT_1, &reg_val[0]);
+    osDelay(100);
+    result |= MPU9250::readRegister(USER_CTRL, &reg_val[0]);
+    reg_val[0] |= MPU_FIFO_RST;
+    result |= MPU9250::writeRegister(USER_CTRL, &reg_val[0]);
+    if (result == 0) {
+        result = MPU9250::accumulateAccel(samples, &sum[0], &sumSq[0], &n);
+    }
+    // sleep between measurement windows
+    MPU9250::readRegister(PWR_MGMT_1, &reg_val[0]);
+    reg_val[0] |= MPU_SLEEP;
+    MPU9250::writeRegister(PWR_MGMT_1, &reg_val[0]);
+
+    if ((result == 0) && (n == 0)) {
+        result = 1;
+    }
+    if (result == 0) {
+        for (uint8_t i = 0; i < 3; i++) {
+            mean[i] = (float)sum[i] / n;
+            // variance of the mean, differenced in 64 bits to avoid float cancellation
+            var += (float)((sumSq[i] * n) - (sum[i] * sum[i])) / ((float)n * n * n);
+        }
+        g2 = (mean[0] * mean[0]) + (mean[1] * mean[1]) + (mean[2] * mean[2]);
+        *pitch = atan2f(-mean[0], sqrtf((mean[1] * mean[1]) + (mean[2] * mean[2]))) * (180.0f / 3.14159265f);
+        *roll = atan2f(mean[1], mean[2]) * (180.0f / 3.14159265f);
+        if (uncertainty != NULL) {
+            *uncertainty = sqrtf(((var > 0.0f) ? var : 0.0f) / g2) * (180.0f / 3.14159265f);
+        }
+    }
+#if MPU9250_DEBUG
+    debug("MPU9250 tilt %d of %d samples : %x\n", n, samples, result);
+#endif
+    return result;
+}
+
+uint8_t MPU9250::readStaticAccel(uint16_t samples, float * mean, float * variance)
+{
+    uint8_t fifoEn[1];
+    uint8_t userCtrl[1];
+    uint8_t reg_val[1];
+    uint8_t result;
+    int64_t sum[3] = {0, 0, 0};
+    int64_t sumSq[3] = {0, 0, 0};
+    uint32_t n = 0;
+
+    // a window is long enough to be worth checking the device is configured for it
+    if ((_checkInterval != 0) && (MPU9250::checkHealth() != 0)) {
+        return 1;
+    }
+    result = MPU9250::readRegister(FIFO_EN, &fifoEn[0]);
+    result |= MPU9250::readRegister(USER_CTRL, &userCtrl[0]);
+    reg_val[0] = MPU_FIFO_ACCEL_EN;
+    result |= MPU9250::writeRegister(FIFO_EN, &reg_val[0]);
+    reg_val[0] = userCtrl[0] | MPU_FIFO_MODE_EN | MPU_FIFO_RST;
+    result |= MPU9250::writeRegister(USER_CTRL, &reg_val[0]);
+    if (result == 0) {
+        result = MPU9250::accumulateAccel(samples, &sum[0], &sumSq[0], &n);
+    }
+    // restore the FIFO as it was, emptied
+    MPU9250::writeRegister(FIFO_EN, &fifoEn[0]);
+    reg_val[0] = userCtrl[0] | MPU_FIFO_RST;
+    MPU9250::writeRegister(USER_CTRL, &reg_val[0]);
+
+    if ((result == 0) && (n == 0)) {
+        result = 1;
+    }
+    if (result == 0) {
+        for (uint8_t i = 0; i < 3; i++) {
+            mean[i] = (float)sum[i] / n;
+            variance[i] = (float)((sumSq[i] * n) - (sum[i] * sum[i])) / ((float)n * n);
+        }
+    }
+    return result;
+}
+
+uint8_t MPU9250::calibrateAccel(uint16_t samples, uint16_t windows, MPU9250AccelCalibration * cal)
+{
+    MPU9250AccelCal solver(_accelfs);
+    float mean[3];
+    float variance[3];
+    uint8_t result = 0;
+    int8_t pose;
+
+    while ((windows > 0) && (solver.poses() != 0x3F) && (result == 0)) {
+        result = MPU9250::readStaticAccel(samples, &mean[0], &variance[0]);
+        if (result == 0) {
+            pose = solver.addPose(&mean[0], &variance[0]);
+#if MPU9250_DEBUG
+            debug("MPU9250 calibration window %6i, %6i, %6i pose %d\n", (int)mean[0], (int)mean[1], (int)mean[2], pose);
+#endif
+            (void)pose;
+        }
+        windows--;
+    }
+    if (result == 0) {
+        result = solver.solve(cal);
+    }
+#if MPU9250_DEBUG
+    debug("MPU9250 accel calibration poses %02x : %x\n", solver.poses(), result);
+#endif
+    return result;
+}
+
+void MPU9250::setAccelCalibration(const MPU9250AccelCalibration * cal)
+{
+    _accelCalValid = (cal != NULL);
+    if (cal != NULL) {
+        _accelCal = *cal;
+    }
+    return;
+}
+
+uint8_t MPU9250::accumulateAccel(uint16_t samples, int64_t * sum, int64_t * sumSq, uint32_t * accepted)
+{
+    int16_t local[MPU_FIFO_BATCH][3];
+    int16_t (*batch)[3] = local;
+    uint8_t reg_val[1];
+    uint8_t *rawData;
+    uint8_t *block = NULL;
+    uint16_t batchMax = MPU_FIFO_BATCH;
+    uint16_t count;
+    uint16_t n = 0;                 // samples in the batch held back until the next count
+    uint16_t i;
+    uint8_t result = 0;
+    uint8_t timeout = 0;
+
+    // a pool block gives larger batches, so fewer FIFO reads; without one use the stack
+    if ((_pool != NULL) && (_pool->blockSize() > sizeof(local))) {
+        block = _pool->acquire();
+        if (block != NULL) {
+            batch = (int16_t (*)[3])block;
+            batchMax = _pool->blockSize() / 6;
+        }
+    }
+    // samples are decoded in place, each 6 bytes read out before its counts are written
+    rawData = (uint8_t *)batch;
+
+    while ((samples > 0) && (result == 0)) {
+        result = MPU9250::readFifoCount(&count, 6);
+        if (((result == 0) && (count == MPU_FIFO_SIZE)) || (result == 2)) {
+            // after an overflow the FIFO no longer holds whole frames, and reading the count
+            // again will not change that. It may have overflowed while the last batch was read,
+            // so drop that too and start again from empty
+            _health.fifoResets++;
+            n = 0;
+            result = MPU9250::readRegister(USER_CTRL, &reg_val[0]);
+            reg_val[0] |= MPU_FIFO_RST;
+            result |= MPU9250::writeRegister(USER_CTRL, &reg_val[0]);
+            if ((result == 0) && (++timeout > 100)) {
+                result = 1;
+            }
+            continue;
+        }
+        if ((result == 0) && (n > 0)) {
+            // the FIFO still holds whole frames, so the last batch was read intact
+            MPU9250::acceptAccel(batch, n, sum, sumSq, accepted);
+            samples -= n;
+            n = 0;
+            if (samples == 0) {
+                break;
+            }
+        }
+        n = count / 6;
+        if (n > batchMax) {
+            n = batchMax;
+        }
+        if (n > samples) {
+            n = samples;
+        }
+        if ((result != 0) || (n == 0)) {
+            // wait for more data, up to 1 s
+            n = 0;
+            if (++timeout > 100) {
+                result = 1;
+            }
+            osDelay(10);
+            continue;
+        }
+        timeout = 0;
+        result = MPU9250::readFifo(&rawData[0], n * 6);
+        for (i = 0; i < n; i++) {
+            const uint8_t *raw = &rawData[6 * i];
+            int16_t x = MPU9250Counts(&raw[0]);
+            int16_t y = MPU9250Counts(&raw[2]);
+            int16_t z = MPU9250Counts(&raw[4]);
+            batch[i][0] = x;
+            batch[i][1] = y;
+            batch[i][2] = z;
+        }
+    }
+    if (block != NULL) {
+        _pool->release(block);
+    }
+    return result;
+}
+
+void MPU9250::acceptAccel(const int16_t (*batch)[3], uint16_t n, int64_t * sum, int64_t * sumSq, uint32_t * accepted)
+{
+    int32_t bsum[3] = {0, 0, 0};
+    int32_t mean[3];
+    int64_t var = 0;
+    int64_t dev;
+    uint16_t i;
+
+    for (i = 0; i < n; i++) {
+        for (uint8_t j = 0; j < 3; j++) {
+            bsum[j] += batch[i][j];
+        }
+    }
+    for (uint8_t j = 0; j < 3; j++) {
+        mean[j] = bsum[j] / n;
+        for (i = 0; i < n; i++) {
+            dev = batch[i][j] - mean[j];
+            var += dev * dev;
+        }
+    }
+    // reject samples further than 3 sigma from the batch mean, squared distance over all axes
+    for (i = 0; i < n; i++) {
+        dev = 0;
+        for (uint8_t j = 0; j < 3; j++) {
+            dev += (int64_t)(batch[i][j] - mean[j]) * (batch[i][j] - mean[j]);
+        }
+        if ((n < 4) || ((dev * n) <= (9 * var))) {
+            for (uint8_t j = 0; j < 3; j++) {
+                sum[j] += batch[i][j];
+                sumSq[j] += (int64_t)batch[i][j] * batch[i][j];
+            }
+            (*accepted)++;
+        }
+    }
+    return;
+}
+
+uint8_t MPU9250::writeAuxRegister(uint8_t addr, uint8_t reg, uint8_t data)
+{
+    uint8_t reg_val[3];
+    uint8_t result;
+
+    reg_val[0] = (addr >> 1);
+    reg_val[1] = reg;
+    reg_val[2] = data;
+    result = MPU9250::writeRegister(I2C_SLV4_ADDR, &reg_val[0], 3);
+    reg_val[0] = MPU_SLV_EN | _mstDelay;
+    result |= MPU9250::writeRegister(I2C_SLV4_CTRL, &reg_val[0]);
+    if (result == 0) {
+        result = MPU9250::waitSlv4();
+    }
+    return result;
+}
+
+uint8_t MPU9250::readAuxRegister(uint8_t addr, uint8_t reg, uint8_t * data)
+{
+    uint8_t reg_val[2];
+    uint8_t result;
 
+    reg_val[0] = MPU_SLV_READ | (addr >> 1);
+    reg_val[1] = reg;
+    result = MPU9250::writeRegister(I2C_SLV4_ADDR, &reg_val[0], 2);
+    reg_val[0] = MPU_SLV_EN | _mstDelay;
+    result |= MPU9250::writeRegister(I2C_SLV4_CTRL, &reg_val[0]);
+    if (result == 0) {
+        result = MPU9250::waitSlv4();
+    }
+    if (result == 0) {
+        result = MPU9250::readRegister(I2C_SLV4_DI, data);
+    }
+    return result;
+}
+
+uint8_t MPU9250::readFifoCount(uint16_t * count, uint8_t frame)
+{
+    uint8_t rawData[2];
+    uint8_t result;
+    uint8_t i = 0;
+
+    do {
+        result = MPU9250::readRegister(FIFO_COUNTH, &rawData[0], 2);
+        *count = ((uint16_t)(rawData[0] & 0x1F) << 8) | (uint16_t)rawData[1];
+        // a full FIFO may have overflowed, so it need not hold whole frames
+        if ((result == 0) && ((*count > MPU_FIFO_SIZE) || ((*count < MPU_FIFO_SIZE) && ((*count % frame) != 0)))) {
+            // draining a corrupted count would read bytes that are not there
+            _health.fifoErrors++;
+            result = 2;
+        }
+    } while ((result == 2) && (i++ < _retries));
+    return result;
+}
+
+uint8_t MPU9250::readFifo(uint8_t * data, uint16_t count)
+{
+    uint8_t result = 0;
+    uint8_t chunk;
+
+    // readRegister takes an 8 bit count, FIFO_R_W does not auto increment
+    while ((count > 0) && (result == 0)) {
+        chunk = (count > 255) ? 255 : count;
+        result = MPU9250::readRegister(FIFO_R_W, data, chunk);
+        data += chunk;
+        count -= chunk;
+    }
+    return result;
+}
+
+uint8_t MPU9250::enableMaster(void)
+{
+    uint8_t reg_val[1];
+    uint8_t result;
+
+    // take the auxiliary bus out of bypass, the master owns it from now on
+    result = MPU9250::readRegister(INT_PIN_CFG, &reg_val[0]);
+    reg_val[0] &= ~MPU_BYPASS_EN;
+    result |= MPU9250::writeRegister(INT_PIN_CFG, &reg_val[0]);
+    reg_val[0] = (MPU_WAIT_FOR_ES | _mstClock);
+    result |= MPU9250::writeRegister(I2C_MST_CTRL, &reg_val[0]);
+    result |= MPU9250::readRegister(USER_CTRL, &reg_val[0]);
+    reg_val[0] |= MPU_I2C_MST_EN;
+    result |= MPU9250::writeRegister(USER_CTRL, &reg_val[0]);
+    if (result == 0) {
+        _masterEnabled = true;
+    }
+#if MPU9250_DEBUG
+    debug("MPU9250 I2C master enable : %x\n", result);
+#endif
+    return result;
+}
+
+uint8_t MPU9250::waitSlv4(void)
+{
+    uint8_t reg_val[1];
+    uint8_t result = 1;
+    uint8_t i = 0;
+
+    // SLV4 runs on the sample clock, so allow for the slowest sample rate
+    do {
+        osDelay(1);
+        reg_val[0] = 0x00;
+        if (MPU9250::readRegister(I2C_MST_STATUS, &reg_val[0]) == 0) {
+            if (reg_val[0] & MPU_SLV4_NACK) {
+                break;
+            }
+            if (reg_val[0] & MPU_SLV4_DONE) {
+                result = 0;
+            }
+        }
+        i++;
+    } while ((result != 0) && (i < 100));
+#if MPU9250_DEBUG
+    if (result != 0) {
+        debug("MPU9250:SLV4 transfer failed %02x\n", reg_val[0]);
+    }
+#endif
+    return result;
+}
 
 uint8_t MPU9250::writeRegister(uint8_t reg, uint8_t* data, uint8_t count)
 {
     char buf[11];
     uint8_t result;
+    uint8_t attempt = 0;
 
     buf[0] = reg;
     memcpy(buf+1,data,count);
 
-    result = _i2c->write(_i2c_addr, buf, (count + 1));
+    do {
+        result = _i2c->write(_i2c_addr, buf, (count + 1));
+    } while ((result != 0) && MPU9250::retry(&attempt));
 #if MPU9250_DEBUG
     if (result != 0) {
         debug("MPU9250:writeRegister failed %d\n",result);
@@ -306,11 +1191,16 @@ uint8_t MPU9250::writeRegister(uint8_t reg, uint8_t* data, uint8_t count)
 uint8_t MPU9250::readRegister(uint8_t reg, uint8_t* data, uint8_t count)
 {
     uint8_t result;
+    uint8_t attempt = 0;
     char reg_out[1];
 
     reg_out[0] = reg;
-    result = _i2c->write(_i2c_addr,reg_out,1,true);
-    result |= _i2c->read(_i2c_addr,(char *) data,count,false);
+    do {
+        result = _i2c->write(_i2c_addr,reg_out,1,true);
+        if (result == 0) {
+            result = _i2c->read(_i2c_addr,(char *) data,count,false);
+        }
+    } while ((result != 0) && MPU9250::retry(&attempt));
 #if MPU9250_DEBUG
     if(result != 0) {
         debug("MPU9250::readRegister failed %d\n", result);
@@ -322,12 +1212,23 @@ uint8_t MPU9250::readRegister(uint8_t reg, uint8_t* data, uint8_t count)
 uint8_t MPU9250::writeMagRegister(uint8_t reg, uint8_t* data, uint8_t count)
 {
     char buf[11];
-    uint8_t result;
+    uint8_t result = 0;
+    uint8_t attempt = 0;
+
+    if (_masterEnabled) {
+        // no bypass, so go byte by byte through I2C_SLV4
+        for (uint8_t i = 0; (i < count) && (result == 0); i++) {
+            result = MPU9250::writeAuxRegister(_i2c_magaddr, reg + i, data[i]);
+        }
+        return result;
+    }
 
     buf[0] = reg;
     memcpy(buf+1,data,count);
 
-    result = _i2c->write(_i2c_magaddr, buf, (count + 1),true);
+    do {
+        result = _i2c->write(_i2c_magaddr, buf, (count + 1),true);
+    } while ((result != 0) && MPU9250::retry(&attempt));
 #if MPU9250_DEBUG
     if (result != 0) {
         debug("MPU9250:writeMagRegister failed %d\n",result);
@@ -338,12 +1239,24 @@ uint8_t MPU9250::writeMagRegister(uint8_t reg, uint8_t* data, uint8_t count)
 
 uint8_t MPU9250::readMagRegister(uint8_t reg, uint8_t* data, uint8_t count)
 {
-    uint8_t result;
+    uint8_t result = 0;
+    uint8_t attempt = 0;
     char reg_out[1];
 
+    if (_masterEnabled) {
+        for (uint8_t i = 0; (i < count) && (result == 0); i++) {
+            result = MPU9250::readAuxRegister(_i2c_magaddr, reg + i, &data[i]);
+        }
+        return result;
+    }
+
     reg_out[0] = reg;
-    result = _i2c->write(_i2c_magaddr,reg_out,1,true);
-    result |= _i2c->read(_i2c_magaddr,(char *) data,count,false);
+    do {
+        result = _i2c->write(_i2c_magaddr,reg_out,1,true);
+        if (result == 0) {
+            result = _i2c->read(_i2c_magaddr,(char *) data,count,false);
+        }
+    } while ((result != 0) && MPU9250::retry(&attempt));
 #if MPU9250_DEBUG
     if(result != 0) {
         debug("MPU9250::readMagRegister failed %d\n", result);
@@ -353,6 +1266,17 @@ uint8_t MPU9250::readMagRegister(uint8_t reg, uint8_t* data, uint8_t count)
 }
 
 
+bool MPU9250::retry(uint8_t * attempt)
+{
+    if (*attempt >= _retries) {
+        _health.failures++;
+        return false;
+    }
+    (*attempt)++;
+    _health.retries++;
+    return true;
+}
+
 /*
 
 
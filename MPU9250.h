@@ -26,6 +26,12 @@
  
 #include "mbed.h"
 #include "math.h"
+#include "MPU9250Sample.h"
+#include "MPU9250Subscriber.h"
+#include "MPU9250Calibration.h"
+#include "MPU9250Decode.h"
+#include "MPU9250Latency.h"
+#include "MPU9250Pool.h"
  
 //  Seven-bit device address is 110100 for ADO = 0 and 110101 for ADO = 1
 //  mbed uses the eight-bit device address, so shift seven-bit addresses left by one!
@@ -56,7 +62,45 @@
 #define MPU_FIFO_OVFL_INT_EN 0x10   // enable FIFO overflow INT
 #define MPU_FSYNC_INT_EN 0x08   // enable FSYNC to INT pin
 #define MPU_DRDY_INT_EN 0x01    // data ready interrupt (RAW)
+#define MPU_RAW_DATA_RDY_INT 0x01   // raw data ready (INT_STATUS)
 #define MPU_FCHOICE 0x03        // set to disable DLPF
+#define MPU_FIFO_MODE_EN 0x40   // enable FIFO operation
+#define MPU_I2C_MST_EN 0x20     // enable I2C master on the auxiliary bus
+#define MPU_FIFO_RST 0x04       // reset FIFO, self clearing
+#define MPU_I2C_MST_RST 0x02    // reset I2C master, self clearing
+#define MPU_WAIT_FOR_ES 0x40    // delay data ready until external sensor data loaded
+#define MPU_SLV3_FIFO_EN 0x20   // write SLV3 data to FIFO (I2C_MST_CTRL)
+#define MPU_I2C_MST_400K 0x0D   // I2C master clock 400 kHz
+#define MPU_SLV_READ 0x80       // slave transfer is a read (I2C_SLVx_ADDR)
+#define MPU_SLV_EN 0x80         // enable slave transfers (I2C_SLVx_CTRL)
+#define MPU_I2C_MST_CLK 0x0F    // I2C master clock divider mask
+#define MPU_DELAY_ES_SHADOW 0x80    // shadow external sensor data only when complete
+#define MPU_I2C_MST_DLY 0x1F    // reduced rate slave delay mask (I2C_SLV4_CTRL)
+#define MPU_SLV4_DONE 0x40      // SLV4 transfer complete (I2C_MST_STATUS)
+#define MPU_SLV4_NACK 0x10      // SLV4 transfer not acknowledged
+#define MPU_SLV0_FIFO_EN 0x01   // write SLV0 data to FIFO (FIFO_EN), SLV1/2 follow
+#define MPU_AUX_SLOTS 4         // I2C_SLV0..3 read into EXT_SENS_DATA
+#define MPU_EXT_SENS_LEN 24     // size of EXT_SENS_DATA
+#define MPU_MAX_SUBSCRIBERS 4   // sample subscribers per device
+#define MPU_FIFO_ACCEL_EN 0x08  // write accel data to FIFO (FIFO_EN)
+#define MPU_FIFO_BATCH 32       // samples drained from the FIFO at a time
+#define MPU_FIFO_SIZE 512       // FIFO bytes
+#define MPU_CONFIG_LEN 5        // SMPLRT_DIV..ACCEL_CONFIG2, compared by the health check
+
+/**
+ *  @struct MPU9250Health
+ *  @brief Fault and recovery counts since the driver was created
+ */
+struct MPU9250Health {
+    uint32_t    retries;        // register transfers repeated after a bus error
+    uint32_t    failures;       // register transfers that failed every attempt
+    uint32_t    checks;         // health checks run
+    uint32_t    resets;         // device resets found by a health check
+    uint32_t    recoveries;     // successful reconfigurations after a reset
+    uint32_t    magOverflows;   // magnetometer readings dropped for HOFL
+    uint32_t    fifoErrors;     // implausible FIFO counts read again
+    uint32_t    fifoResets;     // FIFOs emptied after an overflow left them without whole frames
+};
 
 /**
  *  @class MPU9250
@@ -357,6 +401,13 @@ public:
     */
     void readAccelData(int16_t * destination);
 
+    /** Read the accel, temperature and gyro registers undecoded, in one burst
+    *   For MPU9250FastPath, which decodes, calibrates, rotates and scales them inline.
+    *   @param destination - 14 bytes, ACCEL_XOUT_H to GYRO_ZOUT_L
+    *   @return status of command
+    */
+    uint8_t readBurst(uint8_t * destination);
+
     /** Read Magnetometer data from MPU9250/AK8963
     *   @param destination - pointer to 3 integer vector into which 16 bit values are written
     *   @return measurement status: 0 = good, 1 = no data, 2 = measurement error
@@ -369,6 +420,216 @@ public:
     */
     uint8_t readGyroData(int16_t * destination);
 
+    /** Register an auxiliary sensor to be polled by the internal I2C master
+    *   The sensor is read at every sample, or every rateDiv samples, into EXT_SENS_DATA
+    *   and optionally the FIFO. Registering the first sensor disables bypass mode, so
+    *   magnetometer accesses are routed through the internal master from then on.
+    *   @param addr - 8 bit (mbed) address of the auxiliary device
+    *   @param reg - first register to read
+    *   @param len - number of bytes to read, 1-15
+    *   @param rateDiv - read every rateDiv samples, shared by all reduced rate slaves
+    *   @param fifo - also write the data to the FIFO
+    *   @param slot - returns the slot number used by readAuxData
+    *   @return status of command: 0 = good, 1 = no slot or EXT_SENS_DATA space, else bus error
+    */
+    uint8_t addAuxSensor(uint8_t addr, uint8_t reg, uint8_t len, uint8_t rateDiv, bool fifo, uint8_t * slot);
+
+    /** Read accel, temperature, gyro and all auxiliary sensor data in a single burst
+    *   Auxiliary data is held for readAuxData
+    *   @param accel - pointer to 3 integer vector for accelerometer data
+    *   @param gyro - pointer to 3 integer vector for gyro data
+    *   @param temp - pointer to temperature data, may be NULL
+    *   @return status of command
+    */
+    uint8_t readSensorHub(int16_t * accel, int16_t * gyro, int16_t * temp);
+
+    /** Copy an auxiliary sensor's bytes out of a burst
+    *   The FIFO holds only the slots registered with fifo set, so a FIFO frame is laid
+    *   out differently from EXT_SENS_DATA when some slots are not in it
+    *   @param slot - slot returned by addAuxSensor
+    *   @param destination - buffer for the sensor's bytes
+    *   @param ext - EXT_SENS_DATA image, or the auxiliary part of a FIFO frame. Default NULL uses the last readSensorHub
+    *   @param fifo - ext is the auxiliary part of a FIFO frame, which must then be given
+    *   @return status: 0 = good, 1 = unused slot, or not in the FIFO
+    */
+    uint8_t readAuxData(uint8_t slot, uint8_t * destination, const uint8_t * ext = NULL, bool fifo = false);
+
+    /** Hand the magnetometer to the internal I2C master
+    *   The AK8963 runs continuously and is polled into EXT_SENS_DATA at a reduced rate.
+    *   The poll divider is chosen from the sample rate set by setParameters and the
+    *   magnetometer ODR, so the master polls just faster than the AK8963 produces data.
+    *   readMagData then reads EXT_SENS_DATA instead of the AK8963.
+    *   @param mode - MFS_CONT1 (8 Hz) or MFS_CONT2 (100 Hz)
+    *   @param clk - I2C master clock, I2C_MST_CTRL encoding, default 400 kHz
+    *   @return status of command: 0 = good, 1 = bad mode or no slot, else bus error
+    */
+    uint8_t slaveMagnetometer(MMODE mode = MFS_CONT2, uint8_t clk = MPU_I2C_MST_400K);
+
+    /** Accel/gyro output data rate
+    *   @return sample rate in Hz as set by SMPLRT_DIV, with DLPF enabled
+    */
+    uint16_t getSampleRate(void);
+
+    /** Add a sample subscriber
+    *   The sample rate is raised to the fastest subscriber's rate and every subscriber
+    *   is given a decimation from it. Call before slaveMagnetometer, which depends on
+    *   the sample rate.
+    *   @param sub - the subscriber, must stay in scope while subscribed
+    *   @return status of command: 0 = good, 1 = too many subscribers, else bus error
+    */
+    uint8_t subscribe(MPU9250Subscriber * sub);
+
+    /** Remove a sample subscriber
+    *   @param sub - the subscriber
+    *   @return status of command: 0 = good, 1 = not subscribed, else bus error
+    */
+    uint8_t unsubscribe(MPU9250Subscriber * sub);
+
+    /** Acquire one sample and deliver it to the subscribers that are due
+    *   Call once per data ready. Only channels wanted by a due subscriber are read,
+    *   in a single burst, and the sample is decoded once for all of them.
+    *   @return status of command
+    */
+    uint8_t publish(void);
+
+    /** Publish only if this device has raised data ready
+    *   For devices sharing an interrupt line, see MPU9250Group. INT_STATUS is read first,
+    *   which releases the latched INT pin. With burst it comes in the same transfer as the
+    *   sample, otherwise it is read alone and the sample only if data ready was set.
+    *   @param status - INT_STATUS as read, 0 if the read failed
+    *   @param burst - read the sample with the status, for a device expected to have fired
+    *   @return status of command
+    */
+    uint8_t publishIfReady(uint8_t * status, bool burst = true);
+
+    /** Stamp published samples for latency measurement
+    *   publish opens a record for every sample and stamps it as the transfers, decode and
+    *   calibration complete. The data ready interrupt handler calls latency->edge and the
+    *   application latency->fused with the sample's seq after its filter update.
+    *   @param latency - the instrumentation, NULL to stop stamping
+    */
+    void setLatency(MPU9250Latency * latency);
+
+    /** Borrow FIFO drain buffers from a pool shared with other instances
+    *   readTilt, readStaticAccel and calibrateAccel take a block for the length of a
+    *   window and drain the FIFO in batches of up to blockSize / 6 samples, rather than
+    *   MPU_FIFO_BATCH on the stack. If no block is free the stack buffer is used.
+    *   @param pool - the pool, NULL to drain through the stack only
+    */
+    void setBufferPool(MPU9250BufferPool * pool);
+
+    /** Configure for static tilt measurement
+    *   Gyro, temperature and magnetometer off, accelerometer at 100 Hz behind the 5 Hz
+    *   filter and written to the FIFO. The sensor sleeps between readTilt calls.
+    *   @param accelfs - accelerometer full scale, AFS_2G gives the best resolution
+    *   @return status of command
+    */
+    uint8_t setInclinometerMode(ASCALE accelfs = AFS_2G);
+
+    /** Measure tilt over a window of samples
+    *   Wakes the sensor, drains the FIFO in batches into 64 bit sums, rejecting samples
+    *   more than 3 sigma from their batch mean, then puts the sensor back to sleep.
+    *   1000 samples (10 s) give around 0.01 degree at AFS_2G on a quiet mount.
+    *   @param samples - number of samples in the window
+    *   @param pitch - pitch in degrees
+    *   @param roll - roll in degrees
+    *   @param uncertainty - one sigma uncertainty of the tilt in degrees, may be NULL
+    *   @return status of command: 0 = good, 1 = no samples accepted or FIFO timeout, else bus error
+    */
+    uint8_t readTilt(uint16_t samples, float * pitch, float * roll, float * uncertainty = NULL);
+
+    /** Average a window of accel samples through the FIFO
+    *   The FIFO is switched to accel only for the window and restored afterwards. With
+    *   health checks enabled by setRecovery the device is checked first.
+    *   @param samples - number of samples, at the current sample rate
+    *   @param mean - per axis mean in raw counts
+    *   @param variance - per axis variance in counts squared
+    *   @return status of command: 0 = good, 1 = no samples or FIFO timeout, else bus error
+    */
+    uint8_t readStaticAccel(uint16_t samples, float * mean, float * variance);
+
+    /** Guided six position accelerometer calibration
+    *   Windows of samples are taken back to back while the user turns the device
+    *   through the six axis-up poses; still windows near a new pose are kept
+    *   automatically. The solved calibration is applied with setAccelCalibration.
+    *   @param samples - samples per window, e.g. 1 s worth
+    *   @param windows - windows to try before giving up
+    *   @param cal - the solved calibration
+    *   @return status of command: 0 = good, 1 = poses missing, 2 = poor solution, else bus error
+    */
+    uint8_t calibrateAccel(uint16_t samples, uint16_t windows, MPU9250AccelCalibration * cal);
+
+    /** Set the INT pin polarity and drive
+    *   MPU_INT_ACTL | MPU_INT_OD lets several devices share one active low, wired-OR line
+    *   with a pull-up. The setting is kept through setParameters and recover; a device
+    *   reset drives the pin push-pull active high, holding a shared line low until then.
+    *   @param cfg - MPU_INT_ACTL and MPU_INT_OD bits, 0 for active high push-pull, the default
+    *   @return status of command
+    */
+    uint8_t setInterruptPin(uint8_t cfg);
+
+    /** Apply an accelerometer calibration to readAccelData, readSensorHub and publish
+    *   The calibration only applies while the accelerometer range matches the one it was made at.
+    *   @param cal - the calibration, NULL to return raw counts
+    */
+    void setAccelCalibration(const MPU9250AccelCalibration * cal);
+
+    /** Write a register on an auxiliary device through I2C_SLV4
+    *   @param addr - 8 bit (mbed) address of the auxiliary device
+    *   @param reg - The register to be written
+    *   @param data - The data to be written
+    *   @return status of command: 0 = good, 1 = NACK or timeout
+    */
+    uint8_t writeAuxRegister(uint8_t addr, uint8_t reg, uint8_t data);
+
+    /** Read a register on an auxiliary device through I2C_SLV4
+    *   @param addr - 8 bit (mbed) address of the auxiliary device
+    *   @param reg - The register to read from
+    *   @param data - The data read
+    *   @return status of command: 0 = good, 1 = NACK or timeout
+    */
+    uint8_t readAuxRegister(uint8_t addr, uint8_t reg, uint8_t * data);
+
+    /** Read the number of bytes waiting in the FIFO
+    *   A count over the FIFO size or not a whole number of frames is read again, up to the
+    *   retry limit, so a corrupted count is not used to drain the FIFO. A count of
+    *   MPU_FIFO_SIZE is returned as it is: the FIFO may have overflowed, and then holds
+    *   no whole frames until it is reset, whatever the count reads.
+    *   @param count - number of bytes
+    *   @param frame - bytes written to the FIFO per sample, default 1 for no frame check
+    *   @return status of command
+    */
+    uint8_t readFifoCount(uint16_t * count, uint8_t frame = 1);
+
+    /** Read bytes from the FIFO
+    *   @param data - buffer for FIFO data
+    *   @param count - number of bytes to read
+    *   @return status of command
+    */
+    uint8_t readFifo(uint8_t * data, uint16_t count);
+
+    /** Set how bus errors and device resets are handled
+    *   Each failed register transfer is repeated up to retries times. Every checkInterval
+    *   publishes, and on the publish after one fails, the rate and range registers are read
+    *   back; if the device has reset, recover is called. The default is no retries and no
+    *   checks, as the driver has always behaved.
+    *   @param retries - extra attempts per register transfer
+    *   @param checkInterval - publishes between health checks, 0 disables them
+    */
+    void setRecovery(uint8_t retries, uint16_t checkInterval);
+
+    /** Reset the device and restore the configuration
+    *   The setParameters mode and ranges, subscriber rate, auxiliary sensors and slaved
+    *   magnetometer are set up again as they were. Inclinometer mode is not restored.
+    *   @return status of command
+    */
+    uint8_t recover(void);
+
+    /** Fault and recovery counts
+    *   @return the counts
+    */
+    const MPU9250Health & health(void) const { return _health; }
+
 private:
 
     I2C         			*_i2c;
@@ -378,7 +639,90 @@ private:
     uint8_t static const    _i2c_magaddr = AK8963_ADDRESS;
     MEMS_MODE               _opmode;
     MSCALE                  _magfs;
+    ASCALE                  _accelfs;
+    GSCALE                  _gyrofs;
+    uint8_t                 _config[MPU_CONFIG_LEN];    // as written by setParameters
+    bool                    _configValid;
+    MPU9250AccelCalibration _accelCal;
+    bool                    _accelCalValid;
+    uint8_t                 _smplrtDiv;
+    bool                    _masterEnabled;
+    uint8_t                 _mstClock;
+    uint8_t                 _mstDelay;
+    bool                    _magSlaved;
+    uint8_t                 _magSlot;
+    MMODE                   _magMode;
+    bool                    _magTrigger;                // single shot restart still to be written
+    uint8_t                 _auxCount;
+    uint8_t                 _auxAddr[MPU_AUX_SLOTS];    // addAuxSensor arguments, kept for recover
+    uint8_t                 _auxReg[MPU_AUX_SLOTS];
+    uint8_t                 _auxDiv[MPU_AUX_SLOTS];
+    uint8_t                 _auxFifo;
+    uint8_t                 _auxLen[MPU_AUX_SLOTS];
+    uint8_t                 _auxOffset[MPU_AUX_SLOTS];
+    uint8_t                 _auxFifoOffset[MPU_AUX_SLOTS];  // offset in the auxiliary part of a FIFO frame
+    uint8_t                 _auxFifoLen;
+    uint8_t                 _extLen;
+    uint8_t                 _extData[MPU_EXT_SENS_LEN];
+    MPU9250Subscriber       *_subs[MPU_MAX_SUBSCRIBERS];
+    uint8_t                 _subCount;
+    uint32_t                _seq;
+    MPU9250Latency          *_latency;
+    MPU9250BufferPool       *_pool;
+    uint8_t                 _intCfg;                    // INT_PIN_CFG polarity and drive bits
+    uint8_t                 _retries;
+    uint16_t                _checkInterval;
+    uint16_t                _checkCount;
+    MPU9250Health           _health;
     
+    /** Enable the internal I2C master and take the auxiliary bus out of bypass
+     *  @return - status of command
+     */
+    uint8_t enableMaster(void);
+
+    /** Wait for an I2C_SLV4 transfer to complete
+     *  @return - status of command: 0 = done, 1 = NACK or timeout
+     */
+    uint8_t waitSlv4(void);
+
+    /** Read back the rate and range registers and recover if the device has reset
+     *  @return - status of command
+     */
+    uint8_t checkHealth(void);
+
+    /** Acquire one sample and deliver it to the subscribers that are due
+     *  @param status - NULL to publish unconditionally, else INT_STATUS is read into it first
+     *  and nothing is published unless data ready is set
+     *  @param burst - read INT_STATUS in the same transfer as the sample
+     *  @return - status of command
+     */
+    uint8_t publishSample(uint8_t * status, bool burst);
+
+    /** Set the sample rate for the fastest subscriber and each subscriber's decimation
+     *  @return - status of command
+     */
+    uint8_t updateSubscriberRates(void);
+
+    /** Drain accel samples from the FIFO into sums with outlier rejection
+     *  A FIFO that is full or holds no whole number of frames, as after an overflow,
+     *  is reset and what it held dropped
+     *  @param samples - number of samples to drain
+     *  @param sum - per axis sum of accepted samples
+     *  @param sumSq - per axis sum of squares of accepted samples
+     *  @param accepted - number of accepted samples
+     *  @return - status of command
+     */
+    uint8_t accumulateAccel(uint16_t samples, int64_t * sum, int64_t * sumSq, uint32_t * accepted);
+
+    /** Add a batch of accel samples to the sums, rejecting outliers from the batch mean
+     *  @param batch - samples
+     *  @param n - number of samples
+     *  @param sum - per axis sum of accepted samples
+     *  @param sumSq - per axis sum of squares of accepted samples
+     *  @param accepted - number of accepted samples
+     */
+    void acceptAccel(const int16_t (*batch)[3], uint16_t n, int64_t * sum, int64_t * sumSq, uint32_t * accepted);
+
     /** Initialise the device
      *  Set to the power on reset conditions
      *  @return - status of command (0 = success)
@@ -417,6 +761,12 @@ private:
      */
     uint8_t readMagRegister(uint8_t reg, uint8_t* data, uint8_t count = 1);
 
+    /** Count a failed register transfer and decide whether to repeat it
+     *  @param attempt - repeats so far, incremented when another is allowed
+     *  @return - true to try again
+     */
+    bool retry(uint8_t * attempt);
+
 };
 
 #endif
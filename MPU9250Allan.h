@@ -0,0 +1,236 @@
+/* 
+ * @file    MPU9250Allan.h
+ * @brief   Device driver - MPU9250 streaming Allan deviation
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_ALLAN_H
+#define MPU9250_ALLAN_H
+ 
+#include <stdint.h>
+#include <math.h>
+
+#define MPU_ALLAN_MIN_TERMS 8   // differences needed before a cluster size is used
+
+/**
+ *  @struct MPU9250Noise
+ *  @brief Noise terms for one axis, in the units given by the scale passed to noise
+ *
+ *  For a gyro in deg/s: random walk in deg/sqrt(s), bias instability in deg/s and
+ *  rate random walk in deg/s/sqrt(s). Multiply the first by 60 for deg/sqrt(h).
+ */
+struct MPU9250Noise {
+    float       randomWalk;         // sigma * sqrt(tau) on the -1/2 slope
+    float       biasInstability;    // minimum sigma / 0.664
+    float       rateRandomWalk;     // sigma * sqrt(3 / tau) on the +1/2 slope
+    float       tauMin;             // cluster time of the bias instability floor, s
+};
+
+/**
+ *  @class MPU9250Allan
+ *  @brief Streaming Allan deviation for 3 axes at cluster sizes 1, 2, 4 .. 2^(LEVELS-1)
+ *
+ *  Each level holds cluster sums of 2^k samples, formed every 2^(k-1) samples from two
+ *  non-overlapping sums of the level below, so neighbouring clusters overlap by half.
+ *  The Allan variance at 2^k is taken from clusters 2^k apart. Memory is a few words
+ *  per level, so O(log N) per axis for a run of N samples, and each sample costs about
+ *  two level updates on average, on-device over the FIFO or offline over recordings.
+ *  Cluster sums are exact 64 bit integers; only the squared differences are double.
+ */
+template <uint8_t LEVELS>
+class MPU9250Allan {
+
+public:
+
+    /** Create an empty accumulator
+     */
+    MPU9250Allan()
+    {
+        MPU9250Allan::reset();
+        return;
+    }
+
+    /** Clear all sums
+     */
+    void reset(void)
+    {
+        for (uint8_t k = 0; k < LEVELS; k++) {
+            _terms[k] = 0;
+            _count[k] = 0;
+            for (uint8_t a = 0; a < 3; a++) {
+                _sumSq[k][a] = 0.0;
+                _in[k][a] = 0;
+                _y[k][0][a] = 0;
+                _y[k][1][a] = 0;
+            }
+        }
+        _samples = 0;
+        return;
+    }
+
+    /** Add a sample
+     *  @param xyz - 3 raw counts
+     */
+    void update(const int16_t * xyz)
+    {
+        int64_t v[3];
+
+        v[0] = xyz[0];
+        v[1] = xyz[1];
+        v[2] = xyz[2];
+        // level 0, cluster of 1 sample, difference with the previous sample
+        if (_samples > 0) {
+            MPU9250Allan::addTerm(0, v, _y[0][0]);
+        }
+        for (uint8_t a = 0; a < 3; a++) {
+            _y[0][0][a] = v[a];
+        }
+        _samples++;
+        MPU9250Allan::push(1, v);
+        return;
+    }
+
+    /** Number of samples added
+     *  @return samples
+     */
+    uint32_t samples(void)
+    {
+        return _samples;
+    }
+
+    /** Allan deviation at a cluster size
+     *  @param level - cluster size 2^level samples
+     *  @param axis - 0, 1 or 2
+     *  @param scale - units per count
+     *  @return Allan deviation, 0 if not enough data at this cluster size
+     */
+    float adev(uint8_t level, uint8_t axis, float scale = 1.0f)
+    {
+        double m = (double)((uint32_t)1 << level);
+
+        if ((level >= LEVELS) || (_terms[level] < MPU_ALLAN_MIN_TERMS)) {
+            return 0.0f;
+        }
+        // sums not averages, so divide by the cluster size squared
+        return (float)(sqrt(_sumSq[level][axis] / (2.0 * _terms[level])) / m) * scale;
+    }
+
+    /** Extract the noise terms for an axis from the deviation curve
+     *  @param axis - 0, 1 or 2
+     *  @param rate - sample rate in Hz
+     *  @param scale - units per count
+     *  @param noise - the noise terms
+     *  @return number of usable cluster sizes, at least 3 are needed for a sensible fit
+     */
+    uint8_t noise(uint8_t axis, float rate, float scale, MPU9250Noise * noise)
+    {
+        float sigma[LEVELS];
+        float tau[LEVELS];
+        float slope;
+        float best1 = 1.0f;
+        float best2 = 1.0f;
+        float minSigma = 0.0f;
+        uint8_t n = 0;
+
+        noise->randomWalk = 0.0f;
+        noise->biasInstability = 0.0f;
+        noise->rateRandomWalk = 0.0f;
+        noise->tauMin = 0.0f;
+        while ((n < LEVELS) && ((sigma[n] = MPU9250Allan::adev(n, axis, scale)) > 0.0f)) {
+            tau[n] = (float)((uint32_t)1 << n) / rate;
+            if ((n == 0) || (sigma[n] < minSigma)) {
+                minSigma = sigma[n];
+                noise->tauMin = tau[n];
+            }
+            n++;
+        }
+        for (uint8_t k = 1; k < n; k++) {
+            // log-log slope, log2 tau steps by 1 per level
+            slope = log2f(sigma[k] / sigma[k - 1]);
+            if (fabsf(slope + 0.5f) < best1) {
+                best1 = fabsf(slope + 0.5f);
+                noise->randomWalk = sigma[k - 1] * sqrtf(tau[k - 1]);
+            }
+            if (fabsf(slope - 0.5f) < best2) {
+                best2 = fabsf(slope - 0.5f);
+                noise->rateRandomWalk = sigma[k] * sqrtf(3.0f / tau[k]);
+            }
+        }
+        noise->biasInstability = minSigma / 0.664f;
+        return n;
+    }
+
+private:
+
+    int64_t                 _in[LEVELS][3];         // pending half cluster sum from the level below
+    int64_t                 _y[LEVELS][2][3];       // last two cluster sums
+    double                  _sumSq[LEVELS][3];
+    uint32_t                _terms[LEVELS];
+    uint32_t                _count[LEVELS];         // inputs received
+    uint32_t                _samples;
+
+    void addTerm(uint8_t level, const int64_t * y, const int64_t * ref)
+    {
+        double d;
+
+        for (uint8_t a = 0; a < 3; a++) {
+            d = (double)(y[a] - ref[a]);
+            _sumSq[level][a] += d * d;
+        }
+        _terms[level]++;
+        return;
+    }
+
+    /** Feed a non-overlapping sum of 2^(level-1) samples into a level
+     */
+    void push(uint8_t level, const int64_t * half)
+    {
+        int64_t y[3];
+        uint32_t j;
+
+        while (level < LEVELS) {
+            j = _count[level]++;
+            if (j > 0) {
+                // cluster of 2^level, half overlapping the previous one
+                for (uint8_t a = 0; a < 3; a++) {
+                    y[a] = _in[level][a] + half[a];
+                }
+                // clusters 2^level apart are two steps back
+                if (j > 2) {
+                    MPU9250Allan::addTerm(level, y, _y[level][1]);
+                }
+                for (uint8_t a = 0; a < 3; a++) {
+                    _y[level][1][a] = _y[level][0][a];
+                    _y[level][0][a] = y[a];
+                }
+            }
+            for (uint8_t a = 0; a < 3; a++) {
+                _in[level][a] = half[a];
+            }
+            // every other cluster is non-overlapping, pass it up
+            if ((j & 1) == 0) {
+                return;
+            }
+            half = _y[level][0];
+            level++;
+        }
+        return;
+    }
+
+};
+
+#endif
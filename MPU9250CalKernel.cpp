@@ -0,0 +1,227 @@
+/* 
+ * @file    MPU9250CalKernel.cpp
+ * @brief   Device driver - MPU9250 batch calibration kernels
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250CalKernel.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__ARM_FEATURE_DSP)
+#include "cmsis.h"
+#endif
+
+void MPU9250CalibrateBatch(const MPU9250AccelCalibration * cal, const int16_t * x, const int16_t * y, const int16_t * z,
+                           int16_t * ox, int16_t * oy, int16_t * oz, uint32_t n)
+{
+    int16_t *out[3] = {ox, oy, oz};
+    uint32_t i = 0;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    // pairs (d0, d1) and (d2, 1) against (m0, m1) and (m2, round), two madds per output
+#if defined(__AVX2__)
+    typedef __m256i vec;
+    const uint32_t lanes = 16;
+#define V_SET1_16(v) _mm256_set1_epi16(v)
+#define V_SET1_32(v) _mm256_set1_epi32(v)
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define V_SUBS(a, b) _mm256_subs_epi16(a, b)
+#define V_LO(a, b) _mm256_unpacklo_epi16(a, b)
+#define V_HI(a, b) _mm256_unpackhi_epi16(a, b)
+#define V_MADD(a, b) _mm256_madd_epi16(a, b)
+#define V_ADD32(a, b) _mm256_add_epi32(a, b)
+#define V_SRAI32(a, s) _mm256_srai_epi32(a, s)
+#define V_PACKS(a, b) _mm256_packs_epi32(a, b)
+#else
+    typedef __m128i vec;
+    const uint32_t lanes = 8;
+#define V_SET1_16(v) _mm_set1_epi16(v)
+#define V_SET1_32(v) _mm_set1_epi32(v)
+#define V_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define V_SUBS(a, b) _mm_subs_epi16(a, b)
+#define V_LO(a, b) _mm_unpacklo_epi16(a, b)
+#define V_HI(a, b) _mm_unpackhi_epi16(a, b)
+#define V_MADD(a, b) _mm_madd_epi16(a, b)
+#define V_ADD32(a, b) _mm_add_epi32(a, b)
+#define V_SRAI32(a, s) _mm_srai_epi32(a, s)
+#define V_PACKS(a, b) _mm_packs_epi32(a, b)
+#endif
+    vec b0 = V_SET1_16(cal->offset[0]);
+    vec b1 = V_SET1_16(cal->offset[1]);
+    vec b2 = V_SET1_16(cal->offset[2]);
+    vec one = V_SET1_16(1);
+    vec m01[3];
+    vec m2r[3];
+
+    for (uint8_t r = 0; r < 3; r++) {
+        m01[r] = V_SET1_32((int32_t)(((uint32_t)(uint16_t)cal->matrix[r][1] << 16) | (uint16_t)cal->matrix[r][0]));
+        m2r[r] = V_SET1_32((int32_t)(((uint32_t)(1 << (MPU_CAL_Q - 1)) << 16) | (uint16_t)cal->matrix[r][2]));
+    }
+    for (; (i + lanes) <= n; i += lanes) {
+        vec d0 = V_SUBS(V_LOAD(x + i), b0);
+        vec d1 = V_SUBS(V_LOAD(y + i), b1);
+        vec d2 = V_SUBS(V_LOAD(z + i), b2);
+        vec p01lo = V_LO(d0, d1);
+        vec p01hi = V_HI(d0, d1);
+        vec p2lo = V_LO(d2, one);
+        vec p2hi = V_HI(d2, one);
+
+        for (uint8_t r = 0; r < 3; r++) {
+            vec lo = V_SRAI32(V_ADD32(V_MADD(p01lo, m01[r]), V_MADD(p2lo, m2r[r])), MPU_CAL_Q);
+            vec hi = V_SRAI32(V_ADD32(V_MADD(p01hi, m01[r]), V_MADD(p2hi, m2r[r])), MPU_CAL_Q);
+            // unpack and pack both work within 128 bit lanes, so the order is preserved
+            V_STORE(out[r] + i, V_PACKS(lo, hi));
+        }
+    }
+#undef V_SET1_16
+#undef V_SET1_32
+#undef V_LOAD
+#undef V_STORE
+#undef V_SUBS
+#undef V_LO
+#undef V_HI
+#undef V_MADD
+#undef V_ADD32
+#undef V_SRAI32
+#undef V_PACKS
+#elif defined(__ARM_NEON)
+    int16x8_t b0 = vdupq_n_s16(cal->offset[0]);
+    int16x8_t b1 = vdupq_n_s16(cal->offset[1]);
+    int16x8_t b2 = vdupq_n_s16(cal->offset[2]);
+
+    for (; (i + 8) <= n; i += 8) {
+        int16x8_t d0 = vqsubq_s16(vld1q_s16(x + i), b0);
+        int16x8_t d1 = vqsubq_s16(vld1q_s16(y + i), b1);
+        int16x8_t d2 = vqsubq_s16(vld1q_s16(z + i), b2);
+
+        for (uint8_t r = 0; r < 3; r++) {
+            int32x4_t lo = vmull_n_s16(vget_low_s16(d0), cal->matrix[r][0]);
+            int32x4_t hi = vmull_n_s16(vget_high_s16(d0), cal->matrix[r][0]);
+            lo = vmlal_n_s16(lo, vget_low_s16(d1), cal->matrix[r][1]);
+            hi = vmlal_n_s16(hi, vget_high_s16(d1), cal->matrix[r][1]);
+            lo = vmlal_n_s16(lo, vget_low_s16(d2), cal->matrix[r][2]);
+            hi = vmlal_n_s16(hi, vget_high_s16(d2), cal->matrix[r][2]);
+            // rounding shift and saturating narrow in one
+            vst1q_s16(out[r] + i, vcombine_s16(vqrshrn_n_s32(lo, MPU_CAL_Q), vqrshrn_n_s32(hi, MPU_CAL_Q)));
+        }
+    }
+#elif defined(__ARM_FEATURE_DSP)
+    uint32_t m01[3];
+    int32_t d01;
+    int32_t d2;
+
+    for (uint8_t r = 0; r < 3; r++) {
+        m01[r] = ((uint32_t)(uint16_t)cal->matrix[r][1] << 16) | (uint16_t)cal->matrix[r][0];
+    }
+    for (; i < n; i++) {
+        // dual 16 bit saturating subtract, then one SMLAD per output for the first two terms
+        d01 = (int32_t)__QSUB16(((uint32_t)(uint16_t)y[i] << 16) | (uint16_t)x[i],
+                                ((uint32_t)(uint16_t)cal->offset[1] << 16) | (uint16_t)cal->offset[0]);
+        d2 = __SSAT((int32_t)z[i] - cal->offset[2], 16);
+        for (uint8_t r = 0; r < 3; r++) {
+            out[r][i] = (int16_t)__SSAT((int32_t)__SMLAD(d01, m01[r], (cal->matrix[r][2] * d2) + (1 << (MPU_CAL_Q - 1))) >> MPU_CAL_Q, 16);
+        }
+    }
+#endif
+    // remainder, and the whole block on other targets
+    for (; i < n; i++) {
+        int16_t in[3] = {x[i], y[i], z[i]};
+        int16_t res[3];
+
+        MPU9250ApplyCalibration(cal, in, res);
+        ox[i] = res[0];
+        oy[i] = res[1];
+        oz[i] = res[2];
+    }
+}
+
+void MPU9250CalibrateBatchF(const MPU9250CalibrationF * cal, const float * x, const float * y, const float * z,
+                            float * ox, float * oy, float * oz, uint32_t n)
+{
+    float *out[3] = {ox, oy, oz};
+    uint32_t i = 0;
+
+#if defined(__AVX2__)
+    __m256 b0 = _mm256_set1_ps(cal->offset[0]);
+    __m256 b1 = _mm256_set1_ps(cal->offset[1]);
+    __m256 b2 = _mm256_set1_ps(cal->offset[2]);
+
+    for (; (i + 8) <= n; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + i), b0);
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(y + i), b1);
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(z + i), b2);
+
+        for (uint8_t r = 0; r < 3; r++) {
+            __m256 acc = _mm256_mul_ps(d0, _mm256_set1_ps(cal->matrix[r][0]));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(d1, _mm256_set1_ps(cal->matrix[r][1])));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(d2, _mm256_set1_ps(cal->matrix[r][2])));
+            _mm256_storeu_ps(out[r] + i, acc);
+        }
+    }
+#elif defined(__SSE2__)
+    __m128 b0 = _mm_set1_ps(cal->offset[0]);
+    __m128 b1 = _mm_set1_ps(cal->offset[1]);
+    __m128 b2 = _mm_set1_ps(cal->offset[2]);
+
+    for (; (i + 4) <= n; i += 4) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(x + i), b0);
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(y + i), b1);
+        __m128 d2 = _mm_sub_ps(_mm_loadu_ps(z + i), b2);
+
+        for (uint8_t r = 0; r < 3; r++) {
+            __m128 acc = _mm_mul_ps(d0, _mm_set1_ps(cal->matrix[r][0]));
+            acc = _mm_add_ps(acc, _mm_mul_ps(d1, _mm_set1_ps(cal->matrix[r][1])));
+            acc = _mm_add_ps(acc, _mm_mul_ps(d2, _mm_set1_ps(cal->matrix[r][2])));
+            _mm_storeu_ps(out[r] + i, acc);
+        }
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t b0 = vdupq_n_f32(cal->offset[0]);
+    float32x4_t b1 = vdupq_n_f32(cal->offset[1]);
+    float32x4_t b2 = vdupq_n_f32(cal->offset[2]);
+
+    for (; (i + 4) <= n; i += 4) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(x + i), b0);
+        float32x4_t d1 = vsubq_f32(vld1q_f32(y + i), b1);
+        float32x4_t d2 = vsubq_f32(vld1q_f32(z + i), b2);
+
+        for (uint8_t r = 0; r < 3; r++) {
+            float32x4_t acc = vmulq_n_f32(d0, cal->matrix[r][0]);
+            acc = vmlaq_n_f32(acc, d1, cal->matrix[r][1]);
+            acc = vmlaq_n_f32(acc, d2, cal->matrix[r][2]);
+            vst1q_f32(out[r] + i, acc);
+        }
+    }
+#endif
+    // remainder, and the whole block on FPU only targets such as Cortex-M4F
+    for (; i < n; i++) {
+        float d0 = x[i] - cal->offset[0];
+        float d1 = y[i] - cal->offset[1];
+        float d2 = z[i] - cal->offset[2];
+
+        ox[i] = (cal->matrix[0][0] * d0) + (cal->matrix[0][1] * d1) + (cal->matrix[0][2] * d2);
+        oy[i] = (cal->matrix[1][0] * d0) + (cal->matrix[1][1] * d1) + (cal->matrix[1][2] * d2);
+        oz[i] = (cal->matrix[2][0] * d0) + (cal->matrix[2][1] * d1) + (cal->matrix[2][2] * d2);
+    }
+}
@@ -0,0 +1,59 @@
+/* 
+ * @file    MPU9250CalKernel.h
+ * @brief   Device driver - MPU9250 batch calibration kernels
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_CALKERNEL_H
+#define MPU9250_CALKERNEL_H
+ 
+#include <stdint.h>
+#include "MPU9250Calibration.h"
+
+/**
+ *  @struct MPU9250CalibrationF
+ *  @brief Float form of a calibration, y = M (x - b) in any units
+ */
+struct MPU9250CalibrationF {
+    float       offset[3];
+    float       matrix[3][3];
+};
+
+/** Apply a fixed point calibration to a block of samples, y = M (x - b)
+ *  Samples are structure of arrays, one array per axis; outputs may alias the inputs.
+ *  Uses AVX2 or SSE2 on x86 hosts, NEON on ARMv7-A/ARMv8 and SMLAD on Cortex-M4/M7,
+ *  with a scalar loop elsewhere. Results match MPU9250ApplyCalibration bit for bit,
+ *  except where x - b leaves the int16 range and is saturated first.
+ *  @param cal - the calibration, Q14 matrix
+ *  @param x, y, z - raw counts
+ *  @param ox, oy, oz - calibrated counts
+ *  @param n - number of samples
+ */
+void MPU9250CalibrateBatch(const MPU9250AccelCalibration * cal, const int16_t * x, const int16_t * y, const int16_t * z,
+                           int16_t * ox, int16_t * oy, int16_t * oz, uint32_t n);
+
+/** Apply a float calibration to a block of samples, y = M (x - b)
+ *  Samples are structure of arrays, one array per axis; outputs may alias the inputs.
+ *  @param cal - the calibration
+ *  @param x, y, z - input samples
+ *  @param ox, oy, oz - calibrated samples
+ *  @param n - number of samples
+ */
+void MPU9250CalibrateBatchF(const MPU9250CalibrationF * cal, const float * x, const float * y, const float * z,
+                            float * ox, float * oy, float * oz, uint32_t n);
+
+#endif
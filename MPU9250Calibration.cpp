@@ -0,0 +1,111 @@
+/* 
+ * @file    MPU9250Calibration.cpp
+ * @brief   Device driver - MPU9250 accelerometer calibration
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250Calibration.h"
+#include <math.h>
+
+MPU9250AccelCal::MPU9250AccelCal(uint8_t ascale)
+{
+    _ascale = ascale;
+    _lsb = (float)(16384 >> (ascale >> 3));
+    _poses = 0;
+
+    return;
+}
+
+int8_t MPU9250AccelCal::addPose(const float * mean, const float * variance)
+{
+    float norm;
+    uint8_t axis = 0;
+    uint8_t pose;
+
+    // still: within 10 mg rms on every axis
+    for (uint8_t i = 0; i < 3; i++) {
+        if (variance[i] > (0.0001f * _lsb * _lsb)) {
+            return -1;
+        }
+        if (fabsf(mean[i]) > fabsf(mean[axis])) {
+            axis = i;
+        }
+    }
+    // near a pose: gravity within ~25 degrees of one axis
+    norm = sqrtf((mean[0] * mean[0]) + (mean[1] * mean[1]) + (mean[2] * mean[2]));
+    if ((norm < (0.5f * _lsb)) || (fabsf(mean[axis]) < (0.9f * norm))) {
+        return -1;
+    }
+    pose = (2 * axis) + ((mean[axis] < 0.0f) ? 1 : 0);
+    for (uint8_t i = 0; i < 3; i++) {
+        _mean[pose][i] = mean[i];
+    }
+    _poses |= (1 << pose);
+    return pose;
+}
+
+uint8_t MPU9250AccelCal::poses(void)
+{
+    return _poses;
+}
+
+uint8_t MPU9250AccelCal::solve(MPU9250AccelCalibration * cal)
+{
+    float a[3][3];      // sensitivity, counts per g, column j is the response to +1 g on axis j
+    float inv[3][3];
+    float b[3];
+    float det;
+    float m;
+
+    if (_poses != 0x3F) {
+        return 1;
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        b[i] = 0.0f;
+        for (uint8_t j = 0; j < 3; j++) {
+            b[i] += (_mean[2 * j][i] + _mean[(2 * j) + 1][i]) / 6.0f;
+            a[i][j] = (_mean[2 * j][i] - _mean[(2 * j) + 1][i]) / 2.0f;
+        }
+    }
+    // inverse by adjugate
+    inv[0][0] = (a[1][1] * a[2][2]) - (a[1][2] * a[2][1]);
+    inv[0][1] = (a[0][2] * a[2][1]) - (a[0][1] * a[2][2]);
+    inv[0][2] = (a[0][1] * a[1][2]) - (a[0][2] * a[1][1]);
+    inv[1][0] = (a[1][2] * a[2][0]) - (a[1][0] * a[2][2]);
+    inv[1][1] = (a[0][0] * a[2][2]) - (a[0][2] * a[2][0]);
+    inv[1][2] = (a[0][2] * a[1][0]) - (a[0][0] * a[1][2]);
+    inv[2][0] = (a[1][0] * a[2][1]) - (a[1][1] * a[2][0]);
+    inv[2][1] = (a[0][1] * a[2][0]) - (a[0][0] * a[2][1]);
+    inv[2][2] = (a[0][0] * a[1][1]) - (a[0][1] * a[1][0]);
+    det = (a[0][0] * inv[0][0]) + (a[0][1] * inv[1][0]) + (a[0][2] * inv[2][0]);
+    if (fabsf(det) < 1.0f) {
+        return 2;
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        cal->offset[i] = (int16_t)lroundf(b[i]);
+        for (uint8_t j = 0; j < 3; j++) {
+            // back to nominal counts, Q14
+            m = inv[i][j] * _lsb / det;
+            if (fabsf(m - ((i == j) ? 1.0f : 0.0f)) > 0.25f) {
+                return 2;
+            }
+            cal->matrix[i][j] = (int16_t)lroundf(m * (1 << MPU_CAL_Q));
+        }
+    }
+    cal->ascale = _ascale;
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* 
+ * @file    MPU9250Calibration.h
+ * @brief   Device driver - MPU9250 accelerometer calibration
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_CALIBRATION_H
+#define MPU9250_CALIBRATION_H
+ 
+#include <stdint.h>
+
+#define MPU_CAL_Q 14            // fractional bits of the calibration matrix
+#define MPU_CAL_POSES 6         // +X, -X, +Y, -Y, +Z, -Z up
+
+/**
+ *  @struct MPU9250AccelCalibration
+ *  @brief Offset, scale and misalignment for one accelerometer range
+ *
+ *  Calibrated counts are y = M (x - b), with M in Q14 so identity is 16384 on the
+ *  diagonal. The output stays in counts at the nominal scale of the range.
+ */
+struct MPU9250AccelCalibration {
+    int16_t     offset[3];          // b, raw counts
+    int16_t     matrix[3][3];       // M, Q14, scale on the diagonal, misalignment off it
+    uint8_t     ascale;             // MPU9250::ASCALE the calibration was made at
+};
+
+/** Apply an accelerometer calibration in fixed point
+ *  @param cal - the calibration
+ *  @param raw - 3 raw counts
+ *  @param destination - 3 calibrated counts, may be the same as raw
+ */
+inline void MPU9250ApplyCalibration(const MPU9250AccelCalibration * cal, const int16_t * raw, int16_t * destination)
+{
+    int32_t d[3];
+    int32_t y;
+
+    d[0] = (int32_t)raw[0] - cal->offset[0];
+    d[1] = (int32_t)raw[1] - cal->offset[1];
+    d[2] = (int32_t)raw[2] - cal->offset[2];
+    for (uint8_t i = 0; i < 3; i++) {
+        y = ((cal->matrix[i][0] * d[0]) + (cal->matrix[i][1] * d[1]) + (cal->matrix[i][2] * d[2]) + (1 << (MPU_CAL_Q - 1))) >> MPU_CAL_Q;
+        destination[i] = (int16_t)((y > 32767) ? 32767 : ((y < -32768) ? -32768 : y));
+    }
+}
+
+/**
+ *  @class MPU9250AccelCal
+ *  @brief Six position accelerometer calibration solver
+ *
+ *  Static windows are offered with addPose; windows that are still enough and close
+ *  to one of the six axis-up poses are kept, the rest ignored. With all six poses the
+ *  offset is the mean of each opposing pair and the columns of the sensitivity matrix
+ *  are half their difference; its inverse gives scale and cross-axis misalignment.
+ *  Misalignment of the poses themselves is absorbed as sensor misalignment, so a
+ *  square fixture gives the best result.
+ */ 
+class MPU9250AccelCal {
+
+public:
+
+    /** Create the solver
+     *  @param ascale - MPU9250::ASCALE the windows are measured at
+     */
+    MPU9250AccelCal(uint8_t ascale);
+
+    /** Offer a static window
+     *  @param mean - per axis mean in raw counts
+     *  @param variance - per axis variance in counts squared
+     *  @return pose number 0-5 (+X, -X, +Y, -Y, +Z, -Z) if accepted, -1 if moving or not near a pose
+     */
+    int8_t addPose(const float * mean, const float * variance);
+
+    /** Test for poses collected
+     *  @return bit mask of poses collected, 0x3F when all six are in
+     */
+    uint8_t poses(void);
+
+    /** Solve for the calibration
+     *  @param cal - the calibration
+     *  @return status: 0 = good, 1 = poses missing, 2 = singular or more than 25% off nominal
+     */
+    uint8_t solve(MPU9250AccelCalibration * cal);
+
+private:
+
+    float                   _mean[MPU_CAL_POSES][3];
+    float                   _lsb;           // nominal counts per g
+    uint8_t                 _ascale;
+    uint8_t                 _poses;
+
+};
+
+#endif
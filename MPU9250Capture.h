@@ -0,0 +1,324 @@
+/* 
+ * @file    MPU9250Capture.h
+ * @brief   Device driver - MPU9250 shock/impact capture
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_CAPTURE_H
+#define MPU9250_CAPTURE_H
+ 
+#include "MPU9250.h"
+#include "MPU9250Pool.h"
+
+#define MPU_TRIG_MAG 0x01       // capture triggered on acceleration magnitude
+#define MPU_TRIG_JERK 0x02      // capture triggered on sample to sample change
+
+/**
+ *  @struct MPU9250CaptureInfo
+ *  @brief A frozen capture window, valid until released
+ *
+ *  The window is circular in data: sample i of the window is data[(start + i) % size]
+ */
+struct MPU9250CaptureInfo {
+    const int16_t   (*data)[3];     // raw accel counts
+    uint16_t        start;          // index of the oldest sample
+    uint16_t        length;         // samples in the window
+    uint16_t        size;           // samples in data
+    uint16_t        pre;            // samples before the trigger
+    uint32_t        seq;            // sample number of the trigger
+    uint32_t        peak;           // peak magnitude in mg
+    uint16_t        duration;       // samples above the magnitude threshold
+    uint8_t         trigger;        // MPU_TRIG_ flags
+    uint8_t         ascale;         // MPU9250::ASCALE in use
+    bool            saturated;      // a sample hit full scale, a larger ASCALE is needed
+    uint8_t         slot;           // pass to release
+};
+
+/**
+ *  @class MPU9250Capture
+ *  @brief Pre/post trigger capture over the accelerometer stream
+ *
+ *  update is called for every accel sample, typically from the data ready path. It
+ *  only does integer compares on squared magnitudes, so keeps up with 4 kHz. On a
+ *  trigger the current circular buffer fills POST more samples, then ownership of
+ *  the whole buffer is swapped with a free capture slot, so nothing is copied.
+ *  Storage is static, PRE + 1 + POST samples for each of OWNED buffers, by default
+ *  SLOTS + 1 so every slot can hold a capture. With several sensors, OWNED can be as
+ *  low as 1, the live window, and frozen windows borrowed from a shared pool instead:
+ *  a block is taken on a trigger when no free slot has a buffer, and given back when
+ *  the capture holding it is released. If the window being written is left in a
+ *  block, it is copied back once an owned buffer is released, so RAM follows how many
+ *  captures are held at once rather than SLOTS per sensor.
+ */
+template <uint16_t PRE, uint16_t POST, uint8_t SLOTS, uint8_t OWNED = SLOTS + 1>
+class MPU9250Capture {
+
+public:
+
+    /** Create the capture engine, triggers disabled
+     *  @param pool - blocks of at least (PRE + 1 + POST) * 6 bytes for captures beyond
+     *  the OWNED buffers, NULL for none
+     */
+    MPU9250Capture(MPU9250BufferPool * pool = NULL)
+    {
+        _pool = ((pool != NULL) && (pool->blockSize() >= sizeof(_store[0]))) ? pool : NULL;
+        _active = _store[OWNED - 1];
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            _slotBuf[i] = (i < (OWNED - 1)) ? _store[i] : NULL;
+            _ready[i] = false;
+        }
+        _head = 0;
+        _filled = 0;
+        _post = 0;
+        _seq = 0;
+        _magThr = 0xFFFFFFFF;
+        _jerkThr = 0xFFFFFFFF;
+        _dropped = 0;
+        _ascale = MPU9250::AFS_2G;
+        _last[0] = _last[1] = _last[2] = 0;
+        _primed = false;
+        return;
+    }
+
+    /** Set the trigger thresholds
+     *  @param ascale - accelerometer full scale in use
+     *  @param mag_mg - trigger above this magnitude in mg, 0 disables
+     *  @param jerk_mg - trigger above this change between samples in mg, 0 disables
+     */
+    void setTrigger(MPU9250::ASCALE ascale, uint16_t mag_mg, uint16_t jerk_mg)
+    {
+        uint32_t lsb = 16384 >> (ascale >> 3);  // counts per g
+
+        _ascale = ascale;
+        _magThr = MPU9250Capture::squared(mag_mg, lsb);
+        _jerkThr = MPU9250Capture::squared(jerk_mg, lsb);
+        return;
+    }
+
+    /** Add an accel sample
+     *  @param accel - 3 raw accel counts
+     *  @return true when a capture has just been frozen
+     */
+    bool update(const int16_t * accel)
+    {
+        int16_t *dest;
+        int32_t d;
+        uint32_t mag = 0;
+        uint32_t jerk = 0;
+        bool sat = false;
+        bool done = false;
+
+        if ((_pool != NULL) && !MPU9250Capture::owned(_active)) {
+            MPU9250Capture::reclaim();
+        }
+        dest = _active[_head];
+        for (uint8_t i = 0; i < 3; i++) {
+            dest[i] = accel[i];
+            mag += (uint32_t)((int32_t)accel[i] * accel[i]);
+            // clamp so the square cannot overflow, still far above any threshold
+            // the first sample has nothing to change from, so no jerk
+            d = _primed ? ((int32_t)accel[i] - _last[i]) : 0;
+            d = (d > 32767) ? 32767 : ((d < -32767) ? -32767 : d);
+            jerk += (uint32_t)(d * d);
+            _last[i] = accel[i];
+            if ((accel[i] == 32767) || (accel[i] == -32768)) {
+                sat = true;
+            }
+        }
+        _primed = true;
+        if (++_head == LENGTH) {
+            _head = 0;
+        }
+        if (_filled < LENGTH) {
+            _filled++;
+        }
+
+        if (_post > 0) {
+            // filling the post trigger window
+            if (mag > _info.peak) {
+                _info.peak = mag;
+            }
+            if (mag > _magThr) {
+                _info.duration++;
+            }
+            _info.saturated |= sat;
+            if (--_post == 0) {
+                done = MPU9250Capture::freeze();
+            }
+        } else if ((mag > _magThr) || (jerk > _jerkThr)) {
+            _info.trigger = ((mag > _magThr) ? MPU_TRIG_MAG : 0) | ((jerk > _jerkThr) ? MPU_TRIG_JERK : 0);
+            _info.seq = _seq;
+            _info.peak = mag;
+            _info.duration = (mag > _magThr) ? 1 : 0;
+            _info.saturated = sat;
+            // window starts PRE samples before the trigger, or as far back as we have
+            _info.pre = (_filled > PRE) ? PRE : (_filled - 1);
+            _post = POST;
+        }
+        _seq++;
+        return done;
+    }
+
+    /** Get the oldest frozen capture
+     *  @param info - the capture, peak converted to mg
+     *  @return true if a capture was available
+     */
+    bool get(MPU9250CaptureInfo * info)
+    {
+        uint32_t lsb;
+
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            if (_ready[i]) {
+                // the range the window was captured at, setTrigger may have changed it since
+                lsb = 16384 >> (_slotInfo[i].ascale >> 3);
+                *info = _slotInfo[i];
+                info->data = _slotBuf[i];
+                info->peak = (uint32_t)(sqrtf((float)_slotInfo[i].peak) * 1000.0f / lsb);
+                info->slot = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Hand a capture slot back for reuse, and a borrowed buffer to the pool
+     *  @param slot - slot from MPU9250CaptureInfo
+     */
+    void release(uint8_t slot)
+    {
+        Window buf;
+
+        if ((slot < SLOTS) && _ready[slot]) {
+            buf = _slotBuf[slot];
+            if ((_pool != NULL) && !MPU9250Capture::owned(buf)) {
+                _slotBuf[slot] = NULL;
+                _pool->release(buf);
+            }
+            // buffer given up before the slot is handed back to update
+            __DMB();
+            _ready[slot] = false;
+        }
+        return;
+    }
+
+    /** Number of triggers lost because every slot was full
+     *  @return dropped captures
+     */
+    uint32_t dropped(void)
+    {
+        return _dropped;
+    }
+
+private:
+
+    enum { LENGTH = PRE + 1 + POST };               // pre trigger, trigger and post trigger samples
+
+    typedef int16_t (*Window)[3];
+    typedef char OwnedFitsSlots[((OWNED >= 1) && (OWNED <= (SLOTS + 1))) ? 1 : -1];
+
+    int16_t                 _store[OWNED][LENGTH][3];
+    MPU9250BufferPool       *_pool;
+    Window                  _active;            // buffer being written
+    Window                  _slotBuf[SLOTS];    // buffer held by each slot, NULL for none
+    volatile bool           _ready[SLOTS];
+    MPU9250CaptureInfo      _slotInfo[SLOTS];
+    MPU9250CaptureInfo      _info;              // capture in progress
+    uint16_t                _head;
+    uint16_t                _filled;
+    uint16_t                _post;
+    uint32_t                _seq;
+    uint32_t                _magThr;            // squared counts
+    uint32_t                _jerkThr;
+    uint32_t                _dropped;
+    MPU9250::ASCALE         _ascale;
+    int16_t                 _last[3];
+    bool                    _primed;            // _last holds a sample
+
+    static uint32_t squared(uint16_t mg, uint32_t lsb)
+    {
+        uint32_t counts = ((uint32_t)mg * lsb) / 1000;
+
+        if (mg == 0) {
+            return 0xFFFFFFFF;
+        }
+        return (counts >= 65535) ? 0xFFFFFFFE : counts * counts;
+    }
+
+    bool owned(Window buf) const
+    {
+        return (buf >= _store[0]) && (buf < _store[OWNED]);
+    }
+
+    // move the window being written out of a pool block, into an owned buffer given back by release
+    void reclaim(void)
+    {
+        Window buf;
+
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            if (!_ready[i] && (_slotBuf[i] != NULL) && MPU9250Capture::owned(_slotBuf[i])) {
+                buf = _slotBuf[i];
+                memcpy(buf, _active, sizeof(_store[0]));
+                _slotBuf[i] = NULL;
+                _pool->release(_active);
+                _active = buf;
+                return;
+            }
+        }
+        return;
+    }
+
+    bool freeze(void)
+    {
+        Window buf;
+        uint8_t i;
+        uint8_t spare = SLOTS;
+
+        // a free slot that still has a buffer, else a free slot and a buffer from the pool
+        for (i = 0; i < SLOTS; i++) {
+            if (!_ready[i]) {
+                if (_slotBuf[i] != NULL) {
+                    break;
+                }
+                spare = (spare == SLOTS) ? i : spare;
+            }
+        }
+        if ((i == SLOTS) && (spare < SLOTS) && (_pool != NULL)) {
+            _slotBuf[spare] = (Window)_pool->acquire();
+            i = (_slotBuf[spare] != NULL) ? spare : SLOTS;
+        }
+        if (i == SLOTS) {
+            _dropped++;
+            return false;
+        }
+        _slotInfo[i] = _info;
+        _slotInfo[i].length = _info.pre + 1 + POST;
+        _slotInfo[i].start = (uint16_t)((_head + LENGTH - _slotInfo[i].length) % LENGTH);
+        _slotInfo[i].size = LENGTH;
+        _slotInfo[i].ascale = (uint8_t)_ascale;
+        // swap buffer ownership, the slot keeps the window and we carry on in its old buffer
+        buf = _slotBuf[i];
+        _slotBuf[i] = _active;
+        _active = buf;
+        _head = 0;
+        _filled = 0;
+        _ready[i] = true;
+        return true;
+    }
+
+};
+
+#endif
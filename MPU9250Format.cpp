@@ -0,0 +1,166 @@
+/* 
+ * @file    MPU9250Format.cpp
+ * @brief   Device driver - MPU9250 text output
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include <stddef.h>
+#include "MPU9250Format.h"
+
+// column widths, wide enough for the extreme of each field
+#define MPU_FORMAT_SEQ_W 10
+#define MPU_FORMAT_ACCEL_W 8
+#define MPU_FORMAT_GYRO_W 9
+#define MPU_FORMAT_MAG_W 8
+#define MPU_FORMAT_TEMP_W 7
+#define MPU_FORMAT_QUAT_W 8
+
+static const char * const names[15] = {
+    "seq", "ax", "ay", "az", "gx", "gy", "gz", "mx", "my", "mz", "temp", "qw", "qx", "qy", "qz"
+};
+static const uint8_t widths[15] = {
+    MPU_FORMAT_SEQ_W, MPU_FORMAT_ACCEL_W, MPU_FORMAT_ACCEL_W, MPU_FORMAT_ACCEL_W,
+    MPU_FORMAT_GYRO_W, MPU_FORMAT_GYRO_W, MPU_FORMAT_GYRO_W, MPU_FORMAT_MAG_W, MPU_FORMAT_MAG_W,
+    MPU_FORMAT_MAG_W, MPU_FORMAT_TEMP_W, MPU_FORMAT_QUAT_W, MPU_FORMAT_QUAT_W, MPU_FORMAT_QUAT_W,
+    MPU_FORMAT_QUAT_W
+};
+
+static inline uint32_t magnitude(int32_t value)
+{
+    return (value < 0) ? (0 - (uint32_t)value) : (uint32_t)value;
+}
+
+MPU9250Format::MPU9250Format(uint8_t ascale, uint8_t gscale, uint8_t style)
+{
+    _ashift = (ascale >> 3) & 0x03;
+    _gshift = (gscale >> 3) & 0x03;
+    _style = style;
+
+    return;
+}
+
+uint16_t MPU9250Format::header(char * out, uint16_t size) const
+{
+    char * p = out;
+    uint8_t length;
+
+    if (size < MPU_FORMAT_MAX_LINE) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < 15; i++) {
+        if (i != 0) {
+            *p++ = (_style == MPU_FORMAT_COLUMNS) ? ' ' : ',';
+        }
+        for (length = 0; names[i][length] != '\0'; length++) {
+        }
+        if (_style == MPU_FORMAT_COLUMNS) {
+            for (uint8_t pad = length; pad < widths[i]; pad++) {
+                *p++ = ' ';
+            }
+        }
+        for (uint8_t c = 0; c < length; c++) {
+            *p++ = names[i][c];
+        }
+    }
+    *p++ = '\n';
+    *p = '\0';
+    return (uint16_t)(p - out);
+}
+
+uint16_t MPU9250Format::line(const MPU9250Sample & sample, const float * q, char * out, uint16_t size) const
+{
+    char * p = out;
+    char sep = (_style == MPU_FORMAT_COLUMNS) ? ' ' : ',';
+    bool valid;
+    int32_t v;
+
+    if (size < MPU_FORMAT_MAX_LINE) {
+        return 0;
+    }
+
+    p = MPU9250Format::field(p, sample.seq, false, 0, MPU_FORMAT_SEQ_W, true);
+
+    // 1e-4 g: counts * (2 << ascale) * 10000 / 32768, rounded
+    valid = (sample.channels & MPU_CH_ACCEL) != 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        v = ((int32_t)sample.accel[i] * (625 << _ashift) + 512) >> 10;
+        *p++ = sep;
+        p = MPU9250Format::field(p, magnitude(v), v < 0, 4, MPU_FORMAT_ACCEL_W, valid);
+    }
+    // 0.01 dps: counts * (250 << gscale) * 100 / 32768, rounded
+    valid = (sample.channels & MPU_CH_GYRO) != 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        v = ((int32_t)sample.gyro[i] * (3125 << _gshift) + 2048) >> 12;
+        *p++ = sep;
+        p = MPU9250Format::field(p, magnitude(v), v < 0, 2, MPU_FORMAT_GYRO_W, valid);
+    }
+    // already 0.1 uT per count
+    valid = (sample.channels & MPU_CH_MAG) != 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        *p++ = sep;
+        p = MPU9250Format::field(p, magnitude(sample.mag[i]), sample.mag[i] < 0, 1, MPU_FORMAT_MAG_W, valid);
+    }
+    // 0.01 C: counts / 333.87 + 21, exactly as counts * 10000 / 33387, which cannot tie, rounded
+    v = (int32_t)sample.temp * 10000;
+    v = ((v + ((v < 0) ? -16693 : 16693)) / 33387) + 2100;
+    *p++ = sep;
+    p = MPU9250Format::field(p, magnitude(v), v < 0, 2, MPU_FORMAT_TEMP_W, (sample.channels & MPU_CH_TEMP) != 0);
+    for (uint8_t i = 0; i < 4; i++) {
+        v = 0;
+        if (q != NULL) {
+            v = (int32_t)((q[i] * 10000.0f) + ((q[i] < 0.0f) ? -0.5f : 0.5f));
+        }
+        *p++ = sep;
+        p = MPU9250Format::field(p, magnitude(v), v < 0, 4, MPU_FORMAT_QUAT_W, q != NULL);
+    }
+    *p++ = '\n';
+    *p = '\0';
+    return (uint16_t)(p - out);
+}
+
+char * MPU9250Format::field(char * p, uint32_t u, bool negative, uint8_t decimals, uint8_t width, bool valid) const
+{
+    char digits[12];
+    uint8_t n = 0;
+    uint8_t length;
+
+    if (valid) {
+        do {
+            digits[n++] = (char)('0' + (u % 10));
+            u /= 10;
+        } while ((u != 0) || (n <= decimals));
+    }
+    length = n + ((valid && (decimals != 0)) ? 1 : 0) + ((valid && negative) ? 1 : 0);
+
+    if (_style == MPU_FORMAT_COLUMNS) {
+        for (; length < width; length++) {
+            *p++ = ' ';
+        }
+    }
+    if (valid) {
+        if (negative) {
+            *p++ = '-';
+        }
+        while (n != 0) {
+            *p++ = digits[--n];
+            if ((n == decimals) && (decimals != 0)) {
+                *p++ = '.';
+            }
+        }
+    }
+    return p;
+}
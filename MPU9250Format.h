@@ -0,0 +1,80 @@
+/* 
+ * @file    MPU9250Format.h
+ * @brief   Device driver - MPU9250 text output
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_FORMAT_H
+#define MPU9250_FORMAT_H
+ 
+#include <stdint.h>
+#include "MPU9250Sample.h"
+
+//  Output styles
+#define MPU_FORMAT_CSV 0        // comma separated, no padding
+#define MPU_FORMAT_COLUMNS 1    // space separated, right aligned
+
+#define MPU_FORMAT_MAX_LINE 160 // buffer needed for any line, with the terminator
+
+/**
+ *  @class MPU9250Format
+ *  @brief Sample lines as text in physical units, without printf or floats
+ *
+ *  Raw counts are scaled in fixed point and the digits generated from integers,
+ *  so a line costs a few hundred cycles rather than thousands for printf("%f").
+ *  Fields are seq, accel in g to 4 places, gyro in dps to 2, mag in uT to 1,
+ *  temperature in C to 2 and the quaternion to 4. Channels not in the sample, or
+ *  no quaternion, leave their fields empty.
+ */ 
+class MPU9250Format {
+
+public:
+
+    /** Create the formatter
+     *  @param ascale - MPU9250::ASCALE the accel counts are at
+     *  @param gscale - MPU9250::GSCALE the gyro counts are at
+     *  @param style - MPU_FORMAT_CSV or MPU_FORMAT_COLUMNS
+     */
+    MPU9250Format(uint8_t ascale, uint8_t gscale, uint8_t style = MPU_FORMAT_CSV);
+
+    /** Write the header line naming the fields
+     *  @param out - destination
+     *  @param size - bytes at out, at least MPU_FORMAT_MAX_LINE
+     *  @return characters written, not counting the terminator, 0 if size is too small
+     */
+    uint16_t header(char * out, uint16_t size) const;
+
+    /** Write one sample line
+     *  @param sample - raw sample
+     *  @param q - 4 floats, w, x, y, z, or NULL
+     *  @param out - destination
+     *  @param size - bytes at out, at least MPU_FORMAT_MAX_LINE
+     *  @return characters written, not counting the terminator, 0 if size is too small
+     */
+    uint16_t line(const MPU9250Sample & sample, const float * q, char * out, uint16_t size) const;
+
+private:
+
+    uint8_t                 _ashift;
+    uint8_t                 _gshift;
+    uint8_t                 _style;
+
+    char * field(char * p, uint32_t u, bool negative, uint8_t decimals, uint8_t width, bool valid) const;
+
+};
+
+#endif
@@ -0,0 +1,111 @@
+/* 
+ * @file    MPU9250FreeFall.h
+ * @brief   Device driver - MPU9250 free-fall detection
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_FREEFALL_H
+#define MPU9250_FREEFALL_H
+ 
+#include "MPU9250.h"
+
+/**
+ *  @class MPU9250FreeFall
+ *  @brief Low-g detector on raw accel counts
+ *
+ *  The threshold is converted to squared counts for the active ASCALE once, so each
+ *  update is three multiplies and a compare and can run on the data ready path.
+ *  The event is raised on the sample where the low-g condition has held for the
+ *  configured duration, so the latency is the duration plus one sample period,
+ *  e.g. 6 ms for 5 ms at 1 kHz. It is raised once per fall and re-armed when the
+ *  magnitude returns above the threshold.
+ */ 
+class MPU9250FreeFall {
+
+public:
+
+    /** Create the detector
+     *  @param ascale - accelerometer full scale in use
+     *  @param threshold_mg - low-g threshold in mg, 300 mg is typical
+     *  @param duration_ms - time the magnitude must stay below the threshold
+     *  @param rate - accel sample rate in Hz
+     */
+    MPU9250FreeFall(MPU9250::ASCALE ascale, uint16_t threshold_mg = 300, uint16_t duration_ms = 5, uint16_t rate = 1000)
+    {
+        MPU9250FreeFall::configure(ascale, threshold_mg, duration_ms, rate);
+        return;
+    }
+
+    /** Change the detector settings, e.g. after an ASCALE change
+     *  @param ascale - accelerometer full scale in use
+     *  @param threshold_mg - low-g threshold in mg
+     *  @param duration_ms - time the magnitude must stay below the threshold
+     *  @param rate - accel sample rate in Hz
+     */
+    void configure(MPU9250::ASCALE ascale, uint16_t threshold_mg, uint16_t duration_ms, uint16_t rate)
+    {
+        uint32_t counts = ((uint32_t)threshold_mg * (16384 >> (ascale >> 3))) / 1000;
+
+        _threshold = counts * counts;
+        // round up so the condition always holds for at least the duration
+        _samples = (uint16_t)((((uint32_t)duration_ms * rate) + 999) / 1000);
+        if (_samples == 0) {
+            _samples = 1;
+        }
+        _count = 0;
+        _armed = true;
+        return;
+    }
+
+    /** Add an accel sample
+     *  @param accel - 3 raw accel counts
+     *  @return true on the sample that detects a free fall
+     */
+    bool update(const int16_t * accel)
+    {
+        uint32_t mag = (uint32_t)((int32_t)accel[0] * accel[0]) + (uint32_t)((int32_t)accel[1] * accel[1]) + (uint32_t)((int32_t)accel[2] * accel[2]);
+
+        if (mag >= _threshold) {
+            _count = 0;
+            _armed = true;
+            return false;
+        }
+        if (_armed && (++_count >= _samples)) {
+            _armed = false;
+            return true;
+        }
+        return false;
+    }
+
+    /** Test for a fall in progress
+     *  @return true while the low-g condition holds after an event
+     */
+    bool falling(void)
+    {
+        return !_armed;
+    }
+
+private:
+
+    uint32_t                _threshold;     // squared counts
+    uint16_t                _samples;
+    uint16_t                _count;
+    bool                    _armed;
+
+};
+
+#endif
@@ -0,0 +1,393 @@
+/* 
+ * @file    MPU9250Fusion.cpp
+ * @brief   Device driver - MPU9250 orientation fusion filters
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250Fusion.h"
+
+MPU9250Fusion::MPU9250Fusion()
+{
+    _q[0] = 1.0f;
+    _q[1] = 0.0f;
+    _q[2] = 0.0f;
+    _q[3] = 0.0f;
+    _gravity = 0.0f;
+    _accelBand = 0.0f;
+    _field = 0.0f;
+    _fieldBand = 0.0f;
+
+    return;
+}
+
+const float * MPU9250Fusion::quaternion(void)
+{
+    return _q;
+}
+
+void MPU9250Fusion::setQuaternion(const float * q)
+{
+    MPU9250Fusion::normalise(q[0], q[1], q[2], q[3]);
+    return;
+}
+
+void MPU9250Fusion::euler(float * yaw, float * pitch, float * roll)
+{
+    float q1 = _q[0], q2 = _q[1], q3 = _q[2], q4 = _q[3];
+
+    *yaw = MPU9250Atan2(2.0f * ((q2 * q3) + (q1 * q4)), (q1 * q1) + (q2 * q2) - (q3 * q3) - (q4 * q4)) * MPU_RAD2DEG;
+    *pitch = -MPU9250Asin(2.0f * ((q2 * q4) - (q1 * q3))) * MPU_RAD2DEG;
+    *roll = MPU9250Atan2(2.0f * ((q1 * q2) + (q3 * q4)), (q1 * q1) - (q2 * q2) - (q3 * q3) + (q4 * q4)) * MPU_RAD2DEG;
+    return;
+}
+
+void MPU9250Fusion::setAdaptive(float gravity, float accelBand, float field, float fieldBand)
+{
+    _gravity = gravity;
+    _accelBand = ((gravity > 0.0f) && (accelBand > 0.0f)) ? (1.0f / (gravity * accelBand)) : 0.0f;
+    _field = field;
+    _fieldBand = ((field > 0.0f) && (fieldBand > 0.0f)) ? (1.0f / (field * fieldBand)) : 0.0f;
+    return;
+}
+
+void MPU9250Fusion::normalise(float q1, float q2, float q3, float q4)
+{
+    float norm = MPU9250Rsqrt((q1 * q1) + (q2 * q2) + (q3 * q3) + (q4 * q4));
+
+    _q[0] = q1 * norm;
+    _q[1] = q2 * norm;
+    _q[2] = q3 * norm;
+    _q[3] = q4 * norm;
+    return;
+}
+
+// Implementation of Sebastian Madgwick's "...efficient orientation filter for... inertial/magnetic sensor arrays"
+// (see http://www.x-io.co.uk/category/open-source/ for examples and more details)
+MPU9250Madgwick::MPU9250Madgwick(float beta, float zeta)
+{
+    _beta = beta;
+    _zeta = zeta;
+    _bias[0] = 0.0f;
+    _bias[1] = 0.0f;
+    _bias[2] = 0.0f;
+
+    return;
+}
+
+void MPU9250Madgwick::setGains(float beta, float zeta)
+{
+    _beta = beta;
+    _zeta = zeta;
+    return;
+}
+
+void MPU9250Madgwick::update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float dt)
+{
+    float q1 = _q[0], q2 = _q[1], q3 = _q[2], q4 = _q[3];   // short name local variable for readability
+    float norm;
+    float inv;
+    float wa, wm;
+    float hx, hy, _2bx, _2bz;
+    float fg1, fg2, fg3, fm1, fm2, fm3;
+    float s1, s2, s3, s4;
+
+    // Auxiliary variables to avoid repeated arithmetic
+    float _2q1mx;
+    float _2q1my;
+    float _2q1mz;
+    float _2q2mx;
+    float _2q1 = 2.0f * q1;
+    float _2q2 = 2.0f * q2;
+    float _2q3 = 2.0f * q3;
+    float _2q4 = 2.0f * q4;
+    float q1q1 = q1 * q1;
+    float q1q2 = q1 * q2;
+    float q1q3 = q1 * q3;
+    float q1q4 = q1 * q4;
+    float q2q2 = q2 * q2;
+    float q2q3 = q2 * q3;
+    float q2q4 = q2 * q4;
+    float q3q3 = q3 * q3;
+    float q3q4 = q3 * q4;
+    float q4q4 = q4 * q4;
+
+    // Fall back to 6 axis without a magnetometer
+    if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+        MPU9250Madgwick::updateIMU(ax, ay, az, gx, gy, gz, dt);
+        return;
+    }
+
+    // Normalise accelerometer measurement
+    norm = (ax * ax) + (ay * ay) + (az * az);
+    if (norm == 0.0f) return; // handle NaN
+    inv = MPU9250Rsqrt(norm);
+    wa = MPU9250Fusion::weight(norm, inv, _gravity, _accelBand);
+    ax *= inv;
+    ay *= inv;
+    az *= inv;
+
+    // Normalise magnetometer measurement
+    norm = (mx * mx) + (my * my) + (mz * mz);
+    inv = MPU9250Rsqrt(norm);
+    wm = MPU9250Fusion::weight(norm, inv, _field, _fieldBand);
+    mx *= inv;
+    my *= inv;
+    mz *= inv;
+
+    // Reference direction of Earth's magnetic field
+    _2q1mx = 2.0f * q1 * mx;
+    _2q1my = 2.0f * q1 * my;
+    _2q1mz = 2.0f * q1 * mz;
+    _2q2mx = 2.0f * q2 * mx;
+    hx = mx * q1q1 - _2q1my * q4 + _2q1mz * q3 + mx * q2q2 + _2q2 * my * q3 + _2q2 * mz * q4 - mx * q3q3 - mx * q4q4;
+    hy = _2q1mx * q4 + my * q1q1 - _2q1mz * q2 + _2q2mx * q3 - my * q2q2 + my * q3q3 + _2q3 * mz * q4 - my * q4q4;
+    _2bx = MPU9250Sqrt(hx * hx + hy * hy);
+    _2bz = -_2q1mx * q3 + _2q1my * q2 + mz * q1q1 + _2q2mx * q4 - mz * q2q2 + _2q3 * my * q4 - mz * q3q3 + mz * q4q4;
+
+    // Gravity and field residuals, each weighted by how much it is trusted
+    fg1 = wa * ((2.0f * (q2q4 - q1q3)) - ax);
+    fg2 = wa * ((2.0f * (q1q2 + q3q4)) - ay);
+    fg3 = wa * ((1.0f - (2.0f * (q2q2 + q3q3))) - az);
+    fm1 = wm * ((_2bx * (0.5f - q3q3 - q4q4)) + (_2bz * (q2q4 - q1q3)) - mx);
+    fm2 = wm * ((_2bx * (q2q3 - q1q4)) + (_2bz * (q1q2 + q3q4)) - my);
+    fm3 = wm * ((_2bx * (q1q3 + q2q4)) + (_2bz * (0.5f - q2q2 - q3q3)) - mz);
+
+    // Gradient decent algorithm corrective step
+    s1 = -_2q3 * fg1 + _2q2 * fg2 - _2bz * q3 * fm1 + (-_2bx * q4 + _2bz * q2) * fm2 + _2bx * q3 * fm3;
+    s2 = _2q4 * fg1 + _2q1 * fg2 - 4.0f * q2 * fg3 + _2bz * q4 * fm1 + (_2bx * q3 + _2bz * q1) * fm2 + (_2bx * q4 - 2.0f * _2bz * q2) * fm3;
+    s3 = -_2q1 * fg1 + _2q4 * fg2 - 4.0f * q3 * fg3 + (-2.0f * _2bx * q3 - _2bz * q1) * fm1 + (_2bx * q2 + _2bz * q4) * fm2 + (_2bx * q1 - 2.0f * _2bz * q3) * fm3;
+    s4 = _2q2 * fg1 + _2q3 * fg2 + (-2.0f * _2bx * q4 + _2bz * q2) * fm1 + (-_2bx * q1 + _2bz * q3) * fm2 + _2bx * q2 * fm3;
+
+    MPU9250Madgwick::step(s1, s2, s3, s4, (wa > wm) ? wa : wm, gx, gy, gz, dt);
+    return;
+}
+
+void MPU9250Madgwick::updateIMU(float ax, float ay, float az, float gx, float gy, float gz, float dt)
+{
+    float q1 = _q[0], q2 = _q[1], q3 = _q[2], q4 = _q[3];
+    float norm;
+    float s1, s2, s3, s4;
+    float _2q1 = 2.0f * q1;
+    float _2q2 = 2.0f * q2;
+    float _2q3 = 2.0f * q3;
+    float _2q4 = 2.0f * q4;
+    float _4q1 = 4.0f * q1;
+    float _4q2 = 4.0f * q2;
+    float _4q3 = 4.0f * q3;
+    float _8q2 = 8.0f * q2;
+    float _8q3 = 8.0f * q3;
+    float q1q1 = q1 * q1;
+    float q2q2 = q2 * q2;
+    float q3q3 = q3 * q3;
+    float q4q4 = q4 * q4;
+
+    float inv;
+
+    norm = (ax * ax) + (ay * ay) + (az * az);
+    if (norm == 0.0f) return; // handle NaN
+    inv = MPU9250Rsqrt(norm);
+    ax *= inv;
+    ay *= inv;
+    az *= inv;
+
+    // Gradient decent algorithm corrective step, gravity only
+    s1 = _4q1 * q3q3 + _2q3 * ax + _4q1 * q2q2 - _2q2 * ay;
+    s2 = _4q2 * q4q4 - _2q4 * ax + 4.0f * q1q1 * q2 - _2q1 * ay - _4q2 + _8q2 * q2q2 + _8q2 * q3q3 + _4q2 * az;
+    s3 = 4.0f * q1q1 * q3 + _2q1 * ax + _4q3 * q4q4 - _2q4 * ay - _4q3 + _8q3 * q2q2 + _8q3 * q3q3 + _4q3 * az;
+    s4 = 4.0f * q2q2 * q4 - _2q2 * ax + 4.0f * q3q3 * q4 - _2q3 * ay;
+
+    MPU9250Madgwick::step(s1, s2, s3, s4, MPU9250Fusion::weight(norm, inv, _gravity, _accelBand), gx, gy, gz, dt);
+    return;
+}
+
+void MPU9250Madgwick::step(float s1, float s2, float s3, float s4, float w, float gx, float gy, float gz, float dt)
+{
+    float q1 = _q[0], q2 = _q[1], q3 = _q[2], q4 = _q[3];
+    float norm;
+    float qDot1, qDot2, qDot3, qDot4;
+
+    norm = (s1 * s1) + (s2 * s2) + (s3 * s3) + (s4 * s4);    // normalise step magnitude
+    if (norm > 0.0f) {
+        norm = w * MPU9250Rsqrt(norm);
+        s1 *= norm;
+        s2 *= norm;
+        s3 *= norm;
+        s4 *= norm;
+    }
+
+    if (_zeta > 0.0f) {
+        // gyro bias from the direction of the error, 2 q* x s
+        _bias[0] += ((2.0f * q1 * s2) - (2.0f * q2 * s1) - (2.0f * q3 * s4) + (2.0f * q4 * s3)) * dt * _zeta;
+        _bias[1] += ((2.0f * q1 * s3) + (2.0f * q2 * s4) - (2.0f * q3 * s1) - (2.0f * q4 * s2)) * dt * _zeta;
+        _bias[2] += ((2.0f * q1 * s4) - (2.0f * q2 * s3) + (2.0f * q3 * s2) - (2.0f * q4 * s1)) * dt * _zeta;
+        gx -= _bias[0];
+        gy -= _bias[1];
+        gz -= _bias[2];
+    }
+
+    // Compute rate of change of quaternion
+    qDot1 = 0.5f * (-q2 * gx - q3 * gy - q4 * gz) - _beta * s1;
+    qDot2 = 0.5f * (q1 * gx + q3 * gz - q4 * gy) - _beta * s2;
+    qDot3 = 0.5f * (q1 * gy - q2 * gz + q4 * gx) - _beta * s3;
+    qDot4 = 0.5f * (q1 * gz + q2 * gy - q3 * gx) - _beta * s4;
+
+    // Integrate to yield quaternion
+    MPU9250Fusion::normalise(q1 + (qDot1 * dt), q2 + (qDot2 * dt), q3 + (qDot3 * dt), q4 + (qDot4 * dt));
+    return;
+}
+
+// Similar to Madgwick scheme but uses proportional and integral filtering on the error between estimated reference vectors and
+// measured ones. 
+MPU9250Mahony::MPU9250Mahony(float kp, float ki)
+{
+    _kp = kp;
+    _ki = ki;
+    _eInt[0] = 0.0f;
+    _eInt[1] = 0.0f;
+    _eInt[2] = 0.0f;
+
+    return;
+}
+
+void MPU9250Mahony::setGains(float kp, float ki)
+{
+    _kp = kp;
+    _ki = ki;
+    return;
+}
+
+void MPU9250Mahony::update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float dt)
+{
+    float q1 = _q[0], q2 = _q[1], q3 = _q[2], q4 = _q[3];   // short name local variable for readability
+    float norm;
+    float inv;
+    float wa, wm;
+    float hx, hy, bx, bz;
+    float vx, vy, vz, wx, wy, wz;
+
+    // Auxiliary variables to avoid repeated arithmetic
+    float q1q1 = q1 * q1;
+    float q1q2 = q1 * q2;
+    float q1q3 = q1 * q3;
+    float q1q4 = q1 * q4;
+    float q2q2 = q2 * q2;
+    float q2q3 = q2 * q3;
+    float q2q4 = q2 * q4;
+    float q3q3 = q3 * q3;
+    float q3q4 = q3 * q4;
+    float q4q4 = q4 * q4;   
+
+    // Normalise accelerometer measurement, weighted by how much it is trusted
+    norm = (ax * ax) + (ay * ay) + (az * az);
+    if (norm == 0.0f) return; // handle NaN
+    inv = MPU9250Rsqrt(norm);
+    wa = MPU9250Fusion::weight(norm, inv, _gravity, _accelBand);
+    if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+        // fall back to 6 axis without a magnetometer
+        MPU9250Mahony::updateIMU(ax, ay, az, gx, gy, gz, dt);
+        return;
+    }
+    inv *= wa;
+    ax *= inv;
+    ay *= inv;
+    az *= inv;
+
+    // Normalise magnetometer measurement
+    norm = (mx * mx) + (my * my) + (mz * mz);
+    inv = MPU9250Rsqrt(norm);
+    wm = MPU9250Fusion::weight(norm, inv, _field, _fieldBand);
+    mx *= inv;
+    my *= inv;
+    mz *= inv;
+
+    // Reference direction of Earth's magnetic field
+    hx = 2.0f * mx * (0.5f - q3q3 - q4q4) + 2.0f * my * (q2q3 - q1q4) + 2.0f * mz * (q2q4 + q1q3);
+    hy = 2.0f * mx * (q2q3 + q1q4) + 2.0f * my * (0.5f - q2q2 - q4q4) + 2.0f * mz * (q3q4 - q1q2);
+    bx = MPU9250Sqrt((hx * hx) + (hy * hy));
+    bz = 2.0f * mx * (q2q4 - q1q3) + 2.0f * my * (q3q4 + q1q2) + 2.0f * mz * (0.5f - q2q2 - q3q3);
+
+    // Estimated direction of gravity and magnetic field
+    vx = 2.0f * (q2q4 - q1q3);
+    vy = 2.0f * (q1q2 + q3q4);
+    vz = q1q1 - q2q2 - q3q3 + q4q4;
+    wx = 2.0f * bx * (0.5f - q3q3 - q4q4) + 2.0f * bz * (q2q4 - q1q3);
+    wy = 2.0f * bx * (q2q3 - q1q4) + 2.0f * bz * (q1q2 + q3q4);
+    wz = 2.0f * bx * (q1q3 + q2q4) + 2.0f * bz * (0.5f - q2q2 - q3q3);  
+
+    // Error is cross product between estimated direction and measured direction of gravity
+    // w is built from m, so the mag weight goes on the product rather than on m
+    MPU9250Mahony::step((ay * vz - az * vy) + (wm * (my * wz - mz * wy)),
+                        (az * vx - ax * vz) + (wm * (mz * wx - mx * wz)),
+                        (ax * vy - ay * vx) + (wm * (mx * wy - my * wx)), gx, gy, gz, dt);
+    return;
+}
+
+void MPU9250Mahony::updateIMU(float ax, float ay, float az, float gx, float gy, float gz, float dt)
+{
+    float q1 = _q[0], q2 = _q[1], q3 = _q[2], q4 = _q[3];
+    float norm;
+    float vx, vy, vz;
+
+    norm = (ax * ax) + (ay * ay) + (az * az);
+    if (norm == 0.0f) return; // handle NaN
+    norm = MPU9250Rsqrt(norm);
+    norm *= MPU9250Fusion::weight((ax * ax) + (ay * ay) + (az * az), norm, _gravity, _accelBand);
+    ax *= norm;
+    ay *= norm;
+    az *= norm;
+
+    // Estimated direction of gravity
+    vx = 2.0f * ((q2 * q4) - (q1 * q3));
+    vy = 2.0f * ((q1 * q2) + (q3 * q4));
+    vz = (q1 * q1) - (q2 * q2) - (q3 * q3) + (q4 * q4);
+
+    MPU9250Mahony::step((ay * vz) - (az * vy), (az * vx) - (ax * vz), (ax * vy) - (ay * vx), gx, gy, gz, dt);
+    return;
+}
+
+void MPU9250Mahony::step(float ex, float ey, float ez, float gx, float gy, float gz, float dt)
+{
+    float q1 = _q[0], q2 = _q[1], q3 = _q[2], q4 = _q[3];
+    float pa, pb, pc;
+
+    if (_ki > 0.0f) {
+        _eInt[0] += ex;      // accumulate integral error
+        _eInt[1] += ey;
+        _eInt[2] += ez;
+    } else {
+        _eInt[0] = 0.0f;     // prevent integral wind up
+        _eInt[1] = 0.0f;
+        _eInt[2] = 0.0f;
+    }
+
+    // Apply feedback terms
+    gx = gx + _kp * ex + _ki * _eInt[0];
+    gy = gy + _kp * ey + _ki * _eInt[1];
+    gz = gz + _kp * ez + _ki * _eInt[2];
+
+    // Integrate rate of change of quaternion
+    pa = q2;
+    pb = q3;
+    pc = q4;
+    q1 = q1 + (-q2 * gx - q3 * gy - q4 * gz) * (0.5f * dt);
+    q2 = pa + (q1 * gx + pb * gz - pc * gy) * (0.5f * dt);
+    q3 = pb + (q1 * gy - pa * gz + pc * gx) * (0.5f * dt);
+    q4 = pc + (q1 * gz + pa * gy - pb * gx) * (0.5f * dt);
+
+    MPU9250Fusion::normalise(q1, q2, q3, q4);
+    return;
+}
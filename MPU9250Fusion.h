@@ -0,0 +1,192 @@
+/* 
+ * @file    MPU9250Fusion.h
+ * @brief   Device driver - MPU9250 orientation fusion filters
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_FUSION_H
+#define MPU9250_FUSION_H
+ 
+#include <stdint.h>
+#include "MPU9250Math.h"
+
+/**
+ *  @class MPU9250Fusion
+ *  @brief Quaternion orientation filter, common part
+ *
+ *  Accel and mag may be in any units, they are normalised; gyro is in rad/s and
+ *  the interval in seconds. The quaternion is w, x, y, z. All square roots and
+ *  trigonometry use MPU9250Math.
+ */ 
+class MPU9250Fusion {
+
+public:
+
+    MPU9250Fusion();
+
+    virtual ~MPU9250Fusion() {}
+
+    /** 9 axis update
+     *  @param ax, ay, az - accelerometer
+     *  @param gx, gy, gz - gyro, rad/s
+     *  @param mx, my, mz - magnetometer
+     *  @param dt - time since the last update, s
+     */
+    virtual void update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float dt) = 0;
+
+    /** 6 axis update, no magnetometer, yaw drifts with the gyro
+     *  @param ax, ay, az - accelerometer
+     *  @param gx, gy, gz - gyro, rad/s
+     *  @param dt - time since the last update, s
+     */
+    virtual void updateIMU(float ax, float ay, float az, float gx, float gy, float gz, float dt) = 0;
+
+    /** Current orientation
+     *  @return pointer to 4 floats, w, x, y, z
+     */
+    const float * quaternion(void);
+
+    /** Set the orientation, e.g. from an accel/mag estimate at start up
+     *  @param q - 4 floats, w, x, y, z
+     */
+    void setQuaternion(const float * q);
+
+    /** Current orientation as Euler angles
+     *  @param yaw - yaw in degrees
+     *  @param pitch - pitch in degrees
+     *  @param roll - roll in degrees
+     */
+    void euler(float * yaw, float * pitch, float * roll);
+
+    /** Gate the corrections on how trustworthy each measurement looks
+     *  The accel correction is weighted by how close |a| is to 1 g and the mag
+     *  correction by how close |m| is to the local field, falling linearly from 1 at
+     *  the reference to 0 at the edge of the band. Under linear acceleration or near
+     *  iron the filter then runs on the gyro, so a faster base gain can be used.
+     *  @param gravity - 1 g in accelerometer units, 0 disables accel gating
+     *  @param accelBand - deviation from 1 g giving zero weight, fraction, e.g. 0.15
+     *  @param field - local field in magnetometer units, 0 disables mag gating
+     *  @param fieldBand - deviation from the field giving zero weight, fraction, e.g. 0.2
+     */
+    void setAdaptive(float gravity, float accelBand, float field, float fieldBand);
+
+protected:
+
+    float                   _q[4];
+    float                   _gravity;
+    float                   _accelBand;         // reciprocal of gravity * band
+    float                   _field;
+    float                   _fieldBand;
+
+    /** Correction weight for a measurement
+     *  @param norm2 - squared magnitude of the measurement
+     *  @param inv - 1 / magnitude, already computed for normalisation
+     *  @param ref - reference magnitude, 0 for no gating
+     *  @param band - 1 / (reference * band)
+     *  @return weight 0 to 1
+     */
+    float weight(float norm2, float inv, float ref, float band)
+    {
+        float w;
+
+        if (ref == 0.0f) {
+            return 1.0f;
+        }
+        w = (norm2 * inv) - ref;
+        w = 1.0f - (((w < 0.0f) ? -w : w) * band);
+        return (w > 0.0f) ? w : 0.0f;
+    }
+
+    /** Normalise and store the integrated quaternion
+     */
+    void normalise(float q1, float q2, float q3, float q4);
+
+};
+
+/**
+ *  @class MPU9250Madgwick
+ *  @brief Madgwick gradient descent filter, with gyro bias drift compensation by zeta
+ */ 
+class MPU9250Madgwick : public MPU9250Fusion {
+
+public:
+
+    /** Create the filter
+     *  @param beta - gyro measurement error gain, sqrt(3/4) * error in rad/s
+     *  @param zeta - gyro drift gain, sqrt(3/4) * drift in rad/s/s, 0 disables bias compensation
+     */
+    MPU9250Madgwick(float beta = 0.9068997f, float zeta = 0.0151150f);
+
+    /** Change the gains
+     *  @param beta - gyro measurement error gain
+     *  @param zeta - gyro drift gain
+     */
+    void setGains(float beta, float zeta);
+
+    virtual void update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float dt);
+
+    virtual void updateIMU(float ax, float ay, float az, float gx, float gy, float gz, float dt);
+
+private:
+
+    float                   _beta;
+    float                   _zeta;
+    float                   _bias[3];           // estimated gyro bias, rad/s
+
+    /** Apply a normalised gradient step scaled by the correction weight and integrate
+     */
+    void step(float s1, float s2, float s3, float s4, float w, float gx, float gy, float gz, float dt);
+
+};
+
+/**
+ *  @class MPU9250Mahony
+ *  @brief Mahony complementary filter, proportional and integral feedback on the reference vector error
+ */ 
+class MPU9250Mahony : public MPU9250Fusion {
+
+public:
+
+    /** Create the filter
+     *  @param kp - proportional gain
+     *  @param ki - integral gain, 0 disables the integral term
+     */
+    MPU9250Mahony(float kp = 10.0f, float ki = 0.0f);
+
+    /** Change the gains
+     *  @param kp - proportional gain
+     *  @param ki - integral gain
+     */
+    void setGains(float kp, float ki);
+
+    virtual void update(float ax, float ay, float az, float gx, float gy, float gz, float mx, float my, float mz, float dt);
+
+    virtual void updateIMU(float ax, float ay, float az, float gx, float gy, float gz, float dt);
+
+private:
+
+    float                   _kp;
+    float                   _ki;
+    float                   _eInt[3];
+
+    /** Apply feedback on the error and integrate
+     */
+    void step(float ex, float ey, float ez, float gx, float gy, float gz, float dt);
+
+};
+
+#endif
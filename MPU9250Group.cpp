@@ -0,0 +1,120 @@
+/* 
+ * @file    MPU9250Group.cpp
+ * @brief   Device driver - MPU9250 devices sharing an interrupt line
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250Group.h"
+
+MPU9250Group::MPU9250Group(InterruptIn * line)
+{
+    _count = 0;
+    _line = line;
+    _edges = 0;
+    _edgesSeen = 0;
+    _held = true;
+    _found = us_ticker_read();
+    _timeout = 0xFFFFFFFF;
+    memset(&_stats, 0, sizeof(_stats));
+
+    return;
+}
+
+uint8_t MPU9250Group::add(MPU9250 * imu)
+{
+    if (_count >= MPU_GROUP_MAX) {
+        return 1;
+    }
+    _imu[_count] = imu;
+    // long enough ago that the first dispatch reads its sample with the status
+    _fired[_count] = us_ticker_read() - 0x7FFFFFFF;
+    _count++;
+    return imu->setInterruptPin(MPU_INT_ACTL | MPU_INT_OD);
+}
+
+void MPU9250Group::edge(void)
+{
+    _edges = _edges + 1;
+    return;
+}
+
+bool MPU9250Group::pending(void) const
+{
+    return (_edges != _edgesSeen) || _held || ((us_ticker_read() - _found) > _timeout);
+}
+
+uint8_t MPU9250Group::dispatch(uint8_t * fired)
+{
+    uint8_t serviced = 0;
+    uint8_t result = 0;
+    uint8_t found;
+    uint8_t status;
+    uint8_t pass;
+    uint32_t period;
+    uint32_t longest = 0;
+    bool skipped;
+
+    if ((_edges == _edgesSeen) && !_held && ((us_ticker_read() - _found) > _timeout)) {
+        _stats.timeouts++;
+    }
+    // edges from here on may be for devices already passed, so they dispatch again
+    _edgesSeen = _edges;
+    _stats.dispatches++;
+    for (pass = 0; pass < MPU_GROUP_PASSES; pass++) {
+        found = 0;
+        skipped = false;
+        for (uint8_t i = 0; i < _count; i++) {
+            // the first pass only reads devices due to have fired, status and sample together
+            period = 1000000 / _imu[i]->getSampleRate();
+            longest = (period > longest) ? period : longest;
+            if ((pass == 0) && ((us_ticker_read() - _fired[i]) < (period - (period / 4)))) {
+                skipped = true;
+                continue;
+            }
+            result |= _imu[i]->publishIfReady(&status, pass == 0);
+            if (pass == 0) {
+                _stats.bursts++;
+            } else {
+                _stats.statusReads++;
+            }
+            if (status & MPU_RAW_DATA_RDY_INT) {
+                found |= (uint8_t)(1 << i);
+                _fired[i] = us_ticker_read();
+                _found = _fired[i];
+                _stats.serviced++;
+            }
+        }
+        _stats.passes++;
+        serviced |= found;
+        // every INT released at once, so the next device to latch makes an edge
+        if ((_line != NULL) ? (_line->read() != 0) : ((found == 0) && !skipped)) {
+            break;
+        }
+    }
+    _held = (pass == MPU_GROUP_PASSES);
+    _timeout = (longest > 0) ? (2 * longest) : 0xFFFFFFFF;
+    if (_held) {
+        _stats.unfinished++;
+    }
+    if (serviced == 0) {
+        _stats.spurious++;
+    }
+    if (fired != NULL) {
+        *fired = serviced;
+    }
+    return result;
+}
@@ -0,0 +1,121 @@
+/* 
+ * @file    MPU9250Group.h
+ * @brief   Device driver - MPU9250 devices sharing an interrupt line
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_GROUP_H
+#define MPU9250_GROUP_H
+ 
+#include "mbed.h"
+#include "MPU9250.h"
+
+#define MPU_GROUP_MAX 8         // devices sharing one interrupt line
+#define MPU_GROUP_PASSES 4      // passes over the group per dispatch before leaving it pending
+
+/**
+ *  @struct MPU9250GroupStats
+ *  @brief Dispatch counts since the group was created
+ */
+struct MPU9250GroupStats {
+    uint32_t    dispatches;     // calls to dispatch
+    uint32_t    passes;         // passes over the group
+    uint32_t    bursts;         // INT_STATUS read with the sample, on the first pass
+    uint32_t    statusReads;    // INT_STATUS read alone, on later passes
+    uint32_t    serviced;       // samples published
+    uint32_t    spurious;       // dispatches that found no device with data ready
+    uint32_t    unfinished;     // dispatches that ran out of passes with the line still held
+    uint32_t    timeouts;       // dispatches pending because no device had fired for too long
+};
+
+/**
+ *  @class MPU9250Group
+ *  @brief Devices sharing one open drain, active low interrupt line, and its dispatcher
+ *
+ *  Adding a device switches its INT pin to open drain, active low, so the line is a
+ *  wired-OR with one pull-up and one MCU pin however many devices are on it. The
+ *  line's falling edge handler calls edge and the main loop calls dispatch while
+ *  pending, which reads INT_STATUS and publishes only the devices that raised
+ *  data ready. The first pass reads just the devices most of a sample period on
+ *  from when they last fired, their status in the same burst as the sample; any
+ *  pass after it reads every device's status byte alone, and the sample only if
+ *  it fired.
+ *
+ *  The latched INT pins hold the line low until each is read, so a device latching
+ *  behind the scan while a later one still holds the line makes no edge of its own.
+ *  dispatch therefore passes over the group again until the line reads high, or,
+ *  without a line to read, until a pass finds no device with data ready. A reset
+ *  device holds the line low with no data ready to find until it is recovered, so
+ *  the group is also pending once no device has fired for two of the slowest
+ *  device's sample periods, and is polled until the health checks recover it.
+ */ 
+class MPU9250Group {
+
+public:
+
+    /** Create an empty group
+     *  @param line - the shared interrupt input, read to end dispatch early. Default NULL
+     *  to confirm with an extra pass of status reads instead
+     *
+     *  The first dispatch is pending from the start, for devices that latched data ready
+     *  before the line's fall handler was attached.
+     */
+    MPU9250Group(InterruptIn * line = NULL);
+
+    /** Add a device and set its INT pin open drain, active low
+     *  @param imu - the device, must stay in scope while in the group
+     *  @return status of command: 0 = good, 1 = group full, else bus error
+     */
+    uint8_t add(MPU9250 * imu);
+
+    /** Note a falling edge on the line, from its interrupt handler
+     */
+    void edge(void);
+
+    /** Whether an edge has come since the last dispatch, it left the line held, or no
+     *  device has fired for too long
+     *  @return true if dispatch should be called
+     */
+    bool pending(void) const;
+
+    /** Publish every device that has raised data ready
+     *  @param fired - bit per device, in the order added, set for those published. May be NULL
+     *  @return status of command: 0 = good, else bus error from a device
+     */
+    uint8_t dispatch(uint8_t * fired = NULL);
+
+    /** Dispatch counts
+     *  @return the counts
+     */
+    const MPU9250GroupStats & stats(void) const { return _stats; }
+
+private:
+
+    MPU9250                 *_imu[MPU_GROUP_MAX];
+    uint8_t                 _count;
+    InterruptIn             *_line;
+    uint32_t                _fired[MPU_GROUP_MAX];  // us_ticker_read when each last had data ready
+    volatile uint32_t       _edges;         // written by the edge handler only
+    uint32_t                _edgesSeen;
+    bool                    _held;          // the last dispatch ran out of passes
+    uint32_t                _found;         // us_ticker_read when a device last had data ready
+    uint32_t                _timeout;       // us with none before the group is polled
+    MPU9250GroupStats       _stats;
+
+};
+
+#endif
@@ -0,0 +1,136 @@
+/* 
+ * @file    MPU9250Heading.cpp
+ * @brief   Device driver - MPU9250 tilt compensated compass heading
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250Heading.h"
+
+#define MPU_HEADING_LEARN 50    // updates averaged for a learnt reference
+
+MPU9250Heading::MPU9250Heading(float declination, float gain)
+{
+    _declination = declination;
+    _gain = gain;
+    _heading = 0.0f;
+    _field = 0.0f;
+    _dip = 0.0f;
+    _fieldTol = 0.1f;
+    _dipTol = 5.0f;
+    _learn = 0;
+    _valid = false;
+    _disturbed = false;
+
+    return;
+}
+
+void MPU9250Heading::setDeclination(float declination)
+{
+    _declination = declination;
+    return;
+}
+
+void MPU9250Heading::setReference(float field, float dip)
+{
+    _field = field;
+    _dip = dip;
+    _learn = (field > 0.0f) ? MPU_HEADING_LEARN : 0;
+    return;
+}
+
+void MPU9250Heading::setTolerance(float field, float dip)
+{
+    _fieldTol = field;
+    _dipTol = dip;
+    return;
+}
+
+float MPU9250Heading::update(const float * accel, const float * gyro, const float * mag, float dt)
+{
+    float u[3];
+    float e[3];
+    float norm;
+    float field;
+    float dip;
+    float err;
+    float h;
+
+    norm = (accel[0] * accel[0]) + (accel[1] * accel[1]) + (accel[2] * accel[2]);
+    if (norm == 0.0f) {
+        return MPU9250Heading::heading();
+    }
+    norm = MPU9250Rsqrt(norm);
+    u[0] = accel[0] * norm;
+    u[1] = accel[1] * norm;
+    u[2] = accel[2] * norm;
+
+    // carry the heading on the gyro rate about up, clockwise from above is positive heading
+    if ((gyro != NULL) && _valid) {
+        _heading -= ((gyro[0] * u[0]) + (gyro[1] * u[1]) + (gyro[2] * u[2])) * dt * MPU_RAD2DEG;
+    }
+
+    field = MPU9250Sqrt((mag[0] * mag[0]) + (mag[1] * mag[1]) + (mag[2] * mag[2]));
+    if (field == 0.0f) {
+        _disturbed = true;
+        return MPU9250Heading::heading();
+    }
+    dip = MPU9250Asin(-((mag[0] * u[0]) + (mag[1] * u[1]) + (mag[2] * u[2])) / field) * MPU_RAD2DEG;
+    if (_learn < MPU_HEADING_LEARN) {
+        // no reference given, average the first updates
+        _learn++;
+        _field += (field - _field) / _learn;
+        _dip += (dip - _dip) / _learn;
+        _disturbed = false;
+    } else {
+        _disturbed = ((field > (_field * (1.0f + _fieldTol))) || (field < (_field * (1.0f - _fieldTol))) ||
+                      (dip > (_dip + _dipTol)) || (dip < (_dip - _dipTol)));
+    }
+
+    if (!_disturbed) {
+        // east = mag x up, north = up x east, heading of the x axis
+        e[0] = (mag[1] * u[2]) - (mag[2] * u[1]);
+        e[1] = (mag[2] * u[0]) - (mag[0] * u[2]);
+        e[2] = (mag[0] * u[1]) - (mag[1] * u[0]);
+        h = MPU9250Atan2(e[0], (u[1] * e[2]) - (u[2] * e[1])) * MPU_RAD2DEG;
+        if (!_valid || (gyro == NULL)) {
+            _heading = h;
+            _valid = true;
+        } else {
+            err = h - _heading;
+            err -= 360.0f * (float)(int32_t)((err + ((err < 0.0f) ? -180.0f : 180.0f)) / 360.0f);
+            _heading += _gain * err;
+        }
+    }
+    return MPU9250Heading::heading();
+}
+
+float MPU9250Heading::heading(void)
+{
+    float h = _heading + _declination;
+
+    // wrap to 0..360, the gyro may have carried it round more than once
+    h -= 360.0f * (float)(int32_t)(h / 360.0f);
+    if (h < 0.0f) {
+        h += 360.0f;
+    }
+    return h;
+}
+
+bool MPU9250Heading::disturbed(void)
+{
+    return _disturbed;
+}
@@ -0,0 +1,101 @@
+/* 
+ * @file    MPU9250Heading.h
+ * @brief   Device driver - MPU9250 tilt compensated compass heading
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_HEADING_H
+#define MPU9250_HEADING_H
+ 
+#include <stdint.h>
+#include "MPU9250Math.h"
+
+/**
+ *  @class MPU9250Heading
+ *  @brief Tilt compensated heading without full orientation fusion
+ *
+ *  East is mag x up and north is up x east, both in the sensor frame, so the heading
+ *  of the sensor x axis is one atan2 with no sines or cosines. The magnetometer must
+ *  be calibrated and in the accelerometer frame; for the AK8963 inside the MPU9250
+ *  pass (my, mx, -mz) of readMagData.
+ *
+ *  The field is judged disturbed when its magnitude or dip angle leaves the tolerance
+ *  around the reference. While disturbed, or between corrections, the heading is
+ *  carried on the gyro rate about the up axis.
+ */ 
+class MPU9250Heading {
+
+public:
+
+    /** Create the heading engine
+     *  @param declination - magnetic declination in degrees, east positive
+     *  @param gain - fraction of the magnetic heading error corrected per update, 1 uses the magnetometer alone
+     */
+    MPU9250Heading(float declination = 0.0f, float gain = 0.05f);
+
+    /** Set the magnetic declination
+     *  @param declination - degrees, east positive
+     */
+    void setDeclination(float declination);
+
+    /** Set the expected local field
+     *  @param field - field magnitude in magnetometer units, 0 to learn it from the first updates
+     *  @param dip - dip angle in degrees, down positive
+     */
+    void setReference(float field, float dip);
+
+    /** Set the disturbance limits
+     *  @param field - allowed magnitude error, fraction of the reference
+     *  @param dip - allowed dip error in degrees
+     */
+    void setTolerance(float field, float dip);
+
+    /** Add a measurement
+     *  @param accel - 3 accelerometer values, any units
+     *  @param gyro - 3 gyro values in rad/s, NULL if there is no gyro
+     *  @param mag - 3 calibrated magnetometer values in the accelerometer frame
+     *  @param dt - time since the last update, s
+     *  @return heading in degrees, 0 to 360 from true north
+     */
+    float update(const float * accel, const float * gyro, const float * mag, float dt);
+
+    /** Current heading
+     *  @return heading in degrees, 0 to 360 from true north
+     */
+    float heading(void);
+
+    /** Test for a magnetic disturbance
+     *  @return true while the last measurement was rejected
+     */
+    bool disturbed(void);
+
+private:
+
+    float                   _declination;
+    float                   _gain;
+    float                   _heading;       // degrees, magnetic
+    float                   _field;         // reference magnitude
+    float                   _dip;           // reference dip, degrees
+    float                   _fieldTol;
+    float                   _dipTol;
+    uint16_t                _learn;         // updates used to learn the reference
+    bool                    _valid;
+    bool                    _disturbed;
+
+};
+
+#endif
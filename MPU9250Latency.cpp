@@ -0,0 +1,233 @@
+/* 
+ * @file    MPU9250Latency.cpp
+ * @brief   Device driver - MPU9250 data ready to output latency
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250Latency.h"
+#include <string.h>
+#include <math.h>
+
+MPU9250Latency::MPU9250Latency(MPU9250LatencyRecord * trace, uint16_t size)
+{
+    _trace = (size > 0) ? trace : NULL;
+    _traceMask = (size > 0) ? (size - 1) : 0;
+    _edge = 0;
+    _edges = 0;
+    _edgesSeen = 0;
+    MPU9250Latency::reset();
+
+    return;
+}
+
+void MPU9250Latency::edge(void)
+{
+    _edge = us_ticker_read();
+    // stamp written before the count tells begin there is one
+    __DMB();
+    _edges = _edges + 1;
+    return;
+}
+
+void MPU9250Latency::begin(uint32_t seq)
+{
+    MPU9250LatencyRecord *r = &_pending[seq & (MPU_LAT_PENDING - 1)];
+    uint32_t now = us_ticker_read();
+    uint32_t edges;
+    uint32_t stamp;
+
+    // an edge may arrive while the stamp is read, read again until the count holds
+    do {
+        edges = _edges;
+        __DMB();
+        stamp = _edge;
+        __DMB();
+    } while (edges != _edges);
+
+    r->seq = seq;
+    r->flags = MPU_LAT_OPEN;
+    if (edges == _edgesSeen) {
+        r->flags |= MPU_LAT_POLLED;
+        stamp = now;
+    } else if ((edges - _edgesSeen) > 1) {
+        _skipped += edges - _edgesSeen - 1;
+    }
+    _edgesSeen = edges;
+    for (uint8_t i = 0; i < MPU_LAT_STAMPS; i++) {
+        r->stamp[i] = stamp;
+    }
+    return;
+}
+
+void MPU9250Latency::stamp(uint32_t seq, uint8_t stage)
+{
+    MPU9250LatencyRecord *r = &_pending[seq & (MPU_LAT_PENDING - 1)];
+
+    uint32_t now = us_ticker_read();
+
+    if ((stage > MPU_LAT_EDGE) && (stage < MPU_LAT_FUSION) && (r->seq == seq) && (r->flags & MPU_LAT_OPEN)) {
+        // carried on through the later stages, so one that is never stamped takes 0 us
+        for (uint8_t i = stage; i < MPU_LAT_FUSION; i++) {
+            r->stamp[i] = now;
+        }
+    }
+    return;
+}
+
+bool MPU9250Latency::fused(uint32_t seq)
+{
+    MPU9250LatencyRecord *r = &_pending[seq & (MPU_LAT_PENDING - 1)];
+    uint8_t i;
+
+    if ((r->seq != seq) || !(r->flags & MPU_LAT_OPEN)) {
+        _missed++;
+        return false;
+    }
+    r->stamp[MPU_LAT_FUSION] = us_ticker_read();
+    r->flags &= ~MPU_LAT_OPEN;
+    // unsigned differences, so a ticker wrap between stamps is harmless
+    for (i = MPU_LAT_TRANSFER; i <= MPU_LAT_FUSION; i++) {
+        MPU9250Latency::add(i, r->stamp[i] - r->stamp[i - 1]);
+    }
+    MPU9250Latency::add(MPU_LAT_TOTAL, r->stamp[MPU_LAT_FUSION] - r->stamp[MPU_LAT_EDGE]);
+
+    if (_trace != NULL) {
+        _trace[_traceHead & _traceMask] = *r;
+        _traceHead++;
+        if (_traceCount <= _traceMask) {
+            _traceCount++;
+        }
+    }
+    return true;
+}
+
+void MPU9250Latency::stats(uint8_t stage, MPU9250LatencyStats * stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if ((stage >= MPU_LAT_STAMPS) || (_count[stage] == 0)) {
+        return;
+    }
+    stats->count = _count[stage];
+    stats->min = _min[stage];
+    stats->max = _max[stage];
+    stats->mean = (uint32_t)(_sum[stage] / _count[stage]);
+    stats->p50 = MPU9250Latency::percentile(stage, 50.0f);
+    stats->p90 = MPU9250Latency::percentile(stage, 90.0f);
+    stats->p99 = MPU9250Latency::percentile(stage, 99.0f);
+    stats->p999 = MPU9250Latency::percentile(stage, 99.9f);
+    return;
+}
+
+uint32_t MPU9250Latency::percentile(uint8_t stage, float percent)
+{
+    uint32_t target;
+    uint32_t total = 0;
+    uint32_t us;
+    uint8_t i;
+
+    if ((stage >= MPU_LAT_STAMPS) || (_count[stage] == 0)) {
+        return 0;
+    }
+    // rank of the sample at the percentile, at least the first
+    target = (uint32_t)ceilf((float)_count[stage] * percent / 100.0f);
+    target = (target == 0) ? 1 : target;
+    for (i = 0; i < MPU_LAT_BUCKETS; i++) {
+        total += _hist[stage][i];
+        if (total >= target) {
+            break;
+        }
+    }
+    us = MPU9250Latency::upper((i < MPU_LAT_BUCKETS) ? i : (MPU_LAT_BUCKETS - 1));
+    return (us > _max[stage]) ? _max[stage] : us;
+}
+
+bool MPU9250Latency::trace(uint16_t index, MPU9250LatencyRecord * record)
+{
+    if ((_trace == NULL) || (index >= _traceCount)) {
+        return false;
+    }
+    *record = _trace[(uint16_t)(_traceHead - _traceCount + index) & _traceMask];
+    return true;
+}
+
+uint16_t MPU9250Latency::traced(void)
+{
+    return _traceCount;
+}
+
+uint32_t MPU9250Latency::missed(void)
+{
+    return _missed;
+}
+
+uint32_t MPU9250Latency::skipped(void)
+{
+    return _skipped;
+}
+
+void MPU9250Latency::reset(void)
+{
+    memset(_pending, 0, sizeof(_pending));
+    memset(_hist, 0, sizeof(_hist));
+    memset(_count, 0, sizeof(_count));
+    memset(_max, 0, sizeof(_max));
+    memset(_sum, 0, sizeof(_sum));
+    memset(_min, 0xFF, sizeof(_min));
+    _traceHead = 0;
+    _traceCount = 0;
+    _missed = 0;
+    _skipped = 0;
+    return;
+}
+
+void MPU9250Latency::add(uint8_t stage, uint32_t us)
+{
+    _hist[stage][MPU9250Latency::bucket(us)]++;
+    _count[stage]++;
+    _sum[stage] += us;
+    _min[stage] = (us < _min[stage]) ? us : _min[stage];
+    _max[stage] = (us > _max[stage]) ? us : _max[stage];
+    return;
+}
+
+uint8_t MPU9250Latency::bucket(uint32_t us)
+{
+    uint32_t v = us;
+    uint8_t msb = 0;
+    uint32_t index;
+
+    // 0 to 7 us exactly, then the top four bits: octave and one of 8 steps within it
+    if (us < 8) {
+        return (uint8_t)us;
+    }
+    while (v >>= 1) {
+        msb++;
+    }
+    index = (8 * (uint32_t)(msb - 2)) + ((us >> (msb - 3)) & 7);
+    return (uint8_t)((index < MPU_LAT_BUCKETS) ? index : (MPU_LAT_BUCKETS - 1));
+}
+
+uint32_t MPU9250Latency::upper(uint8_t bucket)
+{
+    uint8_t shift;
+
+    if (bucket < 8) {
+        return bucket;
+    }
+    shift = (bucket / 8) - 1;
+    return ((uint32_t)(8 + (bucket & 7) + 1) << shift) - 1;
+}
@@ -0,0 +1,197 @@
+/* 
+ * @file    MPU9250Latency.h
+ * @brief   Device driver - MPU9250 data ready to output latency
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_LATENCY_H
+#define MPU9250_LATENCY_H
+ 
+#include "mbed.h"
+
+//  Stamps taken along the path of a sample, and the stage ending at each
+#define MPU_LAT_EDGE 0          // data ready interrupt edge
+#define MPU_LAT_TRANSFER 1      // bus transfers complete
+#define MPU_LAT_DECODE 2        // raw counts decoded
+#define MPU_LAT_CALIBRATE 3     // calibration applied
+#define MPU_LAT_FUSION 4        // orientation updated by the application
+#define MPU_LAT_STAMPS 5
+#define MPU_LAT_TOTAL 0         // histogram of edge to fusion, shares the edge index
+
+#define MPU_LAT_PENDING 16      // samples in flight between publish and fusion, power of 2
+#define MPU_LAT_BUCKETS 144     // 8 per octave up to 1 s
+
+#define MPU_LAT_OPEN 0x01       // record flags, stamped by publish and not yet fused
+#define MPU_LAT_POLLED 0x02     // no edge was seen, the edge stamp is the start of publish
+
+/**
+ *  @struct MPU9250LatencyRecord
+ *  @brief The stamps of one sample, us_ticker_read values in us
+ */
+struct MPU9250LatencyRecord {
+    uint32_t    seq;                        // MPU9250Sample::seq
+    uint32_t    stamp[MPU_LAT_STAMPS];      // indexed by MPU_LAT_EDGE .. MPU_LAT_FUSION
+    uint8_t     flags;
+};
+
+/**
+ *  @struct MPU9250LatencyStats
+ *  @brief Summary of one stage, in us
+ */
+struct MPU9250LatencyStats {
+    uint32_t    count;
+    uint32_t    min;
+    uint32_t    max;
+    uint32_t    mean;
+    uint32_t    p50;
+    uint32_t    p90;
+    uint32_t    p99;
+    uint32_t    p999;
+};
+
+/**
+ *  @class MPU9250Latency
+ *  @brief Motion to output latency, from the data ready edge to the fused orientation
+ *
+ *  The data ready interrupt handler calls edge. MPU9250::publish, given the object
+ *  with setLatency, stamps each sample as its transfers, decode and calibration
+ *  complete, and the application calls fused with the sample's seq once its filter
+ *  has taken the sample. Each stage, the time from the previous stamp, and the edge
+ *  to fusion total go into log-linear histograms with 8 buckets per octave, so
+ *  percentiles are within 12.5%, and every fused record into the trace.
+ *  The trace storage is provided by the caller; the histograms take 2880 bytes.
+ *
+ *  Stamps use us_ticker_read, which in the host simulation is simulated time: there
+ *  only bus transfers and delays take time, so decode and calibration read 0 us.
+ */ 
+class MPU9250Latency {
+
+public:
+
+    /** Create the instrumentation
+     *  @param trace - storage for the most recent records, may be NULL
+     *  @param size - number of records in trace, must be a power of 2
+     */
+    MPU9250Latency(MPU9250LatencyRecord * trace = NULL, uint16_t size = 0);
+
+    /** Stamp the data ready edge, call from the interrupt handler
+     */
+    void edge(void);
+
+    /** Open a record for a sample, the edge stamp is the latest edge
+     *  @param seq - sample number
+     */
+    void begin(uint32_t seq);
+
+    /** Stamp the end of a stage
+     *  @param seq - sample number, as given to begin
+     *  @param stage - MPU_LAT_TRANSFER, MPU_LAT_DECODE or MPU_LAT_CALIBRATE
+     */
+    void stamp(uint32_t seq, uint8_t stage);
+
+    /** Stamp the fused output and account the sample
+     *  @param seq - sample number, from MPU9250Sample::seq
+     *  @return false if the record was no longer in flight
+     */
+    bool fused(uint32_t seq);
+
+    /** Summary of a stage
+     *  @param stage - MPU_LAT_TRANSFER .. MPU_LAT_FUSION for the stage ending there, MPU_LAT_TOTAL for edge to fusion
+     *  @param stats - filled in
+     */
+    void stats(uint8_t stage, MPU9250LatencyStats * stats);
+
+    /** Latency not exceeded by a percentage of samples
+     *  The upper edge of the histogram bucket holding the percentile, capped at the maximum seen.
+     *  @param stage - as for stats
+     *  @param percent - e.g. 99.9
+     *  @return latency in us, 0 if nothing has been measured
+     */
+    uint32_t percentile(uint8_t stage, float percent);
+
+    /** Get a record from the trace
+     *  @param index - 0 for the oldest held
+     *  @param record - the record
+     *  @return false if index is beyond the records held
+     */
+    bool trace(uint16_t index, MPU9250LatencyRecord * record);
+
+    /** Number of records in the trace
+     *  @return records held, at most the trace size
+     */
+    uint16_t traced(void);
+
+    /** Samples whose record was overwritten before fused was called
+     *  @return count
+     */
+    uint32_t missed(void);
+
+    /** Edges with no publish between them, so a sample was not read
+     *  @return count
+     */
+    uint32_t skipped(void);
+
+    /** Clear the histograms, counts and trace
+     */
+    void reset(void);
+
+private:
+
+    MPU9250LatencyRecord    _pending[MPU_LAT_PENDING];
+    MPU9250LatencyRecord    *_trace;
+    uint16_t                _traceMask;
+    uint16_t                _traceHead;
+    uint16_t                _traceCount;
+    volatile uint32_t       _edge;          // written by the interrupt handler only
+    volatile uint32_t       _edges;
+    uint32_t                _edgesSeen;
+    uint32_t                _missed;
+    uint32_t                _skipped;
+    uint32_t                _hist[MPU_LAT_STAMPS][MPU_LAT_BUCKETS];
+    uint32_t                _count[MPU_LAT_STAMPS];
+    uint32_t                _min[MPU_LAT_STAMPS];
+    uint32_t                _max[MPU_LAT_STAMPS];
+    uint64_t                _sum[MPU_LAT_STAMPS];
+
+    void add(uint8_t stage, uint32_t us);
+
+    static uint8_t bucket(uint32_t us);
+
+    static uint32_t upper(uint8_t bucket);
+
+};
+
+/**
+ *  @class MPU9250LatencyTrace
+ *  @brief Latency instrumentation holding its own trace of the last SIZE records
+ */ 
+template <uint16_t SIZE>
+class MPU9250LatencyTrace : public MPU9250Latency {
+
+public:
+
+    MPU9250LatencyTrace() : MPU9250Latency(_storage, SIZE) {}
+
+private:
+
+    typedef char SizeIsPowerOf2[((SIZE > 0) && ((SIZE & (SIZE - 1)) == 0)) ? 1 : -1];
+
+    MPU9250LatencyRecord    _storage[SIZE];
+
+};
+
+#endif
@@ -0,0 +1,139 @@
+/* 
+ * @file    MPU9250Math.h
+ * @brief   Device driver - MPU9250 fast approximate maths for fusion and heading
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Bounded error replacements for the libm calls in the fusion path. The errors
+ * below are the maximum measured over a dense sweep of the whole input range
+ * against double precision libm (tools/mpu9250_bench.cpp, "math").
+ */
+ 
+#ifndef MPU9250_MATH_H
+#define MPU9250_MATH_H
+ 
+#include <stdint.h>
+#include <string.h>
+
+#define MPU_PI 3.14159265358979f
+#define MPU_RAD2DEG 57.2957795131f
+#define MPU_SIN_TABLE 256       // entries per turn in the sine table
+
+extern const float MPU9250SinTable[MPU_SIN_TABLE + 1];
+
+/** Reciprocal square root, bit estimate and two Newton steps
+ *  Max relative error 4.7e-6 for normal x > 0. Returns a large value for x = 0.
+ *  @param x - argument
+ *  @return 1 / sqrt(x)
+ */
+inline float MPU9250Rsqrt(float x)
+{
+    float half = 0.5f * x;
+    float y;
+    uint32_t i;
+
+    memcpy(&i, &x, sizeof(i));
+    i = 0x5F375A86 - (i >> 1);
+    memcpy(&y, &i, sizeof(y));
+    y = y * (1.5f - (half * y * y));
+    y = y * (1.5f - (half * y * y));
+    return y;
+}
+
+/** Square root as x * rsqrt(x)
+ *  Max relative error 4.7e-6, exact 0 at 0.
+ *  @param x - argument, >= 0
+ *  @return sqrt(x)
+ */
+inline float MPU9250Sqrt(float x)
+{
+    return (x > 0.0f) ? (x * MPU9250Rsqrt(x)) : 0.0f;
+}
+
+/** Four quadrant arctangent, octant reduction and a degree 9 odd polynomial
+ *  Max absolute error 1.9e-6 rad. Returns 0 for (0, 0).
+ *  @param y - y coordinate
+ *  @param x - x coordinate
+ *  @return angle in radians, -pi to pi
+ */
+inline float MPU9250Atan2(float y, float x)
+{
+    float ax = (x < 0.0f) ? -x : x;
+    float ay = (y < 0.0f) ? -y : y;
+    float a;
+    float s;
+    float r;
+
+    if ((ax == 0.0f) && (ay == 0.0f)) {
+        return 0.0f;
+    }
+    a = (ax < ay) ? (ax / ay) : (ay / ax);
+    s = a * a;
+    r = a * (0.99997726f + (s * (-0.33262347f + (s * (0.19354346f + (s * (-0.11643287f + (s * (0.05265332f + (s * -0.01172120f))))))))));
+    if (ay > ax) {
+        r = (0.5f * MPU_PI) - r;
+    }
+    if (x < 0.0f) {
+        r = MPU_PI - r;
+    }
+    return (y < 0.0f) ? -r : r;
+}
+
+/** Arcsine, Abramowitz and Stegun 4.4.45 with the fast square root
+ *  Max absolute error 7.5e-5 rad. Input is clamped to -1..1.
+ *  @param x - argument
+ *  @return angle in radians, -pi/2 to pi/2
+ */
+inline float MPU9250Asin(float x)
+{
+    float ax = (x < 0.0f) ? -x : x;
+    float r;
+
+    if (ax > 1.0f) {
+        ax = 1.0f;
+    }
+    r = (0.5f * MPU_PI) - (MPU9250Sqrt(1.0f - ax) * (1.5707288f + (ax * (-0.2121144f + (ax * (0.0742610f + (ax * -0.0187293f)))))));
+    return (x < 0.0f) ? -r : r;
+}
+
+/** Sine and cosine together, table lookup and linear interpolation
+ *  Max absolute error 7.6e-5 for |angle| up to 100 rad. Further out the float angle
+ *  itself runs short of resolution, 1.2e-4 at 1000 rad, so wrap accumulated angles
+ *  before calling. Beyond 5e7 rad the turn count overflows and the result is undefined.
+ *  @param angle - angle in radians, |angle| <= 100 for the stated error
+ *  @param s - sine
+ *  @param c - cosine
+ */
+inline void MPU9250SinCos(float angle, float * s, float * c)
+{
+    float t = angle * (MPU_SIN_TABLE / (2.0f * MPU_PI));
+    float f;
+    int32_t i;
+    uint32_t j;
+
+    i = (int32_t)t;
+    if (t < (float)i) {
+        i--;                        // floor for negative angles
+    }
+    f = t - (float)i;
+    j = (uint32_t)i & (MPU_SIN_TABLE - 1);
+    *s = MPU9250SinTable[j] + (f * (MPU9250SinTable[j + 1] - MPU9250SinTable[j]));
+    // cosine is a quarter turn on
+    j = (j + (MPU_SIN_TABLE / 4)) & (MPU_SIN_TABLE - 1);
+    *c = MPU9250SinTable[j] + (f * (MPU9250SinTable[j + 1] - MPU9250SinTable[j]));
+}
+
+#endif
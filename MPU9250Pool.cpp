@@ -0,0 +1,111 @@
+/* 
+ * @file    MPU9250Pool.cpp
+ * @brief   Device driver - fixed block buffer pool shared by MPU9250 instances
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250Pool.h"
+
+// index of a single set bit, by de Bruijn multiply, so no count leading zeros instruction is needed
+static const uint8_t bitIndex[32] = {
+    0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+    31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+};
+
+MPU9250BufferPool::MPU9250BufferPool(uint8_t * storage, uint16_t blockSize, uint8_t blocks)
+{
+    _storage = storage;
+    _blockSize = blockSize;
+    _stride = (blockSize + 3) & ~3;
+    _blocks = (blocks > MPU_POOL_MAX_BLOCKS) ? MPU_POOL_MAX_BLOCKS : blocks;
+    _free = (_blocks == 32) ? 0xFFFFFFFF : ((1UL << _blocks) - 1);
+    _highWater = 0;
+    _failures = 0;
+
+    return;
+}
+
+uint8_t * MPU9250BufferPool::acquire(void)
+{
+    uint32_t free = _free;
+    uint32_t bit;
+
+    do {
+        if (free == 0) {
+            uint32_t failures = _failures;
+            while (!core_util_atomic_cas_u32(&_failures, &failures, failures + 1)) {
+            }
+            return NULL;
+        }
+        // lowest free block
+        bit = free & (~free + 1);
+    } while (!core_util_atomic_cas_u32(&_free, &free, free & ~bit));
+
+    MPU9250BufferPool::raise(&_highWater, _blocks - MPU9250BufferPool::count(free & ~bit));
+    return &_storage[(uint32_t)bitIndex[(uint32_t)(bit * 0x077CB531UL) >> 27] * _stride];
+}
+
+bool MPU9250BufferPool::release(const void * block)
+{
+    uint32_t offset = (uint32_t)((const uint8_t *)block - _storage);
+    uint32_t free = _free;
+    uint32_t bit;
+
+    if (((const uint8_t *)block < _storage) || ((offset % _stride) != 0) || ((offset / _stride) >= _blocks)) {
+        return false;
+    }
+    bit = 1UL << (offset / _stride);
+    do {
+        if (free & bit) {
+            return false;
+        }
+    } while (!core_util_atomic_cas_u32(&_free, &free, free | bit));
+    return true;
+}
+
+uint8_t MPU9250BufferPool::inUse(void) const
+{
+    return _blocks - MPU9250BufferPool::count(_free);
+}
+
+void MPU9250BufferPool::resetHighWater(void)
+{
+    _highWater = MPU9250BufferPool::inUse();
+    return;
+}
+
+uint8_t MPU9250BufferPool::count(uint32_t bits)
+{
+    // population count, pairs then nibbles then bytes summed by the multiply
+    bits = bits - ((bits >> 1) & 0x55555555UL);
+    bits = (bits & 0x33333333UL) + ((bits >> 2) & 0x33333333UL);
+    bits = (bits + (bits >> 4)) & 0x0F0F0F0FUL;
+    return (uint8_t)((bits * 0x01010101UL) >> 24);
+}
+
+void MPU9250BufferPool::raise(volatile uint32_t * value, uint32_t to)
+{
+    uint32_t now = *value;
+
+    // compare and swap up to the new value, unless another context got there first
+    while (now < to) {
+        if (core_util_atomic_cas_u32(value, &now, to)) {
+            break;
+        }
+    }
+    return;
+}
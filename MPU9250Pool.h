@@ -0,0 +1,124 @@
+/* 
+ * @file    MPU9250Pool.h
+ * @brief   Device driver - fixed block buffer pool shared by MPU9250 instances
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_POOL_H
+#define MPU9250_POOL_H
+ 
+#include "mbed.h"
+
+#define MPU_POOL_MAX_BLOCKS 32  // blocks in one pool, one bit each in the free map
+
+/**
+ *  @class MPU9250BufferPool
+ *  @brief Fixed size blocks borrowed for FIFO drains, captures and recording chunks
+ *
+ *  With several sensors, each one owning worst case buffers makes RAM grow with the
+ *  sensor count; borrowing from one pool makes it follow how many are in use at
+ *  once. Free blocks are bits in one word, taken and given back with a compare and
+ *  swap, so acquire and release are O(1), lock free and safe from interrupts and
+ *  threads alike. The most blocks ever in use at once is kept for sizing the pool.
+ */ 
+class MPU9250BufferPool {
+
+public:
+
+    /** Create a pool over caller storage
+     *  @param storage - blocks * blockSize bytes rounded up to words, word aligned
+     *  @param blockSize - bytes in each block
+     *  @param blocks - number of blocks, at most MPU_POOL_MAX_BLOCKS
+     */
+    MPU9250BufferPool(uint8_t * storage, uint16_t blockSize, uint8_t blocks);
+
+    /** Borrow a block
+     *  @return the block, word aligned, or NULL if none is free
+     */
+    uint8_t * acquire(void);
+
+    /** Give a block back
+     *  @param block - a block from acquire
+     *  @return false if it is not a block of this pool or is already free
+     */
+    bool release(const void * block);
+
+    /** Bytes in each block
+     *  @return block size
+     */
+    uint16_t blockSize(void) const { return _blockSize; }
+
+    /** Blocks in the pool
+     *  @return block count
+     */
+    uint8_t blocks(void) const { return _blocks; }
+
+    /** Blocks borrowed now
+     *  @return block count
+     */
+    uint8_t inUse(void) const;
+
+    /** Most blocks borrowed at once since creation or resetHighWater
+     *  @return block count
+     */
+    uint8_t highWater(void) const { return (uint8_t)_highWater; }
+
+    /** Acquires that found no free block
+     *  @return count
+     */
+    uint32_t failures(void) const { return _failures; }
+
+    /** Start the high water mark again from the blocks in use now
+     */
+    void resetHighWater(void);
+
+private:
+
+    uint8_t                 *_storage;
+    uint16_t                _blockSize;
+    uint16_t                _stride;        // block size rounded up to words
+    uint8_t                 _blocks;
+    volatile uint32_t       _free;          // bit i set while block i is free
+    volatile uint32_t       _highWater;
+    volatile uint32_t       _failures;
+
+    static uint8_t count(uint32_t bits);
+
+    static void raise(volatile uint32_t * value, uint32_t to);
+
+};
+
+/**
+ *  @class MPU9250StaticPool
+ *  @brief A pool holding its own storage, COUNT blocks of BLOCK bytes
+ */ 
+template <uint16_t BLOCK, uint8_t COUNT>
+class MPU9250StaticPool : public MPU9250BufferPool {
+
+public:
+
+    MPU9250StaticPool() : MPU9250BufferPool((uint8_t *)_storage, BLOCK, COUNT) {}
+
+private:
+
+    typedef char CountFitsTheMap[((COUNT > 0) && (COUNT <= MPU_POOL_MAX_BLOCKS)) ? 1 : -1];
+
+    uint32_t                _storage[COUNT][(BLOCK + 3) / 4];
+
+};
+
+#endif
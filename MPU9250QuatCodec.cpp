@@ -0,0 +1,182 @@
+/* 
+ * @file    MPU9250QuatCodec.cpp
+ * @brief   Device driver - MPU9250 compact quaternion encoding
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250QuatCodec.h"
+#include "MPU9250Math.h"
+
+#define MPU_QUAT_RANGE 0.70710678f  // the three smallest lie within +-1/sqrt(2)
+
+MPU9250QuatEncoder::MPU9250QuatEncoder(uint8_t bits, bool delta)
+{
+    _bits = (bits == 12) ? 12 : 10;
+    _delta = delta;
+    MPU9250QuatEncoder::reset();
+
+    return;
+}
+
+void MPU9250QuatEncoder::reset(void)
+{
+    _since = 0;
+    _valid = false;
+    return;
+}
+
+uint8_t MPU9250QuatEncoder::encode(const float * q, uint8_t * out)
+{
+    uint16_t max = (1 << _bits) - 1;
+    uint16_t v[3];
+    int16_t d[3];
+    float sign;
+    float c;
+    uint64_t word;
+    uint8_t index = 0;
+    uint8_t n = 0;
+    uint8_t bytes;
+
+    for (uint8_t i = 1; i < 4; i++) {
+        if (((q[i] < 0.0f) ? -q[i] : q[i]) > ((q[index] < 0.0f) ? -q[index] : q[index])) {
+            index = i;
+        }
+    }
+    // q and -q are the same rotation, keep the dropped one positive
+    sign = (q[index] < 0.0f) ? -1.0f : 1.0f;
+    for (uint8_t i = 0; i < 4; i++) {
+        if (i != index) {
+            c = ((sign * q[i]) + MPU_QUAT_RANGE) * (max / (2.0f * MPU_QUAT_RANGE)) + 0.5f;
+            v[n++] = (c <= 0.0f) ? 0 : ((c >= max) ? max : (uint16_t)c);
+        }
+    }
+
+    if (_delta && _valid && (index == _index) && (_since < MPU_QUAT_KEY_INTERVAL)) {
+        for (n = 0; n < 3; n++) {
+            d[n] = (int16_t)v[n] - (int16_t)_last[n];
+            if ((d[n] < -(1 << (MPU_QUAT_DELTA_BITS - 1))) || (d[n] >= (1 << (MPU_QUAT_DELTA_BITS - 1)))) {
+                break;
+            }
+        }
+        if (n == 3) {
+            word = 0;
+            for (n = 0; n < 3; n++) {
+                word = (word << MPU_QUAT_DELTA_BITS) | ((uint16_t)d[n] & ((1 << MPU_QUAT_DELTA_BITS) - 1));
+                _last[n] = v[n];
+            }
+            out[0] = (uint8_t)(word >> 8);
+            out[1] = (uint8_t)word;
+            _since++;
+            return 2;
+        }
+    }
+
+    word = index;
+    for (n = 0; n < 3; n++) {
+        word = (word << _bits) | v[n];
+        _last[n] = v[n];
+    }
+    _index = index;
+    _valid = true;
+    _since = 0;
+    if (_delta) {
+        // key flag above the index, padded to 5 bytes
+        word |= (uint64_t)1 << (2 + (3 * _bits));
+        bytes = 5;
+        word <<= (40 - (3 + (3 * _bits)));
+    } else {
+        bytes = (_bits == 12) ? 5 : 4;
+        word <<= ((8 * bytes) - (2 + (3 * _bits)));
+    }
+    for (n = 0; n < bytes; n++) {
+        out[n] = (uint8_t)(word >> (8 * (bytes - 1 - n)));
+    }
+    return bytes;
+}
+
+MPU9250QuatDecoder::MPU9250QuatDecoder(uint8_t bits, bool delta)
+{
+    _bits = (bits == 12) ? 12 : 10;
+    _delta = delta;
+    MPU9250QuatDecoder::reset();
+
+    return;
+}
+
+void MPU9250QuatDecoder::reset(void)
+{
+    _valid = false;
+    return;
+}
+
+uint8_t MPU9250QuatDecoder::decode(const uint8_t * in, float * q)
+{
+    uint16_t mask = (1 << _bits) - 1;
+    uint64_t word = 0;
+    uint16_t d;
+    uint8_t bytes;
+
+    if (_delta && !(in[0] & 0x80)) {
+        if (!_valid) {
+            return 0;
+        }
+        word = ((uint16_t)in[0] << 8) | in[1];
+        for (int8_t n = 2; n >= 0; n--) {
+            // sign extend and apply
+            d = (uint16_t)(word & ((1 << MPU_QUAT_DELTA_BITS) - 1));
+            if (d & (1 << (MPU_QUAT_DELTA_BITS - 1))) {
+                d |= (uint16_t)(0xFFFF << MPU_QUAT_DELTA_BITS);
+            }
+            _last[n] = (uint16_t)(_last[n] + d) & mask;
+            word >>= MPU_QUAT_DELTA_BITS;
+        }
+        MPU9250QuatDecoder::rebuild(q);
+        return 2;
+    }
+
+    bytes = (_delta || (_bits == 12)) ? 5 : 4;
+    for (uint8_t n = 0; n < bytes; n++) {
+        word = (word << 8) | in[n];
+    }
+    word >>= ((8 * bytes) - (2 + (3 * _bits) + (_delta ? 1 : 0)));
+    for (int8_t n = 2; n >= 0; n--) {
+        _last[n] = (uint16_t)(word & mask);
+        word >>= _bits;
+    }
+    _index = (uint8_t)(word & 0x03);
+    _valid = true;
+    MPU9250QuatDecoder::rebuild(q);
+    return bytes;
+}
+
+void MPU9250QuatDecoder::rebuild(float * q)
+{
+    float scale = (2.0f * MPU_QUAT_RANGE) / ((1 << _bits) - 1);
+    float sum = 0.0f;
+    float c;
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < 4; i++) {
+        if (i != _index) {
+            c = (_last[n++] * scale) - MPU_QUAT_RANGE;
+            q[i] = c;
+            sum += c * c;
+        }
+    }
+    q[_index] = MPU9250Sqrt((sum < 1.0f) ? (1.0f - sum) : 0.0f);
+    return;
+}
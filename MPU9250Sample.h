@@ -0,0 +1,46 @@
+/* 
+ * @file    MPU9250Sample.h
+ * @brief   Device driver - MPU9250 decoded sample record
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_SAMPLE_H
+#define MPU9250_SAMPLE_H
+ 
+#include <stdint.h>
+
+//  Channel flags, which parts of a sample are valid
+#define MPU_CH_ACCEL 0x01
+#define MPU_CH_GYRO 0x02
+#define MPU_CH_MAG 0x04
+#define MPU_CH_TEMP 0x08
+#define MPU_CH_ALL 0x0F
+
+/**
+ *  @struct MPU9250Sample
+ *  @brief One decoded acquisition, raw counts as returned by the read functions
+ */
+struct MPU9250Sample {
+    uint32_t    seq;        // acquisition number
+    uint8_t     channels;   // MPU_CH_ flags for the valid fields
+    int16_t     accel[3];
+    int16_t     gyro[3];
+    int16_t     mag[3];     // 0.1 uT per bit
+    int16_t     temp;
+};
+
+#endif
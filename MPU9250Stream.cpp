@@ -0,0 +1,394 @@
+/* 
+ * @file    MPU9250Stream.cpp
+ * @brief   Device driver - MPU9250 binary sample stream
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include <stddef.h>
+#include "MPU9250Stream.h"
+
+// nibble table, small enough for a Cortex-M0 yet twice the speed of bitwise
+static const uint16_t crcTable[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+uint16_t MPU9250Crc16(const uint8_t * data, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (length--) {
+        crc = (crc << 4) ^ crcTable[(crc >> 12) ^ (*data >> 4)];
+        crc = (crc << 4) ^ crcTable[(crc >> 12) ^ (*data & 0x0F)];
+        data++;
+    }
+    return crc;
+}
+
+static uint8_t * putInt16(uint8_t * p, int16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)((uint16_t)value >> 8);
+    return p + 2;
+}
+
+static const uint8_t * getInt16(const uint8_t * p, int16_t * value)
+{
+    *value = (int16_t)(p[0] | (p[1] << 8));
+    return p + 2;
+}
+
+MPU9250StreamEncoder::MPU9250StreamEncoder(uint8_t * buffer0, uint8_t * buffer1, uint16_t size)
+    : _quat(12, false)
+{
+    _buffer[0] = buffer0;
+    _buffer[1] = (buffer1 != NULL) ? buffer1 : buffer0;
+    _size = size;
+    _active = 0;
+    _length = 0;
+    _seq = 0;
+    _dropped = 0;
+    _rate = 0;
+    _burst = 0;
+    _tokens = 0;
+    _time = 0;
+    _timed = false;
+    _chunked = (buffer0 == NULL);
+
+    return;
+}
+
+bool MPU9250StreamEncoder::attach(uint8_t * chunk)
+{
+    if (!_chunked || (_buffer[_active] != NULL)) {
+        return false;
+    }
+    _buffer[_active] = chunk;
+    _length = 0;
+    return true;
+}
+
+bool MPU9250StreamEncoder::attached(void) const
+{
+    return _buffer[_active] != NULL;
+}
+
+void MPU9250StreamEncoder::setRateLimit(uint32_t bytesPerSecond, uint16_t burst)
+{
+    _rate = bytesPerSecond;
+    _burst = (uint32_t)burst << 10;
+    _tokens = _burst;
+    _timed = false;
+    return;
+}
+
+bool MPU9250StreamEncoder::sample(const MPU9250Sample & sample, uint32_t time)
+{
+    uint8_t body[MPU_STREAM_MAX_BODY];
+    uint8_t * p = body;
+
+    *p++ = sample.channels & MPU_CH_ALL;
+    if (sample.channels & MPU_CH_ACCEL) {
+        for (uint8_t i = 0; i < 3; i++) {
+            p = putInt16(p, sample.accel[i]);
+        }
+    }
+    if (sample.channels & MPU_CH_GYRO) {
+        for (uint8_t i = 0; i < 3; i++) {
+            p = putInt16(p, sample.gyro[i]);
+        }
+    }
+    if (sample.channels & MPU_CH_MAG) {
+        for (uint8_t i = 0; i < 3; i++) {
+            p = putInt16(p, sample.mag[i]);
+        }
+    }
+    if (sample.channels & MPU_CH_TEMP) {
+        p = putInt16(p, sample.temp);
+    }
+    return MPU9250StreamEncoder::frame(MPU_STREAM_SAMPLE, body, (uint8_t)(p - body), time);
+}
+
+bool MPU9250StreamEncoder::quaternion(const float * q, uint32_t time)
+{
+    uint8_t body[MPU_QUAT_MAX_BYTES];
+    uint8_t length;
+
+    length = _quat.encode(q, body);
+    return MPU9250StreamEncoder::frame(MPU_STREAM_QUAT, body, length, time);
+}
+
+bool MPU9250StreamEncoder::status(uint8_t status, uint16_t fifo, uint16_t overruns, uint32_t time)
+{
+    uint8_t body[5];
+
+    body[0] = status;
+    putInt16(putInt16(&body[1], (int16_t)fifo), (int16_t)overruns);
+    return MPU9250StreamEncoder::frame(MPU_STREAM_STATUS, body, sizeof(body), time);
+}
+
+bool MPU9250StreamEncoder::frame(uint8_t type, const uint8_t * body, uint8_t length, uint32_t time)
+{
+    uint8_t raw[MPU_STREAM_MAX_RAW];
+    uint8_t * out;
+    uint8_t * code;
+    uint16_t crc;
+    uint16_t wire;
+    uint32_t elapsed;
+    uint8_t n;
+
+    raw[0] = type;
+    putInt16(&raw[1], (int16_t)_seq);
+    _seq++;
+    for (n = 0; n < length; n++) {
+        raw[3 + n] = body[n];
+    }
+    length += 3;
+    crc = MPU9250Crc16(raw, length);
+    putInt16(&raw[length], (int16_t)crc);
+    length += 2;
+    // COBS adds a byte per 254 and the delimiter, frames are always shorter
+    wire = length + 2;
+
+    if (_rate != 0) {
+        if (_timed) {
+            elapsed = time - _time;
+            // cap the interval so the multiply below cannot overflow
+            if (elapsed > 1000000) {
+                elapsed = 1000000;
+            }
+            _tokens += (uint32_t)(((uint64_t)elapsed * _rate * 1024) / 1000000);
+            if (_tokens > _burst) {
+                _tokens = _burst;
+            }
+        }
+        _time = time;
+        _timed = true;
+        if (_tokens < ((uint32_t)wire << 10)) {
+            _dropped++;
+            return false;
+        }
+        _tokens -= (uint32_t)wire << 10;
+    }
+    if ((_buffer[_active] == NULL) || ((_length + wire) > _size)) {
+        _dropped++;
+        return false;
+    }
+
+    // COBS: each code byte counts the bytes up to the next zero
+    out = &_buffer[_active][_length];
+    code = out++;
+    *code = 1;
+    for (n = 0; n < length; n++) {
+        if (raw[n] == 0) {
+            code = out++;
+            *code = 1;
+        } else {
+            *out++ = raw[n];
+            (*code)++;
+        }
+    }
+    *out++ = 0;
+    _length += wire;
+
+    return true;
+}
+
+uint16_t MPU9250StreamEncoder::flip(const uint8_t ** data)
+{
+    uint16_t length = _length;
+
+    *data = _buffer[_active];
+    if (_chunked) {
+        _buffer[_active] = NULL;
+    } else {
+        _active ^= 1;
+    }
+    _length = 0;
+    return length;
+}
+
+uint16_t MPU9250StreamEncoder::pending(void) const
+{
+    return _length;
+}
+
+uint32_t MPU9250StreamEncoder::dropped(void) const
+{
+    return _dropped;
+}
+
+MPU9250StreamDecoder::MPU9250StreamDecoder(void)
+    : _quat(12, false)
+{
+    _count = 0;
+    _length = 0;
+    _overflow = false;
+    _synced = false;
+    _next = 0;
+    _frames = 0;
+    _errors = 0;
+    _lost = 0;
+
+    return;
+}
+
+bool MPU9250StreamDecoder::push(uint8_t byte)
+{
+    uint8_t in = 0;
+    uint8_t out = 0;
+    uint8_t code;
+    uint16_t seq;
+
+    if (byte != 0) {
+        if (_count < sizeof(_raw)) {
+            _raw[_count++] = byte;
+        } else {
+            _overflow = true;
+        }
+        return false;
+    }
+
+    // delimiter, undo the COBS encoding
+    if ((_count == 0) && !_overflow) {
+        return false;
+    }
+    while (!_overflow && (in < _count)) {
+        code = _raw[in++];
+        // a block is code - 1 bytes and a zero, both must be there and fit
+        if (((in + code - 1) > _count) || ((out + code) > sizeof(_frame))) {
+            _overflow = true;
+            break;
+        }
+        for (uint8_t i = 1; i < code; i++) {
+            _frame[out++] = _raw[in++];
+        }
+        if ((code != 0xFF) && (in < _count)) {
+            _frame[out++] = 0;
+        }
+    }
+    _count = 0;
+    if (_overflow || (out < 5)) {
+        _overflow = false;
+        _errors++;
+        return false;
+    }
+    _length = out - 2;
+    if (MPU9250Crc16(_frame, _length) != (uint16_t)(_frame[_length] | (_frame[_length + 1] << 8))) {
+        _errors++;
+        return false;
+    }
+
+    seq = (uint16_t)(_frame[1] | (_frame[2] << 8));
+    if (_synced) {
+        _lost += (uint16_t)(seq - _next);
+    }
+    _next = seq + 1;
+    _synced = true;
+    _frames++;
+
+    return true;
+}
+
+uint8_t MPU9250StreamDecoder::type(void) const
+{
+    return _frame[0];
+}
+
+uint16_t MPU9250StreamDecoder::seq(void) const
+{
+    return (uint16_t)(_frame[1] | (_frame[2] << 8));
+}
+
+bool MPU9250StreamDecoder::sample(MPU9250Sample * sample) const
+{
+    const uint8_t * p = &_frame[4];
+    uint8_t length = 1;
+    uint8_t channels;
+
+    if ((_frame[0] != MPU_STREAM_SAMPLE) || (_length < 4)) {
+        return false;
+    }
+    channels = _frame[3];
+    length += (channels & MPU_CH_ACCEL) ? 6 : 0;
+    length += (channels & MPU_CH_GYRO) ? 6 : 0;
+    length += (channels & MPU_CH_MAG) ? 6 : 0;
+    length += (channels & MPU_CH_TEMP) ? 2 : 0;
+    if ((_length - 3) != length) {
+        return false;
+    }
+
+    sample->seq = MPU9250StreamDecoder::seq();
+    sample->channels = channels;
+    if (channels & MPU_CH_ACCEL) {
+        for (uint8_t i = 0; i < 3; i++) {
+            p = getInt16(p, &sample->accel[i]);
+        }
+    }
+    if (channels & MPU_CH_GYRO) {
+        for (uint8_t i = 0; i < 3; i++) {
+            p = getInt16(p, &sample->gyro[i]);
+        }
+    }
+    if (channels & MPU_CH_MAG) {
+        for (uint8_t i = 0; i < 3; i++) {
+            p = getInt16(p, &sample->mag[i]);
+        }
+    }
+    if (channels & MPU_CH_TEMP) {
+        p = getInt16(p, &sample->temp);
+    }
+    return true;
+}
+
+bool MPU9250StreamDecoder::quaternion(float * q)
+{
+    if ((_frame[0] != MPU_STREAM_QUAT) || (_length != (3 + MPU_QUAT_MAX_BYTES))) {
+        return false;
+    }
+    return _quat.decode(&_frame[3], q) != 0;
+}
+
+bool MPU9250StreamDecoder::status(uint8_t * status, uint16_t * fifo, uint16_t * overruns) const
+{
+    int16_t value;
+
+    if ((_frame[0] != MPU_STREAM_STATUS) || (_length != 8)) {
+        return false;
+    }
+    *status = _frame[3];
+    getInt16(&_frame[4], &value);
+    *fifo = (uint16_t)value;
+    getInt16(&_frame[6], &value);
+    *overruns = (uint16_t)value;
+    return true;
+}
+
+uint32_t MPU9250StreamDecoder::frames(void) const
+{
+    return _frames;
+}
+
+uint32_t MPU9250StreamDecoder::errors(void) const
+{
+    return _errors;
+}
+
+uint32_t MPU9250StreamDecoder::lost(void) const
+{
+    return _lost;
+}
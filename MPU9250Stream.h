@@ -0,0 +1,249 @@
+/* 
+ * @file    MPU9250Stream.h
+ * @brief   Device driver - MPU9250 binary sample stream
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_STREAM_H
+#define MPU9250_STREAM_H
+ 
+#include <stdint.h>
+#include "MPU9250Sample.h"
+#include "MPU9250QuatCodec.h"
+
+//  Frame types
+#define MPU_STREAM_SAMPLE 0x01  // channels, then int16 fields for each channel present
+#define MPU_STREAM_QUAT 0x02    // 12 bit smallest-three quaternion
+#define MPU_STREAM_STATUS 0x03  // status, FIFO count, overruns
+
+#define MPU_STREAM_MAX_BODY 24  // largest frame body
+#define MPU_STREAM_MAX_RAW (3 + MPU_STREAM_MAX_BODY + 2)    // type, sequence, body, CRC
+#define MPU_STREAM_MAX_FRAME (MPU_STREAM_MAX_RAW + 2)   // COBS overhead and delimiter
+
+/** CRC-16/CCITT-FALSE, polynomial 0x1021, initial value 0xFFFF
+ *  @param data - bytes to check
+ *  @param length - number of bytes
+ *  @return the CRC
+ */
+uint16_t MPU9250Crc16(const uint8_t * data, uint16_t length);
+
+/**
+ *  @class MPU9250StreamEncoder
+ *  @brief Binary frames of samples, quaternions and status for a serial link
+ *
+ *  Each frame is type(1) sequence(2) body CRC(2), little endian, COBS encoded and
+ *  ended by a zero byte so a receiver can resynchronise at any delimiter. A full
+ *  9 axis sample is 28 bytes on the wire and a quaternion 12, so 1 kHz of both needs
+ *  40 kB/s, under half of a 921600 baud UART.
+ *
+ *  Frames are encoded straight into one of two caller buffers; flip() hands back
+ *  the filled one, for a DMA transfer, and carries on in the other. For recording
+ *  from several sensors the buffers can instead be chunks borrowed from a shared
+ *  MPU9250BufferPool: construct with no buffers, attach a chunk, and flip() hands
+ *  it back to be written out and released. The sequence
+ *  number advances for every frame offered, so frames dropped by the rate limit or
+ *  for lack of space show up as gaps at the receiver.
+ */ 
+class MPU9250StreamEncoder {
+
+public:
+
+    /** Create the encoder
+     *  @param buffer0 - first output buffer
+     *  @param buffer1 - second output buffer, may be NULL for a single buffer
+     *  @param size - bytes in each buffer
+     */
+    MPU9250StreamEncoder(uint8_t * buffer0, uint8_t * buffer1, uint16_t size);
+
+    /** Give the encoder a chunk to fill, when created with NULL buffers
+     *  Frames are dropped while no chunk is attached.
+     *  @param chunk - size bytes, e.g. a pool block
+     *  @return false if a chunk is already attached or the encoder has its own buffers
+     */
+    bool attach(uint8_t * chunk);
+
+    /** Whether a chunk is attached, when created with NULL buffers
+     *  @return true if frames can be added
+     */
+    bool attached(void) const;
+
+    /** Limit the output rate with a token bucket, refilled using the time passed in
+     *  @param bytesPerSecond - sustained rate, 0 for no limit
+     *  @param burst - bytes that may be sent at once
+     */
+    void setRateLimit(uint32_t bytesPerSecond, uint16_t burst);
+
+    /** Add a sample frame
+     *  @param sample - the sample, only the channels flagged are sent
+     *  @param time - current time in us
+     *  @return true if the frame was added
+     */
+    bool sample(const MPU9250Sample & sample, uint32_t time);
+
+    /** Add a quaternion frame
+     *  @param q - 4 floats, w, x, y, z, unit length
+     *  @param time - current time in us
+     *  @return true if the frame was added
+     */
+    bool quaternion(const float * q, uint32_t time);
+
+    /** Add a status frame
+     *  @param status - driver status
+     *  @param fifo - FIFO count
+     *  @param overruns - subscriber overruns
+     *  @param time - current time in us
+     *  @return true if the frame was added
+     */
+    bool status(uint8_t status, uint16_t fifo, uint16_t overruns, uint32_t time);
+
+    /** Take the filled buffer and start filling the other
+     *  An attached chunk is handed back and a new one must be attached before more
+     *  frames can be added.
+     *  @param data - set to the filled buffer
+     *  @return bytes in it
+     */
+    uint16_t flip(const uint8_t ** data);
+
+    /** Bytes waiting in the current buffer
+     *  @return byte count
+     */
+    uint16_t pending(void) const;
+
+    /** Frames dropped by the rate limit or for lack of space
+     *  @return frame count
+     */
+    uint32_t dropped(void) const;
+
+private:
+
+    uint8_t *               _buffer[2];
+    uint16_t                _size;
+    uint8_t                 _active;
+    uint16_t                _length;
+    uint16_t                _seq;
+    uint32_t                _dropped;
+    uint32_t                _rate;
+    uint32_t                _burst;         // bucket size and level in bytes << 10
+    uint32_t                _tokens;
+    uint32_t                _time;
+    bool                    _timed;
+    bool                    _chunked;       // created without buffers, filling attached chunks
+    MPU9250QuatEncoder      _quat;
+
+    bool frame(uint8_t type, const uint8_t * body, uint8_t length, uint32_t time);
+
+};
+
+/**
+ *  @class MPU9250StreamBuffers
+ *  @brief An encoder holding its own pair of SIZE byte buffers
+ */ 
+template <uint16_t SIZE>
+class MPU9250StreamBuffers : public MPU9250StreamEncoder {
+
+public:
+
+    MPU9250StreamBuffers() : MPU9250StreamEncoder(_storage[0], _storage[1], SIZE) {}
+
+private:
+
+    typedef char SizeHoldsAFrame[(SIZE >= MPU_STREAM_MAX_FRAME) ? 1 : -1];
+
+    uint8_t                 _storage[2][SIZE];
+
+};
+
+/**
+ *  @class MPU9250StreamDecoder
+ *  @brief Receiver for MPU9250StreamEncoder frames, fed a byte at a time
+ */ 
+class MPU9250StreamDecoder {
+
+public:
+
+    /** Create the decoder
+     */
+    MPU9250StreamDecoder(void);
+
+    /** Feed the next received byte
+     *  @param byte - the byte
+     *  @return true when it completes a valid frame
+     */
+    bool push(uint8_t byte);
+
+    /** Type of the last valid frame
+     *  @return MPU_STREAM_ type
+     */
+    uint8_t type(void) const;
+
+    /** Sequence number of the last valid frame
+     *  @return sequence
+     */
+    uint16_t seq(void) const;
+
+    /** Read the last frame as a sample
+     *  @param sample - filled in, the seq field is the frame sequence
+     *  @return true if it was a sample frame
+     */
+    bool sample(MPU9250Sample * sample) const;
+
+    /** Read the last frame as a quaternion
+     *  @param q - 4 floats, w, x, y, z
+     *  @return true if it was a quaternion frame
+     */
+    bool quaternion(float * q);
+
+    /** Read the last frame as status
+     *  @param status - driver status
+     *  @param fifo - FIFO count
+     *  @param overruns - subscriber overruns
+     *  @return true if it was a status frame
+     */
+    bool status(uint8_t * status, uint16_t * fifo, uint16_t * overruns) const;
+
+    /** Valid frames received
+     *  @return frame count
+     */
+    uint32_t frames(void) const;
+
+    /** Frames rejected for length, COBS or CRC errors
+     *  @return frame count
+     */
+    uint32_t errors(void) const;
+
+    /** Frames missing from the sequence
+     *  @return frame count
+     */
+    uint32_t lost(void) const;
+
+private:
+
+    uint8_t                 _raw[MPU_STREAM_MAX_FRAME];
+    uint8_t                 _frame[MPU_STREAM_MAX_FRAME];  // junk may decode longer than a frame
+    uint8_t                 _count;
+    uint8_t                 _length;        // decoded bytes less the CRC
+    bool                    _overflow;
+    bool                    _synced;
+    uint16_t                _next;
+    uint32_t                _frames;
+    uint32_t                _errors;
+    uint32_t                _lost;
+    MPU9250QuatDecoder      _quat;
+
+};
+
+#endif
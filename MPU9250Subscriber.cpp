@@ -0,0 +1,76 @@
+/* 
+ * @file    MPU9250Subscriber.cpp
+ * @brief   Device driver - MPU9250 sample subscriber queue
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250Subscriber.h"
+
+MPU9250Subscriber::MPU9250Subscriber(MPU9250Sample * buffer, uint16_t size, uint8_t channels, uint16_t rate)
+{
+    _buffer = buffer;
+    _mask = size - 1;
+    _head = 0;
+    _tail = 0;
+    _overruns = 0;
+    _channels = channels;
+    _rate = (rate == 0) ? 1 : rate;
+    _div = 1;
+    _count = 0;
+
+    return;
+}
+
+bool MPU9250Subscriber::read(MPU9250Sample * sample)
+{
+    uint16_t tail = _tail;
+
+    if (tail == _head) {
+        return false;
+    }
+    *sample = _buffer[tail & _mask];
+    // sample copied out before the slot is handed back to the producer
+    __DMB();
+    _tail = tail + 1;
+    return true;
+}
+
+uint16_t MPU9250Subscriber::available(void)
+{
+    return (uint16_t)(_head - _tail);
+}
+
+uint32_t MPU9250Subscriber::overruns(void)
+{
+    return _overruns;
+}
+
+bool MPU9250Subscriber::push(const MPU9250Sample & sample)
+{
+    uint16_t head = _head;
+
+    if ((uint16_t)(head - _tail) > _mask) {
+        _overruns++;
+        return false;
+    }
+    _buffer[head & _mask] = sample;
+    _buffer[head & _mask].channels &= _channels;
+    // sample written before it is made visible to the consumer
+    __DMB();
+    _head = head + 1;
+    return true;
+}
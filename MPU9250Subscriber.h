@@ -0,0 +1,113 @@
+/* 
+ * @file    MPU9250Subscriber.h
+ * @brief   Device driver - MPU9250 sample subscriber queue
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_SUBSCRIBER_H
+#define MPU9250_SUBSCRIBER_H
+ 
+#include "mbed.h"
+#include "MPU9250Sample.h"
+
+class MPU9250;
+
+/**
+ *  @class MPU9250Subscriber
+ *  @brief A consumer of MPU9250 samples at its own rate and channel selection
+ *
+ *  Samples are delivered through a single producer, single consumer queue: the
+ *  driver pushes from MPU9250::publish and the owner pops with read, without locks.
+ *  The queue storage is provided by the caller.
+ */ 
+class MPU9250Subscriber {
+
+public:
+
+    /** Create a subscriber
+     *  @param buffer - queue storage
+     *  @param size - number of samples in buffer, must be a power of 2
+     *  @param channels - MPU_CH_ flags wanted
+     *  @param rate - wanted output rate in Hz
+     */
+    MPU9250Subscriber(MPU9250Sample * buffer, uint16_t size, uint8_t channels, uint16_t rate);
+
+    /** Take the oldest sample from the queue
+     *  @param sample - the sample read
+     *  @return true if a sample was available
+     */
+    bool read(MPU9250Sample * sample);
+
+    /** Number of samples waiting
+     *  @return samples in the queue
+     */
+    uint16_t available(void);
+
+    /** Number of samples dropped because the queue was full
+     *  @return dropped samples
+     */
+    uint32_t overruns(void);
+
+private:
+
+    friend class MPU9250;
+
+    MPU9250Sample           *_buffer;
+    uint16_t                _mask;
+    volatile uint16_t       _head;          // written by the producer only
+    volatile uint16_t       _tail;          // written by the consumer only
+    volatile uint32_t       _overruns;
+    uint8_t                 _channels;
+    uint16_t                _rate;
+    uint16_t                _div;           // decimation from the acquisition rate
+    uint16_t                _count;
+
+    /** Add a sample to the queue, producer side
+     *  @param sample - the sample to add
+     *  @return true if queued, false if the queue was full
+     */
+    bool push(const MPU9250Sample & sample);
+
+};
+
+/**
+ *  @class MPU9250SubscriberQueue
+ *  @brief A subscriber holding its own queue storage, SIZE samples
+ *
+ *  For a static or member subscriber with no separate buffer; SIZE is checked to
+ *  be a power of 2 at compile time.
+ */ 
+template <uint16_t SIZE>
+class MPU9250SubscriberQueue : public MPU9250Subscriber {
+
+public:
+
+    /** Create a subscriber
+     *  @param channels - MPU_CH_ flags wanted
+     *  @param rate - wanted output rate in Hz
+     */
+    MPU9250SubscriberQueue(uint8_t channels, uint16_t rate) : MPU9250Subscriber(_storage, SIZE, channels, rate) {}
+
+private:
+
+    typedef char SizeIsPowerOf2[((SIZE > 0) && ((SIZE & (SIZE - 1)) == 0)) ? 1 : -1];
+
+    MPU9250Sample           _storage[SIZE];
+
+};
+
+#endif
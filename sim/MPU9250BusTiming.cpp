@@ -0,0 +1,116 @@
+/* 
+ * @file    MPU9250BusTiming.cpp
+ * @brief   Host simulation - I2C and SPI bus timing model
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include "MPU9250BusTiming.h"
+
+#define MPU_SPI_WRITE_HZ 1000000    // SCLK limit for register writes
+#define MPU_SPI_CS_SETUP 8          // ns, chip select to first SCLK edge
+#define MPU_SPI_CS_HOLD 500         // ns, last SCLK edge to chip select release
+
+/**
+ *  @struct I2CMode
+ *  @brief UM10204 minimums for one speed mode, ns
+ */
+struct I2CMode {
+    uint32_t    hz;             // fastest clock in the mode
+    uint32_t    low;
+    uint32_t    high;
+    uint32_t    hdSta;
+    uint32_t    suSta;
+    uint32_t    suSto;
+    uint32_t    buf;
+};
+
+static const I2CMode i2cModes[3] = {
+    {100000, 4700, 4000, 4000, 4700, 4000, 4700},       // Standard-mode
+    {400000, 1300, 600, 600, 600, 600, 1300},           // Fast-mode
+    {1000000, 500, 260, 260, 260, 260, 500},            // Fast-mode Plus
+};
+
+MPU9250I2CTiming::MPU9250I2CTiming(uint32_t hz, uint32_t gap)
+{
+    const I2CMode * mode = &i2cModes[2];
+
+    _hz = (hz > 0) ? hz : 100000;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (_hz <= i2cModes[i].hz) {
+            mode = &i2cModes[i];
+            break;
+        }
+    }
+    _bit = 1000000000UL / _hz;
+    if (_bit < (mode->low + mode->high)) {
+        // a faster clock than the mode allows runs at the mode's limit
+        _bit = mode->low + mode->high;
+    }
+    _low = (mode->low > (_bit / 2)) ? mode->low : (_bit / 2);
+    _hdSta = mode->hdSta;
+    _suSta = mode->suSta;
+    _suSto = mode->suSto;
+    _buf = mode->buf;
+    _gap = gap;
+
+    return;
+}
+
+uint32_t MPU9250I2CTiming::transaction(uint16_t bytes, bool repeated, uint32_t stretch) const
+{
+    uint32_t t;
+
+    // START hold, then address and data bytes of 8 bits and an ACK
+    t = _hdSta + (9 * (1 + (uint32_t)bytes) * _bit) + stretch;
+    // SCL low after the last ACK, then either set up a repeated START or STOP and free the bus
+    t += _low + (repeated ? _suSta : (_suSto + _buf));
+    return t + _gap;
+}
+
+uint32_t MPU9250I2CTiming::registerRead(uint16_t bytes) const
+{
+    return MPU9250I2CTiming::transaction(1, true) + MPU9250I2CTiming::transaction(bytes, false);
+}
+
+uint32_t MPU9250I2CTiming::registerWrite(uint16_t bytes) const
+{
+    return MPU9250I2CTiming::transaction(1 + bytes, false);
+}
+
+MPU9250SPITiming::MPU9250SPITiming(uint32_t hz, uint32_t gap)
+{
+    _hz = (hz > 0) ? hz : MPU_SPI_WRITE_HZ;
+    _gap = gap;
+
+    return;
+}
+
+uint32_t MPU9250SPITiming::transaction(uint16_t bytes, uint32_t hz) const
+{
+    // register byte and data, 8 SCLK periods each
+    return MPU_SPI_CS_SETUP + (uint32_t)((8ULL * (1 + bytes) * 1000000000ULL) / hz) + MPU_SPI_CS_HOLD + _gap;
+}
+
+uint32_t MPU9250SPITiming::registerRead(uint16_t bytes) const
+{
+    return MPU9250SPITiming::transaction(bytes, _hz);
+}
+
+uint32_t MPU9250SPITiming::registerWrite(uint16_t bytes) const
+{
+    return MPU9250SPITiming::transaction(bytes, (_hz < MPU_SPI_WRITE_HZ) ? _hz : MPU_SPI_WRITE_HZ);
+}
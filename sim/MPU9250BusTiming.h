@@ -0,0 +1,128 @@
+/* 
+ * @file    MPU9250BusTiming.h
+ * @brief   Host simulation - I2C and SPI bus timing model
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_BUS_TIMING_H
+#define MPU9250_BUS_TIMING_H
+ 
+#include <stdint.h>
+
+/**
+ *  @class MPU9250I2CTiming
+ *  @brief Bus occupancy of I2C transactions, from the UM10204 timing limits
+ *
+ *  A transaction runs from its START, or repeated START, to the end of the bus free
+ *  time after its STOP, or to the repeated START that follows it. Each byte, the
+ *  address included, takes 9 SCL periods with its ACK. The SCL period is the clock
+ *  asked for, stretched if needed to meet tLOW + tHIGH for the speed mode. The
+ *  start hold, stop and repeated start setup and bus free times are the mode's
+ *  minimums, which a master at that clock cannot beat. gap is the master's own
+ *  time between transactions, interrupt or driver overhead, 0 for an ideal master.
+ *  All times are in ns.
+ */ 
+class MPU9250I2CTiming {
+
+public:
+
+    /** Timing for a bus clock
+     *  @param hz - SCL frequency, up to 1 MHz (Fast-mode Plus)
+     *  @param gap - master time between transactions, ns
+     */
+    MPU9250I2CTiming(uint32_t hz = 400000, uint32_t gap = 0);
+
+    /** One transaction
+     *  @param bytes - data bytes after the address
+     *  @param repeated - ends with a repeated START instead of a STOP
+     *  @param stretch - time the target holds SCL low, ns
+     *  @return bus time, ns
+     */
+    uint32_t transaction(uint16_t bytes, bool repeated, uint32_t stretch = 0) const;
+
+    /** A register read as the driver does it, register address write then repeated START read
+     *  @param bytes - bytes read
+     *  @return bus time, ns
+     */
+    uint32_t registerRead(uint16_t bytes) const;
+
+    /** A register write, register address and data in one transaction
+     *  @param bytes - data bytes written
+     *  @return bus time, ns
+     */
+    uint32_t registerWrite(uint16_t bytes) const;
+
+    uint32_t hz(void) const { return _hz; }
+
+private:
+
+    uint32_t                _hz;
+    uint32_t                _bit;           // SCL period
+    uint32_t                _low;           // tLOW
+    uint32_t                _hdSta;         // tHD;STA, START to first SCL fall
+    uint32_t                _suSta;         // tSU;STA, SCL rise to repeated START
+    uint32_t                _suSto;         // tSU;STO, SCL rise to STOP
+    uint32_t                _buf;           // tBUF, STOP to the next START
+    uint32_t                _gap;
+
+};
+
+/**
+ *  @class MPU9250SPITiming
+ *  @brief Bus occupancy of MPU9250 SPI transactions
+ *
+ *  Each transaction is chip select setup, the register byte and data at the SCLK
+ *  rate, and chip select hold, with the datasheet's 8 ns setup and 500 ns hold. The
+ *  MPU9250 takes 1 MHz for every register but 20 MHz for reading the sensor and
+ *  interrupt registers, so writes use the slow clock. There is no repeated start, a
+ *  register read is one transaction. The AK8963 is only reachable through the
+ *  MPU9250's own I2C master over SPI.
+ */ 
+class MPU9250SPITiming {
+
+public:
+
+    /** Timing for a read clock
+     *  @param hz - SCLK for sensor register reads, up to 20 MHz
+     *  @param gap - master time between transactions, ns
+     */
+    MPU9250SPITiming(uint32_t hz = 20000000, uint32_t gap = 0);
+
+    /** A register read
+     *  @param bytes - bytes read
+     *  @return bus time, ns
+     */
+    uint32_t registerRead(uint16_t bytes) const;
+
+    /** A register write, at 1 MHz at most
+     *  @param bytes - data bytes written
+     *  @return bus time, ns
+     */
+    uint32_t registerWrite(uint16_t bytes) const;
+
+    uint32_t hz(void) const { return _hz; }
+
+private:
+
+    uint32_t                _hz;
+    uint32_t                _gap;
+
+    uint32_t transaction(uint16_t bytes, uint32_t hz) const;
+
+};
+
+#endif
@@ -0,0 +1,863 @@
+/* 
+ * @file    MPU9250Sim.cpp
+ * @brief   Host simulation - I2C bus and MPU9250 / AK8963 register model
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include <math.h>
+#include <string.h>
+#include "MPU9250.h"
+#include "MPU9250Sim.h"
+
+#define MPU_SIM_CATCHUP 1024    // sample ticks replayed at most after a long delay
+
+static uint64_t simTime = 0;
+
+uint64_t MPU9250SimNow(void)
+{
+    return simTime;
+}
+
+void MPU9250SimAdvance(uint64_t us)
+{
+    simTime += us;
+    return;
+}
+
+void MPU9250SimRestart(void)
+{
+    simTime = 0;
+    return;
+}
+
+/* xorshift64*, uniform in [0, 1) */
+static double uniform(uint64_t * state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Draw a fault of one kind, never when faults are off */
+static bool inject(MPU9250SimFaults * faults, double MPU9250SimFaults::* probability, double scale = 1.0)
+{
+    return (faults != NULL) && ((faults->*probability) > 0.0) &&
+           (uniform(&faults->state) < ((faults->*probability) * scale));
+}
+
+void MPU9250SimNoFaults(MPU9250SimFaults * faults, uint32_t seed)
+{
+    memset(faults, 0, sizeof(*faults));
+    faults->state = ((uint64_t)seed << 1) | 1;
+    return;
+}
+
+// DLPF bandwidths in Hz by DLPF_CFG and A_DLPFCFG, for the noise level
+static const float gyroBandwidth[8] = {250.0f, 184.0f, 92.0f, 41.0f, 20.0f, 10.0f, 5.0f, 3600.0f};
+static const float accelBandwidth[8] = {218.1f, 218.1f, 99.0f, 44.8f, 21.2f, 10.2f, 5.05f, 420.0f};
+
+MPU9250SimBus::MPU9250SimBus(void)
+{
+    _count = 0;
+    _gap = 0;
+    _timing = MPU9250I2CTiming(100000, _gap);
+    _transactions = 0;
+    _bytes = 0;
+    _naks = 0;
+    _ns = 0;
+    _busy = 0;
+    _faults = NULL;
+    _stuckUntil = 0;
+    _monitor = NULL;
+    _monitorContext = NULL;
+
+    return;
+}
+
+uint8_t MPU9250SimBus::attach(uint8_t address, MPU9250SimTarget * target)
+{
+    if (_count >= MPU_SIM_MAX_TARGETS) {
+        return 1;
+    }
+    _address[_count] = address & 0xFE;
+    _target[_count] = target;
+    _count++;
+    return 0;
+}
+
+void MPU9250SimBus::frequency(int hz)
+{
+    _timing = MPU9250I2CTiming((hz > 0) ? (uint32_t)hz : 100000, _gap);
+    return;
+}
+
+void MPU9250SimBus::setGap(uint32_t ns)
+{
+    _gap = ns;
+    _timing = MPU9250I2CTiming(_timing.hz(), _gap);
+    return;
+}
+
+void MPU9250SimBus::setMonitor(void (*monitor)(void * context, bool ok, bool stop), void * context)
+{
+    _monitor = monitor;
+    _monitorContext = context;
+    return;
+}
+
+int MPU9250SimBus::write(uint8_t address, const uint8_t * data, int length, bool repeated)
+{
+    MPU9250SimTarget * target = MPU9250SimBus::find(address);
+    int result = 0;
+
+    if (!MPU9250SimBus::transfer(length, repeated) || (target == NULL) || !target->write(data, length)) {
+        _naks++;
+        result = 1;
+    }
+    if (_monitor != NULL) {
+        _monitor(_monitorContext, result == 0, !repeated);
+    }
+    return result;
+}
+
+int MPU9250SimBus::read(uint8_t address, uint8_t * data, int length, bool repeated)
+{
+    MPU9250SimTarget * target = MPU9250SimBus::find(address);
+    int result = 0;
+
+    if (!MPU9250SimBus::transfer(length, repeated) || (target == NULL) || !target->read(data, length)) {
+        // nobody drives SDA, the master reads ones
+        memset(data, 0xFF, length);
+        _naks++;
+        result = 1;
+    }
+    if (_monitor != NULL) {
+        _monitor(_monitorContext, result == 0, !repeated);
+    }
+    return result;
+}
+
+MPU9250SimTarget * MPU9250SimBus::find(uint8_t address)
+{
+    for (uint8_t i = 0; i < _count; i++) {
+        if (_address[i] == (address & 0xFE)) {
+            return _target[i];
+        }
+    }
+    return NULL;
+}
+
+bool MPU9250SimBus::transfer(int length, bool repeated)
+{
+    // a failed transfer is taken as an address byte then STOP, as a NAK is
+    uint32_t t = _timing.transaction(0, false);
+    uint32_t stretch = 0;
+    bool ok = true;
+
+    _transactions++;
+    if (MPU9250SimNow() < _stuckUntil) {
+        // SDA is held low, the START fails and the master gives up
+        ok = false;
+    } else if (inject(_faults, &MPU9250SimFaults::nak)) {
+        _faults->naks++;
+        ok = false;
+    } else if (inject(_faults, &MPU9250SimFaults::stuck)) {
+        // the transfer is cut short and a slave is left holding SDA
+        _stuckUntil = MPU9250SimNow() + _faults->stuckUs;
+        _faults->stuckEpisodes++;
+        ok = false;
+    } else {
+        if (inject(_faults, &MPU9250SimFaults::stretch)) {
+            stretch = (uint32_t)(uniform(&_faults->state) * _faults->stretchUs * 1000.0);
+            _faults->stretches++;
+        }
+        t = _timing.transaction((uint16_t)length, repeated, stretch);
+        _bytes += length;
+    }
+    _busy += t;
+    _ns += t;
+    MPU9250SimAdvance(_ns / 1000);
+    _ns %= 1000;
+    return ok;
+}
+
+void MPU9250SimIdeal(MPU9250SimErrors * errors)
+{
+    memset(errors, 0, sizeof(*errors));
+    errors->asa[0] = errors->asa[1] = errors->asa[2] = 128;
+    errors->seed = 1;
+    return;
+}
+
+/* Box-Muller on a private generator, so the fixed errors depend only on the seed */
+static double gaussian(uint64_t * state)
+{
+    double u1;
+    double u2;
+
+    do {
+        u1 = uniform(state);
+    } while (u1 <= 0.0);
+    u2 = uniform(state);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+void MPU9250SimTypical(MPU9250SimErrors * errors, uint32_t seed)
+{
+    uint64_t state = ((uint64_t)seed << 1) | 1;
+
+    MPU9250SimIdeal(errors);
+    errors->seed = seed;
+    // datasheet limits taken as 3 sigma
+    for (uint8_t i = 0; i < 3; i++) {
+        errors->accelBias[i] = (float)(gaussian(&state) * ((i == 2) ? 0.080 : 0.060) / 3.0);
+        errors->accelScale[i] = (float)(gaussian(&state) * 0.03 / 3.0);
+        errors->gyroBias[i] = (float)(gaussian(&state) * 5.0 / 3.0);
+        errors->gyroScale[i] = (float)(gaussian(&state) * 0.03 / 3.0);
+        errors->magBias[i] = (float)(gaussian(&state) * 15.0 / 3.0);
+        errors->magScale[i] = (float)(gaussian(&state) * 0.03 / 3.0);
+        errors->asa[i] = (uint8_t)(176 + (int)(gaussian(&state) * 8.0));
+        for (uint8_t j = 0; j < 3; j++) {
+            if (i != j) {
+                errors->accelMisalign[i][j] = (float)(gaussian(&state) * 0.02 / 3.0);
+                errors->gyroMisalign[i][j] = (float)(gaussian(&state) * 0.02 / 3.0);
+            }
+        }
+    }
+    errors->accelNoise = 300e-6f;
+    errors->gyroNoise = 0.01f;
+    errors->magNoise = 0.4f;
+    errors->tempOffset = (float)gaussian(&state);
+    errors->tempNoise = 0.05f;
+    return;
+}
+
+MPU9250SimMag::MPU9250SimMag(void)
+{
+    memset(_reg, 0, sizeof(_reg));
+    _reg[MPU9250::AK8963_WHO_AM_I] = 0x48;
+    _reg[MPU9250::AK8963_INFO] = 0x9A;
+    _reg[MPU9250::AK8963_ASAX] = _reg[MPU9250::AK8963_ASAY] = _reg[MPU9250::AK8963_ASAZ] = 128;
+    _pointer = 0;
+    _next = 0;
+    _field[0] = _field[1] = _field[2] = 0.0;
+    _faults = NULL;
+
+    return;
+}
+
+void MPU9250SimMag::reset(void)
+{
+    // the fuse ROM survives
+    memset(&_reg[MPU9250::AK8963_ST1], 0, MPU9250::AK8963_ASAX - MPU9250::AK8963_ST1);
+    _next = 0;
+    return;
+}
+
+bool MPU9250SimMag::write(const uint8_t * data, int length)
+{
+    uint64_t now = MPU9250SimNow();
+
+    MPU9250SimMag::update(now);
+    if (length < 1) {
+        return true;
+    }
+    _pointer = data[0];
+    for (int i = 1; i < length; i++, _pointer++) {
+        if (_pointer == MPU9250::AK8963_CNTL) {
+            _reg[_pointer] = data[i];
+            switch (data[i] & 0x0F) {
+                case MPU9250::MFS_SINGLE: _next = now + 7200; break;
+                case MPU9250::MFS_CONT1: _next = now + 125000; break;
+                case MPU9250::MFS_CONT2: _next = now + 10000; break;
+                default: _next = 0; break;
+            }
+        } else if (_pointer == (MPU9250::AK8963_CNTL + 1)) {
+            // CNTL2 soft reset
+            if (data[i] & 0x01) {
+                MPU9250SimMag::reset();
+            }
+        } else if ((_pointer == MPU9250::AK8963_ASTC) || (_pointer == MPU9250::AK8963_I2CDIS)) {
+            _reg[_pointer] = data[i];
+        }
+    }
+    return true;
+}
+
+bool MPU9250SimMag::read(uint8_t * data, int length)
+{
+    MPU9250SimMag::update(MPU9250SimNow());
+    for (int i = 0; i < length; i++, _pointer++) {
+        data[i] = (_pointer < sizeof(_reg)) ? _reg[_pointer] : 0x00;
+        if (_pointer == MPU9250::AK8963_ST2) {
+            // reading ST2 ends the data read and releases DRDY
+            _reg[MPU9250::AK8963_ST1] &= ~0x03;
+        }
+    }
+    return true;
+}
+
+void MPU9250SimMag::update(uint64_t now)
+{
+    while ((_next != 0) && (_next <= now)) {
+        MPU9250SimMag::measure();
+        switch (_reg[MPU9250::AK8963_CNTL] & 0x0F) {
+            case MPU9250::MFS_CONT1: _next += 125000; break;
+            case MPU9250::MFS_CONT2: _next += 10000; break;
+            default:
+                // single shot drops back to power down
+                _reg[MPU9250::AK8963_CNTL] &= 0xF0;
+                _next = 0;
+                break;
+        }
+    }
+    return;
+}
+
+void MPU9250SimMag::measure(void)
+{
+    bool bit16 = (_reg[MPU9250::AK8963_CNTL] & MPU9250::MFS_16BITS) != 0;
+    double lsb = bit16 ? 0.15 : 0.6;
+    double limit = bit16 ? 32760.0 : 8190.0;
+    double total = 0.0;
+    double v;
+    int16_t raw;
+
+    if (_reg[MPU9250::AK8963_ST1] & 0x01) {
+        _reg[MPU9250::AK8963_ST1] |= 0x02;
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        // the part reads low by its ASA factor, the host is expected to correct it
+        v = _field[i] / lsb / ((((int)_reg[MPU9250::AK8963_ASAX + i] - 128) / 256.0) + 1.0);
+        total += fabs(_field[i]);
+        v = (v > limit) ? limit : ((v < -limit) ? -limit : v);
+        raw = (int16_t)lrint(v);
+        _reg[MPU9250::AK8963_XOUT_L + (2 * i)] = (uint8_t)raw;
+        _reg[MPU9250::AK8963_XOUT_H + (2 * i)] = (uint8_t)((uint16_t)raw >> 8);
+    }
+    _reg[MPU9250::AK8963_ST2] = (bit16 ? 0x10 : 0x00) | ((total >= 4912.0) ? 0x08 : 0x00);
+    if (inject(_faults, &MPU9250SimFaults::overflow)) {
+        _reg[MPU9250::AK8963_ST2] |= 0x08;
+        _faults->overflows++;
+    }
+    _reg[MPU9250::AK8963_ST1] |= 0x01;
+    return;
+}
+
+bool MPU9250SimChip::Bypass::write(const uint8_t * data, int length)
+{
+    uint8_t cfg = _chip->_reg[MPU9250::INT_PIN_CFG];
+    uint8_t user = _chip->_reg[MPU9250::USER_CTRL];
+
+    if (!(cfg & MPU_BYPASS_EN) || (user & MPU_I2C_MST_EN)) {
+        return false;
+    }
+    _chip->update();
+    return _chip->_mag.write(data, length);
+}
+
+bool MPU9250SimChip::Bypass::read(uint8_t * data, int length)
+{
+    uint8_t cfg = _chip->_reg[MPU9250::INT_PIN_CFG];
+    uint8_t user = _chip->_reg[MPU9250::USER_CTRL];
+
+    if (!(cfg & MPU_BYPASS_EN) || (user & MPU_I2C_MST_EN)) {
+        return false;
+    }
+    _chip->update();
+    return _chip->_mag.read(data, length);
+}
+
+MPU9250SimChip::MPU9250SimChip(MPU9250SimSource * source, const MPU9250SimErrors & errors)
+    : _bypass(this)
+{
+    _source = source;
+    _errors = errors;
+    _rng = ((uint64_t)errors.seed << 1) | 1;
+    _samples = 0;
+    _faults = NULL;
+    _countLatch = 0;
+    _line = NULL;
+    _lineIndex = 0;
+    _pullsLow = true;
+    memset(&_truth, 0, sizeof(_truth));
+    for (uint8_t i = 0; i < 3; i++) {
+        _mag._reg[MPU9250::AK8963_ASAX + i] = errors.asa[i];
+    }
+    MPU9250SimChip::reset();
+
+    return;
+}
+
+uint8_t MPU9250SimChip::attach(MPU9250SimBus & bus, uint8_t address)
+{
+    uint8_t result;
+
+    result = bus.attach(address, this);
+    result |= bus.attach(MPU9250::AK8963_ADDRESS, &_bypass);
+    return result;
+}
+
+void MPU9250SimChip::reset(void)
+{
+    memset(_reg, 0, sizeof(_reg));
+    _reg[MPU9250::PWR_MGMT_1] = 0x01;
+    _reg[MPU9250::WHO_AM_I_MPU9250] = MPU9250::I_AM_MPU9250;
+    // factory accel trim, any plausible values
+    _reg[MPU9250::XA_OFFSET_H] = 0x0A;
+    _reg[MPU9250::XA_OFFSET_L] = 0x3C;
+    _reg[MPU9250::YA_OFFSET_H] = 0xF5;
+    _reg[MPU9250::YA_OFFSET_L] = 0x92;
+    _reg[MPU9250::ZA_OFFSET_H] = 0x14;
+    _reg[MPU9250::ZA_OFFSET_L] = 0xA8;
+    _pointer = 0;
+    _fifoHead = 0;
+    _fifoCount = 0;
+    _delayCount = 0;
+    _next = MPU9250SimNow() + MPU9250SimChip::period();
+    return;
+}
+
+uint64_t MPU9250SimChip::nextSample(void)
+{
+    MPU9250SimChip::update();
+    return _next;
+}
+
+uint32_t MPU9250SimChip::period(void) const
+{
+    uint8_t dlpf = _reg[MPU9250::CONFIG] & 0x07;
+
+    // the divider only applies with the DLPF in use
+    if (((_reg[MPU9250::GYRO_CONFIG] & MPU_FCHOICE) == 0) && (dlpf >= 1) && (dlpf <= 6)) {
+        return 1000 * (1 + (uint32_t)_reg[MPU9250::SMPLRT_DIV]);
+    }
+    return 125;
+}
+
+void MPU9250SimChip::update(void)
+{
+    uint64_t now = MPU9250SimNow();
+    uint32_t step = MPU9250SimChip::period();
+
+    if (_reg[MPU9250::PWR_MGMT_1] & MPU_SLEEP) {
+        _next = now + step;
+    } else {
+        if ((_next + ((uint64_t)MPU_SIM_CATCHUP * step)) < now) {
+            _next = now - ((uint64_t)MPU_SIM_CATCHUP * step);
+        }
+        while (_next <= now) {
+            MPU9250SimChip::tick(_next);
+            MPU9250SimChip::pin(_next);
+            _next += step;
+        }
+    }
+    _mag.update(now);
+    return;
+}
+
+double MPU9250SimChip::noise(double sigma)
+{
+    return (sigma > 0.0) ? (gaussian(&_rng) * sigma) : 0.0;
+}
+
+int16_t MPU9250SimChip::counts(double value, double lsb) const
+{
+    double v = value * lsb;
+
+    // quantise and saturate as the ADC does
+    v = (v > 32767.0) ? 32767.0 : ((v < -32768.0) ? -32768.0 : v);
+    return (int16_t)lrint(v);
+}
+
+void MPU9250SimChip::tick(uint64_t time)
+{
+    uint8_t accelCfg2 = _reg[MPU9250::ACCEL_CONFIG2];
+    uint8_t gyroCfg = _reg[MPU9250::GYRO_CONFIG];
+    double accelLsb = 16384.0 / (1 << ((_reg[MPU9250::ACCEL_CONFIG] >> 3) & 0x03));
+    double gyroLsb = 32768.0 / 250.0 / (1 << ((gyroCfg >> 3) & 0x03));
+    double accelSigma = _errors.accelNoise * sqrt((accelCfg2 & 0x08) ? 1046.0 : accelBandwidth[accelCfg2 & 0x07]);
+    double gyroSigma = _errors.gyroNoise * sqrt((gyroCfg & MPU_FCHOICE) ? 8800.0 : gyroBandwidth[_reg[MPU9250::CONFIG] & 0x07]);
+    double a[3];
+    double g[3];
+    double m[3];
+    int16_t v[7];
+    uint8_t data[14];
+    uint8_t fifoEn;
+    uint8_t n;
+
+    if (inject(_faults, &MPU9250SimFaults::reset, MPU9250SimChip::period() * 1e-6)) {
+        // a supply glitch resets the whole package, the configuration is lost
+        _faults->resets++;
+        MPU9250SimChip::reset();
+        _mag.reset();
+        return;
+    }
+    _source->truth(time * 1e-6, &_truth);
+    for (uint8_t i = 0; i < 3; i++) {
+        a[i] = _truth.accel[i];
+        g[i] = _truth.gyro[i] * (180.0 / M_PI);
+        for (uint8_t j = 0; j < 3; j++) {
+            if (i != j) {
+                a[i] += _errors.accelMisalign[i][j] * _truth.accel[j];
+                g[i] += _errors.gyroMisalign[i][j] * _truth.gyro[j] * (180.0 / M_PI);
+            }
+        }
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        a[i] = (a[i] * (1.0 + _errors.accelScale[i])) + _errors.accelBias[i] + MPU9250SimChip::noise(accelSigma);
+        g[i] = (g[i] * (1.0 + _errors.gyroScale[i])) + _errors.gyroBias[i] + MPU9250SimChip::noise(gyroSigma);
+        v[i] = MPU9250SimChip::counts(a[i], accelLsb);
+        v[4 + i] = MPU9250SimChip::counts(g[i], gyroLsb);
+    }
+    v[3] = MPU9250SimChip::counts(_truth.temp + _errors.tempOffset + MPU9250SimChip::noise(_errors.tempNoise) - 21.0,
+                                  333.87);
+    for (uint8_t i = 0; i < 7; i++) {
+        data[2 * i] = (uint8_t)((uint16_t)v[i] >> 8);
+        data[(2 * i) + 1] = (uint8_t)v[i];
+    }
+    if (_reg[MPU9250::PWR_MGMT_1] & MPU_TEMP_DIS) {
+        data[6] = _reg[MPU9250::TEMP_OUT_H];
+        data[7] = _reg[MPU9250::TEMP_OUT_L];
+    }
+    memcpy(&_reg[MPU9250::ACCEL_XOUT_H], data, sizeof(data));
+
+    // AK8963 axes are x and y swapped and z inverted from the accelerometer's
+    m[0] = _truth.mag[1];
+    m[1] = _truth.mag[0];
+    m[2] = -_truth.mag[2];
+    for (uint8_t i = 0; i < 3; i++) {
+        _mag._field[i] = (m[i] * (1.0 + _errors.magScale[i])) + _errors.magBias[i] + MPU9250SimChip::noise(_errors.magNoise);
+    }
+    _reg[MPU9250::INT_STATUS] |= MPU_DRDY_INT_EN;
+
+    if (_reg[MPU9250::USER_CTRL] & MPU_I2C_MST_EN) {
+        MPU9250SimChip::master();
+    }
+
+    if (_reg[MPU9250::USER_CTRL] & MPU_FIFO_MODE_EN) {
+        // FIFO order follows the register map
+        fifoEn = _reg[MPU9250::FIFO_EN];
+        if (fifoEn & MPU_FIFO_ACCEL_EN) {
+            MPU9250SimChip::fifoPush(&data[0], 6);
+        }
+        if (fifoEn & 0x80) {
+            MPU9250SimChip::fifoPush(&data[6], 2);
+        }
+        for (uint8_t i = 0; i < 3; i++) {
+            if (fifoEn & (0x40 >> i)) {
+                MPU9250SimChip::fifoPush(&data[8 + (2 * i)], 2);
+            }
+        }
+        n = 0;
+        for (uint8_t k = 0; k < MPU_AUX_SLOTS; k++) {
+            uint8_t ctrl = _reg[MPU9250::I2C_SLV0_CTRL + (3 * k)];
+            bool on = (k == 3) ? ((_reg[MPU9250::I2C_MST_CTRL] & MPU_SLV3_FIFO_EN) != 0) : ((fifoEn & (MPU_SLV0_FIFO_EN << k)) != 0);
+            if ((ctrl & MPU_SLV_EN) && (_reg[MPU9250::I2C_SLV0_ADDR + (3 * k)] & MPU_SLV_READ)) {
+                if (on && ((n + (ctrl & 0x0F)) <= MPU_EXT_SENS_LEN)) {
+                    MPU9250SimChip::fifoPush(&_reg[MPU9250::EXT_SENS_DATA_00 + n], ctrl & 0x0F);
+                }
+                n += ctrl & 0x0F;
+            }
+        }
+    }
+    _samples++;
+    return;
+}
+
+void MPU9250SimChip::master(void)
+{
+    uint8_t delay = _reg[MPU9250::I2C_SLV4_CTRL] & MPU_I2C_MST_DLY;
+    uint8_t ext[MPU_EXT_SENS_LEN];
+    uint8_t n = 0;
+    uint8_t len;
+    uint8_t addr;
+    uint8_t ctrl;
+    bool slow;
+    bool ok;
+
+    // reduced rate slaves run on every (delay + 1)th sample
+    slow = (_delayCount >= delay);
+    _delayCount = slow ? 0 : (_delayCount + 1);
+    memcpy(ext, &_reg[MPU9250::EXT_SENS_DATA_00], sizeof(ext));
+    for (uint8_t k = 0; k < MPU_AUX_SLOTS; k++) {
+        addr = _reg[MPU9250::I2C_SLV0_ADDR + (3 * k)];
+        ctrl = _reg[MPU9250::I2C_SLV0_CTRL + (3 * k)];
+        len = ctrl & 0x0F;
+        if (!(ctrl & MPU_SLV_EN)) {
+            continue;
+        }
+        if ((_reg[MPU9250::I2C_MST_DELAY_CTRL] & (1 << k)) && !slow) {
+            n += (addr & MPU_SLV_READ) ? len : 0;
+            continue;
+        }
+        if (addr & MPU_SLV_READ) {
+            len = ((n + len) > MPU_EXT_SENS_LEN) ? (MPU_EXT_SENS_LEN - n) : len;
+            ok = MPU9250SimChip::auxTransfer(addr & 0x7F, _reg[MPU9250::I2C_SLV0_REG + (3 * k)], &ext[n], len, true);
+            n += len;
+        } else {
+            ok = MPU9250SimChip::auxTransfer(addr & 0x7F, _reg[MPU9250::I2C_SLV0_REG + (3 * k)],
+                                             &_reg[MPU9250::I2C_SLV0_DO + k], 1, false);
+        }
+        if (!ok) {
+            _reg[MPU9250::I2C_MST_STATUS] |= (1 << k);
+        }
+    }
+    // with DELAY_ES_SHADOW the registers only change once every slave has been read
+    if (!(_reg[MPU9250::I2C_MST_DELAY_CTRL] & MPU_DELAY_ES_SHADOW) || slow) {
+        memcpy(&_reg[MPU9250::EXT_SENS_DATA_00], ext, sizeof(ext));
+    }
+
+    ctrl = _reg[MPU9250::I2C_SLV4_CTRL];
+    if (ctrl & MPU_SLV_EN) {
+        addr = _reg[MPU9250::I2C_SLV4_ADDR];
+        if (addr & MPU_SLV_READ) {
+            ok = MPU9250SimChip::auxTransfer(addr & 0x7F, _reg[MPU9250::I2C_SLV4_REG], &_reg[MPU9250::I2C_SLV4_DI], 1, true);
+        } else {
+            ok = MPU9250SimChip::auxTransfer(addr & 0x7F, _reg[MPU9250::I2C_SLV4_REG], &_reg[MPU9250::I2C_SLV4_DO], 1, false);
+        }
+        _reg[MPU9250::I2C_MST_STATUS] |= ok ? MPU_SLV4_DONE : MPU_SLV4_NACK;
+        _reg[MPU9250::I2C_SLV4_CTRL] = ctrl & ~MPU_SLV_EN;
+    }
+    return;
+}
+
+bool MPU9250SimChip::auxTransfer(uint8_t addr, uint8_t reg, uint8_t * data, uint8_t length, bool read)
+{
+    uint8_t buf[2];
+
+    // the AK8963 is the only device on the auxiliary bus
+    if (addr != (MPU9250::AK8963_ADDRESS >> 1)) {
+        return false;
+    }
+    buf[0] = reg;
+    if (read) {
+        return _mag.write(buf, 1) && _mag.read(data, length);
+    }
+    buf[1] = data[0];
+    return _mag.write(buf, 2);
+}
+
+void MPU9250SimChip::fifoPush(const uint8_t * data, uint8_t length)
+{
+    for (uint8_t i = 0; i < length; i++) {
+        if (_fifoCount == MPU_SIM_FIFO_SIZE) {
+            // full, the oldest byte is overwritten
+            _fifoHead = (_fifoHead + 1) % MPU_SIM_FIFO_SIZE;
+            _fifoCount--;
+            _reg[MPU9250::INT_STATUS] |= MPU_FIFO_OVFL_INT_EN;
+        }
+        _fifo[(_fifoHead + _fifoCount) % MPU_SIM_FIFO_SIZE] = data[i];
+        _fifoCount++;
+    }
+    return;
+}
+
+bool MPU9250SimChip::write(const uint8_t * data, int length)
+{
+    MPU9250SimChip::update();
+    if (length < 1) {
+        return true;
+    }
+    _pointer = data[0] & 0x7F;
+    for (int i = 1; i < length; i++) {
+        MPU9250SimChip::writeByte(_pointer, data[i]);
+        if (_pointer != MPU9250::FIFO_R_W) {
+            _pointer = (_pointer + 1) & 0x7F;
+        }
+    }
+    // a reset or a new pin configuration or enable can move the pin
+    MPU9250SimChip::pin(MPU9250SimNow());
+    return true;
+}
+
+bool MPU9250SimChip::read(uint8_t * data, int length)
+{
+    MPU9250SimChip::update();
+    for (int i = 0; i < length; i++) {
+        data[i] = MPU9250SimChip::readByte(_pointer);
+        if (_pointer != MPU9250::FIFO_R_W) {
+            _pointer = (_pointer + 1) & 0x7F;
+        }
+    }
+    if (_reg[MPU9250::INT_PIN_CFG] & MPU_ANYRD_2CLEAR) {
+        _reg[MPU9250::INT_STATUS] = 0;
+    }
+    MPU9250SimChip::pin(MPU9250SimNow());
+    return true;
+}
+
+void MPU9250SimChip::pin(uint64_t time)
+{
+    bool active = (_reg[MPU9250::INT_STATUS] & _reg[MPU9250::INT_ENABLE]) != 0;
+    bool low = (_reg[MPU9250::INT_PIN_CFG] & MPU_INT_ACTL) ? active : !active;
+
+    if ((low != _pullsLow) && (_line != NULL)) {
+        _line->change(_lineIndex, time, low);
+    }
+    _pullsLow = low;
+    return;
+}
+
+uint8_t MPU9250SimChip::readByte(uint8_t reg)
+{
+    uint8_t v = _reg[reg];
+
+    switch (reg) {
+        case MPU9250::INT_STATUS:
+        case MPU9250::I2C_MST_STATUS:
+            _reg[reg] = 0;
+            break;
+        case MPU9250::FIFO_COUNTH:
+            // the count is latched for FIFO_COUNTL, as on the part
+            _countLatch = _fifoCount;
+            if (inject(_faults, &MPU9250SimFaults::fifoCount)) {
+                _countLatch ^= (uint16_t)(1 << (int)(uniform(&_faults->state) * 13.0));
+                _faults->fifoCounts++;
+            }
+            v = (uint8_t)(_countLatch >> 8);
+            break;
+        case MPU9250::FIFO_COUNTL:
+            v = (uint8_t)_countLatch;
+            break;
+        case MPU9250::FIFO_R_W:
+            v = 0xFF;
+            if (_fifoCount > 0) {
+                v = _fifo[_fifoHead];
+                _fifoHead = (_fifoHead + 1) % MPU_SIM_FIFO_SIZE;
+                _fifoCount--;
+            }
+            break;
+        default:
+            break;
+    }
+    return v;
+}
+
+void MPU9250SimChip::writeByte(uint8_t reg, uint8_t value)
+{
+    if ((reg == MPU9250::INT_STATUS) || ((reg >= MPU9250::ACCEL_XOUT_H) && (reg <= MPU9250::EXT_SENS_DATA_23)) ||
+        (reg == MPU9250::I2C_MST_STATUS) || (reg == MPU9250::I2C_SLV4_DI) || (reg == MPU9250::FIFO_COUNTH) ||
+        (reg == MPU9250::FIFO_COUNTL) || (reg == MPU9250::WHO_AM_I_MPU9250)) {
+        return;
+    }
+    switch (reg) {
+        case MPU9250::PWR_MGMT_1:
+            if (value & MPU_H_RESET) {
+                MPU9250SimChip::reset();
+                return;
+            }
+            if ((_reg[reg] & MPU_SLEEP) && !(value & MPU_SLEEP)) {
+                _next = MPU9250SimNow() + MPU9250SimChip::period();
+            }
+            _reg[reg] = value;
+            break;
+        case MPU9250::USER_CTRL:
+            if (value & MPU_FIFO_RST) {
+                _fifoHead = 0;
+                _fifoCount = 0;
+            }
+            if (value & 0x01) {
+                // SIG_COND_RST clears the sensor registers
+                memset(&_reg[MPU9250::ACCEL_XOUT_H], 0, 14);
+            }
+            _reg[reg] = value & ~(MPU_FIFO_RST | MPU_I2C_MST_RST | 0x01);
+            break;
+        case MPU9250::FIFO_R_W:
+            MPU9250SimChip::fifoPush(&value, 1);
+            break;
+        default:
+            _reg[reg] = value;
+            break;
+    }
+    return;
+}
+
+MPU9250SimLine::MPU9250SimLine(void)
+{
+    _count = 0;
+    _held = 0;
+    _logCount = 0;
+    _lost = 0;
+    return;
+}
+
+uint8_t MPU9250SimLine::attach(MPU9250SimChip * chip)
+{
+    if (_count >= MPU_SIM_MAX_TARGETS) {
+        return 1;
+    }
+    chip->_line = this;
+    chip->_lineIndex = _count;
+    _chip[_count] = chip;
+    _pin[_count] = chip->_pullsLow;
+    if (_pin[_count]) {
+        _held++;
+    }
+    _count++;
+    return 0;
+}
+
+void MPU9250SimLine::change(uint8_t device, uint64_t time, bool low)
+{
+    if (_logCount >= MPU_SIM_LINE_LOG) {
+        _lost++;
+        return;
+    }
+    _log[_logCount].time = time;
+    _log[_logCount].device = device;
+    _log[_logCount].low = low;
+    _logCount++;
+    return;
+}
+
+uint32_t MPU9250SimLine::falls(void)
+{
+    uint32_t falls = 0;
+    Change c;
+    uint16_t j;
+
+    for (uint8_t i = 0; i < _count; i++) {
+        _chip[i]->update();
+    }
+    // each device logs in time order but they catch up at different times, sort stably
+    for (uint16_t i = 1; i < _logCount; i++) {
+        c = _log[i];
+        for (j = i; (j > 0) && (_log[j - 1].time > c.time); j--) {
+            _log[j] = _log[j - 1];
+        }
+        _log[j] = c;
+    }
+    for (uint16_t i = 0; i < _logCount; i++) {
+        c = _log[i];
+        if (_pin[c.device] == c.low) {
+            continue;
+        }
+        _pin[c.device] = c.low;
+        if (c.low) {
+            if (_held == 0) {
+                falls++;
+            }
+            _held++;
+        } else {
+            _held--;
+        }
+    }
+    _logCount = 0;
+    return falls;
+}
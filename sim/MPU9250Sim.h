@@ -0,0 +1,447 @@
+/* 
+ * @file    MPU9250Sim.h
+ * @brief   Host simulation - I2C bus and MPU9250 / AK8963 register model
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_SIM_H
+#define MPU9250_SIM_H
+ 
+#include <stdint.h>
+#include "MPU9250BusTiming.h"
+
+#define MPU_SIM_MAX_TARGETS 8   // devices on one simulated bus
+#define MPU_SIM_FIFO_SIZE 512   // MPU9250 FIFO bytes
+#define MPU_SIM_LINE_LOG 256    // INT pin changes held between line evaluations
+
+class MPU9250SimLine;
+
+/** Simulated time, advanced by delays and bus transfers
+ *  @return time in us
+ */
+uint64_t MPU9250SimNow(void);
+
+/** Move simulated time on
+ *  @param us - microseconds to add
+ */
+void MPU9250SimAdvance(uint64_t us);
+
+/** Restart simulated time at zero, for a new run with new models
+ */
+void MPU9250SimRestart(void);
+
+/**
+ *  @struct MPU9250SimFaults
+ *  @brief Faults to inject, and counts of those injected so far
+ *
+ *  Bus faults are drawn per transaction, FIFO count corruption per FIFO_COUNTH read
+ *  and magnetic overflows per AK8963 measurement; resets come at a rate. A stuck bus
+ *  fails every transaction until it clears, as a slave holding SDA low would.
+ */
+struct MPU9250SimFaults {
+    double      nak;            // probability the address is not acknowledged
+    double      stretch;        // probability the target stretches the clock
+    uint32_t    stretchUs;      // longest stretch, us
+    double      stuck;          // probability a transaction leaves SDA stuck low
+    uint32_t    stuckUs;        // how long SDA stays low, us
+    double      fifoCount;      // probability a FIFO count read has one bit flipped
+    double      reset;          // resets of the MPU9250 and AK8963 per second
+    double      overflow;       // probability an AK8963 measurement reports HOFL
+    uint32_t    naks;
+    uint32_t    stretches;
+    uint32_t    stuckEpisodes;
+    uint32_t    fifoCounts;
+    uint32_t    resets;
+    uint32_t    overflows;
+    uint64_t    state;          // fault generator
+};
+
+/** No faults, counts cleared
+ *  @param faults - filled in
+ *  @param seed - random seed for drawing faults once probabilities are set
+ */
+void MPU9250SimNoFaults(MPU9250SimFaults * faults, uint32_t seed);
+
+/**
+ *  @class MPU9250SimTarget
+ *  @brief A device answering on the simulated bus
+ */ 
+class MPU9250SimTarget {
+
+public:
+
+    virtual ~MPU9250SimTarget() {}
+
+    /** Bytes written by the master after the address
+     *  @param data - the bytes
+     *  @param length - byte count
+     *  @return false to NAK
+     */
+    virtual bool write(const uint8_t * data, int length) = 0;
+
+    /** Bytes read by the master after the address
+     *  @param data - filled in
+     *  @param length - byte count
+     *  @return false to NAK the address
+     */
+    virtual bool read(uint8_t * data, int length) = 0;
+
+};
+
+/**
+ *  @class MPU9250SimBus
+ *  @brief I2C bus of simulated targets, with transaction counts
+ *
+ *  Each transfer advances simulated time by its bus occupancy as MPU9250I2CTiming
+ *  models it, START and STOP or repeated START conditions, ACKs and bus free time
+ *  included. NAKs, clock stretching and stuck bus episodes can be injected.
+ */ 
+class MPU9250SimBus {
+
+public:
+
+    MPU9250SimBus(void);
+
+    /** Put a device on the bus
+     *  @param address - 8 bit address as mbed uses
+     *  @param target - the device
+     *  @return 0 on success, 1 if the bus is full
+     */
+    uint8_t attach(uint8_t address, MPU9250SimTarget * target);
+
+    /** Set the bus clock
+     *  @param hz - clock in Hz
+     */
+    void frequency(int hz);
+
+    /** Set the master's own time between transactions
+     *  @param ns - turnaround in ns, interrupt and driver overhead
+     */
+    void setGap(uint32_t ns);
+
+    /** Inject bus faults
+     *  @param faults - fault probabilities and counts, NULL for none
+     */
+    void setFaults(MPU9250SimFaults * faults) { _faults = faults; }
+
+    /** Watch each transaction as it completes, e.g. to put it down to what the driver was doing
+     *  @param monitor - called with whether the transaction was acknowledged and ended with a STOP, NULL for none
+     *  @param context - passed back to the monitor
+     */
+    void setMonitor(void (*monitor)(void * context, bool ok, bool stop), void * context);
+
+    /** mbed style write
+     *  @return 0 on ACK, 1 on NAK
+     */
+    int write(uint8_t address, const uint8_t * data, int length, bool repeated);
+
+    /** mbed style read
+     *  @return 0 on ACK, 1 on NAK
+     */
+    int read(uint8_t address, uint8_t * data, int length, bool repeated);
+
+    uint32_t transactions(void) const { return _transactions; }
+    uint32_t bytes(void) const { return _bytes; }
+    uint32_t naks(void) const { return _naks; }
+    uint64_t busy(void) const { return _busy; }     // ns the bus has been occupied
+
+private:
+
+    uint8_t                 _address[MPU_SIM_MAX_TARGETS];
+    MPU9250SimTarget *      _target[MPU_SIM_MAX_TARGETS];
+    uint8_t                 _count;
+    MPU9250I2CTiming        _timing;
+    uint32_t                _gap;
+    uint32_t                _transactions;
+    uint32_t                _bytes;
+    uint32_t                _naks;
+    uint64_t                _ns;            // part microsecond carried to the next transfer
+    uint64_t                _busy;
+    MPU9250SimFaults *      _faults;
+    uint64_t                _stuckUntil;
+    void                    (*_monitor)(void * context, bool ok, bool stop);
+    void *                  _monitorContext;
+
+    MPU9250SimTarget * find(uint8_t address);
+    bool transfer(int length, bool repeated);
+
+};
+
+/**
+ *  @struct MPU9250SimTruth
+ *  @brief What an ideal sensor would measure, in the accelerometer frame
+ */
+struct MPU9250SimTruth {
+    double      accel[3];       // specific force, g, +1 g on z when level
+    double      gyro[3];        // rad/s
+    double      mag[3];         // uT
+    double      temp;           // C
+    double      q[4];           // orientation, w, x, y, z, sensor to earth
+};
+
+/**
+ *  @class MPU9250SimSource
+ *  @brief Supplies the true motion for the simulated device
+ */ 
+class MPU9250SimSource {
+
+public:
+
+    virtual ~MPU9250SimSource() {}
+
+    /** True values at a time
+     *  @param t - time in s
+     *  @param truth - filled in
+     */
+    virtual void truth(double t, MPU9250SimTruth * truth) = 0;
+
+};
+
+/**
+ *  @struct MPU9250SimErrors
+ *  @brief Sensor imperfections applied before quantisation
+ *
+ *  measured = (I + scale) (I + misalign) true + bias + noise, misalign holds the
+ *  off-diagonal terms only, in rad.
+ */
+struct MPU9250SimErrors {
+    float       accelBias[3];       // g
+    float       accelScale[3];      // fraction
+    float       accelMisalign[3][3];
+    float       accelNoise;         // g / sqrt(Hz)
+    float       gyroBias[3];        // dps
+    float       gyroScale[3];
+    float       gyroMisalign[3][3];
+    float       gyroNoise;          // dps / sqrt(Hz)
+    float       magBias[3];         // uT, hard iron
+    float       magScale[3];
+    float       magNoise;           // uT rms
+    uint8_t     asa[3];             // AK8963 ASAX..Z fuse values, 128 is unity
+    float       tempOffset;         // C
+    float       tempNoise;          // C rms
+    uint32_t    seed;
+};
+
+/** Errors of an ideal part, only quantisation and saturation remain
+ *  @param errors - filled in
+ */
+void MPU9250SimIdeal(MPU9250SimErrors * errors);
+
+/** Errors of a typical part, from the datasheet typical figures
+ *  @param errors - filled in
+ *  @param seed - random seed for the noise and for picking the fixed errors
+ */
+void MPU9250SimTypical(MPU9250SimErrors * errors, uint32_t seed);
+
+/**
+ *  @class MPU9250SimMag
+ *  @brief AK8963 register model, on the auxiliary bus or the main bus in bypass
+ */ 
+class MPU9250SimMag : public MPU9250SimTarget {
+
+public:
+
+    MPU9250SimMag(void);
+
+    virtual bool write(const uint8_t * data, int length);
+
+    virtual bool read(uint8_t * data, int length);
+
+private:
+
+    friend class MPU9250SimChip;
+
+    uint8_t                 _reg[0x13];
+    uint8_t                 _pointer;
+    uint64_t                _next;          // time of the next measurement, 0 for none
+    double                  _field[3];      // uT in AK8963 axes, set by the chip
+    MPU9250SimFaults *      _faults;
+
+    void reset(void);
+    void update(uint64_t now);
+    void measure(void);
+
+};
+
+/**
+ *  @class MPU9250SimChip
+ *  @brief MPU9250 register model with sample clock, FIFO and I2C master
+ *
+ *  Attach it to a bus, which also puts its AK8963 on the bus for bypass mode.
+ *  Registers follow the datasheet reset values. Each access first brings the model
+ *  up to the simulated time, taking a sample from the source at every tick of the
+ *  configured rate. Samples go into the data registers and the FIFO, and the
+ *  enabled auxiliary slaves read into EXT_SENS_DATA. Values are scaled to the
+ *  configured ranges, with the errors applied, then rounded and saturated.
+ */ 
+class MPU9250SimChip : public MPU9250SimTarget {
+
+public:
+
+    /** Create the model
+     *  @param source - true motion
+     *  @param errors - sensor imperfections
+     */
+    MPU9250SimChip(MPU9250SimSource * source, const MPU9250SimErrors & errors);
+
+    /** Put the MPU9250 and, behind its bypass switch, the AK8963 on a bus
+     *  @param bus - the bus
+     *  @param address - 8 bit MPU9250 address
+     *  @return 0 on success
+     */
+    uint8_t attach(MPU9250SimBus & bus, uint8_t address = 0x68 << 1);
+
+    virtual bool write(const uint8_t * data, int length);
+
+    virtual bool read(uint8_t * data, int length);
+
+    /** Inject FIFO count corruption, resets and magnetic overflows
+     *  @param faults - fault probabilities and counts, NULL for none
+     */
+    void setFaults(MPU9250SimFaults * faults) { _faults = faults; _mag._faults = faults; }
+
+    /** Truth at the last sample tick
+     *  @return the truth
+     */
+    const MPU9250SimTruth & truth(void) const { return _truth; }
+
+    /** When the next sample is taken and data ready raised
+     *  @return simulated time in us
+     */
+    uint64_t nextSample(void);
+
+    /** Samples taken since creation
+     *  @return sample count
+     */
+    uint32_t samples(void) const { return _samples; }
+
+private:
+
+    friend class MPU9250SimLine;
+
+    /**
+     *  @class Bypass
+     *  @brief The AK8963 as seen on the main bus, only while bypass is on
+     */
+    class Bypass : public MPU9250SimTarget {
+    public:
+        Bypass(MPU9250SimChip * chip) : _chip(chip) {}
+        virtual bool write(const uint8_t * data, int length);
+        virtual bool read(uint8_t * data, int length);
+    private:
+        MPU9250SimChip *    _chip;
+    };
+
+    MPU9250SimSource *      _source;
+    MPU9250SimErrors        _errors;
+    MPU9250SimMag           _mag;
+    Bypass                  _bypass;
+    MPU9250SimTruth         _truth;
+    uint8_t                 _reg[128];
+    uint8_t                 _pointer;
+    uint8_t                 _fifo[MPU_SIM_FIFO_SIZE];
+    uint16_t                _fifoHead;
+    uint16_t                _fifoCount;
+    uint64_t                _next;          // time of the next sample tick
+    uint8_t                 _delayCount;
+    uint32_t                _samples;
+    uint64_t                _rng;
+    MPU9250SimFaults *      _faults;
+    uint16_t                _countLatch;    // FIFO count latched by reading FIFO_COUNTH
+    MPU9250SimLine *        _line;
+    uint8_t                 _lineIndex;
+    bool                    _pullsLow;      // INT pin as the line last saw it
+
+    void reset(void);
+    void update(void);
+    void pin(uint64_t time);
+    void tick(uint64_t time);
+    void master(void);
+    bool auxTransfer(uint8_t addr, uint8_t reg, uint8_t * data, uint8_t length, bool read);
+    void fifoPush(const uint8_t * data, uint8_t length);
+    uint8_t readByte(uint8_t reg);
+    void writeByte(uint8_t reg, uint8_t value);
+    uint32_t period(void) const;
+    double noise(double sigma);
+    int16_t counts(double value, double lsb) const;
+
+};
+
+/**
+ *  @class MPU9250SimLine
+ *  @brief An interrupt line shared by the INT pins of several simulated devices
+ *
+ *  The line is a wired-OR with a pull-up, low while any device pulls it low: an
+ *  active low INT while asserted, or an active high push-pull one, the reset state,
+ *  while not. INT is modelled latched, as the driver sets it. Devices catch up with
+ *  simulated time lazily, so their pin changes are logged with the times they fell
+ *  at and replayed in order when the line is evaluated.
+ */ 
+class MPU9250SimLine {
+
+public:
+
+    MPU9250SimLine(void);
+
+    /** Connect a device's INT pin
+     *  @param chip - the device
+     *  @return 0 on success, 1 if the line is full
+     */
+    uint8_t attach(MPU9250SimChip * chip);
+
+    /** Bring the devices up to the simulated time and replay their pin changes
+     *  @return falling edges since the last call
+     */
+    uint32_t falls(void);
+
+    /** Level at the last falls
+     *  @return true if some device holds the line low
+     */
+    bool low(void) const { return _held > 0; }
+
+    /** Pin changes dropped because the log was full, the edge count is unreliable if any
+     *  @return dropped changes
+     */
+    uint32_t lost(void) const { return _lost; }
+
+private:
+
+    friend class MPU9250SimChip;
+
+    /**
+     *  @struct Change
+     *  @brief A device's INT pin pulling the line low or letting it go
+     */
+    struct Change {
+        uint64_t    time;
+        uint8_t     device;
+        bool        low;
+    };
+
+    MPU9250SimChip *        _chip[MPU_SIM_MAX_TARGETS];
+    bool                    _pin[MPU_SIM_MAX_TARGETS];   // replayed level of each device
+    uint8_t                 _count;
+    uint8_t                 _held;          // devices holding the line low
+    Change                  _log[MPU_SIM_LINE_LOG];
+    uint16_t                _logCount;
+    uint32_t                _lost;
+
+    void change(uint8_t device, uint64_t time, bool low);
+
+};
+
+#endif
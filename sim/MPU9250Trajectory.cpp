@@ -0,0 +1,197 @@
+/* 
+ * @file    MPU9250Trajectory.cpp
+ * @brief   Host simulation - spline trajectory as a sensor source
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#include <math.h>
+#include <string.h>
+#include "MPU9250Trajectory.h"
+
+#define MPU_SIM_GRAVITY 9.80665     // m/s/s
+#define MPU_SIM_DIFF_STEP 1e-5      // s, for the angular rate
+
+static void quatMultiply(const double * a, const double * b, double * out)
+{
+    out[0] = (a[0] * b[0]) - (a[1] * b[1]) - (a[2] * b[2]) - (a[3] * b[3]);
+    out[1] = (a[0] * b[1]) + (a[1] * b[0]) + (a[2] * b[3]) - (a[3] * b[2]);
+    out[2] = (a[0] * b[2]) - (a[1] * b[3]) + (a[2] * b[0]) + (a[3] * b[1]);
+    out[3] = (a[0] * b[3]) + (a[1] * b[2]) - (a[2] * b[1]) + (a[3] * b[0]);
+}
+
+/* Earth frame vector into the sensor frame, conj(q) v q */
+static void toSensor(const double * q, const double * v, double * out)
+{
+    double c[4] = {q[0], -q[1], -q[2], -q[3]};
+    double p[4] = {0.0, v[0], v[1], v[2]};
+    double t[4];
+    double r[4];
+
+    quatMultiply(c, p, t);
+    quatMultiply(t, q, r);
+    out[0] = r[1];
+    out[1] = r[2];
+    out[2] = r[3];
+}
+
+MPU9250Trajectory::MPU9250Trajectory(const MPU9250SimKey * keys, uint16_t count, const double * field, double temp)
+    : _keys(keys, keys + count)
+{
+    double dot;
+    double n;
+
+    for (uint16_t i = 0; i < count; i++) {
+        MPU9250SimKey & k = _keys[i];
+        n = sqrt((k.q[0] * k.q[0]) + (k.q[1] * k.q[1]) + (k.q[2] * k.q[2]) + (k.q[3] * k.q[3]));
+        for (uint8_t j = 0; j < 4; j++) {
+            k.q[j] /= n;
+        }
+        // q and -q are the same rotation, keep neighbours in one hemisphere so the spline takes the short way
+        if (i > 0) {
+            dot = 0.0;
+            for (uint8_t j = 0; j < 4; j++) {
+                dot += k.q[j] * _keys[i - 1].q[j];
+            }
+            if (dot < 0.0) {
+                for (uint8_t j = 0; j < 4; j++) {
+                    k.q[j] = -k.q[j];
+                }
+            }
+        }
+    }
+    memcpy(_field, field, sizeof(_field));
+    _temp = temp;
+
+    return;
+}
+
+double MPU9250Trajectory::duration(void) const
+{
+    return _keys.empty() ? 0.0 : _keys.back().t;
+}
+
+void MPU9250Trajectory::spline(uint16_t i, double s, const double * p, const double * m, double * value, double * second,
+                               uint8_t n) const
+{
+    double h = _keys[i + 1].t - _keys[i].t;
+    double s2 = s * s;
+    double s3 = s2 * s;
+
+    for (uint8_t j = 0; j < n; j++) {
+        value[j] = (((2 * s3) - (3 * s2) + 1) * p[j]) + ((s3 - (2 * s2) + s) * h * m[j]) +
+                   (((-2 * s3) + (3 * s2)) * p[n + j]) + ((s3 - s2) * h * m[n + j]);
+        if (second != NULL) {
+            second[j] = ((((12 * s) - 6) * p[j]) + (((6 * s) - 4) * h * m[j]) + ((6 - (12 * s)) * p[n + j]) +
+                         (((6 * s) - 2) * h * m[n + j])) / (h * h);
+        }
+    }
+}
+
+void MPU9250Trajectory::pose(double t, double * position, double * acceleration, double * q) const
+{
+    uint16_t count = (uint16_t)_keys.size();
+    uint16_t i = 0;
+    double p[14];       // position then quaternion at both ends of the segment
+    double m[14];       // tangents
+    double value[7];
+    double second[7];
+    double s;
+    double n;
+
+    if ((count < 2) || (t <= _keys[0].t) || (t >= _keys[count - 1].t)) {
+        const MPU9250SimKey & k = (count < 2) || (t <= _keys[0].t) ? _keys[0] : _keys[count - 1];
+        if (position != NULL) {
+            memcpy(position, k.position, 3 * sizeof(double));
+        }
+        if (acceleration != NULL) {
+            acceleration[0] = acceleration[1] = acceleration[2] = 0.0;
+        }
+        if (q != NULL) {
+            memcpy(q, k.q, 4 * sizeof(double));
+        }
+        return;
+    }
+    while (_keys[i + 1].t <= t) {
+        i++;
+    }
+    for (uint8_t e = 0; e < 2; e++) {
+        uint16_t k = i + e;
+        uint16_t lo = (k > 0) ? (k - 1) : k;
+        uint16_t hi = (k < (count - 1)) ? (k + 1) : k;
+        double span = _keys[hi].t - _keys[lo].t;
+        for (uint8_t j = 0; j < 3; j++) {
+            p[(e * 7) + j] = _keys[k].position[j];
+            m[(e * 7) + j] = (_keys[hi].position[j] - _keys[lo].position[j]) / span;
+        }
+        for (uint8_t j = 0; j < 4; j++) {
+            p[(e * 7) + 3 + j] = _keys[k].q[j];
+            m[(e * 7) + 3 + j] = (_keys[hi].q[j] - _keys[lo].q[j]) / span;
+        }
+    }
+    s = (t - _keys[i].t) / (_keys[i + 1].t - _keys[i].t);
+    MPU9250Trajectory::spline(i, s, p, m, value, second, 7);
+
+    if (position != NULL) {
+        memcpy(position, value, 3 * sizeof(double));
+    }
+    if (acceleration != NULL) {
+        memcpy(acceleration, second, 3 * sizeof(double));
+    }
+    if (q != NULL) {
+        n = sqrt((value[3] * value[3]) + (value[4] * value[4]) + (value[5] * value[5]) + (value[6] * value[6]));
+        for (uint8_t j = 0; j < 4; j++) {
+            q[j] = value[3 + j] / n;
+        }
+    }
+}
+
+void MPU9250Trajectory::truth(double t, MPU9250SimTruth * truth)
+{
+    double a[3];
+    double before[4];
+    double after[4];
+    double conj[4];
+    double dq[4];
+    double w[4];
+    double h = MPU_SIM_DIFF_STEP;
+
+    MPU9250Trajectory::pose(t, NULL, a, truth->q);
+    // the accelerometer measures acceleration less gravity, so +1 g up at rest
+    a[0] /= MPU_SIM_GRAVITY;
+    a[1] /= MPU_SIM_GRAVITY;
+    a[2] = (a[2] / MPU_SIM_GRAVITY) + 1.0;
+    toSensor(truth->q, a, truth->accel);
+    toSensor(truth->q, _field, truth->mag);
+
+    // body rate, 2 conj(q) dq/dt
+    MPU9250Trajectory::pose(t - h, NULL, NULL, before);
+    MPU9250Trajectory::pose(t + h, NULL, NULL, after);
+    if (((before[0] * after[0]) + (before[1] * after[1]) + (before[2] * after[2]) + (before[3] * after[3])) < 0.0) {
+        for (uint8_t j = 0; j < 4; j++) {
+            after[j] = -after[j];
+        }
+    }
+    for (uint8_t j = 0; j < 4; j++) {
+        dq[j] = (after[j] - before[j]) / (2.0 * h);
+        conj[j] = (j == 0) ? truth->q[0] : -truth->q[j];
+    }
+    quatMultiply(conj, dq, w);
+    truth->gyro[0] = 2.0 * w[1];
+    truth->gyro[1] = 2.0 * w[2];
+    truth->gyro[2] = 2.0 * w[3];
+    truth->temp = _temp;
+}
@@ -0,0 +1,86 @@
+/* 
+ * @file    MPU9250Trajectory.h
+ * @brief   Host simulation - spline trajectory as a sensor source
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ */
+ 
+#ifndef MPU9250_TRAJECTORY_H
+#define MPU9250_TRAJECTORY_H
+ 
+#include <stdint.h>
+#include <vector>
+#include "MPU9250Sim.h"
+
+/**
+ *  @struct MPU9250SimKey
+ *  @brief One keyframe of a trajectory
+ */
+struct MPU9250SimKey {
+    double      t;              // s, increasing
+    double      position[3];    // m, earth frame, z up
+    double      q[4];           // orientation, w, x, y, z, sensor to earth
+};
+
+/**
+ *  @class MPU9250Trajectory
+ *  @brief Motion through keyframes, as the true input to a simulated sensor
+ *
+ *  Position and the quaternion components each follow a cubic Hermite spline with
+ *  Catmull-Rom tangents, so acceleration is continuous within a segment and the
+ *  path passes through every key. Acceleration comes from the spline's second
+ *  derivative and angular rate from the derivative of the normalised quaternion.
+ *  Before the first key and after the last the body is held still.
+ */ 
+class MPU9250Trajectory : public MPU9250SimSource {
+
+public:
+
+    /** Create the trajectory
+     *  @param keys - keyframes, at least 2, copied
+     *  @param count - number of keyframes
+     *  @param field - earth field in the earth frame, uT
+     *  @param temp - die temperature, C
+     */
+    MPU9250Trajectory(const MPU9250SimKey * keys, uint16_t count, const double * field, double temp = 25.0);
+
+    virtual void truth(double t, MPU9250SimTruth * truth);
+
+    /** Position and orientation at a time
+     *  @param t - time in s
+     *  @param position - m, or NULL
+     *  @param acceleration - m/s/s, or NULL
+     *  @param q - w, x, y, z, or NULL
+     */
+    void pose(double t, double * position, double * acceleration, double * q) const;
+
+    /** Time of the last key
+     *  @return s
+     */
+    double duration(void) const;
+
+private:
+
+    std::vector<MPU9250SimKey>  _keys;
+    double                  _field[3];
+    double                  _temp;
+
+    void spline(uint16_t segment, double s, const double * p, const double * m, double * value, double * second,
+                uint8_t n) const;
+
+};
+
+#endif
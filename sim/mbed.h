@@ -0,0 +1,139 @@
+/* 
+ * @file    mbed.h
+ * @brief   Host simulation - minimal mbed API over the simulated bus
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Put this directory ahead of the library on the include path so the unmodified
+ * driver builds on a host and talks to MPU9250SimBus instead of hardware. Only
+ * what the driver uses is provided.
+ */
+ 
+#ifndef MPU9250_SIM_MBED_H
+#define MPU9250_SIM_MBED_H
+ 
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "MPU9250Sim.h"
+
+typedef int PinName;
+
+/**
+ *  @class I2C
+ *  @brief mbed I2C master, transactions go to a simulated bus
+ */ 
+class I2C {
+
+public:
+
+    /** Attach to a simulated bus
+     *  @param bus - the bus
+     */
+    I2C(MPU9250SimBus & bus) : _bus(&bus) {}
+
+    void frequency(int hz) { _bus->frequency(hz); }
+
+    int write(int address, const char * data, int length, bool repeated = false)
+    {
+        return _bus->write((uint8_t)address, (const uint8_t *)data, length, repeated);
+    }
+
+    int read(int address, char * data, int length, bool repeated = false)
+    {
+        return _bus->read((uint8_t)address, (uint8_t *)data, length, repeated);
+    }
+
+private:
+
+    MPU9250SimBus *         _bus;
+
+};
+
+/**
+ *  @class InterruptIn
+ *  @brief mbed interrupt input, edges are raised by the simulation
+ */ 
+class InterruptIn {
+
+public:
+
+    InterruptIn(PinName pin) : _rise(NULL), _fall(NULL), _sense(NULL) { (void)pin; }
+
+    void rise(void (*handler)(void)) { _rise = handler; }
+
+    void fall(void (*handler)(void)) { _fall = handler; }
+
+    /** Pin level, from the simulation
+     *  @return the level sense gives, 1 if there is none
+     */
+    int read(void) { return (_sense != NULL) ? _sense() : 1; }
+
+    /** Have the simulation supply the pin level
+     *  @param level - returns the level, e.g. of an MPU9250SimLine
+     */
+    void sense(int (*level)(void)) { _sense = level; }
+
+    /** Raise an edge from the simulation
+     *  @param high - true for a rising edge
+     */
+    void edge(bool high)
+    {
+        if (high && (_rise != NULL)) {
+            _rise();
+        } else if (!high && (_fall != NULL)) {
+            _fall();
+        }
+    }
+
+private:
+
+    void                    (*_rise)(void);
+    void                    (*_fall)(void);
+    int                     (*_sense)(void);
+
+};
+
+inline int osDelay(uint32_t millisec)
+{
+    MPU9250SimAdvance((uint64_t)millisec * 1000);
+    return 0;
+}
+
+inline void wait_us(int us)
+{
+    MPU9250SimAdvance((uint64_t)us);
+}
+
+inline uint32_t us_ticker_read(void)
+{
+    return (uint32_t)MPU9250SimNow();
+}
+
+#define __DMB() __sync_synchronize()
+
+inline bool core_util_atomic_cas_u32(volatile uint32_t * ptr, uint32_t * expected, uint32_t desired)
+{
+    uint32_t old = __sync_val_compare_and_swap(ptr, *expected, desired);
+
+    if (old == *expected) {
+        return true;
+    }
+    *expected = old;
+    return false;
+}
+
+#endif
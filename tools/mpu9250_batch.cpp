@@ -0,0 +1,507 @@
+/* 
+ * @file    mpu9250_batch.cpp
+ * @brief   Parallel offline reprocessing of MPU9250 stream recordings
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Build on a Linux host from the library directory, e.g.
+ *     g++ -O2 -march=native -pthread -I. tools/mpu9250_batch.cpp MPU9250Stream.cpp MPU9250QuatCodec.cpp \
+ *         MPU9250Math.cpp MPU9250Fusion.cpp -o mpu9250_batch
+ * Usage: mpu9250_batch [options] -o <output directory> <recording>...
+ *     -a g        accel full scale the recordings were made at, 2, 4, 8 or 16 (2)
+ *     -g dps      gyro full scale, 250, 500, 1000 or 2000 (250)
+ *     -r Hz       sample rate (1000)
+ *     -b beta     Madgwick gain (0.9069)
+ *     -z zeta     Madgwick drift gain (0.0151)
+ *     -c file     accel calibration, 3 offsets then 9 Q14 matrix terms
+ *     -j n        threads (all cores)
+ *     -s MiB      split recordings longer than this into chunks (4)
+ *
+ * Recordings are MPU9250Stream files, memory mapped and decoded, calibrated and
+ * fused. Each output file has the same name in the output directory and holds a
+ * sample frame, calibrated, and a quaternion frame for every input sample. Other
+ * frames are not copied.
+ *
+ * Every recording is a task, and long ones several. Workers take tasks from the
+ * back of their own queue and steal from the front of the others', so a few long
+ * recordings do not leave cores idle. A chunk starts at a frame delimiter and is
+ * decoded and calibrated on its own, but fused in order with the one filter of its
+ * recording, seeded from the first accel and mag reading, so the output is the
+ * same as a single pass. A filter restarted per chunk never catches up: the gyro
+ * bias estimate is still wandering after a minute, and chunks warmed up for 48 s
+ * were 1.2 degrees out on a 300 s recording. Whichever worker decodes the next
+ * chunk in order fuses it, and the one that fuses the last writes the file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MPU9250Stream.h"
+#include "MPU9250Calibration.h"
+#include "MPU9250Fusion.h"
+
+struct Options {
+    float                   accelScale;     // g per count
+    float                   gyroScale;      // rad/s per count
+    float                   dt;
+    float                   beta;
+    float                   zeta;
+    MPU9250AccelCalibration cal;
+    bool                    calValid;
+    size_t                  chunkBytes;
+    std::string             outDir;
+};
+
+struct Result {
+    MPU9250Sample           sample;
+    float                   q[4];
+};
+
+struct Recording;
+
+struct Chunk {
+    Recording *             recording;
+    size_t                  start;
+    size_t                  end;
+    bool                    decoded;
+    std::vector<Result>     results;        // samples once decoded, quaternions once fused
+};
+
+struct Recording {
+    std::string             path;
+    const uint8_t *         data;
+    size_t                  size;
+    std::vector<Chunk>      chunks;
+    std::mutex              lock;
+    MPU9250Madgwick *       filter;         // carried from chunk to chunk
+    bool                    started;
+    bool                    fusing;
+    size_t                  fused;          // chunks fused so far
+};
+
+struct Queue {
+    std::mutex              lock;
+    std::deque<Chunk *>     tasks;
+};
+
+static Options options;
+static std::atomic<uint64_t> samplesDone(0);
+static std::atomic<uint64_t> steals(0);
+static std::atomic<int> failures(0);
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Start of the frame after the first delimiter at or after offset */
+static size_t frameStart(const Recording & r, size_t offset)
+{
+    const void * zero;
+
+    if (offset == 0) {
+        return 0;
+    }
+    if (offset >= r.size) {
+        return r.size;
+    }
+    zero = memchr(r.data + offset - 1, 0, r.size - offset + 1);
+    return (zero == NULL) ? r.size : (size_t)((const uint8_t *)zero - r.data) + 1;
+}
+
+/* Orientation from one accel and mag reading, so a recording starts near the answer
+   rather than relying on the filter to climb out from identity */
+static void initialOrientation(MPU9250Fusion & filter, const float * a, const float * m)
+{
+    float x[3], y[3], z[3];
+    float r[3][3];
+    float q[4];
+    float n;
+    float t;
+
+    // rows of the sensor to earth rotation: north, west and up seen from the sensor
+    n = sqrtf((a[0] * a[0]) + (a[1] * a[1]) + (a[2] * a[2]));
+    for (int i = 0; i < 3; i++) {
+        z[i] = a[i] / n;
+    }
+    y[0] = (z[1] * m[2]) - (z[2] * m[1]);
+    y[1] = (z[2] * m[0]) - (z[0] * m[2]);
+    y[2] = (z[0] * m[1]) - (z[1] * m[0]);
+    n = sqrtf((y[0] * y[0]) + (y[1] * y[1]) + (y[2] * y[2]));
+    if ((n == 0.0f) || (z[0] != z[0])) {
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        y[i] /= n;
+    }
+    x[0] = (y[1] * z[2]) - (y[2] * z[1]);
+    x[1] = (y[2] * z[0]) - (y[0] * z[2]);
+    x[2] = (y[0] * z[1]) - (y[1] * z[0]);
+    for (int i = 0; i < 3; i++) {
+        r[0][i] = x[i];
+        r[1][i] = y[i];
+        r[2][i] = z[i];
+    }
+
+    // largest pivot keeps the conversion well conditioned
+    t = r[0][0] + r[1][1] + r[2][2];
+    if (t > 0.0f) {
+        n = 0.5f / sqrtf(t + 1.0f);
+        q[0] = 0.25f / n;
+        q[1] = (r[2][1] - r[1][2]) * n;
+        q[2] = (r[0][2] - r[2][0]) * n;
+        q[3] = (r[1][0] - r[0][1]) * n;
+    } else if ((r[0][0] > r[1][1]) && (r[0][0] > r[2][2])) {
+        n = 2.0f * sqrtf(1.0f + r[0][0] - r[1][1] - r[2][2]);
+        q[0] = (r[2][1] - r[1][2]) / n;
+        q[1] = 0.25f * n;
+        q[2] = (r[0][1] + r[1][0]) / n;
+        q[3] = (r[0][2] + r[2][0]) / n;
+    } else if (r[1][1] > r[2][2]) {
+        n = 2.0f * sqrtf(1.0f + r[1][1] - r[0][0] - r[2][2]);
+        q[0] = (r[0][2] - r[2][0]) / n;
+        q[1] = (r[0][1] + r[1][0]) / n;
+        q[2] = 0.25f * n;
+        q[3] = (r[1][2] + r[2][1]) / n;
+    } else {
+        n = 2.0f * sqrtf(1.0f + r[2][2] - r[0][0] - r[1][1]);
+        q[0] = (r[1][0] - r[0][1]) / n;
+        q[1] = (r[0][2] + r[2][0]) / n;
+        q[2] = (r[1][2] + r[2][1]) / n;
+        q[3] = 0.25f * n;
+    }
+    filter.setQuaternion(q);
+}
+
+static void decodeChunk(Chunk & c)
+{
+    const Recording & r = *c.recording;
+    MPU9250StreamDecoder decoder;
+    Result result;
+    int16_t accel[3];
+
+    c.results.reserve((c.end - c.start) / 40);
+    for (size_t pos = c.start; pos < c.end; pos++) {
+        if (!decoder.push(r.data[pos]) || !decoder.sample(&result.sample)) {
+            continue;
+        }
+        MPU9250Sample & s = result.sample;
+        if ((s.channels & (MPU_CH_ACCEL | MPU_CH_GYRO)) != (MPU_CH_ACCEL | MPU_CH_GYRO)) {
+            continue;
+        }
+        if (options.calValid) {
+            MPU9250ApplyCalibration(&options.cal, s.accel, accel);
+            memcpy(s.accel, accel, sizeof(accel));
+        }
+        c.results.push_back(result);
+    }
+}
+
+static void fuseChunk(Recording & r, Chunk & c)
+{
+    MPU9250Madgwick & filter = *r.filter;
+
+    for (size_t i = 0; i < c.results.size(); i++) {
+        const MPU9250Sample & s = c.results[i].sample;
+        float ax = s.accel[0] * options.accelScale;
+        float ay = s.accel[1] * options.accelScale;
+        float az = s.accel[2] * options.accelScale;
+        float gx = s.gyro[0] * options.gyroScale;
+        float gy = s.gyro[1] * options.gyroScale;
+        float gz = s.gyro[2] * options.gyroScale;
+        if (s.channels & MPU_CH_MAG) {
+            // AK8963 axes into the accel frame
+            float a[3] = {ax, ay, az};
+            float m[3] = {(float)s.mag[1], (float)s.mag[0], (float)-s.mag[2]};
+            if (!r.started) {
+                initialOrientation(filter, a, m);
+                r.started = true;
+            }
+            filter.update(ax, ay, az, gx, gy, gz, m[0], m[1], m[2], options.dt);
+        } else {
+            filter.updateIMU(ax, ay, az, gx, gy, gz, options.dt);
+        }
+        memcpy(c.results[i].q, filter.quaternion(), sizeof(c.results[i].q));
+    }
+}
+
+/* Mark a chunk decoded and fuse every chunk now ready in order, unless another
+   worker is already doing so and will find it. True once the last is fused. */
+static bool fuseReady(Chunk & c)
+{
+    Recording & r = *c.recording;
+    std::unique_lock<std::mutex> guard(r.lock);
+
+    c.decoded = true;
+    if (r.fusing) {
+        return false;
+    }
+    r.fusing = true;
+    while ((r.fused < r.chunks.size()) && r.chunks[r.fused].decoded) {
+        Chunk & next = r.chunks[r.fused];
+        guard.unlock();
+        fuseChunk(r, next);
+        guard.lock();
+        r.fused++;
+    }
+    r.fusing = false;
+    return (r.fused == r.chunks.size());
+}
+
+static void writeRecording(Recording & r)
+{
+    static const size_t size = 1 << 15;
+    std::vector<uint8_t> buffer(size);
+    MPU9250StreamEncoder encoder(&buffer[0], NULL, size);
+    std::string path = options.outDir + "/" + r.path.substr(r.path.find_last_of('/') + 1);
+    const uint8_t * data;
+    uint64_t samples = 0;
+    uint16_t length;
+    FILE * f;
+
+    f = fopen(path.c_str(), "wb");
+    if (f == NULL) {
+        perror(path.c_str());
+        failures++;
+        return;
+    }
+    for (size_t i = 0; i < r.chunks.size(); i++) {
+        std::vector<Result> & results = r.chunks[i].results;
+        for (size_t j = 0; j < results.size(); j++) {
+            if (encoder.pending() > (size - (2 * MPU_STREAM_MAX_FRAME))) {
+                length = encoder.flip(&data);
+                fwrite(data, 1, length, f);
+            }
+            encoder.sample(results[j].sample, 0);
+            encoder.quaternion(results[j].q, 0);
+        }
+        samples += results.size();
+        std::vector<Result>().swap(results);
+    }
+    length = encoder.flip(&data);
+    fwrite(data, 1, length, f);
+    if (fclose(f) != 0) {
+        perror(path.c_str());
+        failures++;
+    }
+    samplesDone += samples;
+}
+
+static Chunk * take(std::vector<Queue> & queues, size_t self)
+{
+    Chunk * c = NULL;
+
+    {
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        if (!queues[self].tasks.empty()) {
+            c = queues[self].tasks.back();
+            queues[self].tasks.pop_back();
+            return c;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue & victim = queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            c = victim.tasks.front();
+            victim.tasks.pop_front();
+            steals++;
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void worker(std::vector<Queue> * queues, size_t self)
+{
+    Chunk * c;
+
+    while ((c = take(*queues, self)) != NULL) {
+        decodeChunk(*c);
+        if (fuseReady(*c)) {
+            writeRecording(*c->recording);
+        }
+    }
+}
+
+static bool readCalibration(const char * path, MPU9250AccelCalibration * cal)
+{
+    FILE * f = fopen(path, "r");
+    int v[12];
+    int n = 0;
+
+    if (f == NULL) {
+        return false;
+    }
+    while ((n < 12) && (fscanf(f, "%d", &v[n]) == 1)) {
+        n++;
+    }
+    fclose(f);
+    if (n != 12) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        cal->offset[i] = (int16_t)v[i];
+        for (int j = 0; j < 3; j++) {
+            cal->matrix[i][j] = (int16_t)v[3 + (i * 3) + j];
+        }
+    }
+    return true;
+}
+
+static int usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-a g] [-g dps] [-r Hz] [-b beta] [-z zeta] [-c calibration] [-j threads]\n"
+            "       [-s MiB] -o <output directory> <recording>...\n", name);
+    return 2;
+}
+
+int main(int argc, char ** argv)
+{
+    int accelRange = 2;
+    int gyroRange = 250;
+    float rate = 1000.0f;
+    size_t threads = std::thread::hardware_concurrency();
+    std::vector<Recording *> recordings;
+    std::vector<Queue> * queues;
+    std::vector<std::thread> pool;
+    size_t next = 0;
+    size_t bytes = 0;
+    double t;
+    int opt;
+
+    options.beta = 0.9068997f;
+    options.zeta = 0.0151150f;
+    options.calValid = false;
+    options.chunkBytes = (size_t)4 << 20;
+    while ((opt = getopt(argc, argv, "a:g:r:b:z:c:j:s:o:")) != -1) {
+        switch (opt) {
+            case 'a': accelRange = atoi(optarg); break;
+            case 'g': gyroRange = atoi(optarg); break;
+            case 'r': rate = (float)atof(optarg); break;
+            case 'b': options.beta = (float)atof(optarg); break;
+            case 'z': options.zeta = (float)atof(optarg); break;
+            case 'c':
+                if (!readCalibration(optarg, &options.cal)) {
+                    fprintf(stderr, "%s: expected 12 integers\n", optarg);
+                    return 1;
+                }
+                options.calValid = true;
+                break;
+            case 'j': threads = (size_t)atoi(optarg); break;
+            case 's': options.chunkBytes = (size_t)(atof(optarg) * (1 << 20)); break;
+            case 'o': options.outDir = optarg; break;
+            default: return usage(argv[0]);
+        }
+    }
+    if (options.outDir.empty() || (optind >= argc) || (rate <= 0.0f) || (options.chunkBytes == 0) ||
+        ((accelRange != 2) && (accelRange != 4) && (accelRange != 8) && (accelRange != 16)) ||
+        ((gyroRange != 250) && (gyroRange != 500) && (gyroRange != 1000) && (gyroRange != 2000))) {
+        return usage(argv[0]);
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    options.accelScale = accelRange / 32768.0f;
+    options.gyroScale = gyroRange / 32768.0f * (float)(M_PI / 180.0);
+    options.dt = 1.0f / rate;
+    // MPU9250::ASCALE, the calibration file is taken to match the recordings
+    options.cal.ascale = (uint8_t)(((accelRange == 16) ? 3 : (accelRange == 8) ? 2 : (accelRange == 4) ? 1 : 0) << 3);
+
+    for (int a = optind; a < argc; a++) {
+        struct stat st;
+        int fd = open(argv[a], O_RDONLY);
+        if ((fd < 0) || (fstat(fd, &st) != 0)) {
+            perror(argv[a]);
+            return 1;
+        }
+        Recording * r = new Recording;
+        r->path = argv[a];
+        r->size = (size_t)st.st_size;
+        r->data = NULL;
+        r->filter = new MPU9250Madgwick(options.beta, options.zeta);
+        r->started = false;
+        r->fusing = false;
+        r->fused = 0;
+        if (r->size != 0) {
+            void * map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                perror(argv[a]);
+                return 1;
+            }
+            madvise(map, r->size, MADV_SEQUENTIAL);
+            r->data = (const uint8_t *)map;
+        }
+        close(fd);
+        for (size_t start = 0; (start < r->size) || r->chunks.empty();) {
+            Chunk c;
+            size_t end = frameStart(*r, start + options.chunkBytes);
+            c.recording = r;
+            c.start = start;
+            c.end = end;
+            c.decoded = false;
+            r->chunks.push_back(c);
+            start = end;
+        }
+        bytes += r->size;
+        recordings.push_back(r);
+    }
+
+    // deal the tasks out round robin, stealing evens out the rest; each worker takes
+    // its own earliest chunk first so fusion can follow, thieves take the latest
+    queues = new std::vector<Queue>(threads);
+    for (size_t i = 0; i < recordings.size(); i++) {
+        for (size_t j = 0; j < recordings[i]->chunks.size(); j++) {
+            (*queues)[next++ % threads].tasks.push_front(&recordings[i]->chunks[j]);
+        }
+    }
+
+    t = now();
+    for (size_t i = 0; i < threads; i++) {
+        pool.push_back(std::thread(worker, queues, i));
+    }
+    for (size_t i = 0; i < threads; i++) {
+        pool[i].join();
+    }
+    t = now() - t;
+
+    fprintf(stderr, "%zu recordings, %.1f MiB, %llu samples in %.3f s on %zu threads: %.2f Msamples/s, %llu steals\n",
+            recordings.size(), bytes / 1048576.0, (unsigned long long)samplesDone.load(), t, threads,
+            samplesDone.load() / t / 1e6, (unsigned long long)steals.load());
+
+    for (size_t i = 0; i < recordings.size(); i++) {
+        if (recordings[i]->data != NULL) {
+            munmap((void *)recordings[i]->data, recordings[i]->size);
+        }
+        delete recordings[i]->filter;
+        delete recordings[i];
+    }
+    delete queues;
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,685 @@
+/* 
+ * @file    mpu9250_bench.cpp
+ * @brief   Host benchmarks for the MPU9250 driver library
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Build on the host from the library directory, e.g.
+ *     g++ -O2 -march=native -pthread -I. -Isim tools/mpu9250_bench.cpp MPU9250Calibration.cpp \
+ *         MPU9250CalKernel.cpp MPU9250Math.cpp MPU9250Fusion.cpp MPU9250Format.cpp MPU9250Pool.cpp \
+ *         sim/MPU9250BusTiming.cpp -o mpu9250_bench
+ * Run with no arguments for every benchmark, or name the ones wanted.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <random>
+
+#include "MPU9250Calibration.h"
+#include "MPU9250CalKernel.h"
+#include "MPU9250Math.h"
+#include "MPU9250Fusion.h"
+#include "MPU9250Format.h"
+#include "MPU9250BusTiming.h"
+#include "MPU9250Pool.h"
+#include "MPU9250Capture.h"
+#include "MPU9250Decode.h"
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char * name, double seconds, double samples)
+{
+    printf("  %-32s %8.2f Msamples/s  %7.2f ns/sample\n", name, samples / seconds / 1e6, seconds * 1e9 / samples);
+}
+
+// volatile sink so results are not optimised away
+static volatile int32_t sink;
+
+/* Calibration kernel: batch y = M (x - b) against the per sample function */
+static int benchCalKernel(void)
+{
+    const uint32_t n = 4096;
+    const int reps = 2000;
+    std::vector<int16_t> x(n), y(n), z(n), ox(n), oy(n), oz(n), rx(n), ry(n), rz(n);
+    std::vector<float> fx(n), fy(n), fz(n), fox(n), foy(n), foz(n);
+    MPU9250AccelCalibration cal = {{120, -45, 310}, {{16711, 205, -98}, {51, 16056, 33}, {-80, 119, 16547}}, 0};
+    MPU9250CalibrationF calf;
+    uint32_t mismatch = 0;
+    double t;
+
+    srand(1);
+    for (uint32_t i = 0; i < n; i++) {
+        x[i] = (int16_t)((rand() % 40000) - 20000);
+        y[i] = (int16_t)((rand() % 40000) - 20000);
+        z[i] = (int16_t)((rand() % 40000) - 20000);
+        fx[i] = x[i];
+        fy[i] = y[i];
+        fz[i] = z[i];
+    }
+    for (int i = 0; i < 3; i++) {
+        calf.offset[i] = cal.offset[i];
+        for (int j = 0; j < 3; j++) {
+            calf.matrix[i][j] = cal.matrix[i][j] / 16384.0f;
+        }
+    }
+
+    printf("calibration kernel, %u samples x %d\n", n, reps);
+    t = now();
+    for (int r = 0; r < reps; r++) {
+        for (uint32_t i = 0; i < n; i++) {
+            int16_t in[3] = {x[i], y[i], z[i]};
+            int16_t out[3];
+            MPU9250ApplyCalibration(&cal, in, out);
+            rx[i] = out[0];
+            ry[i] = out[1];
+            rz[i] = out[2];
+        }
+        sink = rx[r % n];
+    }
+    report("fixed, per sample", now() - t, (double)n * reps);
+    t = now();
+    for (int r = 0; r < reps; r++) {
+        MPU9250CalibrateBatch(&cal, &x[0], &y[0], &z[0], &ox[0], &oy[0], &oz[0], n);
+        sink = ox[r % n];
+    }
+    report("fixed, batch", now() - t, (double)n * reps);
+    for (uint32_t i = 0; i < n; i++) {
+        mismatch += (ox[i] != rx[i]) + (oy[i] != ry[i]) + (oz[i] != rz[i]);
+    }
+    t = now();
+    for (int r = 0; r < reps; r++) {
+        for (uint32_t i = 0; i < n; i++) {
+            float d0 = fx[i] - calf.offset[0], d1 = fy[i] - calf.offset[1], d2 = fz[i] - calf.offset[2];
+            fox[i] = (calf.matrix[0][0] * d0) + (calf.matrix[0][1] * d1) + (calf.matrix[0][2] * d2);
+            foy[i] = (calf.matrix[1][0] * d0) + (calf.matrix[1][1] * d1) + (calf.matrix[1][2] * d2);
+            foz[i] = (calf.matrix[2][0] * d0) + (calf.matrix[2][1] * d1) + (calf.matrix[2][2] * d2);
+            // stop the compiler fusing the reference loop into a vector loop
+            __asm__ volatile("" ::: "memory");
+        }
+        sink = (int32_t)fox[r % n];
+    }
+    report("float, per sample", now() - t, (double)n * reps);
+    t = now();
+    for (int r = 0; r < reps; r++) {
+        MPU9250CalibrateBatchF(&calf, &fx[0], &fy[0], &fz[0], &fox[0], &foy[0], &foz[0], n);
+        sink = (int32_t)fox[r % n];
+    }
+    report("float, batch", now() - t, (double)n * reps);
+    printf("  fixed batch mismatches against per sample: %u\n", mismatch);
+    return (mismatch == 0) ? 0 : 1;
+}
+
+/* Fast maths: max error over a sweep and speed against libm */
+static int benchMath(void)
+{
+    const int n = 1 << 20;
+    std::vector<float> a(n), b(n);
+    double err;
+    double t;
+    float acc;
+    float s, c;
+
+    printf("fast maths, %d arguments\n", n);
+    srand(2);
+    for (int i = 0; i < n; i++) {
+        a[i] = ((float)rand() / RAND_MAX * 2.0f) - 1.0f;
+        b[i] = ((float)rand() / RAND_MAX * 2.0f) - 1.0f;
+    }
+
+    err = 0.0;
+    for (double x = 1e-6; x < 1e6; x *= 1.0001) {
+        err = fmax(err, fabs(MPU9250Rsqrt((float)x) * sqrt(x) - 1.0));
+    }
+    printf("  rsqrt   max rel error %.2e\n", err);
+    err = 0.0;
+    for (int i = 0; i < 4000000; i++) {
+        double ang = (2.0 * M_PI * i) / 4000000;
+        for (double r = 0.001; r < 1000; r *= 10) {
+            err = fmax(err, fabs(MPU9250Atan2((float)(r * sin(ang)), (float)(r * cos(ang))) - atan2((float)(r * sin(ang)), (float)(r * cos(ang)))));
+        }
+        i += 3;
+    }
+    printf("  atan2   max abs error %.2e rad\n", err);
+    err = 0.0;
+    for (double x = -1.0; x <= 1.0; x += 1e-7) {
+        err = fmax(err, fabs(MPU9250Asin((float)x) - asin((float)x)));
+    }
+    printf("  asin    max abs error %.2e rad\n", err);
+    err = 0.0;
+    for (double x = -20.0; x <= 20.0; x += 1e-6) {
+        MPU9250SinCos((float)x, &s, &c);
+        err = fmax(err, fmax(fabs(s - sin((float)x)), fabs(c - cos((float)x))));
+    }
+    printf("  sincos  max abs error %.2e\n", err);
+
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += 1.0f / sqrtf(fabsf(a[i]) + 0.5f);
+    }
+    sink = (int32_t)acc;
+    report("libm 1/sqrtf", now() - t, n);
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += MPU9250Rsqrt(fabsf(a[i]) + 0.5f);
+    }
+    sink = (int32_t)acc;
+    report("MPU9250Rsqrt", now() - t, n);
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += atan2f(a[i], b[i]);
+    }
+    sink = (int32_t)acc;
+    report("libm atan2f", now() - t, n);
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += MPU9250Atan2(a[i], b[i]);
+    }
+    sink = (int32_t)acc;
+    report("MPU9250Atan2", now() - t, n);
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += asinf(a[i]);
+    }
+    sink = (int32_t)acc;
+    report("libm asinf", now() - t, n);
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += MPU9250Asin(a[i]);
+    }
+    sink = (int32_t)acc;
+    report("MPU9250Asin", now() - t, n);
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += sinf(a[i] * 4.0f) + cosf(a[i] * 4.0f);
+    }
+    sink = (int32_t)acc;
+    report("libm sinf + cosf", now() - t, n);
+    t = now();
+    acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        MPU9250SinCos(a[i] * 4.0f, &s, &c);
+        acc += s + c;
+    }
+    sink = (int32_t)acc;
+    report("MPU9250SinCos", now() - t, n);
+    return 0;
+}
+
+/* Fusion: update rate of each filter over a slowly rotating synthetic input */
+static int benchFusion(void)
+{
+    const int n = 1 << 20;
+    MPU9250Madgwick madgwick, madgwickAdaptive;
+    MPU9250Mahony mahony, mahonyAdaptive;
+    MPU9250Fusion *filters[4] = {&madgwick, &madgwickAdaptive, &mahony, &mahonyAdaptive};
+    const char *names[4] = {"Madgwick 9 axis", "Madgwick 9 axis, adaptive", "Mahony 9 axis", "Mahony 9 axis, adaptive"};
+    std::vector<float> in(n * 9);
+    float yaw, pitch, roll;
+    double t;
+
+    printf("fusion, %d updates\n", n);
+    for (int i = 0; i < n; i++) {
+        float a = i * 1e-4f;
+        float *v = &in[i * 9];
+        v[0] = 0.1f * sinf(a);
+        v[1] = 0.1f * cosf(a);
+        v[2] = 1.0f;
+        v[3] = 0.01f;
+        v[4] = -0.02f;
+        v[5] = 0.1f;
+        v[6] = 20.0f * cosf(a);
+        v[7] = -20.0f * sinf(a);
+        v[8] = -40.0f;
+    }
+    madgwickAdaptive.setAdaptive(1.0f, 0.15f, 44.7f, 0.2f);
+    mahonyAdaptive.setAdaptive(1.0f, 0.15f, 44.7f, 0.2f);
+    for (int f = 0; f < 4; f++) {
+        t = now();
+        for (int i = 0; i < n; i++) {
+            const float *v = &in[i * 9];
+            filters[f]->update(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], 0.001f);
+        }
+        report(names[f], now() - t, n);
+        filters[f]->euler(&yaw, &pitch, &roll);
+        sink = (int32_t)(yaw + pitch + roll);
+    }
+    return 0;
+}
+
+/**
+ *  @struct RuntimeDecode
+ *  @brief Ranges and mounting held in variables, as a driver configured at run time has them
+ */
+struct RuntimeDecode {
+    uint8_t                         ascale;
+    uint8_t                         gscale;
+    uint8_t                         axis[3];    // MPU_AXIS_ codes
+    const MPU9250AccelCalibration   *cal;
+};
+
+/* Decode, calibrate, rotate and scale bursts with the ranges and axes looked up at run time */
+static void __attribute__((noinline)) decodeRuntime(const RuntimeDecode & d, const uint8_t * raw, uint32_t n,
+                                                    float (*g)[3], float (*w)[3])
+{
+    for (uint32_t i = 0; i < n; i++, raw += 14) {
+        int16_t a[3] = {MPU9250Counts(&raw[0]), MPU9250Counts(&raw[2]), MPU9250Counts(&raw[4])};
+        int16_t r[3] = {MPU9250Counts(&raw[8]), MPU9250Counts(&raw[10]), MPU9250Counts(&raw[12])};
+        float as;
+        float gs;
+        if (d.cal != NULL) {
+            MPU9250ApplyCalibration(d.cal, a, a);
+        }
+        switch (d.ascale) {
+            case MPU9250::AFS_2G: as = 2.0f / 32768.0f; break;
+            case MPU9250::AFS_4G: as = 4.0f / 32768.0f; break;
+            case MPU9250::AFS_8G: as = 8.0f / 32768.0f; break;
+            default: as = 16.0f / 32768.0f; break;
+        }
+        switch (d.gscale) {
+            case MPU9250::GFS_250DPS: gs = 250.0f / 32768.0f; break;
+            case MPU9250::GFS_500DPS: gs = 500.0f / 32768.0f; break;
+            case MPU9250::GFS_1000DPS: gs = 1000.0f / 32768.0f; break;
+            default: gs = 2000.0f / 32768.0f; break;
+        }
+        gs *= 0.0174532925f;
+        for (uint8_t j = 0; j < 3; j++) {
+            float sign = (d.axis[j] & MPU_AXIS_NEG) ? -1.0f : 1.0f;
+            g[i][j] = sign * a[d.axis[j] & 3] * as;
+            w[i][j] = sign * r[d.axis[j] & 3] * gs;
+        }
+    }
+}
+
+/* The same through MPU9250FastPath, everything but the calibration fixed at compile time */
+template <class P> static void __attribute__((noinline)) decodeFast(const MPU9250AccelCalibration * cal, const uint8_t * raw,
+                                                                     uint32_t n, float (*g)[3], float (*w)[3])
+{
+    for (uint32_t i = 0; i < n; i++, raw += 14) {
+        P::burst(raw, cal, g[i], w[i]);
+    }
+}
+
+/* Decode fast path: templated ranges and orientation against the same work configured at run time */
+static int benchDecode(void)
+{
+    typedef MPU9250FastPath<MPU9250::AFS_4G, MPU9250::GFS_500DPS, MPU_AXIS_Y, MPU_AXIS_X, MPU_AXIS_Z | MPU_AXIS_NEG> Path;
+    const uint32_t n = 4096;
+    const int reps = 2000;
+    MPU9250AccelCalibration cal = {{120, -45, 310}, {{16711, 205, -98}, {51, 16056, 33}, {-80, 119, 16547}}, MPU9250::AFS_4G};
+    RuntimeDecode d = {MPU9250::AFS_4G, MPU9250::GFS_500DPS, {MPU_AXIS_Y, MPU_AXIS_X, MPU_AXIS_Z | MPU_AXIS_NEG}, &cal};
+    std::vector<uint8_t> raw(n * 14);
+    std::vector<float> g0(n * 3), w0(n * 3), g1(n * 3), w1(n * 3);
+    double diff = 0.0;
+    double t;
+
+    srand(5);
+    for (size_t i = 0; i < raw.size(); i++) {
+        raw[i] = (uint8_t)rand();
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        d.cal = pass ? &cal : NULL;
+        t = now();
+        for (int r = 0; r < reps; r++) {
+            decodeRuntime(d, &raw[0], n, (float (*)[3])&g0[0], (float (*)[3])&w0[0]);
+        }
+        report(pass ? "run time, with calibration" : "run time, no calibration", now() - t, (double)n * reps);
+        t = now();
+        for (int r = 0; r < reps; r++) {
+            decodeFast<Path>(d.cal, &raw[0], n, (float (*)[3])&g1[0], (float (*)[3])&w1[0]);
+        }
+        report(pass ? "MPU9250FastPath, with calibration" : "MPU9250FastPath, no calibration", now() - t, (double)n * reps);
+        for (size_t i = 0; i < g0.size(); i++) {
+            diff = std::max(diff, (double)fabsf(g0[i] - g1[i]) + fabsf(w0[i] - w1[i]));
+        }
+    }
+    printf("  largest difference between the two %.3g\n", diff);
+    return (diff < 1e-5) ? 0 : 1;
+}
+
+/* Text output: fixed point formatter against snprintf of the same fields as floats */
+static int benchFormat(void)
+{
+    const int n = 1 << 18;
+    MPU9250Format csv(0x08, 0x08, MPU_FORMAT_CSV);
+    MPU9250Format columns(0x08, 0x08, MPU_FORMAT_COLUMNS);
+    std::vector<MPU9250Sample> samples(n);
+    char line[MPU_FORMAT_MAX_LINE];
+    float q[4] = {0.7071f, -0.0123f, 0.5f, -0.5f};
+    size_t chars = 0;
+    double t;
+
+    printf("text output, %d lines\n", n);
+    srand(3);
+    for (int i = 0; i < n; i++) {
+        samples[i].seq = i;
+        samples[i].channels = MPU_CH_ALL;
+        for (int j = 0; j < 3; j++) {
+            samples[i].accel[j] = (int16_t)((rand() % 65536) - 32768);
+            samples[i].gyro[j] = (int16_t)((rand() % 65536) - 32768);
+            samples[i].mag[j] = (int16_t)((rand() % 9000) - 4500);
+        }
+        samples[i].temp = (int16_t)((rand() % 20000) - 10000);
+    }
+
+    t = now();
+    for (int i = 0; i < n; i++) {
+        const MPU9250Sample &s = samples[i];
+        chars += snprintf(line, sizeof(line), "%u,%.4f,%.4f,%.4f,%.2f,%.2f,%.2f,%.1f,%.1f,%.1f,%.2f,%.4f,%.4f,%.4f,%.4f\n",
+                          (unsigned)s.seq, s.accel[0] * (4.0f / 32768), s.accel[1] * (4.0f / 32768),
+                          s.accel[2] * (4.0f / 32768), s.gyro[0] * (500.0f / 32768), s.gyro[1] * (500.0f / 32768),
+                          s.gyro[2] * (500.0f / 32768), s.mag[0] * 0.1f, s.mag[1] * 0.1f, s.mag[2] * 0.1f,
+                          (s.temp / 333.87f) + 21.0f, q[0], q[1], q[2], q[3]);
+    }
+    report("snprintf, CSV", now() - t, n);
+    t = now();
+    for (int i = 0; i < n; i++) {
+        chars += csv.line(samples[i], q, line, sizeof(line));
+    }
+    report("formatter, CSV", now() - t, n);
+    t = now();
+    for (int i = 0; i < n; i++) {
+        chars += columns.line(samples[i], q, line, sizeof(line));
+    }
+    report("formatter, columns", now() - t, n);
+    sink = (int32_t)chars;
+
+    csv.line(samples[0], q, line, sizeof(line));
+    printf("  %s", line);
+    columns.header(line, sizeof(line));
+    printf("  %s", line);
+    columns.line(samples[0], q, line, sizeof(line));
+    printf("  %s", line);
+
+    // every field within half its last digit of the exact value, at every range, over full scale counts
+    static const double lsb[15] = {1, 1e-4, 1e-4, 1e-4, 1e-2, 1e-2, 1e-2, 0.1, 0.1, 0.1, 1e-2, 1e-4, 1e-4, 1e-4, 1e-4};
+    uint32_t lines = 0;
+    uint32_t wrong = 0;
+    double worst = 0.0;
+    for (uint8_t a = 0; a < 4; a++) {
+        for (uint8_t g = 0; g < 4; g++) {
+            MPU9250Format f((uint8_t)(a << 3), (uint8_t)(g << 3), MPU_FORMAT_CSV);
+            double ga = (double)(2 << a) / 32768.0;
+            double gg = (double)(250 << g) / 32768.0;
+            for (int i = 0; i < 200000; i++) {
+                MPU9250Sample s;
+                double exact[15];
+                char * p = line;
+                bool ok = true;
+                s.seq = i;
+                s.channels = MPU_CH_ALL;
+                for (int j = 0; j < 3; j++) {
+                    s.accel[j] = (int16_t)((rand() % 65536) - 32768);
+                    s.gyro[j] = (int16_t)((rand() % 65536) - 32768);
+                    s.mag[j] = (int16_t)((rand() % 9000) - 4500);
+                    exact[1 + j] = s.accel[j] * ga;
+                    exact[4 + j] = s.gyro[j] * gg;
+                    exact[7 + j] = s.mag[j] * 0.1;
+                }
+                s.temp = (int16_t)((rand() % 65536) - 32768);
+                exact[0] = i;
+                exact[10] = (s.temp / 333.87) + 21.0;
+                for (int j = 0; j < 4; j++) {
+                    exact[11 + j] = q[j];
+                }
+                f.line(s, q, line, sizeof(line));
+                for (int k = 0; k < 15; k++) {
+                    double e = fabs(strtod(p, &p) - exact[k]) / lsb[k];
+                    worst = (e > worst) ? e : worst;
+                    ok &= (e <= 0.5 + 1e-6);
+                    p += (*p == ',') ? 1 : 0;
+                }
+                wrong += ok ? 0 : 1;
+                lines++;
+            }
+        }
+    }
+    printf("  %u lines at all 16 ranges, %u with a field more than half a digit out, worst %.3f digits\n",
+           (unsigned)lines, (unsigned)wrong, worst);
+    return (wrong == 0) ? 0 : 1;
+}
+
+/**
+ *  @struct BusStep
+ *  @brief One register access of an acquisition strategy
+ */
+struct BusStep {
+    bool        write;
+    uint16_t    bytes;
+    float       perSample;      // accesses per sample, fractions for the magnetometer or a FIFO batch
+};
+
+/**
+ *  @struct BusStrategy
+ *  @brief How a sample is fetched, as register accesses
+ */
+struct BusStrategy {
+    const char  *name;
+    bool        bypass;         // reaches the AK8963 directly, so I2C only
+    BusStep     steps[5];
+    uint8_t     count;
+};
+
+template <class T> static double busPerSample(const T & bus, const BusStrategy & s)
+{
+    double ns = 0.0;
+
+    for (uint8_t i = 0; i < s.count; i++) {
+        ns += s.steps[i].perSample * (s.steps[i].write ? bus.registerWrite(s.steps[i].bytes) : bus.registerRead(s.steps[i].bytes));
+    }
+    return ns * 1e-3;
+}
+
+/* Bus time per sample for each acquisition strategy, modelled, at a 1 kHz sample rate */
+static int benchBus(void)
+{
+    // 100 Hz magnetometer at 1 kHz, FIFO frames of accel, temp, gyro and 8 magnetometer bytes
+    const float mag = 0.1f;
+    const float batch = 1.0f / 32;
+    static const BusStrategy strategies[] = {
+        {"separate reads, bypass mag", true, {{false, 6, 1.0f}, {false, 6, 1.0f}, {false, 1, 1.0f}, {false, 7, mag}, {true, 1, mag}}, 5},
+        {"publish burst, bypass mag", true, {{false, 14, 1.0f}, {false, 1, 1.0f}, {false, 7, mag}, {true, 1, mag}}, 4},
+        {"sensor hub burst", false, {{false, 22, 1.0f}}, 1},
+        {"FIFO, 32 sample batches", false, {{false, 2, batch}, {false, 255, 2 * batch}, {false, 194, batch}}, 3},
+    };
+    const uint32_t gaps[2] = {0, 5000};
+
+    for (int g = 0; g < 2; g++) {
+        printf("bus time per sample at 1 kHz, us, %u ns master gap per transaction\n", (unsigned)gaps[g]);
+        printf("  %-28s %10s %10s %10s %10s %10s %10s\n", "", "bytes@400k", "I2C 100k", "I2C 400k", "I2C 1M", "SPI 1M",
+               "SPI 20M");
+        for (size_t i = 0; i < (sizeof(strategies) / sizeof(strategies[0])); i++) {
+            const BusStrategy & s = strategies[i];
+            double bytes = 0.0;
+            for (uint8_t j = 0; j < s.count; j++) {
+                // what a byte count alone predicts, 9 bits for each data byte
+                bytes += s.steps[j].perSample * s.steps[j].bytes * 9 / 400e3 * 1e6;
+            }
+            printf("  %-28s %10.1f %10.1f %10.1f %10.1f", s.name, bytes,
+                   busPerSample(MPU9250I2CTiming(100000, gaps[g]), s), busPerSample(MPU9250I2CTiming(400000, gaps[g]), s),
+                   busPerSample(MPU9250I2CTiming(1000000, gaps[g]), s));
+            if (s.bypass) {
+                printf(" %10s %10s\n", "-", "-");
+            } else {
+                printf(" %10.1f %10.1f\n", busPerSample(MPU9250SPITiming(1000000, gaps[g]), s),
+                       busPerSample(MPU9250SPITiming(20000000, gaps[g]), s));
+            }
+        }
+    }
+    printf("  the MPU9250 is rated to 400 kHz I2C, 1 MHz is Fast-mode Plus for comparison\n");
+    return 0;
+}
+
+/* Eight sensors capturing shocks at random, each capture held a while by the consumer, held is the most at once */
+template <class C> static void poolCaptures(C ** captures, uint32_t samples, uint32_t * held, uint32_t * dropped)
+{
+    const uint16_t hold = 200;      // samples the consumer keeps a capture before releasing it
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    uint16_t due[8][2] = {{0}};
+    int16_t quiet[3] = {0, 0, 8192};
+    int16_t shock[3] = {0, 0, 30000};
+    MPU9250CaptureInfo info;
+
+    *held = 0;
+    for (uint32_t n = 0; n < samples; n++) {
+        for (int c = 0; c < 8; c++) {
+            // a shock every 5 s or so per sensor at 1 kHz
+            captures[c]->update((uniform(rng) < 0.0002f) ? shock : quiet);
+            for (uint8_t slot = 0; slot < 2; slot++) {
+                if ((due[c][slot] != 0) && (--due[c][slot] == 0)) {
+                    captures[c]->release(slot);
+                }
+            }
+            if (captures[c]->get(&info) && (due[c][info.slot] == 0)) {
+                due[c][info.slot] = hold;
+            }
+        }
+        uint32_t now = 0;
+        for (int c = 0; c < 8; c++) {
+            now += (due[c][0] != 0) + (due[c][1] != 0);
+        }
+        *held = (now > *held) ? now : *held;
+    }
+    *dropped = 0;
+    for (int c = 0; c < 8; c++) {
+        *dropped += captures[c]->dropped();
+    }
+}
+
+/* Buffer pool: acquire and release cost, exclusive ownership under contention, and RAM for 8 sensors */
+static int benchPool(void)
+{
+    typedef MPU9250Capture<256, 256, 2> Owned;
+    typedef MPU9250Capture<256, 256, 2, 1> Shared;
+    static MPU9250StaticPool<513 * 6, 6> windows;
+    static MPU9250StaticPool<64, 8> pool;
+    Owned * owned[8];
+    Shared * shared[8];
+    const int reps = 10000000;
+    const int threads = 4;
+    std::vector<std::thread> workers;
+    volatile int errors = 0;
+    uint32_t held;
+    uint32_t dropped;
+    double t;
+
+    t = now();
+    for (int r = 0; r < reps; r++) {
+        uint8_t * b = pool.acquire();
+        b[0] = (uint8_t)r;
+        pool.release(b);
+    }
+    report("acquire and release", now() - t, reps);
+
+    // each worker tags the blocks it holds and checks nobody else wrote them
+    pool.resetHighWater();
+    t = now();
+    for (int w = 0; w < threads; w++) {
+        workers.push_back(std::thread([w, &errors]() {
+            uint8_t * b[2];
+            for (int r = 0; r < (reps / 10); r++) {
+                b[0] = pool.acquire();
+                b[1] = pool.acquire();
+                for (int k = 0; k < 2; k++) {
+                    if (b[k] != NULL) {
+                        memset(b[k], w + 1, 64);
+                    }
+                }
+                for (int k = 0; k < 2; k++) {
+                    if (b[k] != NULL) {
+                        for (int i = 0; i < 64; i++) {
+                            errors += (b[k][i] != (uint8_t)(w + 1)) ? 1 : 0;
+                        }
+                        pool.release(b[k]);
+                    }
+                }
+            }
+        }));
+    }
+    for (size_t w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+    t = now() - t;
+    printf("  %d threads, 2 blocks each from 8: %.1f ns per acquire and release, high water %u, %u empty, %d overwritten bytes\n",
+           threads, t * 1e9 / (threads * (reps / 10) * 2), (unsigned)pool.highWater(), (unsigned)pool.failures(),
+           (int)errors);
+
+    for (int c = 0; c < 8; c++) {
+        owned[c] = new Owned();
+        shared[c] = new Shared(&windows);
+        owned[c]->setTrigger(MPU9250::AFS_2G, 1500, 0);
+        shared[c]->setTrigger(MPU9250::AFS_2G, 1500, 0);
+    }
+    printf("  8 sensors at 1 kHz, a shock every 5 s or so each, captures of 256 + 1 + 256 samples held 200 ms, 10 min\n");
+    poolCaptures(owned, 600000, &held, &dropped);
+    printf("  %-38s %6u bytes, %u captures dropped, at most %u held at once\n", "2 slots each, all buffers owned",
+           (unsigned)(8 * sizeof(Owned)), (unsigned)dropped, (unsigned)held);
+    poolCaptures(shared, 600000, &held, &dropped);
+    printf("  %-38s %6u bytes, %u captures dropped, at most %u of %u blocks in use\n", "2 slots each, live window + pool",
+           (unsigned)((8 * sizeof(Shared)) + sizeof(windows)), (unsigned)dropped, (unsigned)windows.highWater(),
+           (unsigned)windows.blocks());
+    for (int c = 0; c < 8; c++) {
+        delete owned[c];
+        delete shared[c];
+    }
+    return (errors == 0) ? 0 : 1;
+}
+
+struct Bench {
+    const char  *name;
+    int         (*run)(void);
+};
+
+static const Bench benches[] = {
+    {"calkernel", benchCalKernel},
+    {"math", benchMath},
+    {"fusion", benchFusion},
+    {"decode", benchDecode},
+    {"format", benchFormat},
+    {"bus", benchBus},
+    {"pool", benchPool},
+};
+
+int main(int argc, char ** argv)
+{
+    int result = 0;
+
+    for (size_t b = 0; b < (sizeof(benches) / sizeof(benches[0])); b++) {
+        bool wanted = (argc < 2);
+        for (int a = 1; a < argc; a++) {
+            wanted |= (strcmp(argv[a], benches[b].name) == 0);
+        }
+        if (wanted) {
+            result |= benches[b].run();
+        }
+    }
+    return result;
+}
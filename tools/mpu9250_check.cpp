@@ -0,0 +1,521 @@
+/* 
+ * @file    mpu9250_check.cpp
+ * @brief   Host checks of the accel stream detectors
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ *
+ * Build on the host from the library directory, with sim/ first on the include path
+ *     g++ -O2 -Isim -I. tools/mpu9250_check.cpp sim/MPU9250Sim.cpp sim/MPU9250BusTiming.cpp \
+ *         sim/MPU9250Trajectory.cpp MPU9250.cpp MPU9250Subscriber.cpp MPU9250Calibration.cpp \
+ *         MPU9250Latency.cpp MPU9250Pool.cpp MPU9250Stream.cpp MPU9250QuatCodec.cpp -o mpu9250_check
+ * Usage: mpu9250_check [check...]
+ *     capture     a stationary stream never triggers MPU9250Capture, a step does, and
+ *                 its peak is reported at the range it was captured at
+ *     freefall    a simulated drop is detected by MPU9250FreeFall within the hold time
+ *                 and one sample, still and rotating segments before it are not
+ *     decode      MPU9250FastPath keeps a negatively saturated axis at full scale when
+ *                 the orientation negates it
+ *     fifo        static FIFO windows read on a bus too slow to keep up, so the FIFO
+ *                 overflows, give the same mean as on a fast bus, with default retries
+ *     stream      MPU9250StreamDecoder rejects over-length and garbage frames without
+ *                 writing past itself, and decodes valid frames either side of them
+ *     batch       a simulated recording reprocessed by mpu9250_batch in small chunks on
+ *                 4 threads is byte for byte the same as in a single pass; the tool is
+ *                 run from the directory mpu9250_check was run from
+ *
+ * With no arguments every check runs. Each failure is printed, and the exit status
+ * is 1 if any check failed. Guard bytes catch writes past an object, but not into
+ * its own later members, so also build with -fsanitize=address,undefined to have
+ * every out of bounds index reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MPU9250.h"
+#include "MPU9250Capture.h"
+#include "MPU9250FreeFall.h"
+#include "MPU9250Decode.h"
+#include "MPU9250Stream.h"
+#include "MPU9250Sim.h"
+#include "MPU9250Trajectory.h"
+
+static int failures;
+static char toolDir[256] = ".";
+
+static void expect(bool ok, const char * check, const char * what)
+{
+    if (!ok) {
+        printf("  FAIL %s: %s\n", check, what);
+        failures++;
+    }
+}
+
+/* Deterministic noise of up to +-amplitude counts */
+static int16_t noise(uint32_t * state, int16_t amplitude)
+{
+    *state = (*state * 1664525u) + 1013904223u;
+    return (int16_t)((int32_t)(*state >> 16) % (amplitude + 1)) * (((*state >> 8) & 1) ? 1 : -1);
+}
+
+/* A part lying still at 4 g full scale, 1 g on z with a few mg of noise */
+static void still(uint32_t * state, int16_t * accel)
+{
+    accel[0] = noise(state, 25);
+    accel[1] = noise(state, 25);
+    accel[2] = 8192 + noise(state, 25);
+}
+
+static int checkCapture(void)
+{
+    static MPU9250Capture<16, 16, 2> capture;
+    MPU9250CaptureInfo info = MPU9250CaptureInfo();
+    uint32_t state = 1;
+    int16_t accel[3];
+    uint32_t peak = 0;
+    int start = failures;
+    bool frozen = false;
+
+    // a jerk threshold well under 1 g, so a change from zero on the first sample would fire
+    capture.setTrigger(MPU9250::AFS_4G, 2000, 100);
+    for (int n = 0; n < 4000; n++) {
+        still(&state, accel);
+        frozen |= capture.update(accel);
+    }
+    expect(!frozen && !capture.get(&info), "capture", "stationary stream triggered");
+
+    // half a g knocked onto x must still be caught, as a jerk and not a magnitude
+    for (int n = 0; n <= 16; n++) {
+        still(&state, accel);
+        accel[0] += 4096;
+        frozen |= capture.update(accel);
+    }
+    expect(frozen && capture.get(&info), "capture", "step not captured");
+    expect(frozen && (info.trigger == MPU_TRIG_JERK) && (info.pre == 16), "capture", "step captured wrongly");
+    // about 1.12 g, and still so after the range is changed with the capture held
+    peak = info.peak;
+    capture.setTrigger(MPU9250::AFS_8G, 4000, 200);
+    expect(capture.get(&info) && (info.peak == peak), "capture", "peak changed with the range");
+    expect((peak > 1100) && (peak < 1140), "capture", "peak wrong");
+
+    printf("capture: %s\n", (failures == start) ? "pass" : "FAIL");
+    return (failures == start) ? 0 : 1;
+}
+
+/* Still, a tumble about x, still again, then dropped from 4.5 s for 0.4 s */
+static uint16_t dropKeys(MPU9250SimKey * keys)
+{
+    const double g = 9.80665;
+    uint16_t n = 0;
+    double a = 0.0;
+
+    for (int k = 0; k <= 18; k++) {
+        MPU9250SimKey & key = keys[n++];
+        double t = 0.25 * k;
+        a += ((t > 1.0) && (t <= 3.0)) ? 0.8 : 0.0;
+        key.t = t;
+        key.q[0] = cos(a / 2);
+        key.q[1] = sin(a / 2);
+        key.q[2] = key.q[3] = 0.0;
+        key.position[0] = key.position[1] = key.position[2] = 0.0;
+    }
+    // keys on the parabola, which the spline follows exactly between them
+    for (int k = 1; k <= 8; k++) {
+        MPU9250SimKey & key = keys[n++];
+        double t = 0.05 * k;
+        key = keys[18];
+        key.t = 4.5 + t;
+        key.position[2] = -0.5 * g * t * t;
+    }
+    return n;
+}
+
+static int checkFreeFall(void)
+{
+    static const double field[3] = {20.0, 0.0, -40.0};
+    static MPU9250SimKey keys[32];
+    const uint16_t thresholdMg = 300;
+    const uint16_t durationMs = 5;
+    int start = failures;
+
+    MPU9250SimRestart();
+    MPU9250SimErrors errors;
+    MPU9250SimTypical(&errors, 1);
+    MPU9250Trajectory trajectory(keys, dropKeys(keys), field);
+    MPU9250SimChip chip(&trajectory, errors);
+    MPU9250SimBus bus;
+    chip.attach(bus);
+    I2C i2c(bus);
+    i2c.frequency(400000);
+    InterruptIn intr(0);
+    MPU9250 imu(i2c, &intr);
+    MPU9250SubscriberQueue<16> sub(MPU_CH_ACCEL, 1000);
+    uint8_t result = imu.setParameters(MPU9250::HP_ALL, MPU9250::AFS_4G, MPU9250::MFS_16BITS, MPU9250::GFS_500DPS);
+    result |= imu.subscribe(&sub);
+    uint16_t rate = imu.getSampleRate();
+    MPU9250FreeFall freeFall(MPU9250::AFS_4G, thresholdMg, durationMs, rate);
+    MPU9250Sample s;
+    uint64_t begin = MPU9250SimNow();
+    uint64_t end = begin + (uint64_t)((trajectory.duration() + 0.2) * 1e6);
+    uint32_t samples = 0;
+    uint32_t onset = 0;
+    uint32_t fired = 0;
+    uint32_t events = 0;
+    bool caught = false;
+    uint32_t hold = (((uint32_t)durationMs * rate) + 999) / 1000;
+    double t;
+    double g;
+
+    expect(result == 0, "freefall", "driver configuration failed");
+    // the spline is not a clean catch, so stop once the fall is over
+    while ((result == 0) && !caught && (MPU9250SimNow() < end)) {
+        MPU9250SimAdvance(chip.nextSample() - MPU9250SimNow());
+        intr.edge(true);
+        imu.publish();
+        while (sub.read(&s)) {
+            const MPU9250SimTruth & truth = chip.truth();
+            g = sqrt((truth.accel[0] * truth.accel[0]) + (truth.accel[1] * truth.accel[1]) +
+                     (truth.accel[2] * truth.accel[2]));
+            samples++;
+            if ((onset == 0) && (g < (thresholdMg / 1000.0))) {
+                onset = samples;
+            }
+            caught |= (onset > 0) && (g >= (thresholdMg / 1000.0));
+            if (freeFall.update(s.accel)) {
+                fired = (events++ == 0) ? samples : fired;
+            }
+        }
+    }
+    // the first sample below the threshold counts towards the hold
+    t = (double)(fired - onset + 1) * 1000.0 / rate;
+    expect(onset > 0, "freefall", "trajectory never fell");
+    expect(events == 1, "freefall", "not exactly one event, or one before the fall");
+    expect((fired >= onset) && ((fired - onset) <= hold), "freefall", "event outside the hold time and one sample");
+    printf("freefall: %s, %u samples at %u Hz, %u events, detected %.1f ms into the fall below %u mg, hold %u ms\n",
+           (failures == start) ? "pass" : "FAIL", (unsigned)samples, (unsigned)rate, (unsigned)events,
+           (fired >= onset) ? t : -1.0, (unsigned)thresholdMg, (unsigned)durationMs);
+    return (failures == start) ? 0 : 1;
+}
+
+static int checkDecode(void)
+{
+    // sensor x at negative full scale, y at positive, z at zero
+    static const uint8_t raw[6] = {0x80, 0x00, 0x7F, 0xFF, 0x00, 0x00};
+    int16_t counts[3];
+    int start = failures;
+
+    // body x is minus sensor y, body y is minus sensor x
+    MPU9250FastPath<MPU9250::AFS_4G, MPU9250::GFS_500DPS, MPU_AXIS_Y | MPU_AXIS_NEG, MPU_AXIS_X | MPU_AXIS_NEG,
+                    MPU_AXIS_Z | MPU_AXIS_NEG>::accelCounts(raw, counts);
+    expect((counts[0] == -32767) && (counts[1] == 32767) && (counts[2] == 0), "decode", "negated full scale wrapped");
+    MPU9250FastPath<MPU9250::AFS_4G, MPU9250::GFS_500DPS>::accelCounts(raw, counts);
+    expect((counts[0] == -32768) && (counts[1] == 32767) && (counts[2] == 0), "decode", "unrotated counts changed");
+
+    printf("decode: %s\n", (failures == start) ? "pass" : "FAIL");
+    return (failures == start) ? 0 : 1;
+}
+
+static int checkFifo(void)
+{
+    static const double field[3] = {20.0, 0.0, -40.0};
+    static const MPU9250SimKey keys[2] = {{0.0, {0.0, 0.0, 0.0}, {1.0, 0.0, 0.0, 0.0}},
+                                          {1.0, {0.0, 0.0, 0.0}, {1.0, 0.0, 0.0, 0.0}}};
+    static const int khz[2] = {400, 20};
+    float mean[2][3];
+    float variance[3];
+    uint8_t status[2];
+    uint32_t resets[2];
+    int start = failures;
+
+    for (int b = 0; b < 2; b++) {
+        MPU9250SimRestart();
+        MPU9250SimErrors errors;
+        MPU9250SimTypical(&errors, 1);
+        MPU9250Trajectory trajectory(keys, 2, field);
+        MPU9250SimChip chip(&trajectory, errors);
+        MPU9250SimBus bus;
+        chip.attach(bus);
+        I2C i2c(bus);
+        i2c.frequency(400000);
+        InterruptIn intr(0);
+        MPU9250 imu(i2c, &intr);
+        MPU9250SubscriberQueue<16> sub(MPU_CH_ALL, 1000);
+        uint8_t result = imu.setParameters(MPU9250::HP_ALL, MPU9250::AFS_4G, MPU9250::MFS_16BITS, MPU9250::GFS_500DPS);
+        result |= imu.subscribe(&sub);
+        expect(result == 0, "fifo", "driver configuration failed");
+        // 1 kHz of accel is 6 kB/s into the FIFO, more than a 20 kHz bus can drain
+        i2c.frequency(khz[b] * 1000);
+        status[b] = imu.readStaticAccel(500, mean[b], variance);
+        resets[b] = imu.health().fifoResets;
+    }
+    expect((status[0] == 0) && (status[1] == 0), "fifo", "static window failed");
+    expect((resets[0] == 0) && (resets[1] > 0), "fifo", "FIFO overflow not seen");
+    for (int j = 0; j < 3; j++) {
+        expect(fabsf(mean[1][j] - mean[0][j]) < 10.0f, "fifo", "mean wrong after overflow");
+    }
+    printf("fifo: %s, %u FIFO resets on a %u kHz bus, z mean %.1f against %.1f counts\n",
+           (failures == start) ? "pass" : "FAIL", (unsigned)resets[1], (unsigned)khz[1], mean[1][2], mean[0][2]);
+    return (failures == start) ? 0 : 1;
+}
+
+/* A decoder with guard bytes after it, to see junk is not written past the object */
+struct GuardedDecoder {
+    MPU9250StreamDecoder    decoder;
+    uint8_t                 guard[512];
+};
+
+static uint32_t feed(MPU9250StreamDecoder & decoder, const uint8_t * data, uint16_t length)
+{
+    uint32_t frames = 0;
+
+    for (uint16_t i = 0; i < length; i++) {
+        frames += decoder.push(data[i]) ? 1 : 0;
+    }
+    return frames;
+}
+
+/* Encode a sample with every channel, the longest frame, and see it decoded */
+static bool roundTrip(MPU9250StreamDecoder & decoder, uint32_t seq)
+{
+    static MPU9250StreamBuffers<256> encoder;
+    const uint8_t * data;
+    MPU9250Sample in = {seq, MPU_CH_ALL, {1, -2, 8192}, {-32768, 0, 32767}, {100, 0, -1}, 21};
+    MPU9250Sample out;
+    uint16_t length;
+
+    encoder.sample(in, 0);
+    length = encoder.flip(&data);
+    return (length <= MPU_STREAM_MAX_FRAME) && (feed(decoder, data, length) == 1) && decoder.sample(&out) &&
+           (out.channels == in.channels) && (memcmp(out.accel, in.accel, sizeof(in.accel)) == 0) &&
+           (memcmp(out.gyro, in.gyro, sizeof(in.gyro)) == 0) && (memcmp(out.mag, in.mag, sizeof(in.mag)) == 0) &&
+           (out.temp == in.temp);
+}
+
+static int checkStream(void)
+{
+    static GuardedDecoder g;
+    uint8_t junk[MPU_STREAM_MAX_FRAME + 64];
+    uint32_t state = 1;
+    uint32_t errors;
+    uint32_t frames = 0;
+    uint32_t garbage = 0;
+    bool intact = true;
+    int start = failures;
+
+    memset(g.guard, 0xA5, sizeof(g.guard));
+    expect(roundTrip(g.decoder, 0), "stream", "valid frame not decoded");
+
+    // a code byte covering a whole frame of non-zero bytes, decoding to more than a frame
+    errors = g.decoder.errors();
+    junk[0] = MPU_STREAM_MAX_FRAME;
+    memset(&junk[1], 0x55, MPU_STREAM_MAX_FRAME - 1);
+    junk[MPU_STREAM_MAX_FRAME] = 0;
+    expect(feed(g.decoder, junk, MPU_STREAM_MAX_FRAME + 1) == 0, "stream", "over-length frame accepted");
+    // more bytes than the receive buffer holds
+    memset(junk, 0x55, sizeof(junk) - 1);
+    junk[sizeof(junk) - 1] = 0;
+    expect(feed(g.decoder, junk, sizeof(junk)) == 0, "stream", "oversized frame accepted");
+    expect(g.decoder.errors() == (errors + 2), "stream", "over-length frames not counted as errors");
+    expect(roundTrip(g.decoder, 1), "stream", "valid frame not decoded after an over-length one");
+
+    // line noise, with a delimiter now and then
+    for (int n = 0; n < 100000; n++) {
+        state = (state * 1664525u) + 1013904223u;
+        uint8_t byte = ((state >> 24) < 8) ? 0 : (uint8_t)(state >> 16);
+        garbage += (byte == 0) ? 1 : 0;
+        frames += g.decoder.push(byte) ? 1 : 0;
+    }
+    expect(frames == 0, "stream", "garbage frame accepted");
+    // a receiver resynchronises at the next delimiter
+    g.decoder.push(0);
+    expect(roundTrip(g.decoder, 2), "stream", "valid frame not decoded after garbage");
+
+    for (size_t i = 0; i < sizeof(g.guard); i++) {
+        intact &= (g.guard[i] == 0xA5);
+    }
+    expect(intact, "stream", "decoder wrote past its end");
+    printf("stream: %s, %u delimiters in the garbage, %u decoder errors\n", (failures == start) ? "pass" : "FAIL",
+           (unsigned)garbage, (unsigned)g.decoder.errors());
+    return (failures == start) ? 0 : 1;
+}
+
+/* Keys every half second: turning at a varying rate, tilted and nodding */
+static uint16_t turnKeys(MPU9250SimKey * keys, uint16_t count)
+{
+    double yaw = 0.0;
+
+    for (uint16_t k = 0; k < count; k++) {
+        MPU9250SimKey & key = keys[k];
+        double tilt = 0.3 * sin(0.7 * k);
+        yaw += 0.4 * sin(0.3 * k);
+        key.t = 0.5 * k;
+        // yaw about earth z of a tilt about sensor x
+        key.q[0] = cos(yaw / 2) * cos(tilt / 2);
+        key.q[1] = cos(yaw / 2) * sin(tilt / 2);
+        key.q[2] = sin(yaw / 2) * sin(tilt / 2);
+        key.q[3] = sin(yaw / 2) * cos(tilt / 2);
+        key.position[0] = key.position[1] = key.position[2] = 0.0;
+    }
+    return count;
+}
+
+static long readFile(const char * path, uint8_t * data, long size)
+{
+    FILE * f = fopen(path, "rb");
+    long n;
+
+    if (f == NULL) {
+        return -1;
+    }
+    n = (long)fread(data, 1, size, f);
+    fclose(f);
+    return n;
+}
+
+static int checkBatch(void)
+{
+    static const double field[3] = {20.0, 0.0, -40.0};
+    static const double chunkMiB = 0.05;
+    static MPU9250SimKey keys[41];
+    static uint8_t streamBuffer[4096];
+    static uint8_t output[2][1 << 20];
+    MPU9250StreamEncoder encoder(streamBuffer, NULL, sizeof(streamBuffer));
+    char dir[] = "/tmp/mpu9250_checkXXXXXX";
+    char recording[64];
+    char out[2][64];
+    char file[160];
+    char command[1024];
+    const uint8_t * data;
+    long length[2] = {-1, -1};
+    uint32_t samples = 0;
+    int start = failures;
+    FILE * f;
+
+    MPU9250SimRestart();
+    MPU9250SimErrors errors;
+    MPU9250SimTypical(&errors, 1);
+    MPU9250Trajectory trajectory(keys, turnKeys(keys, 41), field);
+    MPU9250SimChip chip(&trajectory, errors);
+    MPU9250SimBus bus;
+    chip.attach(bus);
+    I2C i2c(bus);
+    i2c.frequency(400000);
+    InterruptIn intr(0);
+    MPU9250 imu(i2c, &intr);
+    MPU9250SubscriberQueue<16> sub(MPU_CH_ALL, 1000);
+    uint8_t result = imu.setParameters(MPU9250::HP_ALL, MPU9250::AFS_4G, MPU9250::MFS_16BITS, MPU9250::GFS_500DPS);
+    result |= imu.subscribe(&sub);
+    MPU9250Sample s;
+    uint64_t end = MPU9250SimNow() + (uint64_t)(trajectory.duration() * 1e6);
+    float q[4];
+
+    expect(result == 0, "batch", "driver configuration failed");
+    if ((result != 0) || (mkdtemp(dir) == NULL)) {
+        expect(false, "batch", "no temporary directory");
+        printf("batch: FAIL\n");
+        return 1;
+    }
+    snprintf(out[0], sizeof(out[0]), "%s/single", dir);
+    snprintf(out[1], sizeof(out[1]), "%s/chunked", dir);
+    mkdir(out[0], 0700);
+    mkdir(out[1], 0700);
+
+    // samples each followed by the true orientation, as mpu9250_sim -o writes
+    snprintf(recording, sizeof(recording), "%s/recording", dir);
+    f = fopen(recording, "wb");
+    while ((f != NULL) && (MPU9250SimNow() < end)) {
+        MPU9250SimAdvance(chip.nextSample() - MPU9250SimNow());
+        intr.edge(true);
+        imu.publish();
+        while (sub.read(&s)) {
+            for (int j = 0; j < 4; j++) {
+                q[j] = (float)chip.truth().q[j];
+            }
+            if (encoder.pending() > (sizeof(streamBuffer) - (2 * MPU_STREAM_MAX_FRAME))) {
+                uint16_t n = encoder.flip(&data);
+                fwrite(data, 1, n, f);
+            }
+            encoder.sample(s, 0);
+            encoder.quaternion(q, 0);
+            samples++;
+        }
+    }
+    if (f != NULL) {
+        uint16_t n = encoder.flip(&data);
+        fwrite(data, 1, n, f);
+        fclose(f);
+    }
+    expect(f != NULL, "batch", "recording not written");
+
+    for (int b = 0; b < 2; b++) {
+        snprintf(command, sizeof(command), "%s/mpu9250_batch -a 4 -g 500 -r 1000 -s %g -j %d -o %s %s 2>/dev/null",
+                 toolDir, (b == 0) ? 1000.0 : chunkMiB, (b == 0) ? 1 : 4, out[b], recording);
+        expect(system(command) == 0, "batch", "mpu9250_batch failed or not found");
+        snprintf(file, sizeof(file), "%s/recording", out[b]);
+        length[b] = readFile(file, output[b], sizeof(output[b]));
+        remove(file);
+        rmdir(out[b]);
+    }
+    remove(recording);
+    rmdir(dir);
+    expect((length[0] > 0) && (length[0] < (long)sizeof(output[0])), "batch", "single pass output missing or too long");
+    expect((length[0] > (long)(4 * chunkMiB * (1 << 20))), "batch", "recording too short to split");
+    expect((length[1] == length[0]) && (memcmp(output[0], output[1], length[0]) == 0), "batch",
+           "chunked output differs from a single pass");
+    printf("batch: %s, %u samples, %ld bytes out, in %.2f MiB chunks on 4 threads %s a single pass\n",
+           (failures == start) ? "pass" : "FAIL", (unsigned)samples, length[0], chunkMiB,
+           (failures == start) ? "the same as" : "against");
+    return (failures == start) ? 0 : 1;
+}
+
+struct Check {
+    const char  *name;
+    int         (*run)(void);
+};
+
+static const Check checks[] = {
+    {"capture", checkCapture},
+    {"freefall", checkFreeFall},
+    {"decode", checkDecode},
+    {"fifo", checkFifo},
+    {"stream", checkStream},
+    {"batch", checkBatch},
+};
+
+int main(int argc, char ** argv)
+{
+    int result = 0;
+    const char * slash = strrchr(argv[0], '/');
+
+    if (slash != NULL) {
+        snprintf(toolDir, sizeof(toolDir), "%.*s", (int)(slash - argv[0]), argv[0]);
+    }
+    for (size_t c = 0; c < (sizeof(checks) / sizeof(checks[0])); c++) {
+        bool wanted = (argc < 2);
+        for (int a = 1; a < argc; a++) {
+            wanted |= (strcmp(argv[a], checks[c].name) == 0);
+        }
+        if (wanted) {
+            result |= checks[c].run();
+        }
+    }
+    return result;
+}
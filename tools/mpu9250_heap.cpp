@@ -0,0 +1,350 @@
+/* 
+ * @file    mpu9250_heap.cpp
+ * @brief   Check the streaming paths make no heap allocation after initialisation
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ *
+ * Build on the host from the library directory, with sim/ first on the include path,
+ * against glibc, whose allocator entry points the replacements below forward to, e.g.
+ *     g++ -O2 -Isim -I. tools/mpu9250_heap.cpp sim/MPU9250Sim.cpp sim/MPU9250BusTiming.cpp \
+ *         sim/MPU9250Trajectory.cpp MPU9250.cpp MPU9250Subscriber.cpp MPU9250Calibration.cpp \
+ *         MPU9250Fusion.cpp MPU9250Heading.cpp MPU9250Math.cpp MPU9250Stream.cpp \
+ *         MPU9250QuatCodec.cpp MPU9250Format.cpp MPU9250Latency.cpp MPU9250Pool.cpp -o mpu9250_heap
+ * Usage: mpu9250_heap [-t seconds] [-r Hz] [-F]
+ *     -t  seconds of streaming (10)
+ *     -r  subscriber rate (500)
+ *     -F  inject bus faults and resets, so the retry and recovery paths run too
+ *
+ * malloc, calloc, realloc, the aligned allocators and every operator new are replaced
+ * with counting versions. Everything is set up first: the simulated part, the driver
+ * with a slaved magnetometer, calibration, subscriber, latency trace, fusion, heading,
+ * stream encoder and decoder, text formatter, pooled capture, free fall and Allan accumulators.
+ * Counting is then armed and samples streamed through all of them as firmware would,
+ * from data ready edge to decoded stream frame. Any allocation while armed fails the
+ * run, with exit status 1. The replacements are checked to be in use before arming.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <new>
+
+#include "MPU9250.h"
+#include "MPU9250Fusion.h"
+#include "MPU9250Heading.h"
+#include "MPU9250Latency.h"
+#include "MPU9250Stream.h"
+#include "MPU9250Format.h"
+#include "MPU9250Capture.h"
+#include "MPU9250FreeFall.h"
+#include "MPU9250Allan.h"
+#include "MPU9250Sim.h"
+#include "MPU9250Trajectory.h"
+
+extern "C" {
+void * __libc_malloc(size_t size);
+void * __libc_calloc(size_t count, size_t size);
+void * __libc_realloc(void * p, size_t size);
+void * __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void * p);
+}
+
+static volatile bool armed;
+static volatile uint32_t allocations;
+static volatile size_t firstSize;
+
+static void count(size_t size)
+{
+    if (armed) {
+        if (allocations == 0) {
+            firstSize = size;
+        }
+        allocations = allocations + 1;
+    }
+}
+
+extern "C" {
+
+void * malloc(size_t size)
+{
+    count(size);
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t n, size_t size)
+{
+    count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void * realloc(void * p, size_t size)
+{
+    count(size);
+    return __libc_realloc(p, size);
+}
+
+void * memalign(size_t alignment, size_t size)
+{
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void ** p, size_t alignment, size_t size)
+{
+    count(size);
+    *p = __libc_memalign(alignment, size);
+    return (*p != NULL) ? 0 : ENOMEM;
+}
+
+void free(void * p)
+{
+    __libc_free(p);
+}
+
+}
+
+static void * allocate(size_t size)
+{
+    void * p;
+
+    count(size);
+    p = __libc_malloc((size > 0) ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void * operator new(size_t size) { return allocate(size); }
+void * operator new[](size_t size) { return allocate(size); }
+void * operator new(size_t size, const std::nothrow_t &) noexcept { count(size); return __libc_malloc(size ? size : 1); }
+void * operator new[](size_t size, const std::nothrow_t &) noexcept { count(size); return __libc_malloc(size ? size : 1); }
+void operator delete(void * p) noexcept { __libc_free(p); }
+void operator delete[](void * p) noexcept { __libc_free(p); }
+void operator delete(void * p, size_t) noexcept { __libc_free(p); }
+void operator delete[](void * p, size_t) noexcept { __libc_free(p); }
+
+/* Arm counting, allocate each way, and see every one counted */
+static bool selfTest(void)
+{
+    void * volatile p;
+    int * volatile q;
+    uint32_t n;
+
+    allocations = 0;
+    armed = true;
+    p = malloc(16);
+    free(p);
+    p = calloc(2, 8);
+    free(p);
+    q = new int;
+    delete q;
+    q = new int[4];
+    delete[] q;
+    armed = false;
+    n = allocations;
+    allocations = 0;
+    return n == 4;
+}
+
+static MPU9250Latency * edgeLatency;
+
+/* The data ready interrupt handler */
+static void dataReady(void)
+{
+    edgeLatency->edge();
+}
+
+int main(int argc, char ** argv)
+{
+    static const double field[3] = {20.0, 0.0, -40.0};
+    static MPU9250SimKey keys[64];
+    static MPU9250LatencyTrace<256> latency;
+    static MPU9250StreamBuffers<1024> encoder;
+    static MPU9250StreamDecoder decoder;
+    static MPU9250StaticPool<129 * 6, 2> windows;
+    static MPU9250Capture<64, 64, 2, 1> capture(&windows);
+    static MPU9250Allan<12> allan;
+    static char line[MPU_FORMAT_MAX_LINE];
+    double seconds = 10.0;
+    int rate = 500;
+    bool faulty = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:r:F")) != -1) {
+        switch (opt) {
+            case 't': seconds = atof(optarg); break;
+            case 'r': rate = atoi(optarg); break;
+            case 'F': faulty = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds] [-r Hz] [-F]\n", argv[0]);
+                return 2;
+        }
+    }
+    if ((seconds <= 0.0) || (rate <= 0) || (rate > 1000) || ((seconds * 2.0) > 62.0)) {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+    if (!selfTest()) {
+        fprintf(stderr, "allocation counting is not in use, glibc is needed\n");
+        return 2;
+    }
+
+    // a slow turn about each axis in turn, keys every half second
+    for (int k = 0; k < 64; k++) {
+        double a = 0.3 * sin(k * 0.7);
+        keys[k].t = k * 0.5;
+        keys[k].q[0] = cos(a / 2);
+        keys[k].q[1] = (k % 3 == 0) ? sin(a / 2) : 0.0;
+        keys[k].q[2] = (k % 3 == 1) ? sin(a / 2) : 0.0;
+        keys[k].q[3] = (k % 3 == 2) ? sin(a / 2) : 0.0;
+        keys[k].position[0] = keys[k].position[1] = keys[k].position[2] = 0.0;
+    }
+
+    MPU9250SimFaults faults;
+    MPU9250SimErrors errors;
+    MPU9250SimNoFaults(&faults, 1);
+    MPU9250SimTypical(&errors, 1);
+    MPU9250Trajectory trajectory(keys, 64, field);
+    MPU9250SimChip chip(&trajectory, errors);
+    MPU9250SimBus bus;
+    chip.attach(bus);
+    I2C i2c(bus);
+    i2c.frequency(400000);
+    InterruptIn intr(0);
+    MPU9250 imu(i2c, &intr);
+    MPU9250SubscriberQueue<64> sub(MPU_CH_ALL, (uint16_t)rate);
+
+    MPU9250AccelCalibration cal = {{12, -5, 31}, {{16400, 20, -10}, {5, 16370, 3}, {-8, 12, 16390}}, MPU9250::AFS_4G};
+    uint8_t result = imu.setParameters(MPU9250::HP_ALL, MPU9250::AFS_4G, MPU9250::MFS_16BITS, MPU9250::GFS_500DPS);
+    result |= imu.subscribe(&sub);
+    result |= imu.slaveMagnetometer();
+    if (result != 0) {
+        fprintf(stderr, "driver configuration failed %x\n", result);
+        return 1;
+    }
+    imu.setAccelCalibration(&cal);
+    imu.setRecovery(2, 100);
+    imu.setLatency(&latency);
+    edgeLatency = &latency;
+    intr.rise(dataReady);
+
+    MPU9250Madgwick filter;
+    MPU9250Heading heading;
+    MPU9250FreeFall freeFall(MPU9250::AFS_4G, 300, 100, imu.getSampleRate());
+    MPU9250Format format(MPU9250::AFS_4G, MPU9250::GFS_500DPS);
+    MPU9250CaptureInfo info;
+    MPU9250Sample s;
+    MPU9250Sample decoded;
+    const float accelScale = 4.0f / 32768.0f;
+    const float gyroScale = 500.0f / 32768.0f * 0.0174532925f;
+    const float dt = 1.0f / imu.getSampleRate();
+    const uint8_t * data;
+    uint64_t start = MPU9250SimNow();
+    uint32_t publishes = 0;
+    uint32_t samples = 0;
+    uint32_t frames = 0;
+    uint32_t chars = 0;
+    float q[4];
+
+    capture.setTrigger(MPU9250::AFS_4G, 2500, 1500);
+    if (faulty) {
+        faults.nak = 1e-3;
+        faults.stretch = 1e-2;
+        faults.stretchUs = 50;
+        faults.fifoCount = 1e-2;
+        faults.reset = 0.1;
+        faults.overflow = 1e-2;
+        bus.setFaults(&faults);
+        chip.setFaults(&faults);
+    }
+
+    // from here on nothing may allocate
+    armed = true;
+    while ((MPU9250SimNow() - start) < (uint64_t)(seconds * 1e6)) {
+        MPU9250SimAdvance(chip.nextSample() - MPU9250SimNow());
+        intr.edge(true);
+        imu.publish();
+        publishes++;
+        while (sub.read(&s)) {
+            float a[3] = {s.accel[0] * accelScale, s.accel[1] * accelScale, s.accel[2] * accelScale};
+            float g[3] = {s.gyro[0] * gyroScale, s.gyro[1] * gyroScale, s.gyro[2] * gyroScale};
+            float m[3] = {(float)s.mag[1], (float)s.mag[0], -(float)s.mag[2]};
+            if (s.channels & MPU_CH_MAG) {
+                filter.update(a[0], a[1], a[2], g[0], g[1], g[2], m[0], m[1], m[2], dt);
+                heading.update(a, g, m, dt);
+            } else {
+                filter.updateIMU(a[0], a[1], a[2], g[0], g[1], g[2], dt);
+            }
+            latency.fused(s.seq);
+            memcpy(q, filter.quaternion(), sizeof(q));
+            if (s.channels & MPU_CH_ACCEL) {
+                freeFall.update(s.accel);
+                allan.update(s.gyro);
+                if (capture.update(s.accel) && capture.get(&info)) {
+                    capture.release(info.slot);
+                }
+            }
+            chars += format.line(s, q, line, sizeof(line));
+            encoder.sample(s, us_ticker_read());
+            encoder.quaternion(q, us_ticker_read());
+            if ((samples++ % 100) == 0) {
+                encoder.status(0, 0, (uint16_t)sub.overruns(), us_ticker_read());
+            }
+            if (encoder.pending() > (1024 - (3 * MPU_STREAM_MAX_FRAME))) {
+                uint16_t length = encoder.flip(&data);
+                for (uint16_t i = 0; i < length; i++) {
+                    if (decoder.push(data[i])) {
+                        frames++;
+                        decoder.sample(&decoded);
+                        decoder.quaternion(q);
+                    }
+                }
+            }
+        }
+    }
+    armed = false;
+
+    MPU9250LatencyStats l;
+    latency.stats(MPU_LAT_TOTAL, &l);
+    printf("%u publishes, %u samples fused, %u stream frames decoded with %u errors, %u characters formatted\n",
+           (unsigned)publishes, (unsigned)samples, (unsigned)frames, (unsigned)decoder.errors(), (unsigned)chars);
+    printf("edge to fusion %u us p99, Allan deviation at 1 sample %.3f, heading %.1f deg\n",
+           (unsigned)l.p99, allan.adev(0, 0, gyroScale), heading.heading());
+    if (faulty) {
+        const MPU9250Health & h = imu.health();
+        printf("injected %u NAKs, %u bad FIFO counts, %u resets; driver %u retries, %u recoveries\n",
+               (unsigned)faults.naks, (unsigned)faults.fifoCounts, (unsigned)faults.resets,
+               (unsigned)h.retries, (unsigned)h.recoveries);
+    }
+    if (allocations != 0) {
+        printf("FAIL: %u heap allocations after initialisation, the first of %u bytes\n",
+               (unsigned)allocations, (unsigned)firstSize);
+        return 1;
+    }
+    printf("PASS: no heap allocation after initialisation\n");
+    return 0;
+}
@@ -0,0 +1,409 @@
+/* 
+ * @file    mpu9250_shared.cpp
+ * @brief   Run several MPU9250 drivers on one shared interrupt line
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Build on the host from the library directory, with sim/ first on the include path
+ * so the driver picks up the simulated mbed.h, e.g.
+ *     g++ -O2 -Isim -I. tools/mpu9250_shared.cpp sim/MPU9250Sim.cpp sim/MPU9250BusTiming.cpp \
+ *         MPU9250.cpp MPU9250Group.cpp MPU9250Subscriber.cpp MPU9250Calibration.cpp \
+ *         MPU9250Latency.cpp MPU9250Pool.cpp -o mpu9250_shared
+ * Usage: mpu9250_shared [-n devices] [-r Hz,...] [-t seconds] [-k kHz] [-d us] [-x resets]
+ *     -n  devices, each on its own bus as only one MPU9250 and AK8963 pair fits one (4)
+ *     -r  subscriber rates, given to the devices in turn (200)
+ *     -t  simulated seconds (10)
+ *     -k  bus clock (400)
+ *     -d  interrupt to dispatch, us (0)
+ *     -x  resets per second per device, each holds a shared line low until recovered (0)
+ *
+ * The same devices are run three ways: with a pin each, as the driver was used
+ * until now, and on one shared open drain line dispatched by MPU9250Group, first
+ * reading the line to end dispatch and then without, confirming with an extra pass
+ * of status reads. The line is modelled by MPU9250SimLine from the devices' INT
+ * pins, so an edge is only seen where the wired-OR line really falls. Reported are
+ * samples lost against the data ready ticks of the run, bus transactions, bytes and
+ * time and status reads per sample delivered, the dispatch passes, and how often
+ * the line was left low with no edge to come, which would stop acquisition.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "MPU9250.h"
+#include "MPU9250Group.h"
+#include "MPU9250Sim.h"
+
+/**
+ *  @struct Still
+ *  @brief A level, stationary device
+ */
+struct Still : public MPU9250SimSource {
+    virtual void truth(double t, MPU9250SimTruth * truth)
+    {
+        memset(truth, 0, sizeof(*truth));
+        truth->accel[2] = 1.0;
+        truth->mag[0] = 20.0;
+        truth->mag[2] = -40.0;
+        truth->temp = 25.0;
+        truth->q[0] = 1.0;
+        (void)t;
+    }
+};
+
+/**
+ *  @struct Options
+ *  @brief Command line settings
+ */
+struct Options {
+    int                 devices;
+    std::vector<int>    rates;
+    double              seconds;
+    int                 khz;
+    uint32_t            dispatch;
+    double              resets;
+};
+
+/**
+ *  @struct Result
+ *  @brief Counts from one run
+ */
+struct Result {
+    uint32_t            expected;       // data ready ticks during the run
+    uint32_t            delivered;      // samples reaching the subscribers
+    uint32_t            lost;           // expected less delivered, per device
+    uint32_t            edges;          // falling edges seen
+    uint32_t            polls;          // devices published for having no edge for too long
+    uint32_t            transactions;
+    uint32_t            bytes;
+    uint64_t            bus;            // ns the buses were occupied
+    uint32_t            stuck;          // waits with the line low and nothing pending
+    uint32_t            resets;
+    uint32_t            recoveries;
+    MPU9250GroupStats   group;
+};
+
+enum Mode {
+    OWN_PINS,
+    SHARED_READ,
+    SHARED_PASS
+};
+
+static MPU9250Group * group;
+static MPU9250SimLine * shared;
+static uint32_t sharedFalls;            // found while the group read the line, raised after dispatch
+static volatile bool ownPending[MPU_GROUP_MAX];
+
+static void sharedFall(void)
+{
+    group->edge();
+}
+
+static int sharedLevel(void)
+{
+    // the line is brought up to date as the group reads it, edges found are raised after dispatch
+    sharedFalls += shared->falls();
+    return shared->low() ? 0 : 1;
+}
+
+/* Replay the lines up to now and raise their edges */
+static uint32_t deliver(std::vector<MPU9250SimLine *> & lines, std::vector<InterruptIn *> & pins, Mode mode)
+{
+    uint32_t edges = 0;
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        uint32_t n = lines[i]->falls();
+        if (i == 0) {
+            n += sharedFalls;
+            sharedFalls = 0;
+        }
+        edges += n;
+        while (n-- > 0) {
+            if (mode == OWN_PINS) {
+                ownPending[i] = true;
+            } else {
+                pins[i]->edge(false);
+            }
+        }
+    }
+    return edges;
+}
+
+static bool run(const Options & o, Mode mode, Result * r)
+{
+    static MPU9250Sample queue[MPU_GROUP_MAX][16];
+    std::vector<MPU9250SimChip *> chips;
+    std::vector<MPU9250SimBus *> buses;
+    std::vector<I2C *> i2c;
+    std::vector<MPU9250 *> imus;
+    std::vector<MPU9250Subscriber *> subs;
+    std::vector<MPU9250SimLine *> lines;
+    std::vector<InterruptIn *> pins;
+    std::vector<uint64_t> published;
+    std::vector<uint32_t> expected;
+    std::vector<uint32_t> delivered;
+    MPU9250SimErrors errors;
+    MPU9250SimFaults faults;
+    MPU9250Sample s;
+    Still still;
+    uint8_t result = 0;
+
+    memset(r, 0, sizeof(*r));
+    MPU9250SimRestart();
+    MPU9250SimNoFaults(&faults, 7);
+    faults.reset = o.resets;
+    // one line for the whole group, or one per device
+    for (int i = 0; i < ((mode == OWN_PINS) ? o.devices : 1); i++) {
+        lines.push_back(new MPU9250SimLine());
+        pins.push_back(new InterruptIn(i));
+    }
+    shared = lines[0];
+    sharedFalls = 0;
+    group = new MPU9250Group((mode == SHARED_READ) ? pins[0] : NULL);
+    pins[0]->sense(sharedLevel);
+    for (int i = 0; i < o.devices; i++) {
+        MPU9250SimTypical(&errors, 1 + i);
+        chips.push_back(new MPU9250SimChip(&still, errors));
+        buses.push_back(new MPU9250SimBus());
+        chips[i]->attach(*buses[i]);
+        lines[(mode == OWN_PINS) ? i : 0]->attach(chips[i]);
+        i2c.push_back(new I2C(*buses[i]));
+        i2c[i]->frequency(o.khz * 1000);
+        imus.push_back(new MPU9250(*i2c[i], pins[(mode == OWN_PINS) ? i : 0]));
+        subs.push_back(new MPU9250Subscriber(queue[i], 16, MPU_CH_ACCEL | MPU_CH_GYRO | MPU_CH_TEMP,
+                                             (uint16_t)o.rates[i % o.rates.size()]));
+        result |= imus[i]->setParameters(MPU9250::HP_ALL, MPU9250::AFS_4G, MPU9250::MFS_16BITS, MPU9250::GFS_500DPS);
+        result |= imus[i]->subscribe(subs[i]);
+        if (mode == OWN_PINS) {
+            result |= imus[i]->setInterruptPin(MPU_INT_ACTL);
+        } else {
+            result |= group->add(imus[i]);
+        }
+        imus[i]->setRecovery(2, 50);
+    }
+    if (result != 0) {
+        fprintf(stderr, "driver configuration failed %x\n", result);
+        return false;
+    }
+
+    // devices latched during bring up, before the line was watched, so service them all once
+    // before the run, that sample was taken before it starts
+    if (mode != OWN_PINS) {
+        pins[0]->fall(sharedFall);
+        group->edge();
+        group->dispatch();
+    }
+    uint64_t end = MPU9250SimNow() + (uint64_t)(o.seconds * 1e6);
+    for (int i = 0; i < o.devices; i++) {
+        uint64_t period = 1000000 / imus[i]->getSampleRate();
+        uint64_t first;
+        if (mode == OWN_PINS) {
+            imus[i]->publish();
+        }
+        while (subs[i]->read(&s)) {
+        }
+        ownPending[i] = false;
+        published.push_back(MPU9250SimNow());
+        delivered.push_back(0);
+        // the simulated clock is exact, so the ticks to come are known from the first
+        first = chips[i]->nextSample();
+        expected.push_back((first < end) ? (uint32_t)(((end - first - 1) / period) + 1) : 0);
+        chips[i]->setFaults(&faults);
+    }
+    MPU9250GroupStats before = group->stats();
+    for (int i = 0; i < o.devices; i++) {
+        r->transactions -= buses[i]->transactions();
+        r->bytes -= buses[i]->bytes();
+        r->bus -= buses[i]->busy();
+    }
+
+    while (MPU9250SimNow() < end) {
+        uint64_t next = end;
+        bool pending;
+
+        for (int i = 0; i < o.devices; i++) {
+            uint64_t t = chips[i]->nextSample();
+            next = (t < next) ? t : next;
+        }
+        if (next > MPU9250SimNow()) {
+            MPU9250SimAdvance(next - MPU9250SimNow());
+        }
+        r->edges += deliver(lines, pins, mode);
+        MPU9250SimAdvance(o.dispatch);
+        do {
+            pending = false;
+            if (mode == OWN_PINS) {
+                for (int i = 0; i < o.devices; i++) {
+                    // as MPU9250Group does, poll a device silent for two periods, it may have reset,
+                    // publishing only if it has data ready so a late sample is not read twice
+                    if (ownPending[i]) {
+                        ownPending[i] = false;
+                        imus[i]->publish();
+                        published[i] = MPU9250SimNow();
+                    } else if ((MPU9250SimNow() - published[i]) > (2000000u / imus[i]->getSampleRate())) {
+                        uint8_t status;
+                        imus[i]->publishIfReady(&status, false);
+                        published[i] = MPU9250SimNow();
+                        r->polls++;
+                    }
+                }
+            } else if (group->pending()) {
+                group->dispatch();
+            }
+            r->edges += deliver(lines, pins, mode);
+            for (int i = 0; i < o.devices; i++) {
+                pending |= ownPending[i];
+                while (subs[i]->read(&s)) {
+                    delivered[i]++;
+                }
+            }
+            pending |= (mode != OWN_PINS) && group->pending();
+        } while (pending && (MPU9250SimNow() < end));
+        for (size_t i = 0; i < lines.size(); i++) {
+            // low with no edge to come: nothing will be dispatched again
+            if (!pending && lines[i]->low()) {
+                r->stuck++;
+            }
+        }
+    }
+
+    const MPU9250GroupStats & after = group->stats();
+    r->group.dispatches = after.dispatches - before.dispatches;
+    r->group.passes = after.passes - before.passes;
+    r->group.bursts = after.bursts - before.bursts;
+    r->group.statusReads = after.statusReads - before.statusReads;
+    r->group.serviced = after.serviced - before.serviced;
+    r->group.spurious = after.spurious - before.spurious;
+    r->group.unfinished = after.unfinished - before.unfinished;
+    r->group.timeouts = after.timeouts - before.timeouts;
+    for (int i = 0; i < o.devices; i++) {
+        r->transactions += buses[i]->transactions();
+        r->bytes += buses[i]->bytes();
+        r->bus += buses[i]->busy();
+        r->recoveries += imus[i]->health().recoveries;
+        r->expected += expected[i];
+        r->delivered += delivered[i];
+        r->lost += (delivered[i] < expected[i]) ? (expected[i] - delivered[i]) : 0;
+    }
+    r->resets = faults.resets;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (lines[i]->lost() > 0) {
+            fprintf(stderr, "line model overflowed, edges unreliable\n");
+        }
+    }
+    for (int i = 0; i < o.devices; i++) {
+        delete subs[i];
+        delete imus[i];
+        delete i2c[i];
+        delete buses[i];
+        delete chips[i];
+    }
+    for (size_t i = 0; i < lines.size(); i++) {
+        delete lines[i];
+        delete pins[i];
+    }
+    delete group;
+    return true;
+}
+
+static void report(const char * name, int pins, const Result & r)
+{
+    double n = r.delivered ? r.delivered : 1;
+
+    printf("%-20s %4d %8u %6u %8.2f %8.1f %10.1f %6u", name, pins, (unsigned)r.delivered, (unsigned)r.lost,
+           r.transactions / n, r.bytes / n, r.bus * 1e-3 / n, (unsigned)r.stuck);
+    if (r.group.dispatches > 0) {
+        printf(" %6.2f %8.2f %5u %5u %5u", (double)r.group.passes / r.group.dispatches,
+               (double)r.group.statusReads / n, (unsigned)r.group.spurious, (unsigned)r.group.unfinished,
+               (unsigned)r.group.timeouts);
+    } else {
+        printf(" %6s %8s %5s %5s %5u", "", "", "", "", (unsigned)r.polls);
+    }
+    printf("\n");
+    return;
+}
+
+int main(int argc, char ** argv)
+{
+    Options o;
+    Result own;
+    Result read;
+    Result pass;
+    int opt;
+
+    o.devices = 4;
+    o.seconds = 10.0;
+    o.khz = 400;
+    o.dispatch = 0;
+    o.resets = 0.0;
+    while ((opt = getopt(argc, argv, "n:r:t:k:d:x:")) != -1) {
+        switch (opt) {
+            case 'n': o.devices = atoi(optarg); break;
+            case 'r': {
+                char * p = optarg;
+                while (*p != '\0') {
+                    o.rates.push_back((int)strtol(p, &p, 10));
+                    if (*p == ',') {
+                        p++;
+                    } else if (*p != '\0') {
+                        o.rates.push_back(0);
+                        break;
+                    }
+                }
+                break;
+            }
+            case 't': o.seconds = atof(optarg); break;
+            case 'k': o.khz = atoi(optarg); break;
+            case 'd': o.dispatch = (uint32_t)atoi(optarg); break;
+            case 'x': o.resets = atof(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n devices] [-r Hz,...] [-t seconds] [-k kHz] [-d us] [-x resets]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (o.rates.empty()) {
+        o.rates.push_back(200);
+    }
+    for (size_t i = 0; i < o.rates.size(); i++) {
+        if ((o.rates[i] <= 0) || (o.rates[i] > 1000)) {
+            o.seconds = 0.0;
+        }
+    }
+    if ((o.devices < 1) || (o.devices > MPU_GROUP_MAX) || (o.seconds <= 0.0) || (o.khz <= 0) || (o.resets < 0.0)) {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    if (!run(o, OWN_PINS, &own) || !run(o, SHARED_READ, &read) || !run(o, SHARED_PASS, &pass)) {
+        return 1;
+    }
+    printf("%d devices, %.1f s, %d kHz buses, %u us dispatch, %.2f resets/s each\n", o.devices, o.seconds, o.khz,
+           (unsigned)o.dispatch, o.resets);
+    printf("                     pins  samples   lost xfer/smp byte/smp bus us/smp  stuck passes stat/smp  spur unfin  poll\n");
+    report("pin per device", o.devices, own);
+    report("shared, line read", 1, read);
+    report("shared, extra pass", 1, pass);
+    if (o.resets > 0.0) {
+        printf("resets %u, %u, %u; recoveries %u, %u, %u\n", (unsigned)own.resets, (unsigned)read.resets,
+               (unsigned)pass.resets, (unsigned)own.recoveries, (unsigned)read.recoveries, (unsigned)pass.recoveries);
+    }
+    // without resets the line must never be left low with nothing pending
+    return ((o.resets > 0.0) || ((read.stuck + pass.stuck) == 0)) ? 0 : 1;
+}
@@ -0,0 +1,619 @@
+/* 
+ * @file    mpu9250_sim.cpp
+ * @brief   Run the MPU9250 driver against a simulated device and trajectory
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Build on the host from the library directory, with sim/ first on the include path
+ * so the driver picks up the simulated mbed.h, e.g.
+ *     g++ -O2 -Isim -I. tools/mpu9250_sim.cpp sim/MPU9250Sim.cpp sim/MPU9250BusTiming.cpp \
+ *         sim/MPU9250Trajectory.cpp MPU9250.cpp MPU9250Subscriber.cpp MPU9250Calibration.cpp \
+ *         MPU9250Fusion.cpp MPU9250Math.cpp MPU9250Stream.cpp MPU9250QuatCodec.cpp MPU9250Latency.cpp \
+ *         MPU9250Pool.cpp -o mpu9250_sim
+ * Usage: mpu9250_sim [-t seconds] [-r Hz] [-k kHz] [-s seed] [-i] [-m] [-o file]
+ *                    [-f faults] [-R retries,interval] [-w windows] [-G ns] [-d us] [-l file]
+ *     -t  length of the random trajectory (20)
+ *     -r  subscriber rate (200)
+ *     -k  bus clock (400), bus time is modelled by MPU9250I2CTiming
+ *     -s  seed for the trajectory and the part's errors (1)
+ *     -i  ideal part, only quantisation and saturation
+ *     -m  slave the magnetometer to the MPU9250's I2C master instead of bypass
+ *     -o  write the samples, each followed by the true orientation, as an MPU9250Stream
+ *         file, the dataset format mpu9250_tune takes
+ *     -f  inject faults, comma separated, e.g. nak=1e-3,stuck=1e-4:2000,reset=0.1
+ *             nak=p           address not acknowledged, per transaction
+ *             stretch=p:us    clock stretched by up to us, per transaction
+ *             stuck=p:us      SDA held low for us, per transaction
+ *             fifo=p          one bit of the FIFO count flipped, per count read
+ *             reset=r         MPU9250 and AK8963 reset, per second
+ *             hofl=p          AK8963 magnetic overflow, per measurement
+ *     -R  driver retries per register transfer and publishes between health checks (2,100)
+ *     -w  static FIFO windows read with readStaticAccel after the trajectory (20)
+ *     -G  master time between transactions, ns (0)
+ *     -d  data ready interrupt to publish, us, the firmware's dispatch time (0)
+ *     -l  write the latency trace, one line of stamps per fused sample, as CSV
+ *
+ * The unmodified driver is initialised and configured for all sensors, then
+ * publishes to a subscriber as a firmware main loop would. Samples are fused and
+ * the orientation compared to the truth, and the bus traffic per sample reported.
+ * The typical part is uncalibrated, so its error is dominated by gyro and hard
+ * iron bias; -i isolates the filter and the trajectory's linear acceleration.
+ *
+ * The main loop waits for each data ready edge, raised at the part's sample tick,
+ * and MPU9250Latency stamps the samples on their way to the filter. In simulated
+ * time only the bus and -d take time, so the latency table shows what the bus clock,
+ * magnetometer path and retries cost from the edge to the fused output.
+ *
+ * With -f the same run is made twice, without and with the faults, and the cost of
+ * handling them reported: samples lost or wrong, how long outages last from the
+ * first bad sample to the next good one, the extra time in publish, and the bus
+ * transactions that failed, repeated a transfer or reconfigured after a reset, each
+ * put down to the driver's retries and recoveries as it was made.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "MPU9250.h"
+#include "MPU9250Fusion.h"
+#include "MPU9250Latency.h"
+#include "MPU9250Stream.h"
+#include "MPU9250Sim.h"
+#include "MPU9250Trajectory.h"
+
+/* Keys every half second: a wandering heading, tilt within 30 degrees, and hand tremor sized moves */
+static std::vector<MPU9250SimKey> randomKeys(double seconds, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<MPU9250SimKey> keys;
+    double yaw = 0.0;
+
+    for (double t = 0.0; t <= (seconds + 0.5); t += 0.5) {
+        MPU9250SimKey k;
+        double roll = (t < 1.0) ? 0.0 : (0.5 * uniform(rng));
+        double pitch = (t < 1.0) ? 0.0 : (0.5 * uniform(rng));
+        double cy, sy, cp, sp, cr, sr;
+        yaw += (t < 1.0) ? 0.0 : (1.0 * uniform(rng));
+        cy = cos(yaw / 2); sy = sin(yaw / 2);
+        cp = cos(pitch / 2); sp = sin(pitch / 2);
+        cr = cos(roll / 2); sr = sin(roll / 2);
+        k.t = t;
+        // z-y-x Euler order
+        k.q[0] = (cr * cp * cy) + (sr * sp * sy);
+        k.q[1] = (sr * cp * cy) - (cr * sp * sy);
+        k.q[2] = (cr * sp * cy) + (sr * cp * sy);
+        k.q[3] = (cr * cp * sy) - (sr * sp * cy);
+        for (int j = 0; j < 3; j++) {
+            k.position[j] = (t < 1.0) ? 0.0 : (0.01 * uniform(rng));
+        }
+        keys.push_back(k);
+    }
+    return keys;
+}
+
+static double angle(const float * a, const double * b)
+{
+    double w = (a[0] * b[0]) + (a[1] * b[1]) + (a[2] * b[2]) + (a[3] * b[3]);
+    double x = (a[0] * b[1]) - (a[1] * b[0]) - (a[2] * b[3]) + (a[3] * b[2]);
+    double y = (a[0] * b[2]) + (a[1] * b[3]) - (a[2] * b[0]) - (a[3] * b[1]);
+    double z = (a[0] * b[3]) - (a[1] * b[2]) + (a[2] * b[1]) - (a[3] * b[0]);
+
+    return 2.0 * atan2(sqrt((x * x) + (y * y) + (z * z)), fabs(w)) * (180.0 / M_PI);
+}
+
+/**
+ *  @struct Options
+ *  @brief One run's settings
+ */
+struct Options {
+    double          seconds;
+    int             rate;
+    int             khz;
+    uint32_t        seed;
+    bool            ideal;
+    bool            slave;
+    uint8_t         retries;
+    uint16_t        interval;
+    int             windows;
+    uint32_t        gap;
+    const char *    out;
+    uint32_t        dispatch;
+    const char *    trace;
+};
+
+/**
+ *  @struct Result
+ *  @brief What a run measured
+ */
+struct Result {
+    uint32_t        expected;       // sample periods in the run
+    uint32_t        publishes;
+    uint32_t        good;
+    uint32_t        wrong;          // delivered but not what the part measured
+    uint32_t        magSamples;
+    uint32_t        ticks;
+    uint32_t        overruns;
+    uint32_t        transactions;
+    uint32_t        bytes;
+    uint32_t        naks;
+    uint64_t        busy;           // us spent in publish
+    uint64_t        bus;            // ns of bus occupancy
+    uint32_t        outages;
+    double          outageSum;      // ms
+    double          outageWorst;
+    double          sumSq;
+    double          worst;
+    uint32_t        scored;
+    uint32_t        windows;
+    uint32_t        windowsGood;
+    uint32_t        windowsWrong;
+    float           window[3];      // first good static mean, counts
+    MPU9250Health   health;
+    uint32_t        retryTransactions;      // repeating a transfer, from the first retry on
+    uint32_t        recoveryTransactions;   // reconfiguring after a reset was found
+    uint32_t        failedTransactions;
+    uint16_t        fs;
+    MPU9250LatencyStats latency[MPU_LAT_STAMPS];
+    uint32_t        skipped;        // data ready edges with no publish
+};
+
+/**
+ *  @struct Attribution
+ *  @brief Bus transactions put down to the driver's retries and recoveries
+ *
+ *  The driver counts a retry just before repeating a transfer and a reset just
+ *  before reconfiguring, so its health counts moving since the last transaction
+ *  say what this one is for. A retry runs to the transfer's STOP or its next
+ *  failure; a recovery to the count of recoveries moving, or to the end of the
+ *  driver call if it fails.
+ */
+struct Attribution {
+    const MPU9250 *     imu;
+    MPU9250Health       last;
+    bool                retrying;
+    bool                recovering;
+    Result *            r;
+};
+
+static void attribute(void * context, bool ok, bool stop)
+{
+    Attribution * a = (Attribution *)context;
+    const MPU9250Health & h = a->imu->health();
+
+    a->retrying |= (h.retries != a->last.retries);
+    a->recovering |= (h.resets != a->last.resets);
+    a->recovering &= (h.recoveries == a->last.recoveries);
+    a->r->retryTransactions += a->retrying ? 1 : 0;
+    a->r->recoveryTransactions += (a->recovering && !a->retrying) ? 1 : 0;
+    a->r->failedTransactions += ok ? 0 : 1;
+    a->retrying &= ok && !stop;
+    a->last = h;
+    return;
+}
+
+static MPU9250Latency * edgeLatency;
+
+/* The data ready interrupt handler */
+static void dataReady(void)
+{
+    edgeLatency->edge();
+}
+
+/* Write the latency trace as CSV */
+static bool writeTrace(const char * name, MPU9250Latency & latency)
+{
+    MPU9250LatencyRecord rec;
+    FILE * f = fopen(name, "w");
+
+    if (f == NULL) {
+        perror(name);
+        return false;
+    }
+    fprintf(f, "seq,edge,transfer,decode,calibrate,fusion,polled\n");
+    for (uint16_t i = 0; latency.trace(i, &rec); i++) {
+        fprintf(f, "%u,%u,%u,%u,%u,%u,%d\n", (unsigned)rec.seq, (unsigned)rec.stamp[MPU_LAT_EDGE],
+                (unsigned)rec.stamp[MPU_LAT_TRANSFER], (unsigned)rec.stamp[MPU_LAT_DECODE],
+                (unsigned)rec.stamp[MPU_LAT_CALIBRATE], (unsigned)rec.stamp[MPU_LAT_FUSION],
+                (rec.flags & MPU_LAT_POLLED) ? 1 : 0);
+    }
+    fclose(f);
+    return true;
+}
+
+/* Parse the -f list into the fault probabilities */
+static bool parseFaults(char * spec, MPU9250SimFaults * faults)
+{
+    for (char * item = strtok(spec, ","); item != NULL; item = strtok(NULL, ",")) {
+        char * value = strchr(item, '=');
+        char * extra;
+        double p;
+
+        if (value == NULL) {
+            return false;
+        }
+        *value++ = '\0';
+        p = strtod(value, &extra);
+        if ((p < 0.0) || ((p > 1.0) && strcmp(item, "reset"))) {
+            return false;
+        }
+        if (!strcmp(item, "nak")) {
+            faults->nak = p;
+        } else if (!strcmp(item, "stretch") && (*extra == ':')) {
+            faults->stretch = p;
+            faults->stretchUs = (uint32_t)atoi(extra + 1);
+        } else if (!strcmp(item, "stuck") && (*extra == ':')) {
+            faults->stuck = p;
+            faults->stuckUs = (uint32_t)atoi(extra + 1);
+        } else if (!strcmp(item, "fifo")) {
+            faults->fifoCount = p;
+        } else if (!strcmp(item, "reset")) {
+            faults->reset = p;
+        } else if (!strcmp(item, "hofl")) {
+            faults->overflow = p;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Run the driver over the trajectory, with faults if given */
+static bool run(const Options & o, MPU9250SimFaults * faults, const float * reference, Result * r)
+{
+    static const double field[3] = {20.0, 0.0, -40.0};     // uT, north and down
+    static MPU9250Sample queue[64];
+    static uint8_t streamBuffer[4096];
+    static MPU9250LatencyRecord trace[4096];
+    MPU9250SimErrors errors;
+    MPU9250StreamEncoder encoder(streamBuffer, NULL, sizeof(streamBuffer));
+    FILE * f = NULL;
+
+    memset(r, 0, sizeof(*r));
+    MPU9250SimRestart();
+    if (o.ideal) {
+        MPU9250SimIdeal(&errors);
+    } else {
+        MPU9250SimTypical(&errors, o.seed);
+    }
+    if (o.out != NULL) {
+        f = fopen(o.out, "wb");
+        if (f == NULL) {
+            perror(o.out);
+            return false;
+        }
+    }
+
+    std::vector<MPU9250SimKey> keys = randomKeys(o.seconds, o.seed);
+    MPU9250Trajectory trajectory(&keys[0], (uint16_t)keys.size(), field);
+    MPU9250SimChip chip(&trajectory, errors);
+    MPU9250SimBus bus;
+    chip.attach(bus);
+    I2C i2c(bus);
+    bus.setGap(o.gap);
+    i2c.frequency(o.khz * 1000);
+
+    // faults start once the driver is configured, bring up is not under test
+    InterruptIn intr(0);
+    MPU9250 imu(i2c, &intr);
+    MPU9250Subscriber sub(queue, 64, MPU_CH_ALL, (uint16_t)o.rate);
+    uint8_t result = imu.setParameters(MPU9250::HP_ALL, MPU9250::AFS_4G, MPU9250::MFS_16BITS, MPU9250::GFS_500DPS);
+    result |= imu.subscribe(&sub);
+    if (o.slave) {
+        result |= imu.slaveMagnetometer();
+    }
+    if (result != 0) {
+        fprintf(stderr, "driver configuration failed %x\n", result);
+        if (f != NULL) {
+            fclose(f);
+        }
+        return false;
+    }
+    imu.setRecovery(o.retries, o.interval);
+    MPU9250Latency latency(trace, sizeof(trace) / sizeof(trace[0]));
+    edgeLatency = &latency;
+    intr.rise(dataReady);
+    imu.setLatency(&latency);
+    bus.setFaults(faults);
+    chip.setFaults(faults);
+    Attribution attribution = {&imu, imu.health(), false, false, r};
+    bus.setMonitor(attribute, &attribution);
+
+    MPU9250Madgwick filter;
+    MPU9250Sample s;
+    const float accelScale = 4.0f / 32768.0f;
+    const float gyroScale = 500.0f / 32768.0f * (float)(M_PI / 180.0);
+    uint64_t start = MPU9250SimNow();
+    uint64_t period = 1000000 / (uint64_t)imu.getSampleRate();
+    uint64_t next = start;
+    uint64_t fused = start;
+    uint64_t outage = 0;
+    uint64_t t;
+    uint32_t transactions = bus.transactions();
+    uint32_t bytes = bus.bytes();
+    uint32_t naks = bus.naks();
+    uint64_t occupied = bus.busy();
+    double e;
+    float q[4];
+    bool seeded = false;
+    bool ok;
+
+    r->fs = imu.getSampleRate();
+    while ((MPU9250SimNow() - start) < (uint64_t)(o.seconds * 1e6)) {
+        // periods missed while the driver was busy recovering are lost samples
+        next = chip.nextSample();
+        MPU9250SimAdvance(next - MPU9250SimNow());
+        intr.edge(true);
+        MPU9250SimAdvance(o.dispatch);
+        r->expected = (uint32_t)((next - start) / period);
+        t = MPU9250SimNow();
+        imu.publish();
+        attribution.recovering = false;
+        r->publishes++;
+        r->busy += MPU9250SimNow() - t;
+        while (sub.read(&s)) {
+            const MPU9250SimTruth & truth = chip.truth();
+            // the part's own reading, for spotting samples decoded at the wrong range
+            const double limitG = 0.3;
+            const double limitDps = 30.0;
+            ok = (s.channels & MPU_CH_ACCEL) && (s.channels & MPU_CH_GYRO);
+            for (int j = 0; ok && (j < 3); j++) {
+                ok = (fabs((s.accel[j] * accelScale) - truth.accel[j]) < limitG) &&
+                     (fabs((s.gyro[j] * gyroScale) - truth.gyro[j]) * (180.0 / M_PI) < limitDps);
+            }
+            if (!ok) {
+                r->wrong += (s.channels & MPU_CH_ACCEL) ? 1 : 0;
+                if (outage == 0) {
+                    outage = MPU9250SimNow();
+                }
+                continue;
+            }
+            if (outage != 0) {
+                e = (MPU9250SimNow() - outage) * 1e-3;
+                r->outages++;
+                r->outageSum += e;
+                r->outageWorst = (e > r->outageWorst) ? e : r->outageWorst;
+                outage = 0;
+            }
+            r->good++;
+            if (!seeded) {
+                for (int j = 0; j < 4; j++) {
+                    q[j] = (float)truth.q[j];
+                }
+                filter.setQuaternion(q);
+                seeded = true;
+            }
+            float dt = (float)((MPU9250SimNow() - fused) * 1e-6);
+            float ax = s.accel[0] * accelScale, ay = s.accel[1] * accelScale, az = s.accel[2] * accelScale;
+            float gx = s.gyro[0] * gyroScale, gy = s.gyro[1] * gyroScale, gz = s.gyro[2] * gyroScale;
+            fused = MPU9250SimNow();
+            if (s.channels & MPU_CH_MAG) {
+                // AK8963 axes into the accel frame
+                filter.update(ax, ay, az, gx, gy, gz, s.mag[1], s.mag[0], -s.mag[2], dt);
+                r->magSamples++;
+            } else {
+                filter.updateIMU(ax, ay, az, gx, gy, gz, dt);
+            }
+            latency.fused(s.seq);
+            if ((MPU9250SimNow() - start) > 2000000) {
+                e = angle(filter.quaternion(), truth.q);
+                r->sumSq += e * e;
+                r->worst = (e > r->worst) ? e : r->worst;
+                r->scored++;
+            }
+            if (f != NULL) {
+                for (int j = 0; j < 4; j++) {
+                    q[j] = (float)truth.q[j];
+                }
+                if (encoder.pending() > (sizeof(streamBuffer) - (2 * MPU_STREAM_MAX_FRAME))) {
+                    const uint8_t * data;
+                    uint16_t length = encoder.flip(&data);
+                    fwrite(data, 1, length, f);
+                }
+                encoder.sample(s, 0);
+                encoder.quaternion(q, 0);
+            }
+        }
+    }
+    if (outage != 0) {
+        r->outages++;
+        e = (MPU9250SimNow() - outage) * 1e-3;
+        r->outageSum += e;
+        r->outageWorst = (e > r->outageWorst) ? e : r->outageWorst;
+    }
+    r->ticks = chip.samples();
+    r->overruns = sub.overruns();
+    r->transactions = bus.transactions() - transactions;
+    r->bytes = bus.bytes() - bytes;
+    r->naks = bus.naks() - naks;
+    r->bus = bus.busy() - occupied;
+    for (uint8_t j = 0; j < MPU_LAT_STAMPS; j++) {
+        latency.stats(j, &r->latency[j]);
+    }
+    r->skipped = latency.skipped();
+    imu.setLatency(NULL);
+    if ((o.trace != NULL) && !writeTrace(o.trace, latency)) {
+        if (f != NULL) {
+            fclose(f);
+        }
+        return false;
+    }
+
+    // the keys run on past the end, once they stop each window should agree with the first clean one
+    MPU9250SimAdvance(1000000);
+    for (int w = 0; w < o.windows; w++) {
+        float mean[3];
+        float variance[3];
+        r->windows++;
+        uint8_t status = imu.readStaticAccel(50, mean, variance);
+        attribution.recovering = false;
+        if (status != 0) {
+            continue;
+        }
+        if (reference == NULL) {
+            reference = r->window;
+            memcpy(r->window, mean, sizeof(mean));
+        }
+        ok = true;
+        for (int j = 0; j < 3; j++) {
+            ok = ok && (fabs(mean[j] - reference[j]) < (0.02f / accelScale));
+        }
+        r->windowsGood += ok ? 1 : 0;
+        r->windowsWrong += ok ? 0 : 1;
+    }
+    r->health = imu.health();
+    bus.setMonitor(NULL, NULL);
+
+    if (f != NULL) {
+        const uint8_t * data;
+        uint16_t length = encoder.flip(&data);
+        fwrite(data, 1, length, f);
+        fclose(f);
+    }
+    return true;
+}
+
+static void report(const char * name, const Result & r)
+{
+    uint32_t lost = r.expected - ((r.good + r.wrong) < r.expected ? (r.good + r.wrong) : r.expected);
+
+    printf("%s\n", name);
+    printf("  %u of %u samples good, %u lost, %u wrong, %u with mag, %u device ticks, %u subscriber overruns\n",
+           (unsigned)r.good, (unsigned)r.expected, (unsigned)lost, (unsigned)r.wrong, (unsigned)r.magSamples,
+           (unsigned)r.ticks, (unsigned)r.overruns);
+    printf("  %.2f transactions and %.1f bytes per sample, %u NAKs, %.1f us bus and %.1f us in publish per sample\n",
+           (double)r.transactions / (r.expected ? r.expected : 1), (double)r.bytes / (r.expected ? r.expected : 1),
+           (unsigned)r.naks, (double)r.bus * 1e-3 / (r.expected ? r.expected : 1),
+           (double)r.busy / (r.expected ? r.expected : 1));
+    if (r.outages > 0) {
+        printf("  %u outages, %.2f ms mean, %.2f ms worst\n", (unsigned)r.outages, r.outageSum / r.outages, r.outageWorst);
+    }
+    printf("  driver: %u retries, %u failed transfers, %u checks, %u resets found, %u recoveries, "
+           "%u mag overflows, %u bad FIFO counts, %u FIFO resets\n", (unsigned)r.health.retries,
+           (unsigned)r.health.failures, (unsigned)r.health.checks, (unsigned)r.health.resets,
+           (unsigned)r.health.recoveries, (unsigned)r.health.magOverflows, (unsigned)r.health.fifoErrors,
+           (unsigned)r.health.fifoResets);
+    if (r.windows > 0) {
+        printf("  static FIFO windows: %u good, %u wrong, %u failed\n", (unsigned)r.windowsGood,
+               (unsigned)r.windowsWrong, (unsigned)(r.windows - r.windowsGood - r.windowsWrong));
+    }
+    printf("  Madgwick orientation error after 2 s: %.3f deg rms, %.3f deg worst\n",
+           r.scored ? sqrt(r.sumSq / r.scored) : 0.0, r.worst);
+    printf("  latency, us     count    min   mean    p50    p90    p99  p99.9    max\n");
+    for (uint8_t j = MPU_LAT_TRANSFER; j <= (MPU_LAT_STAMPS + MPU_LAT_TOTAL); j++) {
+        static const char * names[] = {"edge to fusion", "edge to transfer", "decode", "calibrate", "to fusion"};
+        const MPU9250LatencyStats & l = r.latency[j % MPU_LAT_STAMPS];
+        printf("  %-16s %6u %6u %6u %6u %6u %6u %6u %6u\n", names[j % MPU_LAT_STAMPS], (unsigned)l.count,
+               (unsigned)l.min, (unsigned)l.mean, (unsigned)l.p50, (unsigned)l.p90, (unsigned)l.p99,
+               (unsigned)l.p999, (unsigned)l.max);
+    }
+    if (r.skipped > 0) {
+        printf("  %u data ready edges with no publish\n", (unsigned)r.skipped);
+    }
+    return;
+}
+
+int main(int argc, char ** argv)
+{
+    Options o = {20.0, 200, 400, 1, false, false, 2, 100, 20, 0, NULL, 0, NULL};
+    MPU9250SimFaults faults;
+    Result clean;
+    Result faulty;
+    char * spec = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:r:k:s:imo:f:R:w:G:d:l:")) != -1) {
+        switch (opt) {
+            case 't': o.seconds = atof(optarg); break;
+            case 'r': o.rate = atoi(optarg); break;
+            case 'k': o.khz = atoi(optarg); break;
+            case 's': o.seed = (uint32_t)atoi(optarg); break;
+            case 'i': o.ideal = true; break;
+            case 'm': o.slave = true; break;
+            case 'o': o.out = optarg; break;
+            case 'f': spec = optarg; break;
+            case 'R': {
+                int retries = 0;
+                int interval = 0;
+                if (sscanf(optarg, "%d,%d", &retries, &interval) != 2) {
+                    retries = -1;
+                }
+                o.retries = (uint8_t)retries;
+                o.interval = (uint16_t)interval;
+                if ((retries < 0) || (retries > 255) || (interval < 0) || (interval > 65535)) {
+                    o.seconds = 0.0;
+                }
+                break;
+            }
+            case 'w': o.windows = atoi(optarg); break;
+            case 'G': o.gap = (uint32_t)atoi(optarg); break;
+            case 'd': o.dispatch = (uint32_t)atoi(optarg); break;
+            case 'l': o.trace = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds] [-r Hz] [-k kHz] [-s seed] [-i] [-m] [-o file] "
+                        "[-f faults] [-R retries,interval] [-w windows] [-G ns] [-d us] [-l file]\n", argv[0]);
+                return 2;
+        }
+    }
+    MPU9250SimNoFaults(&faults, o.seed);
+    if ((o.seconds <= 0.0) || (o.rate <= 0) || (o.rate > 1000) || (o.khz <= 0) || (o.windows < 0) ||
+        ((spec != NULL) && !parseFaults(spec, &faults))) {
+        fprintf(stderr, "bad arguments\n");
+        return 2;
+    }
+
+    printf("%s part, seed %u, %.1f s at %d Hz, %s magnetometer, %d kHz bus, %d retries, check every %d\n",
+           o.ideal ? "ideal" : "typical", (unsigned)o.seed, o.seconds, o.rate, o.slave ? "slaved" : "bypass",
+           o.khz, (int)o.retries, (int)o.interval);
+    if (spec == NULL) {
+        if (!run(o, NULL, NULL, &clean)) {
+            return 1;
+        }
+        report("no faults", clean);
+        return 0;
+    }
+
+    const char * out = o.out;
+    const char * trace = o.trace;
+    o.out = NULL;
+    o.trace = NULL;
+    if (!run(o, NULL, NULL, &clean)) {
+        return 1;
+    }
+    o.out = out;
+    o.trace = trace;
+    if (!run(o, &faults, clean.window, &faulty)) {
+        return 1;
+    }
+    report("no faults", clean);
+    report("with faults", faulty);
+    printf("injected: %u NAKs, %u stretches, %u stuck bus, %u bad FIFO counts, %u resets, %u overflows\n",
+           (unsigned)faults.naks, (unsigned)faults.stretches, (unsigned)faults.stuckEpisodes,
+           (unsigned)faults.fifoCounts, (unsigned)faults.resets, (unsigned)faults.overflows);
+    printf("cost: %u transactions failed, %u repeating %u retried transfers, %u reconfiguring after %u resets,\n"
+           "      %+.1f us in publish per sample, %d samples lost or wrong\n",
+           (unsigned)faulty.failedTransactions, (unsigned)faulty.retryTransactions, (unsigned)faulty.health.retries,
+           (unsigned)faulty.recoveryTransactions, (unsigned)faulty.health.resets,
+           ((double)faulty.busy / (faulty.expected ? faulty.expected : 1)) -
+           ((double)clean.busy / (clean.expected ? clean.expected : 1)),
+           (int)(clean.good - faulty.good));
+    return 0;
+}
@@ -0,0 +1,146 @@
+/* 
+ * @file    mpu9250_stream.cpp
+ * @brief   Host decoder for the MPU9250 binary sample stream
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Build on a Linux host from the library directory, e.g.
+ *     g++ -O2 -I. tools/mpu9250_stream.cpp MPU9250Stream.cpp MPU9250QuatCodec.cpp MPU9250Math.cpp \
+ *         -o mpu9250_stream
+ * Usage: mpu9250_stream [-b baud] [-q] <serial device | file | ->
+ * Frames are written to stdout as CSV, one line each:
+ *     S,seq,channels,ax,ay,az,gx,gy,gz,mx,my,mz,temp
+ *     Q,seq,w,x,y,z
+ *     T,seq,status,fifo,overruns
+ * -q prints only the totals, written to stderr at the end of the input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "MPU9250Stream.h"
+
+static speed_t baudRate(long baud)
+{
+    switch (baud) {
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        default: return B0;
+    }
+}
+
+static int openInput(const char * path, long baud)
+{
+    struct termios tio;
+    speed_t speed;
+    int fd;
+
+    if (strcmp(path, "-") == 0) {
+        return STDIN_FILENO;
+    }
+    fd = open(path, O_RDONLY | O_NOCTTY);
+    if ((fd < 0) || !isatty(fd)) {
+        return fd;
+    }
+    speed = baudRate(baud);
+    if ((speed == B0) || (tcgetattr(fd, &tio) != 0)) {
+        fprintf(stderr, "cannot set %ld baud on %s\n", baud, path);
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &tio);
+    return fd;
+}
+
+static void print(MPU9250StreamDecoder & decoder)
+{
+    MPU9250Sample s;
+    float q[4];
+    uint8_t status;
+    uint16_t fifo;
+    uint16_t overruns;
+
+    if (decoder.sample(&s)) {
+        printf("S,%u,%u", (unsigned)s.seq, s.channels);
+        for (int i = 0; i < 3; i++) {
+            printf((s.channels & MPU_CH_ACCEL) ? ",%d" : ",", s.accel[i]);
+        }
+        for (int i = 0; i < 3; i++) {
+            printf((s.channels & MPU_CH_GYRO) ? ",%d" : ",", s.gyro[i]);
+        }
+        for (int i = 0; i < 3; i++) {
+            printf((s.channels & MPU_CH_MAG) ? ",%d" : ",", s.mag[i]);
+        }
+        printf((s.channels & MPU_CH_TEMP) ? ",%d\n" : ",\n", s.temp);
+    } else if (decoder.quaternion(q)) {
+        printf("Q,%u,%.5f,%.5f,%.5f,%.5f\n", decoder.seq(), q[0], q[1], q[2], q[3]);
+    } else if (decoder.status(&status, &fifo, &overruns)) {
+        printf("T,%u,%u,%u,%u\n", decoder.seq(), status, fifo, overruns);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    MPU9250StreamDecoder decoder;
+    uint8_t buffer[4096];
+    long baud = 921600;
+    bool quiet = false;
+    ssize_t n;
+    int opt;
+    int fd;
+
+    while ((opt = getopt(argc, argv, "b:q")) != -1) {
+        switch (opt) {
+            case 'b': baud = strtol(optarg, NULL, 10); break;
+            case 'q': quiet = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-b baud] [-q] <serial device | file | ->\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind != (argc - 1)) {
+        fprintf(stderr, "usage: %s [-b baud] [-q] <serial device | file | ->\n", argv[0]);
+        return 2;
+    }
+    fd = openInput(argv[optind], baud);
+    if (fd < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (decoder.push(buffer[i]) && !quiet) {
+                print(decoder);
+            }
+        }
+    }
+    fprintf(stderr, "%u frames, %u errors, %u lost\n", (unsigned)decoder.frames(), (unsigned)decoder.errors(),
+            (unsigned)decoder.lost());
+    return 0;
+}
@@ -0,0 +1,412 @@
+/* 
+ * @file    mpu9250_tune.cpp
+ * @brief   Parallel fusion gain search against reference orientation
+ * @author  David Bartlett
+ * @version 1.0
+ * Copyright (c) 2016 Omnisense Limited (www.omnisense.co.uk)
+ *
+ * Licensed under the Apache Licence, Version 2.0 (the "Licence");
+ * you may not use this file except in compliance with the Licence.
+ * You may obtain a copy of the Licence at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the Licence is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the Licence for the specific language governing permissions and
+ * limitations under the Licence.
+ *
+ * Build on a Linux host from the library directory, e.g.
+ *     g++ -O2 -march=native -pthread -I. tools/mpu9250_tune.cpp MPU9250Stream.cpp MPU9250QuatCodec.cpp \
+ *         MPU9250Math.cpp MPU9250Fusion.cpp -o mpu9250_tune
+ * Usage: mpu9250_tune [options] <dataset>...
+ *     -f filter   madgwick, mahony or both (both)
+ *     -m mode     grid or search (search)
+ *     -n points   grid points per gain (12)
+ *     -a g        accel full scale, 2, 4, 8 or 16 (2)
+ *     -g dps      gyro full scale, 250, 500, 1000 or 2000 (250)
+ *     -r Hz       sample rate (1000)
+ *     -s n        samples at the start of each dataset left out of the score (2000)
+ *     -j n        threads (all cores)
+ *
+ * A dataset is an MPU9250Stream file in which every sample frame is followed by a
+ * quaternion frame holding the reference orientation for it, from motion capture
+ * or a high grade IMU merged into the stream, in the same frame as the filter's.
+ * Samples are taken to be calibrated already, as mpu9250_batch writes them.
+ *
+ * Datasets are decoded once into float buffers shared by every evaluation. An
+ * evaluation runs one filter with one set of gains over one dataset, seeded with
+ * the reference orientation, and sums the squared angle to the reference; these
+ * are spread over the threads. The grid is log spaced over each gain. The search
+ * is a coordinate descent in log steps from the library defaults, halving the step
+ * when no gain improves. Each filter's best gains are printed with RMS and worst
+ * error and the measured cost per update.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "MPU9250Stream.h"
+#include "MPU9250Fusion.h"
+
+#define FILTER_MADGWICK 0
+#define FILTER_MAHONY 1
+
+struct Dataset {
+    const char *            path;
+    std::vector<float>      in;             // ax, ay, az, gx, gy, gz, mx, my, mz per sample
+    std::vector<uint8_t>    mag;            // mag valid per sample
+    std::vector<float>      ref;            // w, x, y, z per sample
+    size_t                  count;
+};
+
+struct Candidate {
+    int                     filter;
+    float                   gain[2];
+    double                  sumSq;          // squared error in degrees, over all scored samples
+    double                  worst;
+    double                  seconds;
+    uint64_t                scored;
+    uint64_t                updates;
+};
+
+struct Gain {
+    const char *            name;
+    float                   start;
+    float                   low;
+    float                   high;
+    bool                    zero;           // 0 is allowed and switches the term off
+};
+
+static const Gain gains[2][2] = {
+    {{"beta", 0.9068997f, 0.005f, 5.0f, false}, {"zeta", 0.0151150f, 0.0001f, 0.5f, true}},
+    {{"kp", 10.0f, 0.05f, 50.0f, false}, {"ki", 0.01f, 0.0005f, 2.0f, true}},
+};
+static const char * const filterNames[2] = {"madgwick", "mahony"};
+
+static std::vector<Dataset> datasets;
+static float dt = 0.001f;
+static size_t settle = 2000;
+static size_t threads = 1;
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool load(Dataset & d, float accelScale, float gyroScale)
+{
+    MPU9250StreamDecoder decoder;
+    MPU9250Sample s;
+    std::vector<uint8_t> bytes;
+    bool pending = false;
+    float q[4];
+    struct stat st;
+    int fd;
+
+    fd = open(d.path, O_RDONLY);
+    if ((fd < 0) || (fstat(fd, &st) != 0)) {
+        return false;
+    }
+    bytes.resize((size_t)st.st_size);
+    if (read(fd, bytes.data(), bytes.size()) != (ssize_t)bytes.size()) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    for (size_t i = 0; i < bytes.size(); i++) {
+        if (!decoder.push(bytes[i])) {
+            continue;
+        }
+        if (decoder.sample(&s)) {
+            pending = ((s.channels & (MPU_CH_ACCEL | MPU_CH_GYRO)) == (MPU_CH_ACCEL | MPU_CH_GYRO));
+        } else if (decoder.quaternion(q) && pending) {
+            // AK8963 axes into the accel frame
+            float v[9] = {s.accel[0] * accelScale, s.accel[1] * accelScale, s.accel[2] * accelScale,
+                          s.gyro[0] * gyroScale, s.gyro[1] * gyroScale, s.gyro[2] * gyroScale,
+                          (float)s.mag[1], (float)s.mag[0], (float)-s.mag[2]};
+            d.in.insert(d.in.end(), v, v + 9);
+            d.mag.push_back((s.channels & MPU_CH_MAG) != 0);
+            d.ref.insert(d.ref.end(), q, q + 4);
+            pending = false;
+        }
+    }
+    d.count = d.mag.size();
+    return d.count > settle;
+}
+
+/* Angle between two orientations in degrees, atan2 keeps small angles accurate */
+static double angle(const float * a, const float * b)
+{
+    double w = (a[0] * b[0]) + (a[1] * b[1]) + (a[2] * b[2]) + (a[3] * b[3]);
+    double x = (a[0] * b[1]) - (a[1] * b[0]) - (a[2] * b[3]) + (a[3] * b[2]);
+    double y = (a[0] * b[2]) + (a[1] * b[3]) - (a[2] * b[0]) - (a[3] * b[1]);
+    double z = (a[0] * b[3]) - (a[1] * b[2]) + (a[2] * b[1]) - (a[3] * b[0]);
+
+    return 2.0 * atan2(sqrt((x * x) + (y * y) + (z * z)), fabs(w)) * (180.0 / M_PI);
+}
+
+static void evaluate(Candidate & c, const Dataset & d, double * sumSq, double * worst, double * seconds)
+{
+    MPU9250Madgwick madgwick(c.gain[0], c.gain[1]);
+    MPU9250Mahony mahony(c.gain[0], c.gain[1]);
+    MPU9250Fusion & filter = (c.filter == FILTER_MADGWICK) ? (MPU9250Fusion &)madgwick : (MPU9250Fusion &)mahony;
+    double t;
+    double e;
+
+    *sumSq = 0.0;
+    *worst = 0.0;
+    filter.setQuaternion(&d.ref[0]);
+    t = now();
+    for (size_t i = 0; i < d.count; i++) {
+        const float * v = &d.in[i * 9];
+        if (d.mag[i]) {
+            filter.update(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], dt);
+        } else {
+            filter.updateIMU(v[0], v[1], v[2], v[3], v[4], v[5], dt);
+        }
+        if (i >= settle) {
+            e = angle(filter.quaternion(), &d.ref[i * 4]);
+            *sumSq += e * e;
+            *worst = (e > *worst) ? e : *worst;
+        }
+    }
+    *seconds = now() - t;
+}
+
+/* Every candidate over every dataset, one job each, spread over the threads */
+static void evaluateAll(std::vector<Candidate> & candidates)
+{
+    size_t jobs = candidates.size() * datasets.size();
+    std::vector<double> sumSq(jobs), worst(jobs), seconds(jobs);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+
+    for (size_t t = 0; t < threads; t++) {
+        pool.push_back(std::thread([&]() {
+            size_t j;
+            while ((j = next++) < jobs) {
+                evaluate(candidates[j / datasets.size()], datasets[j % datasets.size()], &sumSq[j], &worst[j], &seconds[j]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < pool.size(); t++) {
+        pool[t].join();
+    }
+
+    for (size_t c = 0; c < candidates.size(); c++) {
+        Candidate & k = candidates[c];
+        k.sumSq = 0.0;
+        k.worst = 0.0;
+        k.seconds = 0.0;
+        k.scored = 0;
+        k.updates = 0;
+        for (size_t d = 0; d < datasets.size(); d++) {
+            size_t j = (c * datasets.size()) + d;
+            k.sumSq += sumSq[j];
+            k.worst = std::max(k.worst, worst[j]);
+            k.seconds += seconds[j];
+            k.scored += datasets[d].count - settle;
+            k.updates += datasets[d].count;
+        }
+    }
+}
+
+static double rms(const Candidate & c)
+{
+    return sqrt(c.sumSq / c.scored);
+}
+
+static Candidate make(int filter, float g0, float g1)
+{
+    Candidate c;
+
+    memset(&c, 0, sizeof(c));
+    c.filter = filter;
+    c.gain[0] = g0;
+    c.gain[1] = g1;
+    return c;
+}
+
+static std::vector<Candidate> grid(int filter, int points)
+{
+    std::vector<Candidate> candidates;
+    const Gain * g = gains[filter];
+    std::vector<float> v[2];
+
+    for (int k = 0; k < 2; k++) {
+        if (g[k].zero) {
+            v[k].push_back(0.0f);
+        }
+        for (int i = 0; i < points; i++) {
+            v[k].push_back(g[k].low * powf(g[k].high / g[k].low, (points > 1) ? (float)i / (points - 1) : 0.0f));
+        }
+    }
+    for (size_t i = 0; i < v[0].size(); i++) {
+        for (size_t j = 0; j < v[1].size(); j++) {
+            candidates.push_back(make(filter, v[0][i], v[1][j]));
+        }
+    }
+    evaluateAll(candidates);
+    return candidates;
+}
+
+static bool seen(const std::vector<Candidate> & tried, const Candidate & c)
+{
+    for (size_t i = 0; i < tried.size(); i++) {
+        // steps taken in different orders land a rounding error apart
+        if ((fabsf(tried[i].gain[0] - c.gain[0]) <= (1e-5f * c.gain[0])) &&
+            (fabsf(tried[i].gain[1] - c.gain[1]) <= (1e-5f * c.gain[1]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::vector<Candidate> search(int filter)
+{
+    std::vector<Candidate> tried;
+    std::vector<Candidate> round;
+    const Gain * g = gains[filter];
+    Candidate best = make(filter, g[0].start, g[1].start);
+    float step = 4.0f;
+    bool improved;
+
+    round.push_back(best);
+    evaluateAll(round);
+    best = round[0];
+    tried = round;
+    while (step > 1.05f) {
+        // both directions of every gain are independent, evaluate them together
+        round.clear();
+        for (int k = 0; k < 2; k++) {
+            float up = std::min(best.gain[k] * step, g[k].high);
+            float down = (best.gain[k] == 0.0f) ? g[k].low : std::max(best.gain[k] / step, g[k].low);
+            float options[3] = {up, down, 0.0f};
+            for (int o = 0; o < (g[k].zero && (best.gain[k] != 0.0f) ? 3 : 2); o++) {
+                Candidate c = best;
+                c.gain[k] = options[o];
+                if (!seen(tried, c) && !seen(round, c)) {
+                    round.push_back(c);
+                }
+            }
+        }
+        if (round.empty()) {
+            step = sqrtf(step);
+            continue;
+        }
+        evaluateAll(round);
+        tried.insert(tried.end(), round.begin(), round.end());
+        improved = false;
+        for (size_t i = 0; i < round.size(); i++) {
+            if (rms(round[i]) < rms(best)) {
+                best = round[i];
+                improved = true;
+            }
+        }
+        if (!improved) {
+            step = sqrtf(step);
+        }
+    }
+    return tried;
+}
+
+static void report(int filter, std::vector<Candidate> & candidates, double seconds)
+{
+    const Gain * g = gains[filter];
+    uint64_t updates = 0;
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate & a, const Candidate & b) { return rms(a) < rms(b); });
+    for (size_t i = 0; i < candidates.size(); i++) {
+        updates += candidates[i].updates;
+    }
+    printf("%s: %zu gain sets in %.2f s, %.1f Mupdates/s\n", filterNames[filter], candidates.size(), seconds,
+           updates / seconds / 1e6);
+    printf("  %10s %10s %10s %10s %12s\n", g[0].name, g[1].name, "rms deg", "worst deg", "ns/update");
+    for (size_t i = 0; (i < candidates.size()) && (i < 5); i++) {
+        const Candidate & c = candidates[i];
+        printf("  %10.5f %10.5f %10.4f %10.4f %12.1f\n", c.gain[0], c.gain[1], rms(c), c.worst,
+               c.seconds * 1e9 / c.updates);
+    }
+    printf("best %s %s=%.5f %s=%.5f rms %.4f deg\n", filterNames[filter], g[0].name, candidates[0].gain[0], g[1].name,
+           candidates[0].gain[1], rms(candidates[0]));
+}
+
+static int usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-f madgwick|mahony|both] [-m grid|search] [-n points] [-a g] [-g dps] [-r Hz]\n"
+            "       [-s samples] [-j threads] <dataset>...\n", name);
+    return 2;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * filter = "both";
+    const char * mode = "search";
+    int points = 12;
+    int accelRange = 2;
+    int gyroRange = 250;
+    float rate = 1000.0f;
+    double t;
+    int opt;
+
+    threads = std::thread::hardware_concurrency();
+    while ((opt = getopt(argc, argv, "f:m:n:a:g:r:s:j:")) != -1) {
+        switch (opt) {
+            case 'f': filter = optarg; break;
+            case 'm': mode = optarg; break;
+            case 'n': points = atoi(optarg); break;
+            case 'a': accelRange = atoi(optarg); break;
+            case 'g': gyroRange = atoi(optarg); break;
+            case 'r': rate = (float)atof(optarg); break;
+            case 's': settle = (size_t)atoi(optarg); break;
+            case 'j': threads = (size_t)atoi(optarg); break;
+            default: return usage(argv[0]);
+        }
+    }
+    if ((optind >= argc) || (rate <= 0.0f) || (points < 1) ||
+        (strcmp(filter, "madgwick") && strcmp(filter, "mahony") && strcmp(filter, "both")) ||
+        (strcmp(mode, "grid") && strcmp(mode, "search")) ||
+        ((accelRange != 2) && (accelRange != 4) && (accelRange != 8) && (accelRange != 16)) ||
+        ((gyroRange != 250) && (gyroRange != 500) && (gyroRange != 1000) && (gyroRange != 2000))) {
+        return usage(argv[0]);
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    dt = 1.0f / rate;
+
+    datasets.resize(argc - optind);
+    for (int a = optind; a < argc; a++) {
+        Dataset & d = datasets[a - optind];
+        d.path = argv[a];
+        if (!load(d, accelRange / 32768.0f, gyroRange / 32768.0f * (float)(M_PI / 180.0))) {
+            fprintf(stderr, "%s: unreadable, or no more than %zu referenced samples\n", d.path, settle);
+            return 1;
+        }
+        printf("%s: %zu samples\n", d.path, d.count);
+    }
+
+    for (int f = FILTER_MADGWICK; f <= FILTER_MAHONY; f++) {
+        if (strcmp(filter, "both") && strcmp(filter, filterNames[f])) {
+            continue;
+        }
+        t = now();
+        std::vector<Candidate> candidates = (strcmp(mode, "grid") == 0) ? grid(f, points) : search(f);
+        report(f, candidates, now() - t);
+    }
+    return 0;
+}